@@ -0,0 +1,412 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "block_backup_helpers.h"
+#include <limits.h>
+#include <pthread.h>
+
+#define PROC_MTD					"/proc/mtd"
+#define DEVICE_DIRECTORY			"/dev"
+#define RECORD_INDEX_SIZE			4
+
+struct partition
+{
+	char				name[PARTITION_NAME_SIZE];
+	char				device[PATH_MAX];
+	bool				failed;
+	struct blockManifest	manifest;		// the new one, saved after all partitions were read
+};
+
+struct backupJob
+{
+	struct partition *	partitions;
+	size_t				count;
+	size_t				next;
+	pthread_mutex_t		lock;
+	const char *		stateDirectory;
+	const char *		outputDirectory;
+	uint32_t			blockSize;
+	bool				full;
+};
+
+void usage()
+{
+	fprintf(stderr, "block_backup - incremental backup of MTD partitions (or other devices) with block hashes\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "block_backup -s <state_dir> -o <output_dir> [ -b <block_size> ] [ -j <threads> ] [ -f ]\n");
+	fprintf(stderr, "             [ -m [ -p <proc_mtd> ] [ -d <device_dir> ] ] [ <name>=<device>... ]\n");
+	fprintf(stderr, "\nEach device is read once (the devices are spread over the specified number");
+	fprintf(stderr, "\nof threads, default: number of CPUs) and a SHA-256 value is computed for");
+	fprintf(stderr, "\neach block (default size: %u bytes). Only blocks, which differ from the", DEFAULT_BLOCK_SIZE);
+	fprintf(stderr, "\nmanifest of the previous run (stored in the state directory), are written");
+	fprintf(stderr, "\nto the file '<name>%s' in the output directory, together with the", DELTA_SUFFIX);
+	fprintf(stderr, "\nnew list of block hashes. The first run (or each run with option -f)");
+	fprintf(stderr, "\nwrites all blocks.\n");
+	fprintf(stderr, "\nWith option -m all partitions from '%s' are saved with the name", PROC_MTD);
+	fprintf(stderr, "\n'mtd<n>_<partition_name>', the device files are expected in '%s'.", DEVICE_DIRECTORY);
+	fprintf(stderr, "\nOther files may be specified as additional arguments, image files may");
+	fprintf(stderr, "\nstand in for devices (e.g. for tests).\n");
+	fprintf(stderr, "\nThe manifest of a partition is updated only, if its delta file was written");
+	fprintf(stderr, "\nsuccessfully. The images are rebuilt from the delta files with the");
+	fprintf(stderr, "\nutility 'block_restore'.\n");
+	fprintf(stderr, "\nOne line per device is written to STDOUT with tab separated fields:");
+	fprintf(stderr, "\nname, device, image size, number of blocks, number of changed blocks and");
+	fprintf(stderr, "\nthe generation of the delta file (0 for a full backup).\n");
+}
+
+bool addPartition(struct backupJob *job, const char *name, const char *device)
+{
+	struct partition *	partitions;
+	struct partition *	partition;
+	size_t				i;
+
+	if (*name == 0 || strlen(name) >= PARTITION_NAME_SIZE || strchr(name, '/') != NULL)
+	{
+		fprintf(stderr, "Invalid partition name '%s'.\n", name);
+		return false;
+	}
+
+	for (i = 0; i < job->count; i++)
+	{
+		if (strcmp(job->partitions[i].name, name) == 0)
+		{
+			fprintf(stderr, "The partition name '%s' is used twice.\n", name);
+			return false;
+		}
+	}
+
+	if ((partitions = realloc(job->partitions, (job->count + 1) * sizeof(struct partition))) == NULL) return false;
+	job->partitions = partitions;
+	partition = &job->partitions[job->count++];
+	memset(partition, 0, sizeof(struct partition));
+	strcpy(partition->name, name);
+	snprintf(partition->device, sizeof(partition->device), "%s", device);
+
+	return true;
+}
+
+// lines look like 'mtd0: 00020000 00010000 "urlader"', the name is used like 'save_system.sh' does it
+bool readProcMtd(struct backupJob *job, const char *procFile, const char *deviceDirectory)
+{
+	FILE *				file;
+	char				line[256];
+	bool				result = true;
+
+	if ((file = fopen(procFile, "r")) == NULL)
+	{
+		fprintf(stderr, "Error %d opening partition list '%s'.\n", errno, procFile);
+		return false;
+	}
+
+	while (result && fgets(line, sizeof(line), file) != NULL)
+	{
+		char			device[16];
+		char			label[41];
+		char			name[PARTITION_NAME_SIZE];
+		char			path[PATH_MAX];
+		char *			src;
+		char *			dst;
+
+		if (sscanf(line, "%15[^:]: %*x %*x \"%40[^\"]\"", device, label) != 2) continue;
+		if (strncmp(device, "mtd", 3) != 0) continue;
+
+		for (src = label, dst = label; *src; src++)
+		{
+			if (*src == '(' || *src == ')') continue;
+			*(dst++) = (*src == ' ' || *src == '/' ? '_' : *src);
+		}
+		*dst = 0;
+
+		snprintf(name, sizeof(name), "%s_%s", device, label);
+		snprintf(path, sizeof(path), "%s/%s", deviceDirectory, device);
+		result = addPartition(job, name, path);
+	}
+
+	fclose(file);
+
+	return result;
+}
+
+// the delta file contains the header, the changed blocks (each with its index) and the new hash list
+bool writeDelta(struct backupJob *job, struct partition *partition, const struct blockManifest *previous, int input, int output)
+{
+	struct blockManifest *	manifest = &partition->manifest;
+	uint8_t				header[MANIFEST_HEADER_SIZE];
+	uint8_t				record[RECORD_INDEX_SIZE];
+	uint8_t *			buffer;
+	size_t				hashesSize = 0;
+	bool				result = true;
+	ssize_t				got = 0;
+
+	if ((buffer = malloc(job->blockSize)) == NULL) return false;
+
+	// the header is written again, when the counts are known
+	memset(header, 0, sizeof(header));
+	if (!writeFully(output, header, sizeof(header))) result = false;
+
+	while (result && (got = readFully(input, buffer, job->blockSize)) > 0)
+	{
+		uint32_t		index = manifest->blockCount;
+		uint8_t *		hash;
+
+		if ((size_t) (index + 1) * BLOCK_HASH_SIZE > hashesSize)
+		{
+			uint8_t *	hashes;
+
+			hashesSize = (hashesSize ? hashesSize * 2 : 1024 * BLOCK_HASH_SIZE);
+			if ((hashes = realloc(manifest->hashes, hashesSize)) == NULL)
+			{
+				result = false;
+				break;
+			}
+			manifest->hashes = hashes;
+		}
+
+		hash = manifest->hashes + (size_t) index * BLOCK_HASH_SIZE;
+		hashBlock(buffer, got, hash);
+		manifest->blockCount++;
+		manifest->imageSize += got;
+
+		// a shorter last block from the previous run differs, even if the hash would match
+		if (previous == NULL || index >= previous->blockCount || blockLength(previous, index) != (size_t) got ||
+			memcmp(previous->hashes + (size_t) index * BLOCK_HASH_SIZE, hash, BLOCK_HASH_SIZE) != 0)
+		{
+			record[0] = (index >> 24) & 0xFF;
+			record[1] = (index >> 16) & 0xFF;
+			record[2] = (index >> 8) & 0xFF;
+			record[3] = index & 0xFF;
+			if (!writeFully(output, record, sizeof(record)) || !writeFully(output, buffer, got)) result = false;
+			manifest->changedCount++;
+		}
+
+		if ((size_t) got < job->blockSize) break;
+	}
+
+	if (result && got == -1)
+	{
+		fprintf(stderr, "Error %d reading device '%s'.\n", errno, partition->device);
+		result = false;
+	}
+	else if (result)
+	{
+		result = writeFully(output, manifest->hashes, (size_t) manifest->blockCount * BLOCK_HASH_SIZE) &&
+				 lseek(output, 0, SEEK_SET) == 0 &&
+				 writeManifestHeader(output, DELTA_MAGIC, manifest) &&
+				 fsync(output) == 0;
+	}
+	else fprintf(stderr, "Error %d writing delta for '%s'.\n", errno, partition->name);
+
+	free(buffer);
+
+	return result;
+}
+
+bool backupPartition(struct backupJob *job, struct partition *partition)
+{
+	struct blockManifest	previous;
+	struct blockManifest *	manifest = &partition->manifest;
+	char				fileName[PATH_MAX];
+	char				tempName[PATH_MAX + 4];
+	int					input;
+	int					output;
+	bool				usePrevious = false;
+	bool				result;
+
+	memset(&previous, 0, sizeof(previous));
+	memset(manifest, 0, sizeof(struct blockManifest));
+	strcpy(manifest->name, partition->name);
+	manifest->blockSize = job->blockSize;
+
+	if (!job->full)
+	{
+		snprintf(fileName, sizeof(fileName), "%s/%s%s", job->stateDirectory, partition->name, MANIFEST_SUFFIX);
+		if (loadManifest(fileName, &previous) && previous.blockSize == job->blockSize && strcmp(previous.name, partition->name) == 0) usePrevious = true;
+	}
+
+	if (usePrevious) manifest->generation = previous.generation + 1;
+	else manifest->flags = DELTA_FULL;
+
+	if ((input = open(partition->device, O_RDONLY)) == -1)
+	{
+		fprintf(stderr, "Error %d opening device '%s'.\n", errno, partition->device);
+		freeManifest(&previous);
+		return false;
+	}
+	posix_fadvise(input, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	snprintf(fileName, sizeof(fileName), "%s/%s%s", job->outputDirectory, partition->name, DELTA_SUFFIX);
+	snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+
+	if ((output = open(tempName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+	{
+		fprintf(stderr, "Error %d creating delta file '%s'.\n", errno, tempName);
+		result = false;
+	}
+	else
+	{
+		result = writeDelta(job, partition, (usePrevious ? &previous : NULL), input, output);
+		if (close(output) == -1) result = false;
+		if (result && rename(tempName, fileName) == -1)
+		{
+			fprintf(stderr, "Error %d renaming delta file '%s'.\n", errno, tempName);
+			result = false;
+		}
+		if (!result) unlink(tempName);
+	}
+
+	close(input);
+	freeManifest(&previous);
+
+	return result;
+}
+
+void * backupWorker(void *arg)
+{
+	struct backupJob *	job = (struct backupJob *) arg;
+	size_t				index;
+
+	while (true)
+	{
+		pthread_mutex_lock(&job->lock);
+		index = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (index >= job->count) break;
+		job->partitions[index].failed = !backupPartition(job, &job->partitions[index]);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 0;
+	const char *		procFile = PROC_MTD;
+	const char *		deviceDirectory = DEVICE_DIRECTORY;
+	struct backupJob	job;
+	long				threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *			threads;
+	bool				useProcMtd = false;
+	char				fileName[PATH_MAX];
+	size_t				i;
+	int					arg;
+
+	memset(&job, 0, sizeof(job));
+	pthread_mutex_init(&job.lock, NULL);
+	job.blockSize = DEFAULT_BLOCK_SIZE;
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) job.stateDirectory = argv[++arg];
+		else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) job.outputDirectory = argv[++arg];
+		else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) job.blockSize = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) threadCount = atol(argv[++arg]);
+		else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc) procFile = argv[++arg];
+		else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) deviceDirectory = argv[++arg];
+		else if (strcmp(argv[arg], "-f") == 0) job.full = true;
+		else if (strcmp(argv[arg], "-m") == 0) useProcMtd = true;
+		else if (argv[arg][0] != '-' && strchr(argv[arg], '=') != NULL)
+		{
+			char *		device = strchr(argv[arg], '=');
+
+			*(device++) = 0;
+			if (!addPartition(&job, argv[arg], device)) exit(1);
+		}
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (job.stateDirectory == NULL || job.outputDirectory == NULL || job.blockSize < 512 || job.blockSize > 16 * 1024 * 1024)
+	{
+		usage();
+		exit(1);
+	}
+
+	if (useProcMtd && !readProcMtd(&job, procFile, deviceDirectory)) exit(1);
+
+	if (job.count == 0)
+	{
+		fprintf(stderr, "No partitions to save.\n");
+		exit(1);
+	}
+
+	if (threadCount < 1) threadCount = 1;
+	if ((size_t) threadCount > job.count) threadCount = job.count;
+
+	if ((threads = calloc(threadCount, sizeof(pthread_t))) == NULL) exit(1);
+
+	for (i = 0; i < (size_t) threadCount; i++)
+	{
+		if (pthread_create(&threads[i], NULL, backupWorker, &job) != 0)
+		{
+			fprintf(stderr, "Error creating worker thread, continuing with %zu thread(s).\n", i);
+			threadCount = i;
+			break;
+		}
+	}
+
+	if (threadCount == 0) backupWorker(&job);
+	for (i = 0; i < (size_t) threadCount; i++) pthread_join(threads[i], NULL);
+
+	// manifests are replaced only for partitions with a complete delta file
+	for (i = 0; i < job.count; i++)
+	{
+		struct partition *	partition = &job.partitions[i];
+
+		if (!partition->failed)
+		{
+			snprintf(fileName, sizeof(fileName), "%s/%s%s", job.stateDirectory, partition->name, MANIFEST_SUFFIX);
+			if (!saveManifest(fileName, &partition->manifest))
+			{
+				// the delta can't be used without the manifest, the next run would repeat its generation
+				fprintf(stderr, "Error %d saving manifest '%s'.\n", errno, fileName);
+				snprintf(fileName, sizeof(fileName), "%s/%s%s", job.outputDirectory, partition->name, DELTA_SUFFIX);
+				unlink(fileName);
+				partition->failed = true;
+			}
+		}
+
+		if (partition->failed)
+		{
+			fprintf(stdout, "%s\t%s\t-\t-\t-\t-\n", partition->name, partition->device);
+			returnCode = 1;
+		}
+		else
+		{
+			fprintf(stdout, "%s\t%s\t%" PRIu64 "\t%" PRIu32 "\t%" PRIu32 "\t%" PRIu32 "\n", partition->name, partition->device,
+				partition->manifest.imageSize, partition->manifest.blockCount, partition->manifest.changedCount, partition->manifest.generation);
+		}
+
+		freeManifest(&partition->manifest);
+	}
+
+	free(threads);
+	free(job.partitions);
+	pthread_mutex_destroy(&job.lock);
+
+	exit(returnCode);
+}
@@ -0,0 +1,196 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "block_backup_helpers.h"
+
+static void putUint32(uint8_t *ptr, uint32_t value)
+{
+	ptr[0] = (value >> 24) & 0xFF;
+	ptr[1] = (value >> 16) & 0xFF;
+	ptr[2] = (value >> 8) & 0xFF;
+	ptr[3] = value & 0xFF;
+}
+
+static uint32_t getUint32(const uint8_t *ptr)
+{
+	return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16) | ((uint32_t) ptr[2] << 8) | ptr[3];
+}
+
+bool readManifestHeader(int fd, const char *magic, struct blockManifest *manifest)
+{
+	uint8_t				header[MANIFEST_HEADER_SIZE];
+	uint8_t *			ptr = header;
+
+	memset(manifest, 0, sizeof(struct blockManifest));
+
+	if (readFully(fd, header, sizeof(header)) != sizeof(header)) return false;
+	if (memcmp(ptr, magic, 4) != 0 || getUint32(ptr + 4) != BACKUP_FORMAT_VERSION) return false;
+	ptr += 8;
+
+	memcpy(manifest->name, ptr, PARTITION_NAME_SIZE);
+	manifest->name[PARTITION_NAME_SIZE - 1] = 0;
+	ptr += PARTITION_NAME_SIZE;
+	manifest->blockSize = getUint32(ptr);
+	manifest->imageSize = ((uint64_t) getUint32(ptr + 4) << 32) | getUint32(ptr + 8);
+	manifest->blockCount = getUint32(ptr + 12);
+	manifest->generation = getUint32(ptr + 16);
+	manifest->changedCount = getUint32(ptr + 20);
+	manifest->flags = getUint32(ptr + 24);
+
+	// the block count has to match the image size, it's used to size the hash list
+	if (manifest->blockSize == 0 || manifest->name[0] == 0) return false;
+	if (manifest->blockCount != (manifest->imageSize + manifest->blockSize - 1) / manifest->blockSize) return false;
+	if (manifest->changedCount > manifest->blockCount) return false;
+
+	return true;
+}
+
+bool writeManifestHeader(int fd, const char *magic, const struct blockManifest *manifest)
+{
+	uint8_t				header[MANIFEST_HEADER_SIZE];
+	uint8_t *			ptr = header;
+
+	memset(header, 0, sizeof(header));
+	memcpy(ptr, magic, 4);
+	putUint32(ptr + 4, BACKUP_FORMAT_VERSION);
+	ptr += 8;
+
+	memcpy(ptr, manifest->name, strnlen(manifest->name, PARTITION_NAME_SIZE - 1));
+	ptr += PARTITION_NAME_SIZE;
+	putUint32(ptr, manifest->blockSize);
+	putUint32(ptr + 4, (uint32_t) (manifest->imageSize >> 32));
+	putUint32(ptr + 8, (uint32_t) manifest->imageSize);
+	putUint32(ptr + 12, manifest->blockCount);
+	putUint32(ptr + 16, manifest->generation);
+	putUint32(ptr + 20, manifest->changedCount);
+	putUint32(ptr + 24, manifest->flags);
+
+	return writeFully(fd, header, sizeof(header));
+}
+
+bool readManifestHashes(int fd, struct blockManifest *manifest)
+{
+	size_t				size = (size_t) manifest->blockCount * BLOCK_HASH_SIZE;
+
+	free(manifest->hashes);
+	if ((manifest->hashes = malloc(size ? size : 1)) == NULL) return false;
+
+	return (readFully(fd, manifest->hashes, size) == (ssize_t) size);
+}
+
+bool loadManifest(const char *fileName, struct blockManifest *manifest)
+{
+	int					fd;
+	bool				result;
+
+	memset(manifest, 0, sizeof(struct blockManifest));
+	if ((fd = open(fileName, O_RDONLY)) == -1) return false;
+
+	result = readManifestHeader(fd, MANIFEST_MAGIC, manifest) && readManifestHashes(fd, manifest);
+	close(fd);
+
+	if (!result) freeManifest(manifest);
+
+	return result;
+}
+
+// the new manifest is written to a temporary file and renamed, a crash leaves the old one intact
+bool saveManifest(const char *fileName, const struct blockManifest *manifest)
+{
+	char				tempName[4096];
+	int					fd;
+	bool				result;
+
+	snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+	if ((fd = open(tempName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) return false;
+
+	result = writeManifestHeader(fd, MANIFEST_MAGIC, manifest) &&
+			 writeFully(fd, manifest->hashes, (size_t) manifest->blockCount * BLOCK_HASH_SIZE) &&
+			 fsync(fd) == 0;
+	if (close(fd) == -1) result = false;
+
+	if (result && rename(tempName, fileName) == -1) result = false;
+	if (!result) unlink(tempName);
+
+	return result;
+}
+
+void freeManifest(struct blockManifest *manifest)
+{
+	free(manifest->hashes);
+	manifest->hashes = NULL;
+}
+
+size_t blockLength(const struct blockManifest *manifest, uint32_t index)
+{
+	uint64_t			start = (uint64_t) index * manifest->blockSize;
+
+	if (start >= manifest->imageSize) return 0;
+	if (manifest->imageSize - start < manifest->blockSize) return (size_t) (manifest->imageSize - start);
+
+	return manifest->blockSize;
+}
+
+void hashBlock(const void *data, size_t size, uint8_t *hash)
+{
+	EVP_Digest(data, size, hash, NULL, EVP_sha256(), NULL);
+}
+
+ssize_t readFully(int fd, void *buffer, size_t count)
+{
+	size_t				done = 0;
+	ssize_t				got;
+
+	// read as much as possible, pipes and character devices may deliver less than requested
+	while (done < count)
+	{
+		got = read(fd, (uint8_t *) buffer + done, count - done);
+		if (got == 0) break;
+		if (got == -1)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		done += got;
+	}
+
+	return done;
+}
+
+bool writeFully(int fd, const void *buffer, size_t count)
+{
+	size_t				done = 0;
+	ssize_t				written;
+
+	while (done < count)
+	{
+		written = write(fd, (const uint8_t *) buffer + done, count - done);
+		if (written == -1)
+		{
+			if (errno == EINTR) continue;
+			return false;
+		}
+		done += written;
+	}
+
+	return true;
+}
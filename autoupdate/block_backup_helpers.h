@@ -0,0 +1,58 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef BLOCK_BACKUP_HELPERS_H
+#define BLOCK_BACKUP_HELPERS_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+#include <openssl/evp.h>
+
+#define MANIFEST_MAGIC				"YFBM"
+#define DELTA_MAGIC					"YFBD"
+#define BACKUP_FORMAT_VERSION		1
+#define BLOCK_HASH_SIZE				32		// SHA-256
+#define PARTITION_NAME_SIZE			64
+#define DEFAULT_BLOCK_SIZE			(64 * 1024)
+#define MANIFEST_SUFFIX				".manifest"
+#define DELTA_SUFFIX				".delta"
+
+#define DELTA_FULL					0x00000001	// all blocks are contained, the image is rebuilt from scratch
+
+// the header of a manifest (from the last run) or a delta file, all values are stored in big endian order
+struct blockManifest
+{
+	char				name[PARTITION_NAME_SIZE];
+	uint32_t			blockSize;
+	uint64_t			imageSize;
+	uint32_t			blockCount;
+	uint32_t			generation;		// incremented with each delta, 0 for a full backup
+	uint32_t			changedCount;	// number of block records in a delta file
+	uint32_t			flags;
+	uint8_t *			hashes;			// BLOCK_HASH_SIZE bytes for each block
+};
+
+// the stored size of the header above (without the hashes)
+#define MANIFEST_HEADER_SIZE		(4 + 4 + PARTITION_NAME_SIZE + 4 + 8 + 4 + 4 + 4 + 4)
+
+bool readManifestHeader(int fd, const char *magic, struct blockManifest *manifest);
+bool writeManifestHeader(int fd, const char *magic, const struct blockManifest *manifest);
+bool readManifestHashes(int fd, struct blockManifest *manifest);
+bool loadManifest(const char *fileName, struct blockManifest *manifest);
+bool saveManifest(const char *fileName, const struct blockManifest *manifest);
+void freeManifest(struct blockManifest *manifest);
+size_t blockLength(const struct blockManifest *manifest, uint32_t index);
+void hashBlock(const void *data, size_t size, uint8_t *hash);
+
+ssize_t readFully(int fd, void *buffer, size_t count);
+bool writeFully(int fd, const void *buffer, size_t count);
+
+#endif
@@ -0,0 +1,363 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "block_backup_helpers.h"
+#include <limits.h>
+
+// an image, which was changed by one of the delta files
+struct restoredImage
+{
+	char				name[PARTITION_NAME_SIZE];
+	uint64_t			imageSize;
+	uint32_t			generation;
+};
+
+void usage()
+{
+	fprintf(stderr, "block_restore - rebuild full images from the delta files of 'block_backup'\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "block_restore -o <image_dir> [ -n ] [ -f ] <delta_file>...\n");
+	fprintf(stderr, "\nThe delta files are applied in the specified order to the images with");
+	fprintf(stderr, "\nthe name of the saved partition in the image directory. A full backup");
+	fprintf(stderr, "\ncreates the image from scratch, further deltas have to follow without");
+	fprintf(stderr, "\ngaps - the generation of an image is kept in a manifest file next to it");
+	fprintf(stderr, "\n('<name>%s'), a missing delta is detected this way. Option -f", MANIFEST_SUFFIX);
+	fprintf(stderr, "\napplies a delta, even if its generation doesn't follow.\n");
+	fprintf(stderr, "\nAt the end each changed image is read again and the hashes of its blocks");
+	fprintf(stderr, "\nare compared with the list from the last delta, option -n skips this");
+	fprintf(stderr, "\nverification.\n");
+	fprintf(stderr, "\nOne line per image is written to STDOUT with tab separated fields:");
+	fprintf(stderr, "\nname, image size, generation and the result of the verification.\n");
+}
+
+// the whole file is checked (and the hash list is loaded), before the image gets changed - the
+// structure first, then the content of each block is compared with its hash from the list
+bool checkDelta(int fd, struct blockManifest *delta, const char *deltaFile)
+{
+	uint8_t				record[4];
+	uint8_t				hash[BLOCK_HASH_SIZE];
+	uint8_t *			buffer;
+	uint8_t				extra;
+	bool				result = true;
+	uint32_t			i;
+
+	for (i = 0; i < delta->changedCount; i++)
+	{
+		uint32_t		index;
+		size_t			length;
+
+		if (readFully(fd, record, sizeof(record)) != sizeof(record)) break;
+		index = ((uint32_t) record[0] << 24) | ((uint32_t) record[1] << 16) | ((uint32_t) record[2] << 8) | record[3];
+		if (index >= delta->blockCount || (length = blockLength(delta, index)) == 0) break;
+		if (lseek(fd, length, SEEK_CUR) == -1) break;
+	}
+
+	if (i < delta->changedCount || !readManifestHashes(fd, delta) || readFully(fd, &extra, 1) != 0 || lseek(fd, MANIFEST_HEADER_SIZE, SEEK_SET) == -1)
+	{
+		fprintf(stderr, "The delta file '%s' is truncated or damaged.\n", deltaFile);
+		return false;
+	}
+
+	if ((buffer = malloc(delta->blockSize)) == NULL) return false;
+
+	for (i = 0; result && i < delta->changedCount; i++)
+	{
+		uint32_t		index;
+		size_t			length;
+
+		if (readFully(fd, record, sizeof(record)) != sizeof(record)) result = false;
+		else
+		{
+			index = ((uint32_t) record[0] << 24) | ((uint32_t) record[1] << 16) | ((uint32_t) record[2] << 8) | record[3];
+			length = blockLength(delta, index);
+			if (readFully(fd, buffer, length) != (ssize_t) length) result = false;
+			else
+			{
+				hashBlock(buffer, length, hash);
+				if (memcmp(hash, delta->hashes + (size_t) index * BLOCK_HASH_SIZE, BLOCK_HASH_SIZE) != 0)
+				{
+					fprintf(stderr, "The content of block %" PRIu32 " in the delta file '%s' doesn't match its hash.\n", index, deltaFile);
+					free(buffer);
+					return false;
+				}
+			}
+		}
+	}
+
+	free(buffer);
+
+	if (!result || lseek(fd, MANIFEST_HEADER_SIZE, SEEK_SET) == -1)
+	{
+		fprintf(stderr, "Error %d reading delta file '%s'.\n", errno, deltaFile);
+		return false;
+	}
+
+	return true;
+}
+
+bool applyDelta(const char *deltaFile, const char *imageDirectory, bool force, struct restoredImage **images, size_t *count)
+{
+	struct blockManifest	delta;
+	struct blockManifest	current;
+	char				imageName[PATH_MAX];
+	char				manifestName[PATH_MAX + sizeof(MANIFEST_SUFFIX)];
+	uint8_t				record[4];
+	uint8_t *			buffer = NULL;
+	int					input;
+	int					output = -1;
+	bool				result = true;
+	uint32_t			i;
+	size_t				j;
+
+	if ((input = open(deltaFile, O_RDONLY)) == -1)
+	{
+		fprintf(stderr, "Error %d opening delta file '%s'.\n", errno, deltaFile);
+		return false;
+	}
+
+	if (!readManifestHeader(input, DELTA_MAGIC, &delta) || strchr(delta.name, '/') != NULL)
+	{
+		fprintf(stderr, "The file '%s' isn't a valid delta file.\n", deltaFile);
+		close(input);
+		return false;
+	}
+
+	snprintf(imageName, sizeof(imageName), "%s/%s", imageDirectory, delta.name);
+	snprintf(manifestName, sizeof(manifestName), "%s%s", imageName, MANIFEST_SUFFIX);
+
+	if (!(delta.flags & DELTA_FULL))
+	{
+		if (!loadManifest(manifestName, &current))
+		{
+			fprintf(stderr, "The image '%s' wasn't restored from a full backup yet, '%s' can't be applied.\n", imageName, deltaFile);
+			result = false;
+		}
+		else if (current.generation + 1 != delta.generation && !force)
+		{
+			fprintf(stderr, "The delta '%s' (generation %" PRIu32 ") doesn't follow the image '%s' (generation %" PRIu32 ").\n", deltaFile, delta.generation, imageName, current.generation);
+			result = false;
+		}
+		else if (current.blockSize != delta.blockSize)
+		{
+			fprintf(stderr, "The delta '%s' uses another block size than the image '%s'.\n", deltaFile, imageName);
+			result = false;
+		}
+		freeManifest(&current);
+	}
+
+	if (result && !checkDelta(input, &delta, deltaFile)) result = false;
+
+	if (result && (output = open(imageName, O_RDWR | O_CREAT | ((delta.flags & DELTA_FULL) ? O_TRUNC : 0), 0644)) == -1)
+	{
+		fprintf(stderr, "Error %d opening image '%s'.\n", errno, imageName);
+		result = false;
+	}
+
+	if (result && (buffer = malloc(delta.blockSize)) == NULL) result = false;
+
+	for (i = 0; result && i < delta.changedCount; i++)
+	{
+		uint32_t		index;
+		size_t			length;
+
+		if (readFully(input, record, sizeof(record)) != sizeof(record))
+		{
+			result = false;
+			break;
+		}
+
+		index = ((uint32_t) record[0] << 24) | ((uint32_t) record[1] << 16) | ((uint32_t) record[2] << 8) | record[3];
+		length = blockLength(&delta, index);
+		if (readFully(input, buffer, length) != (ssize_t) length)
+		{
+			fprintf(stderr, "Error %d reading delta file '%s'.\n", errno, deltaFile);
+			result = false;
+			break;
+		}
+
+		if (pwrite(output, buffer, length, (off_t) index * delta.blockSize) != (ssize_t) length)
+		{
+			fprintf(stderr, "Error %d writing image '%s'.\n", errno, imageName);
+			result = false;
+		}
+	}
+
+	if (result && ftruncate(output, (off_t) delta.imageSize) == -1)
+	{
+		fprintf(stderr, "Error %d setting size of image '%s'.\n", errno, imageName);
+		result = false;
+	}
+
+	// the manifest is written after the image, it's the state to continue with
+	if (result && (fsync(output) == -1 || !saveManifest(manifestName, &delta)))
+	{
+		fprintf(stderr, "Error %d saving manifest '%s'.\n", errno, manifestName);
+		result = false;
+	}
+
+	if (result)
+	{
+		for (j = 0; j < *count; j++)
+		{
+			if (strcmp((*images)[j].name, delta.name) == 0) break;
+		}
+
+		if (j == *count)
+		{
+			struct restoredImage *	grown;
+
+			if ((grown = realloc(*images, (*count + 1) * sizeof(struct restoredImage))) == NULL) result = false;
+			else
+			{
+				*images = grown;
+				strcpy((*images)[(*count)++].name, delta.name);
+			}
+		}
+		if (result)
+		{
+			(*images)[j].imageSize = delta.imageSize;
+			(*images)[j].generation = delta.generation;
+		}
+	}
+
+	if (output != -1) close(output);
+	close(input);
+	free(buffer);
+	freeManifest(&delta);
+
+	return result;
+}
+
+// returns the number of blocks, which don't match their hash from the manifest
+int64_t verifyImage(const char *imageDirectory, const char *name, struct blockManifest *manifest)
+{
+	char				imageName[PATH_MAX];
+	char				manifestName[PATH_MAX + sizeof(MANIFEST_SUFFIX)];
+	uint8_t *			buffer;
+	uint8_t				hash[BLOCK_HASH_SIZE];
+	int64_t				mismatches = 0;
+	uint32_t			i;
+	int					fd;
+
+	snprintf(imageName, sizeof(imageName), "%s/%s", imageDirectory, name);
+	snprintf(manifestName, sizeof(manifestName), "%s%s", imageName, MANIFEST_SUFFIX);
+
+	if (!loadManifest(manifestName, manifest)) return -1;
+	if ((fd = open(imageName, O_RDONLY)) == -1) return -1;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if ((buffer = malloc(manifest->blockSize)) == NULL)
+	{
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < manifest->blockCount; i++)
+	{
+		size_t			length = blockLength(manifest, i);
+
+		if (readFully(fd, buffer, length) != (ssize_t) length)
+		{
+			mismatches += manifest->blockCount - i;
+			break;
+		}
+
+		hashBlock(buffer, length, hash);
+		if (memcmp(hash, manifest->hashes + (size_t) i * BLOCK_HASH_SIZE, BLOCK_HASH_SIZE) != 0) mismatches++;
+	}
+
+	free(buffer);
+	close(fd);
+
+	return mismatches;
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 0;
+	const char *		imageDirectory = NULL;
+	struct restoredImage *	images = NULL;
+	size_t				count = 0;
+	bool				verify = true;
+	bool				force = false;
+	int					firstDelta = 0;
+	size_t				i;
+	int					arg;
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) imageDirectory = argv[++arg];
+		else if (strcmp(argv[arg], "-n") == 0) verify = false;
+		else if (strcmp(argv[arg], "-f") == 0) force = true;
+		else if (argv[arg][0] == '-')
+		{
+			usage();
+			exit(1);
+		}
+		else
+		{
+			firstDelta = arg;
+			break;
+		}
+	}
+
+	if (imageDirectory == NULL || firstDelta == 0)
+	{
+		usage();
+		exit(1);
+	}
+
+	// a failed delta stops the restore, later ones would be applied to a wrong base
+	for (arg = firstDelta; arg < argc; arg++)
+	{
+		if (!applyDelta(argv[arg], imageDirectory, force, &images, &count))
+		{
+			returnCode = 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		struct blockManifest	manifest;
+		int64_t			mismatches = 0;
+
+		memset(&manifest, 0, sizeof(manifest));
+
+		if (verify && (mismatches = verifyImage(imageDirectory, images[i].name, &manifest)) != 0)
+		{
+			if (mismatches < 0) fprintf(stderr, "Error %d verifying image '%s'.\n", errno, images[i].name);
+			else fprintf(stderr, "The image '%s' has %" PRId64 " block(s) with a wrong hash.\n", images[i].name, mismatches);
+			returnCode = 1;
+		}
+
+		fprintf(stdout, "%s\t%" PRIu64 "\t%" PRIu32 "\t%s\n", images[i].name, images[i].imageSize, images[i].generation,
+			(!verify ? "not verified" : (mismatches == 0 ? "verified" : "failed")));
+		freeManifest(&manifest);
+	}
+
+	free(images);
+
+	exit(returnCode);
+}
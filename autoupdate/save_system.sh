@@ -41,13 +41,33 @@ rm -r $TD
 mkdir -p $TD
 log "Saving serial flash content:"
 logfile </proc/mtd
-sed -n -e "s/^\(mtd[0-9]\{1,2\}\): [0-9a-f]* [0-9a-f]* \"\(.*\)\"\$/MTD=\1 NAME=\"\2\"/p" /proc/mtd |
-while read line; do
-	eval $line
-	NAME=$(echo "$NAME" | sed -e "s/[()]//g" -e "s/ /_/")
-	cat /dev/$MTD >$TD/${MTD}_$NAME
-	log "Copying /dev/$MTD to $TD/${MTD}_$NAME done, rc=$?"
-done
+# the binary for this core is preferred, the other core can't run a 'block_backup' built for this one
+bb=$nand/block_backup.$core
+[ -x $bb ] || bb=$nand/block_backup
+rc=1
+if [ -x $bb ]; then
+	# only blocks changed since the last run are saved, use 'block_restore' to rebuild the images
+	mkdir -p $nand/.block_backup/$core
+	$bb -s $nand/.block_backup/$core -o $TD -m >/var/tmp/block_backup.out 2>&1
+	rc=$?
+	logfile </var/tmp/block_backup.out
+	rm /var/tmp/block_backup.out
+	log "Incremental backup of all partitions to $TD done, rc=$rc"
+fi
+if [ $rc -ne 0 ]; then
+	if [ -x $bb ]; then
+		log "Saving complete partitions instead"
+		rm -r $TD
+		mkdir -p $TD
+	fi
+	sed -n -e "s/^\(mtd[0-9]\{1,2\}\): [0-9a-f]* [0-9a-f]* \"\(.*\)\"\$/MTD=\1 NAME=\"\2\"/p" /proc/mtd |
+	while read line; do
+		eval $line
+		NAME=$(echo "$NAME" | sed -e "s/[()]//g" -e "s/ /_/")
+		cat /dev/$MTD >$TD/${MTD}_$NAME
+		log "Copying /dev/$MTD to $TD/${MTD}_$NAME done, rc=$?"
+	done
+fi
 log "Saving serial flash done"
 log "Saving kernel and filesystem partitions"
 mp=/var/tmp/savesystem.mp
@@ -20,27 +20,109 @@
  *                                                                     *
  ***********************************************************************/
 
+#define _GNU_SOURCE
 #include "avm_kernel_config_helpers.h"
+#include "statistics_helpers.h"
+#include <string.h>
 
-bool openMemoryMappedFile(struct memoryMappedFile *file, const char *fileName, const char *fileDescription, int openFlags, int prot, int flags)
+// pipes, character devices and files on filesystems without mmap() support are read into a buffer,
+// the buffer has some zero bytes after the content, because the scanners access it as 32-bit words
+static bool readWholeFile(struct memoryMappedFile *file)
+{
+	uint8_t *			buffer = NULL;
+	size_t				allocated = 0;
+	size_t				size = 0;
+	ssize_t				count;
+	bool				seekable = S_ISREG(file->fileStat.st_mode);
+
+	while (true)
+	{
+		if (size + MAPPING_READ_BLOCK_SIZE + sizeof(uint32_t) > allocated)
+		{
+			size_t		newSize = (allocated ? allocated * 2 : MAPPING_READ_BLOCK_SIZE + sizeof(uint32_t));
+			uint8_t *	grown;
+
+			if (seekable && newSize < (size_t) file->fileStat.st_size + MAPPING_READ_BLOCK_SIZE + sizeof(uint32_t)) newSize = file->fileStat.st_size + MAPPING_READ_BLOCK_SIZE + sizeof(uint32_t);
+			if ((grown = realloc(buffer, newSize)) == NULL)
+			{
+				fprintf(stderr, "Error allocating memory for %s file '%s'.\n", file->fileDescription, file->fileName);
+				free(buffer);
+				return false;
+			}
+			buffer = grown;
+			allocated = newSize;
+		}
+
+		count = (seekable ? pread(file->fileDescriptor, buffer + size, MAPPING_READ_BLOCK_SIZE, size) : read(file->fileDescriptor, buffer + size, MAPPING_READ_BLOCK_SIZE));
+		if (count == -1 && errno == EINTR) continue;
+		if (count == -1)
+		{
+			fprintf(stderr, "Error %d reading %s file '%s'.\n", errno, file->fileDescription, file->fileName);
+			free(buffer);
+			return false;
+		}
+		if (count == 0) break;
+		size += count;
+	}
+
+	memset(buffer + size, 0, allocated - size);
+
+	file->fileBuffer = buffer;
+	file->fileStat.st_size = size;
+	file->fileRead = true;
+	statisticsAdd("bytesLoaded", size);
+
+	return true;
+}
+
+static void adviseMapping(struct memoryMappedFile *file, unsigned int hints)
+{
+	if (hints & MAPPING_SEQUENTIAL) madvise(file->fileBuffer, file->fileStat.st_size, MADV_SEQUENTIAL);
+	if (hints & MAPPING_WILLNEED) madvise(file->fileBuffer, file->fileStat.st_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	if (hints & MAPPING_HUGEPAGE) madvise(file->fileBuffer, file->fileStat.st_size, MADV_HUGEPAGE);
+#endif
+}
+
+// the file name '-' means STDIN, the content of files, which can't be mapped, is read into memory -
+// callers use 'fileBuffer' and 'fileStat.st_size' in both cases
+bool openMemoryMappedFile(struct memoryMappedFile *file, const char *fileName, const char *fileDescription, int openFlags, int prot, int flags, unsigned int hints)
 {
 	bool			result = false;
 
 	file->fileMapped = false;
+	file->fileRead = false;
 	file->fileBuffer = NULL;
 	file->fileName = fileName;
 	file->fileDescription = fileDescription;
 
-	if ((file->fileDescriptor = open(file->fileName, openFlags)) != -1)
+	if (hints & MAPPING_POPULATE) flags |= MAP_POPULATE;
+
+	if ((file->fileDescriptor = (strcmp(fileName, "-") == 0 ? dup(0) : open(file->fileName, openFlags))) != -1)
 	{
 		if (fstat(file->fileDescriptor, &file->fileStat) != -1)
 		{
-			if ((file->fileBuffer = (void *) mmap(NULL, file->fileStat.st_size, prot, flags, file->fileDescriptor, 0)) != MAP_FAILED)
+			if (!S_ISREG(file->fileStat.st_mode) || file->fileStat.st_size == 0)
+			{
+				result = readWholeFile(file);
+			}
+			else if ((file->fileBuffer = (void *) mmap(NULL, file->fileStat.st_size, prot, flags, file->fileDescriptor, 0)) != MAP_FAILED)
 			{
 				file->fileMapped = true;
 				result = true;
+				adviseMapping(file, hints);
+				statisticsAdd("bytesMapped", file->fileStat.st_size);
+			}
+			else if (errno == ENODEV)
+			{
+				file->fileBuffer = NULL;
+				result = readWholeFile(file);
+			}
+			else
+			{
+				file->fileBuffer = NULL;
+				fprintf(stderr, "Error %d mapping %u bytes of %s file '%s' to memory.\n", errno, (int) file->fileStat.st_size, file->fileDescription, file->fileName);
 			}
-			else fprintf(stderr, "Error %d mapping %u bytes of %s file '%s' to memory.\n", errno, (int) file->fileStat.st_size, file->fileDescription, file->fileName);
 		}
 		else fprintf(stderr, "Error %d getting file stats for '%s'.\n", errno, file->fileName);
 
@@ -65,6 +147,13 @@ void closeMemoryMappedFile(struct memoryMappedFile *file)
 		file->fileMapped = false;
 	}
 
+	if (file->fileRead)
+	{
+		free(file->fileBuffer);
+		file->fileBuffer = NULL;
+		file->fileRead = false;
+	}
+
 	if (file->fileDescriptor != -1)
 	{
 		close(file->fileDescriptor);
@@ -187,3 +276,59 @@ void swapEndianess(bool needed, uint32_t *ptr)
 
 }
 
+bool relocateConfigArea(struct _avm_kernel_config * *configArea, size_t configSize)
+{
+	bool						swapNeeded;
+	uint32_t     		 		kernelOffset;
+	uint32_t					configBase;
+	struct _avm_kernel_config *	entry;
+
+	//	- the configuration area is aligned on a 4K boundary and the first 32 bit contain a
+	//	  pointer to an 'struct _avm_kernel_config' array
+	//	- we take the first 32 bit value from the dump and align this pointer to 4K to get
+	//	  the start address of the area in the linked kernel
+
+	if (!detectInputEndianess(configArea, configSize, &swapNeeded)) return false;
+
+	configBase = (uint32_t) configArea;
+	swapEndianess(swapNeeded, (uint32_t *) configArea);
+
+	kernelOffset = (uint32_t) *((uint32_t *) configArea) & 0xFFFFF000;
+
+	entry = (struct _avm_kernel_config *) (*((uint32_t *) configArea) - kernelOffset + configBase);
+	*configArea = entry;
+
+	if (entry == NULL) return false;
+
+	swapEndianess(swapNeeded, &entry->tag);
+
+	while (entry->tag <= avm_kernel_config_tags_last)
+	{
+		if (entry->config == NULL) break;
+
+		swapEndianess(swapNeeded, (uint32_t *) &entry->config);
+		entry->config = (void *) ((uint32_t) entry->config - kernelOffset + configBase);
+
+		if ((int) entry->tag == avm_kernel_config_tags_modulememory)
+		{	
+			// only _kernel_modulmemory_config entries need relocation of members
+			struct _kernel_modulmemory_config *	module = (struct _kernel_modulmemory_config *) entry->config;
+			
+			while (module->name != NULL)
+			{	
+				swapEndianess(swapNeeded, (uint32_t *) &module->name);
+				module->name = (char *) ((uint32_t) module->name - kernelOffset + configBase);
+				swapEndianess(swapNeeded, &module->size);
+
+				module++;
+			}
+		}
+
+		entry++;
+		swapEndianess(swapNeeded, &entry->tag);
+	}
+
+	statisticsAdd("configEntries", entry - *configArea);
+
+	return true;
+}
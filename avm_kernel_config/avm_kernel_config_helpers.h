@@ -20,19 +20,30 @@
 #include "linux/include/uapi/linux/avm_kernel_config.h"
 #endif // FREETZ
 
+// access hints for openMemoryMappedFile, they're only advices - failures are ignored
+#define MAPPING_SEQUENTIAL			0x0001	// MADV_SEQUENTIAL, more readahead and early reclaim
+#define MAPPING_WILLNEED			0x0002	// MADV_WILLNEED, start reading the whole file now
+#define MAPPING_HUGEPAGE			0x0004	// MADV_HUGEPAGE, if the kernel supports it for files
+#define MAPPING_POPULATE			0x0008	// MAP_POPULATE, prefault all pages while mapping
+
+// files, which can't be mapped (pipes, STDIN as '-'), are read into memory with this block size
+#define MAPPING_READ_BLOCK_SIZE		(4 * 1024 * 1024)
+
 struct memoryMappedFile
 {
 	const char *		fileName;
 	const char *		fileDescription;
 	int					fileDescriptor;
-	struct stat			fileStat;
+	struct stat			fileStat;		// st_size is the size of the buffer content, even for pipes
 	void *				fileBuffer;
 	bool				fileMapped;
+	bool				fileRead;		// the buffer was allocated and filled with read() calls
 };
 
-bool openMemoryMappedFile(struct memoryMappedFile *file, const char *fileName, const char *fileDescription, int openFlags, int prot, int flags);
+bool openMemoryMappedFile(struct memoryMappedFile *file, const char *fileName, const char *fileDescription, int openFlags, int prot, int flags, unsigned int hints);
 void closeMemoryMappedFile(struct memoryMappedFile *file);
 bool detectInputEndianess(struct _avm_kernel_config * *configArea, size_t configSize, bool *swapNeeded);
 void swapEndianess(bool needed, uint32_t *ptr);
+bool relocateConfigArea(struct _avm_kernel_config * *configArea, size_t configSize);
 
 #endif
@@ -0,0 +1,86 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "avm_kernel_config_helpers.h"
+#include "content_store_helpers.h"
+#include <string.h>
+
+void usage()
+{
+	fprintf(stderr, "content_store - put files into or get them from a content-addressed store\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "content_store put <store> [ <file> ... ]\n");
+	fprintf(stderr, "content_store get <store> <reference>\n");
+	fprintf(stderr, "\nThe 'put' command stores each specified file (or the data read from");
+	fprintf(stderr, "\nSTDIN, if no file was specified) and writes one reference per file");
+	fprintf(stderr, "\nto STDOUT. The content is split into chunks at content-defined");
+	fprintf(stderr, "\nboundaries and each chunk is written only once, even if it's used");
+	fprintf(stderr, "\nby many files. A summary is written to STDERR.\n");
+	fprintf(stderr, "\nThe 'get' command writes the content of the referenced object to");
+	fprintf(stderr, "\nSTDOUT.\n");
+	fprintf(stderr, "\nThe store is the same, which is used by 'extract_avm_kernel_config',");
+	fprintf(stderr, "\n'gen_avm_kernel_config' and 'rle_decode' with the -c option.\n");
+}
+
+int main(int argc, char * argv[])
+{
+	int						returnCode = 0;
+	struct contentStore		store;
+	char					reference[CONTENT_STORE_REFERENCE_SIZE];
+
+	if (argc < 3 || (strcmp(argv[1], "put") != 0 && strcmp(argv[1], "get") != 0) || (strcmp(argv[1], "get") == 0 && argc != 4))
+	{
+		usage();
+		exit(1);
+	}
+
+	if (!openContentStore(&store, argv[2])) exit(1);
+
+	if (strcmp(argv[1], "get") == 0)
+	{
+		exit(getContentStoreObject(&store, argv[3], 1) ? 0 : 1);
+	}
+
+	// without any file name, the data is read from STDIN
+	for (int i = 3; i < argc || i == 3; i++)
+	{
+		const char *			inputName = (i < argc ? argv[i] : "-");
+		struct memoryMappedFile	input;
+
+		if (openMemoryMappedFile(&input, inputName, "input", O_RDONLY, PROT_READ, MAP_SHARED, MAPPING_SEQUENTIAL | MAPPING_WILLNEED))
+		{
+			if (putContentStoreObject(&store, input.fileBuffer, input.fileStat.st_size, reference))
+			{
+				if (strcmp(inputName, "-") == 0) fprintf(stdout, "%s\n", reference);
+				else fprintf(stdout, "%s\t%s\n", reference, inputName);
+			}
+			else returnCode = 1;
+			closeMemoryMappedFile(&input);
+		}
+		else returnCode = 1;
+	}
+
+	reportContentStore(&store, stderr);
+	exit(returnCode);
+}
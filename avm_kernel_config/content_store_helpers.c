@@ -0,0 +1,410 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+#include "content_store_helpers.h"
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+static uint64_t	gearTable[256];
+static bool		gearTableReady = false;
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t readLE64(const uint8_t *ptr)
+{
+	uint64_t	value = 0;
+
+	for (int i = 7; i >= 0; i--) value = (value << 8) | ptr[i];
+	return value;
+}
+
+static inline uint32_t readLE32(const uint8_t *ptr)
+{
+	return (uint32_t) ptr[0] | (uint32_t) ptr[1] << 8 | (uint32_t) ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+}
+
+static inline uint64_t hashRound(uint64_t accumulator, uint64_t input)
+{
+	accumulator += input * PRIME64_2;
+	accumulator = rotateLeft(accumulator, 31);
+	return accumulator * PRIME64_1;
+}
+
+static inline uint64_t hashMerge(uint64_t accumulator, uint64_t value)
+{
+	accumulator ^= hashRound(0, value);
+	return accumulator * PRIME64_1 + PRIME64_4;
+}
+
+// XXH64 (seed 0) - fast and independent of the byte order of the host
+uint64_t contentHash(const void *buffer, size_t size)
+{
+	const uint8_t *	ptr = buffer;
+	const uint8_t *	end = ptr + size;
+	uint64_t		hash;
+
+	if (size >= 32)
+	{
+		uint64_t	v1 = PRIME64_1 + PRIME64_2;
+		uint64_t	v2 = PRIME64_2;
+		uint64_t	v3 = 0;
+		uint64_t	v4 = 0 - PRIME64_1;
+
+		while (ptr + 32 <= end)
+		{
+			v1 = hashRound(v1, readLE64(ptr));
+			v2 = hashRound(v2, readLE64(ptr + 8));
+			v3 = hashRound(v3, readLE64(ptr + 16));
+			v4 = hashRound(v4, readLE64(ptr + 24));
+			ptr += 32;
+		}
+
+		hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+		hash = hashMerge(hash, v1);
+		hash = hashMerge(hash, v2);
+		hash = hashMerge(hash, v3);
+		hash = hashMerge(hash, v4);
+	}
+	else hash = PRIME64_5;
+
+	hash += (uint64_t) size;
+
+	while (ptr + 8 <= end)
+	{
+		hash ^= hashRound(0, readLE64(ptr));
+		hash = rotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+		ptr += 8;
+	}
+
+	if (ptr + 4 <= end)
+	{
+		hash ^= (uint64_t) readLE32(ptr) * PRIME64_1;
+		hash = rotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+		ptr += 4;
+	}
+
+	while (ptr < end)
+	{
+		hash ^= (*ptr) * PRIME64_5;
+		hash = rotateLeft(hash, 11) * PRIME64_1;
+		ptr++;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+static void initializeGearTable(void)
+{
+	uint64_t	state = 0x59465249545A2121ULL; // fixed seed, chunk boundaries have to be stable
+
+	for (int i = 0; i < 256; i++)
+	{
+		uint64_t	value;
+
+		// splitmix64
+		state += 0x9E3779B97F4A7C15ULL;
+		value = state;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+		gearTable[i] = value ^ (value >> 31);
+	}
+	gearTableReady = true;
+}
+
+// content-defined chunking with a 'gear' rolling hash - a changed byte moves
+// at most the surrounding boundaries, all other chunks keep their content
+size_t nextChunkSize(const uint8_t *buffer, size_t size)
+{
+	uint64_t	mask = ~0ULL << (64 - CONTENT_STORE_CHUNK_MASK_BITS);
+	uint64_t	fingerprint = 0;
+	size_t		limit = (size > CONTENT_STORE_CHUNK_MAX ? CONTENT_STORE_CHUNK_MAX : size);
+
+	if (!gearTableReady) initializeGearTable();
+
+	if (limit <= CONTENT_STORE_CHUNK_MIN) return limit;
+
+	for (size_t i = CONTENT_STORE_CHUNK_MIN - 64; i < limit; i++)
+	{
+		fingerprint = (fingerprint << 1) + gearTable[buffer[i]];
+		if (i >= CONTENT_STORE_CHUNK_MIN && (fingerprint & mask) == 0) return i + 1;
+	}
+
+	return limit;
+}
+
+static bool makeDirectory(const char *path)
+{
+	if (mkdir(path, 0755) == 0 || errno == EEXIST) return true;
+	fprintf(stderr, "Error %d creating directory '%s'.\n", errno, path);
+	return false;
+}
+
+bool openContentStore(struct contentStore *store, const char *storePath)
+{
+	char	path[PATH_MAX];
+
+	memset(store, 0, sizeof(*store));
+	store->storePath = storePath;
+
+	if (!makeDirectory(storePath)) return false;
+	snprintf(path, sizeof(path), "%s/chunks", storePath);
+	if (!makeDirectory(path)) return false;
+	snprintf(path, sizeof(path), "%s/objects", storePath);
+	if (!makeDirectory(path)) return false;
+
+	return true;
+}
+
+static bool readWholeFile(const char *path, void *buffer, size_t size)
+{
+	int			fd = open(path, O_RDONLY);
+	struct stat	st;
+	size_t		done = 0;
+	bool		result = false;
+
+	if (fd == -1) return false;
+
+	if (fstat(fd, &st) == 0 && (size_t) st.st_size == size)
+	{
+		while (done < size)
+		{
+			ssize_t	count = read(fd, (uint8_t *) buffer + done, size - done);
+
+			if (count <= 0) break;
+			done += count;
+		}
+		result = (done == size);
+	}
+
+	close(fd);
+	return result;
+}
+
+// existing files are never rewritten, new ones appear atomically by rename()
+static int storeFile(struct contentStore *store, const char *path, const char *directory, const void *buffer, size_t size)
+{
+	char		temporary[PATH_MAX];
+	int			fd;
+	size_t		done = 0;
+	uint8_t *	existing;
+
+	if (access(path, F_OK) == 0)
+	{
+		if ((existing = malloc(size ? size : 1)) == NULL) return -1;
+
+		if (!readWholeFile(path, existing, size) || memcmp(existing, buffer, size) != 0)
+		{
+			fprintf(stderr, "Content of '%s' differs from data with the same hash value.\n", path);
+			free(existing);
+			return -1;
+		}
+
+		free(existing);
+		return 0;
+	}
+
+	if (!makeDirectory(directory)) return -1;
+
+	snprintf(temporary, sizeof(temporary), "%s.%u", path, (unsigned int) getpid());
+	if ((fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+	{
+		fprintf(stderr, "Error %d creating file '%s'.\n", errno, temporary);
+		return -1;
+	}
+
+	while (done < size)
+	{
+		ssize_t	count = write(fd, (const uint8_t *) buffer + done, size - done);
+
+		if (count <= 0)
+		{
+			fprintf(stderr, "Error %d writing file '%s'.\n", errno, temporary);
+			close(fd);
+			unlink(temporary);
+			return -1;
+		}
+		done += count;
+	}
+
+	close(fd);
+
+	if (rename(temporary, path) != 0)
+	{
+		fprintf(stderr, "Error %d renaming file '%s'.\n", errno, temporary);
+		unlink(temporary);
+		return -1;
+	}
+
+	store->bytesWritten += size;
+	return 1;
+}
+
+static void formatReference(char *reference, uint64_t hash, size_t size)
+{
+	snprintf(reference, CONTENT_STORE_REFERENCE_SIZE, "%016" PRIx64 "-%zu", hash, size);
+}
+
+bool putContentStoreObject(struct contentStore *store, const void *buffer, size_t size, char *reference)
+{
+	const uint8_t *	data = buffer;
+	size_t			offset = 0;
+	char *			manifest = NULL;
+	size_t			manifestSize = 0;
+	size_t			manifestUsed = 0;
+	char			path[PATH_MAX];
+	char			directory[PATH_MAX];
+	bool			result = false;
+
+	formatReference(reference, contentHash(buffer, size), size);
+
+	while (offset < size || (size == 0 && manifestUsed == 0))
+	{
+		size_t	chunkSize = nextChunkSize(data + offset, size - offset);
+		char	chunkReference[CONTENT_STORE_REFERENCE_SIZE];
+		int		stored;
+
+		formatReference(chunkReference, contentHash(data + offset, chunkSize), chunkSize);
+
+		snprintf(directory, sizeof(directory), "%s/chunks/%.2s", store->storePath, chunkReference);
+		snprintf(path, sizeof(path), "%s/chunks/%.2s/%s", store->storePath, chunkReference, chunkReference);
+		if ((stored = storeFile(store, path, directory, data + offset, chunkSize)) < 0) goto exit;
+
+		store->chunksTotal++;
+		if (stored > 0) store->chunksNew++;
+
+		if (manifestUsed + CONTENT_STORE_REFERENCE_SIZE + 1 > manifestSize)
+		{
+			char *	grown = realloc(manifest, manifestSize + 64 * (CONTENT_STORE_REFERENCE_SIZE + 1));
+
+			if (grown == NULL)
+			{
+				fprintf(stderr, "Error allocating memory for object manifest.\n");
+				goto exit;
+			}
+			manifest = grown;
+			manifestSize += 64 * (CONTENT_STORE_REFERENCE_SIZE + 1);
+		}
+		manifestUsed += sprintf(manifest + manifestUsed, "%s\n", chunkReference);
+
+		offset += chunkSize;
+		if (size == 0) break;
+	}
+
+	snprintf(directory, sizeof(directory), "%s/objects/%.2s", store->storePath, reference);
+	snprintf(path, sizeof(path), "%s/objects/%.2s/%s", store->storePath, reference, reference);
+	if (storeFile(store, path, directory, manifest, manifestUsed) < 0) goto exit;
+
+	store->bytesTotal += size;
+	result = true;
+
+exit:
+	free(manifest);
+	return result;
+}
+
+bool getContentStoreObject(struct contentStore *store, const char *reference, int outputFile)
+{
+	char		path[PATH_MAX];
+	char		chunkReference[CONTENT_STORE_REFERENCE_SIZE + 2];
+	FILE *		manifest;
+	uint8_t *	chunk = NULL;
+	bool		result = true;
+
+	snprintf(path, sizeof(path), "%s/objects/%.2s/%s", store->storePath, reference, reference);
+	if ((manifest = fopen(path, "r")) == NULL)
+	{
+		fprintf(stderr, "Object '%s' not found in store '%s'.\n", reference, store->storePath);
+		return false;
+	}
+
+	if ((chunk = malloc(CONTENT_STORE_CHUNK_MAX)) == NULL)
+	{
+		fclose(manifest);
+		return false;
+	}
+
+	while (result && fgets(chunkReference, sizeof(chunkReference), manifest) != NULL)
+	{
+		char *		separator;
+		size_t		chunkSize;
+		size_t		done = 0;
+
+		chunkReference[strcspn(chunkReference, "\n")] = 0;
+		if ((separator = strchr(chunkReference, '-')) == NULL || (chunkSize = strtoul(separator + 1, NULL, 10)) > CONTENT_STORE_CHUNK_MAX)
+		{
+			fprintf(stderr, "Invalid chunk reference '%s' in object '%s'.\n", chunkReference, reference);
+			result = false;
+			break;
+		}
+
+		snprintf(path, sizeof(path), "%s/chunks/%.2s/%s", store->storePath, chunkReference, chunkReference);
+		if (!readWholeFile(path, chunk, chunkSize) || contentHash(chunk, chunkSize) != strtoull(chunkReference, NULL, 16))
+		{
+			fprintf(stderr, "Chunk '%s' of object '%s' is missing or damaged.\n", chunkReference, reference);
+			result = false;
+			break;
+		}
+
+		while (done < chunkSize)
+		{
+			ssize_t	count = write(outputFile, chunk + done, chunkSize - done);
+
+			if (count <= 0)
+			{
+				fprintf(stderr, "Error %d writing object content.\n", errno);
+				result = false;
+				break;
+			}
+			done += count;
+		}
+	}
+
+	free(chunk);
+	fclose(manifest);
+	return result;
+}
+
+void reportContentStore(struct contentStore *store, FILE *output)
+{
+	fprintf(output, "store '%s': %" PRIu64 " bytes in %zu chunks, %zu new chunks, %" PRIu64 " bytes written\n", store->storePath, store->bytesTotal, store->chunksTotal, store->chunksNew, store->bytesWritten);
+}
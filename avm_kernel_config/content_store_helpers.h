@@ -0,0 +1,38 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef CONTENT_STORE_HELPERS_H
+#define CONTENT_STORE_HELPERS_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+//	- an object is split into chunks at content-defined boundaries, each
+//	  chunk is stored once as 'chunks/xx/<hash>-<size>'
+//	- the object itself is a list of its chunks, stored as
+//	  'objects/xx/<hash>-<size>', where the name is also the reference
+//	  returned to the caller
+
+#define CONTENT_STORE_REFERENCE_SIZE	40
+#define CONTENT_STORE_CHUNK_MIN			2048
+#define CONTENT_STORE_CHUNK_MAX			65536
+#define CONTENT_STORE_CHUNK_MASK_BITS	13
+
+struct contentStore
+{
+	const char *		storePath;
+	size_t				chunksTotal;
+	size_t				chunksNew;
+	uint64_t			bytesTotal;
+	uint64_t			bytesWritten;
+};
+
+uint64_t contentHash(const void *buffer, size_t size);
+size_t nextChunkSize(const uint8_t *buffer, size_t size);
+bool openContentStore(struct contentStore *store, const char *storePath);
+bool putContentStoreObject(struct contentStore *store, const void *buffer, size_t size, char *reference);
+bool getContentStoreObject(struct contentStore *store, const char *reference, int outputFile);
+void reportContentStore(struct contentStore *store, FILE *output);
+
+#endif
@@ -0,0 +1,441 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "avm_kernel_config_helpers.h"
+#include "content_store_helpers.h"
+#include "statistics_helpers.h"
+#include <string.h>
+#include <ctype.h>
+#include <libfdt.h>
+
+#define DEVICE_TREES_MAX		(avm_kernel_config_tags_device_tree_subrev_last - avm_kernel_config_tags_device_tree_subrev_0 + 1)
+#define NODE_PATH_SIZE			256
+#define VALUE_OUTPUT_LIMIT		32
+
+void usage()
+{
+	fprintf(stderr, "diff_avm_kernel_config - compare kernel config areas structurally\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "diff_avm_kernel_config [ -s ] [ -f ] [ --stats[=<file>] ]\n");
+	fprintf(stderr, "                       <config_area_1> <config_area_2> [ <config_area_n> ... ]\n");
+	fprintf(stderr, "\nThe binary config area dumps (as written by 'extract_avm_kernel_config')");
+	fprintf(stderr, "\nare compared entry by entry - the version info fields, the names and");
+	fprintf(stderr, "\nsizes of the module memory list and the nodes and properties of each");
+	fprintf(stderr, "\ndevice tree.\n");
+	fprintf(stderr, "\nIf more than two files are specified, each one is compared with its");
+	fprintf(stderr, "\npredecessor (e.g. a version history in ascending order) or with the");
+	fprintf(stderr, "\nfirst file, if the -f option is used.\n");
+	fprintf(stderr, "\nEach part of an area is hashed first and only parts with different");
+	fprintf(stderr, "\nhash values are compared in detail. With -s, only the names of the");
+	fprintf(stderr, "\ndifferent parts are listed.\n");
+	fprintf(stderr, "\nThe differences are written to STDOUT, the exit code is 0, if all");
+	fprintf(stderr, "\nareas are equal, 1 if differences were found and 2 on errors.\n");
+	fprintf(stderr, "\nWith --stats (or if %s is set), timings, page faults", STATISTICS_ENVIRONMENT);
+	fprintf(stderr, "\nand counters of this run are written as a JSON line to STDERR");
+	fprintf(stderr, "\n(or appended to the specified file).\n");
+}
+
+// a relocated config area with the hash values of its parts, a missing part has a hash value of 0
+struct areaSummary
+{
+	const char *		fileName;
+	struct memoryMappedFile	file;
+	struct _avm_kernel_version_info		version;	// zero-padded copy
+	uint64_t			versionHash;
+	struct _kernel_modulmemory_config *	modules;
+	uint64_t			modulesHash;
+	const void *		deviceTrees[DEVICE_TREES_MAX];
+	uint32_t			deviceTreeSizes[DEVICE_TREES_MAX];
+	uint64_t			deviceTreeHashes[DEVICE_TREES_MAX];
+};
+
+// the context of a single comparison, the header line is written only in front of the first difference
+struct comparison
+{
+	const struct areaSummary *	from;
+	const struct areaSummary *	to;
+	bool				summaryOnly;
+	bool				headerWritten;
+	unsigned int		differences;
+};
+
+uint64_t mixHash(uint64_t hash, uint64_t value)
+{
+	uint64_t			values[2] = { hash, value };
+
+	return contentHash(values, sizeof(values));
+}
+
+bool loadArea(struct areaSummary *area, const char *fileName)
+{
+	struct _avm_kernel_config *	entry;
+	struct _avm_kernel_config **	configArea;
+
+	memset(area, 0, sizeof(*area));
+	area->fileName = fileName;
+
+	if (!openMemoryMappedFile(&area->file, fileName, "config area", O_RDONLY, PROT_READ | PROT_WRITE, MAP_PRIVATE, MAPPING_WILLNEED | MAPPING_POPULATE)) return false;
+
+	configArea = (struct _avm_kernel_config **) area->file.fileBuffer;
+	if (!relocateConfigArea(configArea, area->file.fileStat.st_size))
+	{
+		fprintf(stderr, "Unable to identify and relocate the config area dump file '%s', may be it's empty.\n", fileName);
+		closeMemoryMappedFile(&area->file);
+		return false;
+	}
+
+	for (entry = *configArea; entry->tag <= avm_kernel_config_tags_last && entry->config != NULL; entry++)
+	{
+		if (entry->tag == avm_kernel_config_tags_version_info)
+		{
+			struct _avm_kernel_version_info *	version = (struct _avm_kernel_version_info *) entry->config;
+
+			// anything behind the terminating zero byte doesn't count
+			strncpy(area->version.buildnumber, version->buildnumber, sizeof(area->version.buildnumber));
+			strncpy(area->version.svnversion, version->svnversion, sizeof(area->version.svnversion));
+			strncpy(area->version.firmwarestring, version->firmwarestring, sizeof(area->version.firmwarestring));
+			area->versionHash = mixHash(contentHash(&area->version, sizeof(area->version)), 1);
+		}
+		else if ((int) entry->tag == avm_kernel_config_tags_modulememory)
+		{
+			struct _kernel_modulmemory_config *	module;
+
+			area->modules = (struct _kernel_modulmemory_config *) entry->config;
+			area->modulesHash = 1;
+			for (module = area->modules; module->name != NULL; module++)
+			{
+				area->modulesHash = mixHash(mixHash(area->modulesHash, contentHash(module->name, strlen(module->name))), module->size);
+			}
+		}
+		else if (entry->tag >= avm_kernel_config_tags_device_tree_subrev_0 && entry->tag <= avm_kernel_config_tags_device_tree_subrev_last)
+		{
+			unsigned int	subRev = entry->tag - avm_kernel_config_tags_device_tree_subrev_0;
+			uint32_t		dtbSize = *(((uint32_t *) entry->config) + 1);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			// the 'dtc' compiler always emits this value in 'big endian'
+			swapEndianess(true, &dtbSize);
+#endif
+			area->deviceTrees[subRev] = entry->config;
+			area->deviceTreeSizes[subRev] = dtbSize;
+			area->deviceTreeHashes[subRev] = mixHash(contentHash(entry->config, dtbSize), dtbSize);
+		}
+	}
+
+	statisticsAdd("areas", 1);
+
+	return true;
+}
+
+void freeArea(struct areaSummary *area)
+{
+	closeMemoryMappedFile(&area->file);
+}
+
+// equal hash values mean unchanged content, only the others are compared in detail
+bool sectionChanged(struct comparison *cmp, const char *section, uint64_t fromHash, uint64_t toHash)
+{
+	if (fromHash == toHash)
+	{
+		statisticsAdd("sectionsSkipped", 1);
+		return false;
+	}
+
+	statisticsAdd("sectionsCompared", 1);
+
+	if (!cmp->headerWritten)
+	{
+		fprintf(stdout, "--- %s\n+++ %s\n", cmp->from->fileName, cmp->to->fileName);
+		cmp->headerWritten = true;
+	}
+	cmp->differences++;
+
+	if (cmp->summaryOnly) fprintf(stdout, "%s\n", section);
+
+	return !cmp->summaryOnly;
+}
+
+void compareVersionField(const char *field, const char *from, const char *to, size_t size)
+{
+	if (strncmp(from, to, size) == 0) return;
+	fprintf(stdout, "version_info.%s: \"%.*s\" -> \"%.*s\"\n", field, (int) size, from, (int) size, to);
+}
+
+void compareVersionInfo(struct comparison *cmp)
+{
+	const struct _avm_kernel_version_info *	from = &cmp->from->version;
+	const struct _avm_kernel_version_info *	to = &cmp->to->version;
+
+	if (!sectionChanged(cmp, "version_info", cmp->from->versionHash, cmp->to->versionHash)) return;
+
+	if (cmp->from->versionHash == 0) fprintf(stdout, "version_info: added\n");
+	else if (cmp->to->versionHash == 0) fprintf(stdout, "version_info: removed\n");
+	else
+	{
+		compareVersionField("buildnumber", from->buildnumber, to->buildnumber, sizeof(from->buildnumber));
+		compareVersionField("svnversion", from->svnversion, to->svnversion, sizeof(from->svnversion));
+		compareVersionField("firmwarestring", from->firmwarestring, to->firmwarestring, sizeof(from->firmwarestring));
+	}
+}
+
+const struct _kernel_modulmemory_config * findModule(const struct _kernel_modulmemory_config *modules, const char *name)
+{
+	if (modules == NULL) return NULL;
+
+	for (; modules->name != NULL; modules++)
+	{
+		if (strcmp(modules->name, name) == 0) return modules;
+	}
+
+	return NULL;
+}
+
+void compareModuleMemory(struct comparison *cmp)
+{
+	const struct _kernel_modulmemory_config *	module;
+	const struct _kernel_modulmemory_config *	other;
+
+	if (!sectionChanged(cmp, "module_memory", cmp->from->modulesHash, cmp->to->modulesHash)) return;
+
+	// the lists contain some dozens of entries, a linear search is fast enough
+	for (module = cmp->from->modules; module != NULL && module->name != NULL; module++)
+	{
+		if ((other = findModule(cmp->to->modules, module->name)) == NULL) fprintf(stdout, "module_memory: -%s %u\n", module->name, module->size);
+		else if (other->size != module->size) fprintf(stdout, "module_memory: %s %u -> %u (%+" PRId64 ")\n", module->name, module->size, other->size, (int64_t) other->size - module->size);
+	}
+
+	for (module = cmp->to->modules; module != NULL && module->name != NULL; module++)
+	{
+		if (findModule(cmp->from->modules, module->name) == NULL) fprintf(stdout, "module_memory: +%s %u\n", module->name, module->size);
+	}
+}
+
+// property values are shown like 'dtc' does it - as strings, as cells or as bytes
+void printPropertyValue(const void *value, int length)
+{
+	const uint8_t *		bytes = (const uint8_t *) value;
+	bool				printable = (length > 0 && bytes[length - 1] == 0 && bytes[0] != 0);
+	int					i;
+
+	for (i = 0; printable && i < length - 1; i++)
+	{
+		if (bytes[i] == 0 ? bytes[i + 1] == 0 : !isprint(bytes[i])) printable = false;
+	}
+
+	if (printable)
+	{
+		for (i = 0; i < length - 1; i += strlen((const char *) bytes + i) + 1)
+		{
+			fprintf(stdout, "%s\"%s\"", (i ? ", " : ""), (const char *) bytes + i);
+		}
+	}
+	else if (length % 4 == 0)
+	{
+		fprintf(stdout, "<");
+		for (i = 0; i < length && i < VALUE_OUTPUT_LIMIT; i += 4)
+		{
+			uint32_t	cell;
+
+			memcpy(&cell, bytes + i, sizeof(cell));
+			fprintf(stdout, "%s0x%08x", (i ? " " : ""), fdt32_to_cpu(cell));
+		}
+		fprintf(stdout, "%s>", (i < length ? " ..." : ""));
+	}
+	else
+	{
+		fprintf(stdout, "[");
+		for (i = 0; i < length && i < VALUE_OUTPUT_LIMIT; i++) fprintf(stdout, "%s%02x", (i ? " " : ""), bytes[i]);
+		fprintf(stdout, "%s]", (i < length ? " ..." : ""));
+	}
+}
+
+unsigned int compareProperties(const char *section, const char *path, const void *from, int fromNode, const void *to, int toNode)
+{
+	int					property;
+	const void *		value;
+	const void *		other;
+	const char *		name;
+	int					length;
+	int					otherLength;
+	unsigned int		differences = 0;
+
+	for (property = fdt_first_property_offset(from, fromNode); property >= 0; property = fdt_next_property_offset(from, property))
+	{
+		value = fdt_getprop_by_offset(from, property, &name, &length);
+		if (value == NULL) continue;
+
+		other = fdt_getprop(to, toNode, name, &otherLength);
+		if (other != NULL && otherLength == length && memcmp(value, other, length) == 0) continue;
+
+		fprintf(stdout, "%s: %s%s:%s ", section, (other == NULL ? "-" : ""), path, name);
+		differences++;
+		printPropertyValue(value, length);
+		if (other != NULL)
+		{
+			fprintf(stdout, " -> ");
+			printPropertyValue(other, otherLength);
+		}
+		fprintf(stdout, "\n");
+	}
+
+	for (property = fdt_first_property_offset(to, toNode); property >= 0; property = fdt_next_property_offset(to, property))
+	{
+		value = fdt_getprop_by_offset(to, property, &name, &length);
+		if (value == NULL || fdt_getprop(from, fromNode, name, NULL) != NULL) continue;
+
+		fprintf(stdout, "%s: +%s:%s ", section, path, name);
+		differences++;
+		printPropertyValue(value, length);
+		fprintf(stdout, "\n");
+	}
+
+	return differences;
+}
+
+// all nodes of 'from' are looked up by their path in 'to', a missing node is reported once for its
+// whole subtree - the reverse direction only looks for added nodes
+unsigned int compareNodes(const char *section, const void *from, const void *to, bool reverse)
+{
+	char				path[NODE_PATH_SIZE];
+	int					node;
+	int					depth = 0;
+	int					missingDepth = -1;
+	unsigned int		differences = 0;
+
+	for (node = 0; node >= 0 && depth >= 0; node = fdt_next_node(from, node, &depth))
+	{
+		int				other;
+
+		if (missingDepth >= 0)
+		{
+			if (depth > missingDepth) continue;
+			missingDepth = -1;
+		}
+
+		if (fdt_get_path(from, node, path, sizeof(path)) != 0)
+		{
+			fprintf(stderr, "Error getting the path of a node from %s.\n", section);
+			continue;
+		}
+
+		if ((other = fdt_path_offset(to, path)) < 0)
+		{
+			fprintf(stdout, "%s: %c%s\n", section, (reverse ? '+' : '-'), path);
+			missingDepth = depth;
+			differences++;
+		}
+		else if (!reverse) differences += compareProperties(section, path, from, node, to, other);
+	}
+
+	return differences;
+}
+
+void compareDeviceTrees(struct comparison *cmp)
+{
+	char				section[32];
+
+	for (int subRev = 0; subRev < DEVICE_TREES_MAX; subRev++)
+	{
+		const void *	from = cmp->from->deviceTrees[subRev];
+		const void *	to = cmp->to->deviceTrees[subRev];
+
+		snprintf(section, sizeof(section), "device_tree_subrev_%u", subRev);
+		if (!sectionChanged(cmp, section, cmp->from->deviceTreeHashes[subRev], cmp->to->deviceTreeHashes[subRev])) continue;
+
+		if (from == NULL) fprintf(stdout, "%s: added (%u bytes)\n", section, cmp->to->deviceTreeSizes[subRev]);
+		else if (to == NULL) fprintf(stdout, "%s: removed (%u bytes)\n", section, cmp->from->deviceTreeSizes[subRev]);
+		else if (fdt_check_header(from) != 0 || fdt_check_header(to) != 0)
+		{
+			fprintf(stdout, "%s: invalid device tree, content differs (%u -> %u bytes)\n", section, cmp->from->deviceTreeSizes[subRev], cmp->to->deviceTreeSizes[subRev]);
+		}
+		else
+		{
+			unsigned int	differences = compareNodes(section, from, to, false) + compareNodes(section, to, from, true);
+
+			// only the header (e.g. the order of strings) or the memory reservations differ
+			if (differences == 0) fprintf(stdout, "%s: same nodes and properties, BLOB differs (%u -> %u bytes)\n", section, cmp->from->deviceTreeSizes[subRev], cmp->to->deviceTreeSizes[subRev]);
+		}
+	}
+}
+
+bool compareAreas(const struct areaSummary *from, const struct areaSummary *to, bool summaryOnly)
+{
+	struct comparison	cmp = { from, to, summaryOnly, false, 0 };
+
+	compareVersionInfo(&cmp);
+	compareModuleMemory(&cmp);
+	compareDeviceTrees(&cmp);
+
+	return (cmp.differences > 0);
+}
+
+int main(int argc, char * argv[])
+{
+	int						returnCode = 0;
+	bool					summaryOnly = false;
+	bool					againstFirst = false;
+	struct areaSummary		areas[2];
+	int						i = 1;
+
+	initStatistics("diff_avm_kernel_config", &argc, argv);
+
+	for (; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0) summaryOnly = true;
+		else if (strcmp(argv[i], "-f") == 0) againstFirst = true;
+		else break;
+	}
+
+	if (argc - i < 2 || argv[i][0] == '-')
+	{
+		usage();
+		exit(2);
+	}
+
+	// only two areas are mapped at any time, even for a long version history
+	if (!loadArea(&areas[0], argv[i++])) exit(2);
+
+	statisticsStartPhase("compare");
+	for (; i < argc; i++)
+	{
+		if (!loadArea(&areas[1], argv[i]))
+		{
+			returnCode = 2;
+			break;
+		}
+
+		if (compareAreas(&areas[0], &areas[1], summaryOnly)) returnCode = 1;
+
+		if (againstFirst) freeArea(&areas[1]);
+		else
+		{
+			freeArea(&areas[0]);
+			memcpy(&areas[0], &areas[1], sizeof(areas[0]));
+		}
+	}
+
+	freeArea(&areas[0]);
+
+	exit(returnCode);
+}
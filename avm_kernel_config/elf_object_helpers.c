@@ -0,0 +1,327 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "elf_object_helpers.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <elf.h>
+
+#define ELF_HEADER_SIZE				52
+#define ELF_SECTION_HEADER_SIZE		40
+#define ELF_SYMBOL_SIZE				16
+#define ELF_REL_SIZE				8
+
+// not every 'elf.h' defines the ABI flags for MIPS
+#ifndef EF_MIPS_ABI_O32
+#define EF_MIPS_ABI_O32				0x00001000
+#endif
+#ifndef EF_MIPS_ARCH_32
+#define EF_MIPS_ARCH_32				0x50000000
+#endif
+
+// the flags are the same as from 'as' for a kernel build (o32 ABI resp. EABI version 5)
+static const struct
+{
+	const char *		name;
+	uint16_t			machine;
+	uint32_t			flags;
+	uint32_t			relocationType;
+} elfMachines[] = {
+	{ "mips", EM_MIPS, EF_MIPS_ABI_O32 | EF_MIPS_ARCH_32, R_MIPS_32 },
+	{ "arm", EM_ARM, EF_ARM_EABI_VER5, R_ARM_ABS32 },
+	{ NULL, 0, 0, 0 }
+};
+
+static void put16(const struct elfObject *object, uint8_t *ptr, uint16_t value)
+{
+	ptr[object->bigEndian ? 0 : 1] = (uint8_t) (value >> 8);
+	ptr[object->bigEndian ? 1 : 0] = (uint8_t) value;
+}
+
+static void put32(const struct elfObject *object, uint8_t *ptr, uint32_t value)
+{
+	int					i;
+
+	for (i = 0; i < 4; i++) ptr[object->bigEndian ? 3 - i : i] = (uint8_t) (value >> (i * 8));
+}
+
+static uint32_t alignValue(uint32_t value, uint32_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool initElfObject(struct elfObject *object, const char *machine, bool bigEndian)
+{
+	int					i;
+
+	memset(object, 0, sizeof(struct elfObject));
+	object->bigEndian = bigEndian;
+
+	for (i = 0; elfMachines[i].name != NULL; i++)
+	{
+		if (strcmp(elfMachines[i].name, machine) != 0) continue;
+
+		object->machine = elfMachines[i].machine;
+		object->flags = elfMachines[i].flags;
+		object->relocationType = elfMachines[i].relocationType;
+		return true;
+	}
+
+	return false;
+}
+
+int addElfSection(struct elfObject *object, const char *name)
+{
+	struct elfSection *	section;
+
+	if (object->sectionCount >= ELF_OBJECT_MAX_SECTIONS) return -1;
+
+	section = &object->sections[object->sectionCount];
+	memset(section, 0, sizeof(struct elfSection));
+	section->name = name;
+	section->alignment = 1;
+
+	return object->sectionCount++;
+}
+
+bool appendElfData(struct elfObject *object, int section, const void *data, size_t size)
+{
+	struct elfSection *	s = &object->sections[section];
+
+	if (s->size + size > s->allocated)
+	{
+		size_t			allocated = (s->allocated ? s->allocated : 4096);
+		uint8_t *		grown;
+
+		while (allocated < s->size + size) allocated *= 2;
+		if ((grown = realloc(s->data, allocated)) == NULL) return false;
+		s->data = grown;
+		s->allocated = allocated;
+	}
+
+	if (data == NULL) memset(s->data + s->size, 0, size);
+	else memcpy(s->data + s->size, data, size);
+	s->size += size;
+
+	return true;
+}
+
+// the alignment is a number of bytes (a power of 2), padding is done with zeros
+bool alignElfSection(struct elfObject *object, int section, uint32_t alignment)
+{
+	struct elfSection *	s = &object->sections[section];
+
+	if (alignment > s->alignment) s->alignment = alignment;
+	return appendElfData(object, section, NULL, alignValue(s->size, alignment) - s->size);
+}
+
+bool appendElfWord(struct elfObject *object, int section, uint32_t value)
+{
+	uint8_t				word[4];
+
+	put32(object, word, value);
+	return appendElfData(object, section, word, sizeof(word));
+}
+
+bool appendElfPointer(struct elfObject *object, int section, int target, uint32_t targetOffset)
+{
+	struct elfSection *	s = &object->sections[section];
+	struct elfRelocation *	relocations;
+
+	if ((relocations = realloc(s->relocations, (s->relocationCount + 1) * sizeof(struct elfRelocation))) == NULL) return false;
+	s->relocations = relocations;
+	s->relocations[s->relocationCount].offset = s->size;
+	s->relocations[s->relocationCount].target = target;
+	s->relocationCount++;
+
+	return appendElfWord(object, section, targetOffset);
+}
+
+// forward references are emitted with a dummy value and patched later
+void patchElfWord(struct elfObject *object, int section, uint32_t offset, uint32_t value)
+{
+	put32(object, object->sections[section].data + offset, value);
+}
+
+static void putSectionHeader(const struct elfObject *object, uint8_t *header, uint32_t name, uint32_t type, uint32_t flags, uint32_t offset, uint32_t size, uint32_t link, uint32_t info, uint32_t alignment, uint32_t entrySize)
+{
+	put32(object, header, name);
+	put32(object, header + 4, type);
+	put32(object, header + 8, flags);
+	put32(object, header + 12, 0);
+	put32(object, header + 16, offset);
+	put32(object, header + 20, size);
+	put32(object, header + 24, link);
+	put32(object, header + 28, info);
+	put32(object, header + 32, alignment);
+	put32(object, header + 36, entrySize);
+}
+
+// layout: ELF header, section data, relocations, symbols, string tables and section headers
+bool writeElfObject(struct elfObject *object, int fd)
+{
+	unsigned int		relocationSections = 0;
+	unsigned int		headerCount;
+	unsigned int		symtabIndex;
+	uint32_t			sectionOffset[ELF_OBJECT_MAX_SECTIONS];
+	uint32_t			relocationOffset[ELF_OBJECT_MAX_SECTIONS];
+	uint32_t			sectionName[ELF_OBJECT_MAX_SECTIONS];
+	uint32_t			relocationName[ELF_OBJECT_MAX_SECTIONS];
+	uint32_t			symtabOffset;
+	uint32_t			strtabOffset;
+	uint32_t			shstrtabOffset;
+	uint32_t			shstrtabSize = 1;
+	uint32_t			headersOffset;
+	uint32_t			offset = ELF_HEADER_SIZE;
+	uint32_t			symtabName;
+	uint32_t			strtabName;
+	uint32_t			shstrtabName;
+	uint8_t *			buffer;
+	uint8_t *			ptr;
+	unsigned int		i;
+	size_t				j;
+	bool				result;
+
+	for (i = 0; i < object->sectionCount; i++)
+	{
+		const struct elfSection *	s = &object->sections[i];
+
+		offset = alignValue(offset, s->alignment);
+		sectionOffset[i] = offset;
+		offset += s->size;
+		sectionName[i] = shstrtabSize;
+		shstrtabSize += strlen(s->name) + 1;
+		if (s->relocationCount > 0)
+		{
+			relocationName[i] = shstrtabSize;
+			shstrtabSize += strlen(s->name) + 5;
+			relocationSections++;
+		}
+	}
+
+	for (i = 0; i < object->sectionCount; i++)
+	{
+		if (object->sections[i].relocationCount == 0) continue;
+		offset = alignValue(offset, 4);
+		relocationOffset[i] = offset;
+		offset += object->sections[i].relocationCount * ELF_REL_SIZE;
+	}
+
+	symtabName = shstrtabSize;
+	shstrtabSize += sizeof(".symtab");
+	strtabName = shstrtabSize;
+	shstrtabSize += sizeof(".strtab");
+	shstrtabName = shstrtabSize;
+	shstrtabSize += sizeof(".shstrtab");
+
+	symtabOffset = alignValue(offset, 4);
+	strtabOffset = symtabOffset + (object->sectionCount + 1) * ELF_SYMBOL_SIZE;
+	shstrtabOffset = strtabOffset + 1;
+	headersOffset = alignValue(shstrtabOffset + shstrtabSize, 4);
+	headerCount = 1 + object->sectionCount + relocationSections + 3;
+	symtabIndex = 1 + object->sectionCount + relocationSections;
+
+	if ((buffer = calloc(1, headersOffset + headerCount * ELF_SECTION_HEADER_SIZE)) == NULL) return false;
+
+	// ELF header
+	memcpy(buffer, ELFMAG, SELFMAG);
+	buffer[EI_CLASS] = ELFCLASS32;
+	buffer[EI_DATA] = (object->bigEndian ? ELFDATA2MSB : ELFDATA2LSB);
+	buffer[EI_VERSION] = EV_CURRENT;
+	buffer[EI_OSABI] = ELFOSABI_NONE;
+	put16(object, buffer + 16, ET_REL);
+	put16(object, buffer + 18, object->machine);
+	put32(object, buffer + 20, EV_CURRENT);
+	put32(object, buffer + 32, headersOffset);
+	put32(object, buffer + 36, object->flags);
+	put16(object, buffer + 40, ELF_HEADER_SIZE);
+	put16(object, buffer + 46, ELF_SECTION_HEADER_SIZE);
+	put16(object, buffer + 48, headerCount);
+	put16(object, buffer + 50, headerCount - 1);
+
+	// section content, relocations and the section symbols (one per section, the relocations use them)
+	ptr = buffer + headersOffset + ELF_SECTION_HEADER_SIZE;
+	for (i = 0; i < object->sectionCount; i++, ptr += ELF_SECTION_HEADER_SIZE)
+	{
+		const struct elfSection *	s = &object->sections[i];
+		uint8_t *		symbol = buffer + symtabOffset + (i + 1) * ELF_SYMBOL_SIZE;
+
+		if (s->size > 0) memcpy(buffer + sectionOffset[i], s->data, s->size);
+		putSectionHeader(object, ptr, sectionName[i], SHT_PROGBITS, SHF_ALLOC, sectionOffset[i], s->size, 0, 0, s->alignment, 0);
+		strcpy((char *) buffer + shstrtabOffset + sectionName[i], s->name);
+
+		symbol[12] = ELF32_ST_INFO(STB_LOCAL, STT_SECTION);
+		put16(object, symbol + 14, i + 1);
+	}
+
+	for (i = 0; i < object->sectionCount; i++)
+	{
+		const struct elfSection *	s = &object->sections[i];
+
+		if (s->relocationCount == 0) continue;
+
+		for (j = 0; j < s->relocationCount; j++)
+		{
+			uint8_t *	rel = buffer + relocationOffset[i] + j * ELF_REL_SIZE;
+
+			put32(object, rel, s->relocations[j].offset);
+			put32(object, rel + 4, ELF32_R_INFO(s->relocations[j].target + 1, object->relocationType));
+		}
+
+		putSectionHeader(object, ptr, relocationName[i], SHT_REL, SHF_INFO_LINK, relocationOffset[i], s->relocationCount * ELF_REL_SIZE, symtabIndex, i + 1, 4, ELF_REL_SIZE);
+		sprintf((char *) buffer + shstrtabOffset + relocationName[i], ".rel%s", s->name);
+		ptr += ELF_SECTION_HEADER_SIZE;
+	}
+
+	putSectionHeader(object, ptr, symtabName, SHT_SYMTAB, 0, symtabOffset, (object->sectionCount + 1) * ELF_SYMBOL_SIZE, symtabIndex + 1, object->sectionCount + 1, 4, ELF_SYMBOL_SIZE);
+	ptr += ELF_SECTION_HEADER_SIZE;
+	putSectionHeader(object, ptr, strtabName, SHT_STRTAB, 0, strtabOffset, 1, 0, 0, 1, 0);
+	ptr += ELF_SECTION_HEADER_SIZE;
+	putSectionHeader(object, ptr, shstrtabName, SHT_STRTAB, 0, shstrtabOffset, shstrtabSize, 0, 0, 1, 0);
+
+	strcpy((char *) buffer + shstrtabOffset + symtabName, ".symtab");
+	strcpy((char *) buffer + shstrtabOffset + strtabName, ".strtab");
+	strcpy((char *) buffer + shstrtabOffset + shstrtabName, ".shstrtab");
+
+	offset = headersOffset + headerCount * ELF_SECTION_HEADER_SIZE;
+	result = (write(fd, buffer, offset) == (ssize_t) offset);
+	if (!result) fprintf(stderr, "Error %d writing object file.\n", errno);
+
+	free(buffer);
+
+	return result;
+}
+
+void freeElfObject(struct elfObject *object)
+{
+	unsigned int		i;
+
+	for (i = 0; i < object->sectionCount; i++)
+	{
+		free(object->sections[i].data);
+		free(object->sections[i].relocations);
+	}
+
+	object->sectionCount = 0;
+}
@@ -0,0 +1,52 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef ELF_OBJECT_HELPERS_H
+#define ELF_OBJECT_HELPERS_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#define ELF_OBJECT_MAX_SECTIONS		4
+
+// a relocation of a 32-bit word with an absolute address, the symbol is the start of the target
+// section and the addend is stored in place (REL format, like 'as' emits it for MIPS and ARM)
+struct elfRelocation
+{
+	uint32_t			offset;
+	unsigned int		target;
+};
+
+struct elfSection
+{
+	const char *		name;
+	uint8_t *			data;
+	size_t				size;
+	size_t				allocated;
+	uint32_t			alignment;
+	struct elfRelocation *	relocations;
+	size_t				relocationCount;
+};
+
+// a relocatable object file with allocated PROGBITS sections only
+struct elfObject
+{
+	bool				bigEndian;
+	uint16_t			machine;
+	uint32_t			flags;
+	uint32_t			relocationType;
+	struct elfSection	sections[ELF_OBJECT_MAX_SECTIONS];
+	unsigned int		sectionCount;
+};
+
+bool initElfObject(struct elfObject *object, const char *machine, bool bigEndian);
+int addElfSection(struct elfObject *object, const char *name);
+bool appendElfData(struct elfObject *object, int section, const void *data, size_t size);
+bool alignElfSection(struct elfObject *object, int section, uint32_t alignment);
+bool appendElfWord(struct elfObject *object, int section, uint32_t value);
+bool appendElfPointer(struct elfObject *object, int section, int target, uint32_t targetOffset);
+void patchElfWord(struct elfObject *object, int section, uint32_t offset, uint32_t value);
+bool writeElfObject(struct elfObject *object, int fd);
+void freeElfObject(struct elfObject *object);
+
+#endif
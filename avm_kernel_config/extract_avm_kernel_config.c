@@ -21,6 +21,9 @@
  ***********************************************************************/
 
 #include "avm_kernel_config_helpers.h"
+#include "content_store_helpers.h"
+#include "statistics_helpers.h"
+#include <string.h>
 #include <libfdt.h>
 
 void usage()
@@ -29,7 +32,9 @@ void usage()
 	fprintf(stderr, "(C) 2016-2017 P. Hämmerlein (http://www.yourfritz.de)\n\n");
 	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
 	fprintf(stderr, "Usage:\n\n");
-	fprintf(stderr, "extract_avm_kernel_config [ -s <size in KByte> ] <unpacked_kernel> [<dtb_file>]\n");
+	fprintf(stderr, "extract_avm_kernel_config [ -s <size in KByte> ] [ -c <store> | --store=<store> ] [ -v ]\n");
+	fprintf(stderr, "                          [ --stats[=<file>] ]\n");
+	fprintf(stderr, "                          <unpacked_kernel> [<dtb_file>]\n");
 	fprintf(stderr, "\nThe specified DTB content (a compiled OF device tree BLOB) is");
 	fprintf(stderr, "\nsearched in the unpacked kernel and the place, where it's found");
 	fprintf(stderr, "\nis assumed to be within the original kernel config area.\n");
@@ -41,6 +46,14 @@ void usage()
 	fprintf(stderr, "\nTo support different models with changing sizes of the embedded");
 	fprintf(stderr, "\nconfiguration area, a default size of 64 KB for this area is used,");
 	fprintf(stderr, "\nwhich may be overwritten with the -s option.\n");
+	fprintf(stderr, "\nIf a content store directory is specified with the -c (or --store=)");
+	fprintf(stderr, "\noption, the config area is put into this store (see 'content_store')");
+	fprintf(stderr, "\nand only the reference to the stored object is written to STDOUT.\n");
+	fprintf(stderr, "\nThe -v option shows the offset of the config area in the unpacked");
+	fprintf(stderr, "\nkernel on STDERR.\n");
+	fprintf(stderr, "\nWith --stats (or if %s is set), timings, page faults", STATISTICS_ENVIRONMENT);
+	fprintf(stderr, "\nand counters of this run are written as a JSON line to STDERR");
+	fprintf(stderr, "\n(or appended to the specified file).\n");
 }
 
 bool checkConfigArea(struct _avm_kernel_config ** configArea, size_t configSize)
@@ -71,6 +84,7 @@ void * findDeviceTreeImage(void *haystack, size_t haystackSize, void *needle, si
 	bool		matchedSoFar = false;
 	uint32_t *	resetSliding;
 	size_t		resetToSearch;
+	uint64_t	candidates = 0;
 
 	if (toSearch > 0)
 	{
@@ -88,6 +102,7 @@ void * findDeviceTreeImage(void *haystack, size_t haystackSize, void *needle, si
 
 			if (toSearch > 0) // match found for first uint32
 			{	
+				candidates++;
 				matchedSoFar = true;
 				resetToSearch = --toSearch;
 				resetSliding = ++sliding;
@@ -145,6 +160,8 @@ void * findDeviceTreeImage(void *haystack, size_t haystackSize, void *needle, si
 		}
 	}
 
+	statisticsAdd("dtbCandidates", candidates);
+
 	return location;
 }
 
@@ -153,6 +170,7 @@ void * locateDeviceTreeSignature(void *kernelBuffer, size_t kernelSize)
 	void *		location = NULL;
 	uint32_t	signature = 0xD00DFEED;
 	uint32_t *	ptr = (uint32_t *) kernelBuffer;	
+	uint64_t	candidates = 0;
 	
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 	// the DTB signature is store in 'big endian' => swap needed, if we're running on 'little endian' machine
@@ -163,6 +181,7 @@ void * locateDeviceTreeSignature(void *kernelBuffer, size_t kernelSize)
 	{
 		if (*ptr == signature) // possibly found the tree
 		{
+			candidates++;
 			if (fdt_check_header((void *) ptr) == 0)
 			{
 				location = ptr;
@@ -172,6 +191,8 @@ void * locateDeviceTreeSignature(void *kernelBuffer, size_t kernelSize)
 		ptr++;
 	}
 
+	statisticsAdd("signatureCandidates", candidates);
+
 	return location;
 }
 
@@ -184,13 +205,44 @@ int main(int argc, char * argv[])
 	ssize_t					size = 64 * 1024;
 	int						i = 1;
 	int						paramCount = argc;
+	char *					storePath = NULL;
+	bool					verbose = false;
+
+	initStatistics("extract_avm_kernel_config", &argc, argv);
+	paramCount = argc;
 
 	/* no reason to use a getopt implementation for our simple calling convention */
-	if (paramCount > i)
+	while (i < argc && argv[i][0] == '-')
 	{
 		char *				sizeString = NULL;
 
-		if (strcmp(argv[i], "-s") == 0)
+		if (strcmp(argv[i], "-c") == 0)
+		{
+			if (paramCount > i + 1)
+			{
+				storePath = argv[i + 1];
+				i += 2;
+				paramCount -= 2;
+			}
+			else
+			{
+				fprintf(stderr, "Missing directory name after option '-c'.\n");
+				exit(2);
+			}
+		}
+		else if (strncmp(argv[i], "--store=", 8) == 0)
+		{
+			storePath = strchr(argv[i], '=') + 1;
+			i += 1;
+			paramCount -= 1;
+		}
+		else if (strcmp(argv[i], "-v") == 0)
+		{
+			verbose = true;
+			i += 1;
+			paramCount -= 1;
+		}
+		else if (strcmp(argv[i], "-s") == 0)
 		{
 			if (paramCount > i + 1)
 			{
@@ -211,6 +263,7 @@ int main(int argc, char * argv[])
 			i += 1;
 			paramCount -= 1;
 		}
+		else break;
 
 		if (sizeString != NULL)
 		{
@@ -242,11 +295,13 @@ int main(int argc, char * argv[])
 		exit(1);
 	}
 
-	if (openMemoryMappedFile(&kernel, argv[i], "unpacked kernel", O_RDONLY | O_SYNC, PROT_READ, MAP_SHARED))
+	statisticsStartPhase("map");
+	if (openMemoryMappedFile(&kernel, argv[i], "unpacked kernel", O_RDONLY, PROT_READ, MAP_SHARED, MAPPING_SEQUENTIAL | MAPPING_WILLNEED | MAPPING_HUGEPAGE | MAPPING_POPULATE))
 	{
+		statisticsStartPhase("search");
 		if (paramCount > 2)
 		{
-			if (openMemoryMappedFile(&dtb, argv[i + 1], "device tree BLOB", O_RDONLY | O_SYNC, PROT_READ, MAP_SHARED))
+			if (openMemoryMappedFile(&dtb, argv[i + 1], "device tree BLOB", O_RDONLY, PROT_READ, MAP_SHARED, MAPPING_WILLNEED))
 			{
 				if (fdt_check_header(dtb.fileBuffer) == 0)
 				{
@@ -272,9 +327,33 @@ int main(int argc, char * argv[])
 		
 		if (dtbLocation != NULL)
 		{
-			struct _avm_kernel_config * *configArea = findConfigArea(dtbLocation, size);
-			
-			if (configArea != NULL)
+			struct _avm_kernel_config * *configArea;
+
+			statisticsStartPhase("check");
+			configArea = findConfigArea(dtbLocation, size);
+			statisticsStartPhase("output");
+
+			if (configArea != NULL && verbose)
+			{
+				fprintf(stderr, "Config area found at offset 0x%08zx.\n", (size_t) ((uint8_t *) configArea - (uint8_t *) kernel.fileBuffer));
+			}
+
+			if (configArea != NULL && storePath != NULL)
+			{
+				struct contentStore	store;
+				char				reference[CONTENT_STORE_REFERENCE_SIZE];
+
+				if (openContentStore(&store, storePath) && putContentStoreObject(&store, (void *) configArea, size, reference))
+				{
+					fprintf(stdout, "%s\n", reference);
+					returnCode = 0;
+				}
+				else
+				{
+					fprintf(stderr, "Error storing config area content.\n");
+				}
+			}
+			else if (configArea != NULL)
 			{
 				ssize_t	written = write(1, (void *) configArea, size);
 
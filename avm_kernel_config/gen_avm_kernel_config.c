@@ -21,6 +21,10 @@
  ***********************************************************************/
 
 #include "avm_kernel_config_helpers.h"
+#include "content_store_helpers.h"
+#include "statistics_helpers.h"
+#include "elf_object_helpers.h"
+#include <string.h>
 
 void usage()
 {
@@ -29,111 +33,182 @@ void usage()
 	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
 	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
 	fprintf(stderr, "Usage:\n\n");
-	fprintf(stderr, "gen_avm_kernel_config <binary_config_area_file>\n");
+	fprintf(stderr, "gen_avm_kernel_config [ -c <store> | -o <object_file> [ -m mips|arm ] ] [ -r ] [ --stats[=<file>] ]\n");
+	fprintf(stderr, "                      <binary_config_area_file>\n");
 	fprintf(stderr, "\nThe configuration area dump is read and an assembler source file");
 	fprintf(stderr, "\nis created from its content. This file may later be compiled into");
 	fprintf(stderr, "\nan object file ready to be included into an own kernel while");
 	fprintf(stderr, "\nlinking it.\n");
 	fprintf(stderr, "\nThe output is written to STDOUT, so you've to redirect it to the");
 	fprintf(stderr, "\nproper location.\n");
+	fprintf(stderr, "\nIf a content store directory is specified with the -c option, each");
+	fprintf(stderr, "\ndevice tree BLOB is put into this store (see 'content_store') and");
+	fprintf(stderr, "\nonly a list of the references to the stored objects is written to");
+	fprintf(stderr, "\nSTDOUT instead of the assembler source.\n");
+	fprintf(stderr, "\nWith the -o option, a relocatable ELF object file (for MIPS or ARM,");
+	fprintf(stderr, "\nwith the byte order of the dump) is written directly, it contains the");
+	fprintf(stderr, "\nsame 'configarea' section as the assembled source.\n");
+	fprintf(stderr, "\nIdentical device tree BLOBs for different subrevisions are stored only");
+	fprintf(stderr, "\nonce, the config entries for the other subrevisions refer to the first");
+	fprintf(stderr, "\ncopy. The -r option writes a report about the byte order of the dump,");
+	fprintf(stderr, "\nthe shared BLOBs and the saved memory to STDERR.\n");
+	fprintf(stderr, "\nWith --stats (or if %s is set), timings, page faults", STATISTICS_ENVIRONMENT);
+	fprintf(stderr, "\nand counters of this run are written as a JSON line to STDERR");
+	fprintf(stderr, "\n(or appended to the specified file).\n");
 
 }
 
-bool relocateConfigArea(struct _avm_kernel_config * *configArea, size_t configSize)
+// identical device tree BLOBs (often used for different subrevisions of a model) are emitted only
+// once, all further config entries for the same content refer to the first copy
+struct deviceTreeBlob
 {
-	bool						swapNeeded;
-	uint32_t     		 		kernelOffset;
-	uint32_t					configBase;
-	struct _avm_kernel_config *	entry;
+	unsigned int		subRev;
+	const uint8_t *		data;
+	uint32_t			size;
+	uint64_t			hash;
+	int					sharedWith;		// index of the first copy or -1
+};
 
-	//	- the configuration area is aligned on a 4K boundary and the first 32 bit contain a
-	//	  pointer to an 'struct _avm_kernel_config' array
-	//	- we take the first 32 bit value from the dump and align this pointer to 4K to get
-	//	  the start address of the area in the linked kernel
+#define DEVICE_TREE_BLOBS_MAX	(avm_kernel_config_tags_device_tree_subrev_last - avm_kernel_config_tags_device_tree_subrev_0 + 1)
 
-	if (!detectInputEndianess(configArea, configSize, &swapNeeded)) return false;
+int collectDeviceTrees(struct _avm_kernel_config * *configArea, struct deviceTreeBlob *blobs)
+{
+	struct _avm_kernel_config *	entry = *configArea;
+	int							count = 0;
 
-	configBase = (uint32_t) configArea;
-	swapEndianess(swapNeeded, (uint32_t *) configArea);
+	if (entry == NULL) return 0;
 
-	kernelOffset = (uint32_t) *((uint32_t *) configArea) & 0xFFFFF000;
+	for (; entry->tag <= avm_kernel_config_tags_last && entry->config != NULL && count < DEVICE_TREE_BLOBS_MAX; entry++)
+	{
+		if (entry->tag >= avm_kernel_config_tags_device_tree_subrev_0 && entry->tag <= avm_kernel_config_tags_device_tree_subrev_last)
+		{
+			struct deviceTreeBlob *	blob = &blobs[count];
 
-	entry = (struct _avm_kernel_config *) (*((uint32_t *) configArea) - kernelOffset + configBase);
-	*configArea = entry;
+			blob->subRev = entry->tag - avm_kernel_config_tags_device_tree_subrev_0;
+			blob->data = (const uint8_t *) entry->config;
+			blob->size = *(((uint32_t *) entry->config) + 1);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			// the 'dtc' compiler always emits this value in 'big endian' (using ASM_EMIT_BELONG
+			// in 'flattree.c' - see there)
+			swapEndianess(true, &blob->size);
+#endif
+			blob->hash = contentHash(blob->data, blob->size);
+			blob->sharedWith = -1;
 
-	if (entry == NULL) return false;
+			// the hash is only a shortcut, sharing needs identical content
+			for (int i = 0; i < count; i++)
+			{
+				if (blobs[i].sharedWith != -1 || blobs[i].hash != blob->hash || blobs[i].size != blob->size) continue;
+				if (memcmp(blobs[i].data, blob->data, blob->size) != 0) continue;
+				blob->sharedWith = i;
+				break;
+			}
 
-	swapEndianess(swapNeeded, &entry->tag);
+			statisticsAdd("deviceTrees", 1);
+			if (blob->sharedWith == -1) statisticsAdd("deviceTreeBytes", blob->size);
+			else statisticsAdd("deviceTreeBytesShared", blob->size);
 
-	while (entry->tag <= avm_kernel_config_tags_last)
+			count++;
+		}
+	}
+
+	return count;
+}
+
+void processDeviceTrees(struct _avm_kernel_config * *configArea)
+{
+	struct deviceTreeBlob	blobs[DEVICE_TREE_BLOBS_MAX];
+	int						count = collectDeviceTrees(configArea, blobs);
+
+	if (count == 0) return;
+
+	fprintf(stdout, "\n"); // empty line as optical delimiter in front of DTB dump
+
+	for (int blob = 0; blob < count; blob++)
 	{
-		if (entry->config == NULL) break;
+		uint32_t			dtbSize = blobs[blob].size;
+		uint32_t			i;
 
-		swapEndianess(swapNeeded, (uint32_t *) &entry->config);
-		entry->config = (void *) ((uint32_t) entry->config - kernelOffset + configBase);
+		if (blobs[blob].sharedWith != -1)
+		{
+			fprintf(stdout, "\tAVM_DEVICE_TREE_SHARED\t%u, %u\n", blobs[blob].subRev, blobs[blobs[blob].sharedWith].subRev);
+			continue;
+		}
 
-		if ((int) entry->tag == avm_kernel_config_tags_modulememory)
-		{	
-			// only _kernel_modulmemory_config entries need relocation of members
-			struct _kernel_modulmemory_config *	module = (struct _kernel_modulmemory_config *) entry->config;
-			
-			while (module->name != NULL)
-			{	
-				swapEndianess(swapNeeded, (uint32_t *) &module->name);
-				module->name = (char *) ((uint32_t) module->name - kernelOffset + configBase);
-				swapEndianess(swapNeeded, &module->size);
+		fprintf(stdout, ".L_avm_device_tree_subrev_%u:\n", blobs[blob].subRev);
+		fprintf(stdout, "\tAVM_DEVICE_TREE_BLOB\t%u\n", blobs[blob].subRev);
 
-				module++;
-			}
+		register const uint8_t *	source = blobs[blob].data;
+		while (dtbSize > 0) 
+		{
+			i = (dtbSize > 16 ? 16 : dtbSize);
+			dtbSize -= i;
+
+			fprintf(stdout, "\t.byte\t");
+			while (i--) fprintf(stdout, "0x%02x%c", *(source++), (i ? ',' : '\n'));
 		}
+	}
+}
 
-		entry++;
-		swapEndianess(swapNeeded, &entry->tag);
+void reportDeviceTrees(struct _avm_kernel_config * *configArea, const char *fileName, bool bigEndian)
+{
+	struct deviceTreeBlob	blobs[DEVICE_TREE_BLOBS_MAX];
+	int						count = collectDeviceTrees(configArea, blobs);
+	uint32_t				total = 0;
+	uint32_t				saved = 0;
+	int						shared = 0;
+
+	fprintf(stderr, "%s: byte order %s\n", fileName, (bigEndian ? "big" : "little"));
+
+	for (int blob = 0; blob < count; blob++)
+	{
+		total += blobs[blob].size;
+
+		if (blobs[blob].sharedWith == -1)
+		{
+			fprintf(stderr, "device_tree_subrev_%u\t%u bytes\n", blobs[blob].subRev, blobs[blob].size);
+		}
+		else
+		{
+			fprintf(stderr, "device_tree_subrev_%u\t%u bytes\tshared with device_tree_subrev_%u\n", blobs[blob].subRev, blobs[blob].size, blobs[blobs[blob].sharedWith].subRev);
+			saved += blobs[blob].size;
+			shared++;
+		}
 	}
 
-	return true;
+	fprintf(stderr, "%s: %d device trees with %u bytes, %d shared, %u bytes (%u%%) saved\n", fileName, count, total, shared, saved, (total ? (uint32_t) ((uint64_t) saved * 100 / total) : 0));
 }
 
-void processDeviceTrees(struct _avm_kernel_config * *configArea)
+bool storeDeviceTrees(struct _avm_kernel_config * *configArea, struct contentStore *store)
 {
 	struct _avm_kernel_config *	entry = *configArea;
 
-	if (entry == NULL) return;
-
-	fprintf(stdout, "\n"); // empty line as optical delimiter in front of DTB dump
+	if (entry == NULL) return false;
 
 	while (entry->tag <= avm_kernel_config_tags_last)
 	{
-		if (entry->config == NULL) return;
+		if (entry->config == NULL) break;
 
 		if (entry->tag >= avm_kernel_config_tags_device_tree_subrev_0 && entry->tag <= avm_kernel_config_tags_device_tree_subrev_last)
 		{
 			unsigned int 	subRev = entry->tag - avm_kernel_config_tags_device_tree_subrev_0;
 			uint32_t		dtbSize = *(((uint32_t *) entry->config) + 1);
-			uint32_t		i;
-
-			fprintf(stdout, ".L_avm_device_tree_subrev_%u:\n", subRev);
-			fprintf(stdout, "\tAVM_DEVICE_TREE_BLOB\t%u\n", subRev);
+			char			reference[CONTENT_STORE_REFERENCE_SIZE];
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-			// the 'dtc' compiler always emits this value in 'big endian' (using ASM_EMIT_BELONG
-			// in 'flattree.c' - see there)
 			swapEndianess(true, &dtbSize);
 #endif
 
-			register uint8_t *	source = (uint8_t *) entry->config;
-			while (dtbSize > 0) 
-			{
-				i = (dtbSize > 16 ? 16 : dtbSize);
-				dtbSize -= i;
-	
-				fprintf(stdout, "\t.byte\t");
-				while (i--) fprintf(stdout, "0x%02x%c", *(source++), (i ? ',' : '\n'));
-			}
+			statisticsAdd("deviceTrees", 1);
+			statisticsAdd("deviceTreeBytes", dtbSize);
+			if (!putContentStoreObject(store, entry->config, dtbSize, reference)) return false;
+			fprintf(stdout, "device_tree_subrev_%u\t%s\n", subRev, reference);
 		}
 
 		entry++;
 	}
+
+	return true;
 }
 
 void processVersionInfo(struct _avm_kernel_config * *configArea)
@@ -177,6 +252,7 @@ void processModuleMemoryEntries(struct _avm_kernel_config * *configArea)
 			while (module->name != NULL)
 			{
 				fprintf(stdout, "\tAVM_MODULE_MEMORY\t%u, \"%s\", %u\n", ++mod_no, module->name, module->size);
+				statisticsAdd("modules", 1);
 				module++;
 			}
 			fprintf(stdout, "\tAVM_MODULE_MEMORY\t0\n");
@@ -273,25 +349,201 @@ int processConfigArea(struct _avm_kernel_config * *configArea)
 	return 0;
 }
 
+// the same layout as from the assembler source with 'avm_kernel_config_macros.h' (see above), but
+// written as an ELF object - forward references to the data of an entry are patched at the end
+bool writeConfigAreaObject(struct _avm_kernel_config * *configArea, const char *machine, bool bigEndian, int fd)
+{
+	struct elfObject			object;
+	struct _avm_kernel_config *	entry;
+	uint32_t					entrySlot[avm_kernel_config_tags_last + 1];
+	uint32_t					entryData[avm_kernel_config_tags_last + 1];
+	int							area;
+	int							strings = -1;
+	bool						result = true;
+
+	if (!initElfObject(&object, machine, bigEndian))
+	{
+		fprintf(stderr, "Unsupported machine type '%s' for object file.\n", machine);
+		return false;
+	}
+
+	memset(entrySlot, 0, sizeof(entrySlot));
+	memset(entryData, 0, sizeof(entryData));
+
+	area = addElfSection(&object, "configarea");
+	if (hasModuleMemory(configArea)) strings = addElfSection(&object, "configareastrings");
+
+	// AVM_KERNEL_CONFIG_PTR, the entries start at the next 16 byte boundary
+	result = appendElfPointer(&object, area, area, 16) && alignElfSection(&object, area, 16);
+
+	if (result && hasModuleMemory(configArea))
+	{
+		entrySlot[avm_kernel_config_tags_modulememory] = object.sections[area].size + 4;
+		result = appendElfWord(&object, area, avm_kernel_config_tags_modulememory) && appendElfPointer(&object, area, area, 0);
+	}
+
+	if (result && hasVersionInfo(configArea))
+	{
+		entrySlot[avm_kernel_config_tags_version_info] = object.sections[area].size + 4;
+		result = appendElfWord(&object, area, avm_kernel_config_tags_version_info) && appendElfPointer(&object, area, area, 0);
+	}
+
+	for (int i = 0; result && i <= avm_kernel_config_tags_device_tree_subrev_last; i++)
+	{
+		if (!hasDeviceTree(configArea, i)) continue;
+		entrySlot[avm_kernel_config_tags_device_tree_subrev_0 + i] = object.sections[area].size + 4;
+		result = appendElfWord(&object, area, avm_kernel_config_tags_device_tree_subrev_0 + i) && appendElfPointer(&object, area, area, 0);
+	}
+
+	result = result && appendElfWord(&object, area, 0) && appendElfWord(&object, area, 0) && alignElfSection(&object, area, 16);
+
+	// device trees follow each other without any alignment, in the order from the dump, and each
+	// content is stored only once
+	if (result)
+	{
+		struct deviceTreeBlob	blobs[DEVICE_TREE_BLOBS_MAX];
+		uint32_t				offsets[DEVICE_TREE_BLOBS_MAX];
+		int						count = collectDeviceTrees(configArea, blobs);
+
+		for (int blob = 0; result && blob < count; blob++)
+		{
+			if (blobs[blob].sharedWith == -1)
+			{
+				offsets[blob] = object.sections[area].size;
+				result = appendElfData(&object, area, blobs[blob].data, blobs[blob].size);
+			}
+			else offsets[blob] = offsets[blobs[blob].sharedWith];
+
+			entryData[avm_kernel_config_tags_device_tree_subrev_0 + blobs[blob].subRev] = offsets[blob];
+		}
+	}
+
+	for (entry = *configArea; result && entry->tag <= avm_kernel_config_tags_last && entry->config != NULL; entry++)
+	{
+		if (entry->tag == avm_kernel_config_tags_version_info)
+		{
+			struct _avm_kernel_version_info *	version = (struct _avm_kernel_version_info *) entry->config;
+			struct _avm_kernel_version_info		padded;
+
+			// strings are copied up to the first zero byte, the remaining space is zero-filled
+			memset(&padded, 0, sizeof(padded));
+			strncpy(padded.buildnumber, version->buildnumber, sizeof(padded.buildnumber));
+			strncpy(padded.svnversion, version->svnversion, sizeof(padded.svnversion));
+			strncpy(padded.firmwarestring, version->firmwarestring, sizeof(padded.firmwarestring));
+
+			result = alignElfSection(&object, area, 8);
+			entryData[entry->tag] = object.sections[area].size;
+			result = result && appendElfData(&object, area, &padded, sizeof(padded));
+		}
+	}
+
+	// the module names are stored in their own section, like '.pushsection' in the macro does it
+	for (entry = *configArea; result && entry->tag <= avm_kernel_config_tags_last && entry->config != NULL; entry++)
+	{
+		if (entry->tag == avm_kernel_config_tags_modulememory)
+		{
+			struct _kernel_modulmemory_config *	module = (struct _kernel_modulmemory_config *) entry->config;
+
+			result = alignElfSection(&object, area, 4);
+			entryData[entry->tag] = object.sections[area].size;
+
+			for (; result && module->name != NULL; module++)
+			{
+				result = appendElfPointer(&object, area, strings, object.sections[strings].size) && appendElfWord(&object, area, module->size);
+				result = result && appendElfData(&object, strings, module->name, strlen(module->name) + 1) && alignElfSection(&object, strings, 4);
+				statisticsAdd("modules", 1);
+			}
+			result = result && appendElfWord(&object, area, 0) && appendElfWord(&object, area, 0);
+		}
+	}
+
+	for (int tag = 0; result && tag <= avm_kernel_config_tags_last; tag++)
+	{
+		if (entrySlot[tag] != 0) patchElfWord(&object, area, entrySlot[tag], entryData[tag]);
+	}
+
+	if (result) result = writeElfObject(&object, fd);
+	else fprintf(stderr, "Error allocating memory for object file content.\n");
+
+	freeElfObject(&object);
+
+	return result;
+}
+
 int main(int argc, char * argv[])
 {
 	int						returnCode = 1;
 	struct memoryMappedFile	input;
+	char *					storePath = NULL;
+	char *					objectFile = NULL;
+	char *					machine = "mips";
+	bool					swapNeeded = false;
+	bool					bigEndian = false;
+	bool					report = false;
+	int						i = 1;
+
+	initStatistics("gen_avm_kernel_config", &argc, argv);
+
+	while (argc > i + 1 && argv[i][0] == '-')
+	{
+		if (strcmp(argv[i], "-r") == 0)
+		{
+			report = true;
+			i++;
+			continue;
+		}
+		if (argc <= i + 2) break;
+		if (strcmp(argv[i], "-c") == 0) storePath = argv[i + 1];
+		else if (strcmp(argv[i], "-o") == 0) objectFile = argv[i + 1];
+		else if (strcmp(argv[i], "-m") == 0) machine = argv[i + 1];
+		else break;
+		i += 2;
+	}
 
-	if (argc < 2)
+	if (argc != i + 1 || (storePath != NULL && objectFile != NULL))
 	{
 		usage();
 		exit(1);
 	}
 
-	if (openMemoryMappedFile(&input, argv[1], "input", O_RDONLY | O_SYNC, PROT_WRITE, MAP_PRIVATE))
+	statisticsStartPhase("map");
+	if (openMemoryMappedFile(&input, argv[i], "input", O_RDONLY, PROT_READ | PROT_WRITE, MAP_PRIVATE, MAPPING_WILLNEED | MAPPING_POPULATE))
 	{
 		struct _avm_kernel_config **	configArea = (struct _avm_kernel_config **) input.fileBuffer;
 		size_t							configSize = input.fileStat.st_size;
 		
+		statisticsStartPhase("relocate");
+		// the byte order of the dump is needed for the object file, relocation converts it to ours
+		detectInputEndianess(configArea, configSize, &swapNeeded);
+		bigEndian = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) != swapNeeded;
 		if (relocateConfigArea(configArea, configSize))
 		{
-			returnCode = processConfigArea(configArea);
+			statisticsStartPhase("output");
+			if (storePath != NULL)
+			{
+				struct contentStore		store;
+
+				returnCode = (openContentStore(&store, storePath) && storeDeviceTrees(configArea, &store)) ? 0 : 1;
+			}
+			else if (objectFile != NULL)
+			{
+				int						fd = (strcmp(objectFile, "-") == 0 ? 1 : open(objectFile, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+
+				if (fd == -1)
+				{
+					fprintf(stderr, "Error %d creating object file '%s'.\n", errno, objectFile);
+				}
+				else
+				{
+					returnCode = writeConfigAreaObject(configArea, machine, bigEndian, fd) ? 0 : 1;
+					if (fd != 1 && close(fd) != 0) returnCode = 1;
+				}
+			}
+			else
+			{
+				returnCode = processConfigArea(configArea);
+			}
+			if (report) reportDeviceTrees(configArea, argv[i], bigEndian);
 		}
 		else
 		{
@@ -0,0 +1,315 @@
+#! /bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+# vim: set tabstop=4 syntax=bash :
+#######################################################################################################
+#                                                                                                     #
+# maintain a persistent index of the kernel config areas from a collection of firmware images         #
+#                                                                                                     #
+#######################################################################################################
+#                                                                                                     #
+# Copyright (C) 2016 P.Hämmerlein (peterpawn@yourfritz.de)                                            #
+#                                                                                                     #
+# This program is free software; you can redistribute it and/or modify it under the terms of the GNU  #
+# General Public License as published by the Free Software Foundation; either version 2 of the        #
+# License, or (at your option) any later version.                                                     #
+#                                                                                                     #
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without   #
+# even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      #
+# General Public License under http://www.gnu.org/licenses/gpl-2.0.html for more details.             #
+#                                                                                                     #
+#######################################################################################################
+#                                                                                                     #
+# The index directory contains a content store (see 'content_store') with the config areas and the   #
+# device tree BLOBs of all processed images and a catalogue file with one line per image and these   #
+# tab separated fields:                                                                               #
+#                                                                                                     #
+# - SHA-256 value, size and modification time of the image file and its path                          #
+# - SHA-256 value of the unpacked kernel, byte order ('big' or 'little') and offset of the config     #
+#   area in the unpacked kernel, reference of the config area in the content store                    #
+# - build number, SVN version and firmware string from the version info                               #
+# - a comma separated list of '<subrevision>=<reference>' entries for the device trees                #
+#                                                                                                     #
+# An image is processed again only, if its size or modification time has changed - and even then the #
+# existing entry is reused, if the SHA-256 value is already known (e.g. for a copy of an image).      #
+# Images without a config area get an entry with '-' as kernel value, they're retried with '-r' only. #
+#                                                                                                     #
+# New images are processed in parallel - 'xargs -P' starts the workers and each of them takes the     #
+# next image from the shared queue as soon as it's ready, so a few large images don't hold up the     #
+# remaining ones. The results are written to one file per image and merged into the catalogue at the  #
+# end of a run, the catalogue is replaced atomically.                                                 #
+#                                                                                                     #
+# The utilities from this directory are used from the same directory as this script or from the      #
+# search path.                                                                                        #
+#                                                                                                     #
+#######################################################################################################
+usage()
+(
+	printf "Maintain a persistent index of kernel config areas from firmware images.\n\n"
+	printf "Copyright (C) 2016 P. Haemmerlein (peterpawn@yourfritz.de)\n\n"
+	printf "Usage:\n\n"
+	printf "\033[1m%s\033[0m [ -d <index_directory> ] [ -j <jobs> ] [ -r ] update <image_or_directory> ...\n" "${0##*/}"
+	printf "\033[1m%s\033[0m [ -d <index_directory> ] query dtb <reference_or_dtb_file>\n" "${0##*/}"
+	printf "\033[1m%s\033[0m [ -d <index_directory> ] query kernel <sha256>\n" "${0##*/}"
+	printf "\033[1m%s\033[0m [ -d <index_directory> ] query version <text>\n" "${0##*/}"
+	printf "\033[1m%s\033[0m [ -d <index_directory> ] list | prune\n\n" "${0##*/}"
+	printf "The 'update' command adds new or changed firmware images (or kernel images) to the\n"
+	printf "index, directories are searched for '*.image' files. The number of parallel jobs\n"
+	printf "defaults to the number of processors, '-r' retries images without a config area.\n\n"
+	printf "Queries write the matching catalogue lines to STDOUT - 'dtb' finds all kernels\n"
+	printf "with a device tree (specified by its reference in the content store or as file),\n"
+	printf "'kernel' finds the images with an unpacked kernel and 'version' searches the\n"
+	printf "firmware strings and build numbers.\n\n"
+	printf "'list' shows the whole catalogue, 'prune' removes entries of missing images.\n\n"
+	printf "The default index directory is './firmware_index'.\n"
+)
+#######################################################################################################
+#                                                                                                     #
+# helper functions                                                                                    #
+#                                                                                                     #
+#######################################################################################################
+__tool()
+{
+	if [ -x "$tools_dir/$1" ]; then
+		printf "%s" "$tools_dir/$1"
+	else
+		printf "%s" "$1"
+	fi
+}
+__sha256()
+{
+	sha256sum < "$1" | sed -e "s|[ \t].*||"
+}
+#######################################################################################################
+#                                                                                                     #
+# process a single image, the result is written to the records directory                              #
+#                                                                                                     #
+#######################################################################################################
+__index_image()
+{
+	local image="$1" records="$index_dir/records" tmp size mtime hash kernel="-" offset="-" area="-"
+	local byteorder="-" version="-	-	-" dtbs="-" existing record
+
+	set -- $(stat -c "%s %Y" "$image")
+	size=$1
+	mtime=$2
+	hash="$(__sha256 "$image")"
+	record="$(mktemp "$records/record.XXXXXX")" || return 1
+
+	# a copy of a known image needs no further work
+	existing="$(awk -F '\t' -v hash="$hash" -v retry="$retry" '$1 == hash && ( $5 != "-" || retry == 0 ) { print; exit }' "$catalogue")"
+	if [ -n "$existing" ]; then
+		printf "%s\n" "$existing" | awk -F '\t' -v OFS='\t' -v size="$size" -v mtime="$mtime" -v image="$image" \
+			'{ $2 = size; $3 = mtime; $4 = image; print }' > "$record"
+		return 0
+	fi
+
+	tmp="$(mktemp -d "${TMPDIR:-/tmp}/index_firmware.XXXXXX")" || return 1
+
+	# a firmware image is a TAR file, anything else is expected to be a kernel image
+	if tar -tf "$image" ./var/tmp/kernel.image >/dev/null 2>&1; then
+		tar -xOf "$image" ./var/tmp/kernel.image > "$tmp/kernel.image" 2>/dev/null
+	else
+		cp "$image" "$tmp/kernel.image"
+	fi
+
+	# kernels, which can't be unpacked, may be unpacked already
+	if ! "$unpack" < "$tmp/kernel.image" > "$tmp/kernel" 2>/dev/null || ! [ -s "$tmp/kernel" ]; then
+		mv "$tmp/kernel.image" "$tmp/kernel"
+	fi
+
+	offset="$("$extract" -v "$tmp/kernel" 2>&1 >"$tmp/area" | sed -n -e "s|^Config area found at offset \(0x[0-9a-f]*\)\.\$|\1|p")"
+	if [ -n "$offset" ] && [ -s "$tmp/area" ]; then
+		kernel="$(__sha256 "$tmp/kernel")"
+		area="$("$store_cmd" put "$store" - < "$tmp/area" 2>/dev/null)"
+		version="$("$gen" "$tmp/area" 2>/dev/null | sed -n -e "s|^[ \t]*AVM_VERSION_INFO[ \t]*\"\([^\"]*\)\", \"\([^\"]*\)\", \"\([^\"]*\)\"\$|\1\t\2\t\3|p")"
+		[ -z "$version" ] && version="-	-	-"
+		# the report of the byte order (and the shared BLOBs) is written to STDERR
+		dtbs="$("$gen" -r -c "$store" "$tmp/area" 2>"$tmp/report" | sed -n -e "s|^device_tree_subrev_\([0-9]*\)\t\(.*\)\$|\1=\2|p" | tr "\n" "," | sed -e "s|,\$||")"
+		[ -z "$dtbs" ] && dtbs="-"
+		byteorder="$(sed -n -e "s|^.*: byte order \([a-z]*\)\$|\1|p" "$tmp/report")"
+		[ -z "$byteorder" ] && byteorder="-"
+	else
+		offset="-"
+		printf "No config area found in image '%s'.\n" "$image" 1>&2
+	fi
+
+	printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$hash" "$size" "$mtime" "$image" "$kernel" "$byteorder" "$offset" "$area" \
+		"$version" "$dtbs" > "$record"
+
+	rm -rf "$tmp"
+	return 0
+}
+#######################################################################################################
+#                                                                                                     #
+# add new and changed images to the catalogue                                                         #
+#                                                                                                     #
+#######################################################################################################
+__update()
+{
+	local queue="$index_dir/queue" records="$index_dir/records" rc=0 arg
+
+	if ! mkdir "$index_dir/lock" 2>/dev/null; then
+		printf "Another update of index '%s' is running, remove '%s' if it was aborted.\n" "$index_dir" "$index_dir/lock" 1>&2
+		return 1
+	fi
+	trap "rm -rf \"$index_dir/lock\" \"$queue\" \"$records\" 2>/dev/null" EXIT HUP INT TERM
+	mkdir -p "$records"
+
+	# the catalogue is joined with the current size and modification time of each file - unchanged ones
+	# are skipped without reading them
+	for arg in "$@"; do
+		if [ -d "$arg" ]; then
+			find "$arg" -type f -name "*.image"
+		else
+			printf "%s\n" "$arg"
+		fi
+	done | while IFS= read -r arg; do
+		[ -f "$arg" ] || continue
+		printf "%s\t%s\t%s\n" "$(readlink -f "$arg")" $(stat -c "%s %Y" "$arg")
+	done | awk -F '\t' -v retry="$retry" -v catalogue="$catalogue" '
+		FILENAME == catalogue { if ($5 != "-" || retry == 0) known[$4 "\t" $2 "\t" $3] = 1; next }
+		!(($1 "\t" $2 "\t" $3) in known) { print $1 }' "$catalogue" - | sort -u > "$queue"
+
+	printf "%u image(s) to process with %u job(s).\n" "$(wc -l < "$queue")" "$jobs" 1>&2
+
+	if [ -s "$queue" ]; then
+		export YF_INDEX_WORKER=1 YF_INDEX_DIRECTORY="$index_dir" YF_INDEX_RETRY="$retry"
+		tr "\n" "\0" < "$queue" | xargs -0 -n 1 -P "$jobs" sh "$0" || rc=1
+		unset YF_INDEX_WORKER
+	fi
+
+	# new records replace the entries with the same path, the catalogue is replaced atomically
+	if [ -n "$(ls "$records")" ]; then
+		cat "$records"/* | awk -F '\t' '
+			NR == FNR { path[$4] = 1; print; next }
+			!($4 in path) { print }' - "$catalogue" | sort -t "	" -k 4 > "$catalogue.$$"
+		mv "$catalogue.$$" "$catalogue"
+	fi
+
+	return $rc
+}
+#######################################################################################################
+#                                                                                                     #
+# queries                                                                                             #
+#                                                                                                     #
+#######################################################################################################
+__query()
+{
+	local type="$1" value="$2"
+
+	case "$type" in
+		(dtb)
+			# a file is put into the store to get its reference
+			[ -f "$value" ] && value="$("$store_cmd" put "$store" - < "$value" 2>/dev/null)"
+			awk -F '\t' -v ref="$value" '
+				{ n = split($12, dtbs, ","); for (i = 1; i <= n; i++) if (substr(dtbs[i], index(dtbs[i], "=") + 1) == ref) { print; next } }' "$catalogue"
+			;;
+		(kernel)
+			awk -F '\t' -v hash="$value" '$5 == hash' "$catalogue"
+			;;
+		(version)
+			awk -F '\t' -v text="$value" 'index($9, text) || index($11, text)' "$catalogue"
+			;;
+		(*)
+			usage 1>&2
+			return 1
+			;;
+	esac
+}
+#######################################################################################################
+#                                                                                                     #
+# main                                                                                                #
+#                                                                                                     #
+#######################################################################################################
+tools_dir="${0%/*}"
+[ "$tools_dir" = "$0" ] && tools_dir="."
+unpack="$tools_dir/unpack_kernel.sh"
+extract="$(__tool extract_avm_kernel_config)"
+gen="$(__tool gen_avm_kernel_config)"
+store_cmd="$(__tool content_store)"
+#######################################################################################################
+#                                                                                                     #
+# called as worker from 'xargs'                                                                       #
+#                                                                                                     #
+#######################################################################################################
+if [ -n "$YF_INDEX_WORKER" ]; then
+	index_dir="$YF_INDEX_DIRECTORY"
+	catalogue="$index_dir/catalogue"
+	store="$index_dir/store"
+	retry="$YF_INDEX_RETRY"
+	__index_image "$1"
+	exit $?
+fi
+
+index_dir="./firmware_index"
+jobs="$(nproc 2>/dev/null || printf "1")"
+retry=0
+
+while [ -n "$1" ]; do
+	case "$1" in
+		(-d)
+			index_dir="$2"
+			shift 2
+			;;
+		(-j)
+			jobs="$2"
+			shift 2
+			;;
+		(-r)
+			retry=1
+			shift
+			;;
+		(*)
+			break
+			;;
+	esac
+done
+
+if [ -z "$1" ] || [ -z "$index_dir" ]; then
+	usage 1>&2
+	exit 1
+fi
+
+for cmd in sha256sum awk sed tar xargs stat readlink mktemp od dd; do
+	if ! command -v $cmd >/dev/null 2>&1; then
+		printf "Missing '%s' command, needed for this script.\a\n" "$cmd" 1>&2
+		exit 1
+	fi
+done
+
+catalogue="$index_dir/catalogue"
+store="$index_dir/store"
+mkdir -p "$store" || exit 1
+[ -f "$catalogue" ] || : > "$catalogue"
+
+command="$1"
+shift
+
+case "$command" in
+	(update)
+		[ -z "$1" ] && usage 1>&2 && exit 1
+		__update "$@"
+		;;
+	(query)
+		__query "$@"
+		;;
+	(list)
+		cat "$catalogue"
+		;;
+	(prune)
+		while IFS= read -r line; do
+			[ -f "$(printf "%s\n" "$line" | cut -f 4)" ] && printf "%s\n" "$line"
+		done < "$catalogue" > "$catalogue.$$"
+		mv "$catalogue.$$" "$catalogue"
+		;;
+	(*)
+		usage 1>&2
+		exit 1
+		;;
+esac
+#######################################################################################################
+#                                                                                                     #
+# end of script                                                                                       #
+#                                                                                                     #
+#######################################################################################################
+exit $?
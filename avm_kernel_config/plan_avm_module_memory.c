@@ -0,0 +1,470 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+#include "avm_kernel_config_helpers.h"
+#include "statistics_helpers.h"
+#include <string.h>
+#include <dirent.h>
+#include <limits.h>
+#include <elf.h>
+
+#define MODULE_NAME_SIZE		64
+#define DEFAULT_HEADROOM		10
+#define DEFAULT_ALIGNMENT		4096
+
+#define ALIGN(value, alignment)	(((value) + (alignment) - 1) / (alignment) * (alignment))
+
+void usage()
+{
+	fprintf(stderr, "plan_avm_module_memory - compute module memory reservations from module files\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "plan_avm_module_memory [ -r <headroom_percent> ] [ -a <alignment> ] [ -c ]\n");
+	fprintf(stderr, "                       [ -s <binary_config_area_file> ] [ --stats[=<file>] ]\n");
+	fprintf(stderr, "                       <root_filesystem_directory>\n");
+	fprintf(stderr, "\nAll kernel modules (*.ko) below the specified directory are read and");
+	fprintf(stderr, "\nthe memory needed for their core and init sections is computed the");
+	fprintf(stderr, "\nsame way as the kernel lays them out while loading a module (with the");
+	fprintf(stderr, "\nalignment of each section and the symbol table for kallsyms).\n");
+	fprintf(stderr, "\nThe reservation for each module is the sum of both parts (only the core");
+	fprintf(stderr, "\npart with -c) plus a headroom (default: %u percent), aligned to the", DEFAULT_HEADROOM);
+	fprintf(stderr, "\nspecified value (default: %u bytes).\n", DEFAULT_ALIGNMENT);
+	fprintf(stderr, "\nIf a config area dump is specified with -s, only the modules from its");
+	fprintf(stderr, "\nmodule memory list are planned (in the same order, modules without a");
+	fprintf(stderr, "\nfile keep their size) and the reclaimed memory is shown.\n");
+	fprintf(stderr, "\nThe AVM_MODULE_MEMORY entries are written to STDOUT (as a replacement");
+	fprintf(stderr, "\nfor the list from 'gen_avm_kernel_config'), a summary goes to STDERR.\n");
+	fprintf(stderr, "\nWith --stats (or if %s is set), timings, page faults", STATISTICS_ENVIRONMENT);
+	fprintf(stderr, "\nand counters of this run are written as a JSON line to STDERR");
+	fprintf(stderr, "\n(or appended to the specified file).\n");
+}
+
+struct moduleFootprint
+{
+	char				name[MODULE_NAME_SIZE];
+	uint32_t			coreSize;
+	uint32_t			initSize;
+};
+
+struct moduleList
+{
+	struct moduleFootprint *	modules;
+	size_t				count;
+	size_t				allocated;
+};
+
+// module files are ELF32 relocatable objects for MIPS or ARM, in any byte order
+struct elfFile
+{
+	const uint8_t *		data;
+	size_t				size;
+	bool				swap;
+	uint32_t			sectionOffset;
+	uint32_t			sectionCount;
+	uint32_t			sectionEntrySize;
+	uint32_t			sectionNames;
+};
+
+uint32_t elfWord(const struct elfFile *elf, const void *ptr)
+{
+	uint32_t			value;
+
+	memcpy(&value, ptr, sizeof(value));
+	swapEndianess(elf->swap, &value);
+
+	return value;
+}
+
+uint16_t elfHalf(const struct elfFile *elf, const void *ptr)
+{
+	uint16_t			value;
+
+	memcpy(&value, ptr, sizeof(value));
+
+	return (elf->swap ? (uint16_t) ((value >> 8) | (value << 8)) : value);
+}
+
+const Elf32_Shdr * elfSection(const struct elfFile *elf, uint32_t index)
+{
+	return (const Elf32_Shdr *) (elf->data + elf->sectionOffset + index * elf->sectionEntrySize);
+}
+
+const char * elfSectionName(const struct elfFile *elf, const Elf32_Shdr *section)
+{
+	uint32_t			offset = elfWord(elf, &elfSection(elf, elf->sectionNames)->sh_offset) + elfWord(elf, &section->sh_name);
+
+	return (offset < elf->size ? (const char *) elf->data + offset : "");
+}
+
+// 'layout_sections' in 'kernel/module.c' places the allocated sections in this order: code, read-only
+// data, writable data and anything else - each one aligned on its own, sections with a name starting
+// with '.init' are put into the init part, which is freed after the module was initialized; the loader
+// clears SHF_ALLOC for '.modinfo' and '__versions' before
+uint32_t layoutSections(const struct elfFile *elf, bool init, bool *placed)
+{
+	static const uint32_t	masks[][2] = {
+		{ SHF_EXECINSTR | SHF_ALLOC, 0 },
+		{ SHF_ALLOC, SHF_WRITE },
+		{ SHF_WRITE | SHF_ALLOC, 0 },
+		{ SHF_ALLOC, 0 }
+	};
+	uint32_t			size = 0;
+	uint32_t			m;
+	uint32_t			i;
+
+	for (m = 0; m < sizeof(masks) / sizeof(masks[0]); m++)
+	{
+		for (i = 1; i < elf->sectionCount; i++)
+		{
+			const Elf32_Shdr *	section = elfSection(elf, i);
+			uint32_t			flags = elfWord(elf, &section->sh_flags);
+			uint32_t			alignment = elfWord(elf, &section->sh_addralign);
+			const char *		name = elfSectionName(elf, section);
+
+			if (placed[i] || (flags & masks[m][0]) != masks[m][0] || (flags & masks[m][1]) != 0) continue;
+			if (strcmp(name, ".modinfo") == 0 || strcmp(name, "__versions") == 0) continue;
+			if ((strncmp(name, ".init", 5) == 0) != init) continue;
+
+			size = ALIGN(size, (alignment ? alignment : 1)) + elfWord(elf, &section->sh_size);
+			placed[i] = true;
+		}
+	}
+
+	return size;
+}
+
+// 'layout_symtab' keeps the symbols from the core sections (and their names) for kallsyms in the core
+// part, the whole symbol table is needed in the init part while loading
+void layoutSymbols(const struct elfFile *elf, const bool *core, uint32_t *coreSize, uint32_t *initSize)
+{
+	uint32_t			i;
+
+	for (i = 1; i < elf->sectionCount; i++)
+	{
+		const Elf32_Shdr *	section = elfSection(elf, i);
+		const Elf32_Shdr *	strings;
+		const Elf32_Sym *	symbols;
+		const char *		names;
+		uint32_t			count;
+		uint32_t			alignment;
+		uint32_t			coreSymbols = 1;
+		uint32_t			coreStrings = 1;
+		uint32_t			j;
+
+		if (elfWord(elf, &section->sh_type) != SHT_SYMTAB) continue;
+		if (elfWord(elf, &section->sh_link) >= elf->sectionCount) break;
+
+		strings = elfSection(elf, elfWord(elf, &section->sh_link));
+		count = elfWord(elf, &section->sh_size) / sizeof(Elf32_Sym);
+		alignment = elfWord(elf, &section->sh_addralign);
+		symbols = (const Elf32_Sym *) (elf->data + elfWord(elf, &section->sh_offset));
+		names = (const char *) elf->data + elfWord(elf, &strings->sh_offset);
+
+		if ((uint64_t) elfWord(elf, &section->sh_offset) + elfWord(elf, &section->sh_size) > elf->size) break;
+		if ((uint64_t) elfWord(elf, &strings->sh_offset) + elfWord(elf, &strings->sh_size) > elf->size) break;
+
+		// the first entry is the empty symbol, it's always copied
+		for (j = 1; j < count; j++)
+		{
+			uint16_t	index = elfHalf(elf, &symbols[j].st_shndx);
+			uint32_t	name = elfWord(elf, &symbols[j].st_name);
+
+			if (index == SHN_UNDEF || index >= elf->sectionCount || name == 0 || name >= elfWord(elf, &strings->sh_size) || !core[index]) continue;
+			coreSymbols++;
+			coreStrings += strnlen(names + name, elfWord(elf, &strings->sh_size) - name) + 1;
+		}
+
+		*coreSize = ALIGN(*coreSize, (alignment ? alignment : 1)) + coreSymbols * sizeof(Elf32_Sym) + coreStrings;
+		*initSize = ALIGN(*initSize, (alignment ? alignment : 1)) + elfWord(elf, &section->sh_size) + elfWord(elf, &strings->sh_size);
+		break;
+	}
+}
+
+bool readModuleFootprint(const char *fileName, struct moduleFootprint *module)
+{
+	struct memoryMappedFile	file;
+	struct elfFile		elf;
+	const Elf32_Ehdr *	header;
+	bool *				core = NULL;
+	bool *				init = NULL;
+	bool				result = false;
+
+	if (!openMemoryMappedFile(&file, fileName, "module", O_RDONLY, PROT_READ, MAP_SHARED, MAPPING_WILLNEED)) return false;
+
+	elf.data = (const uint8_t *) file.fileBuffer;
+	elf.size = file.fileStat.st_size;
+	header = (const Elf32_Ehdr *) elf.data;
+
+	if (elf.size < sizeof(Elf32_Ehdr) || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS32)
+	{
+		fprintf(stderr, "File '%s' isn't an ELF32 object file, ignored.\n", fileName);
+	}
+	else
+	{
+		elf.swap = (header->e_ident[EI_DATA] == ELFDATA2MSB) != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+		elf.sectionOffset = elfWord(&elf, &header->e_shoff);
+		elf.sectionCount = elfHalf(&elf, &header->e_shnum);
+		elf.sectionEntrySize = elfHalf(&elf, &header->e_shentsize);
+		elf.sectionNames = elfHalf(&elf, &header->e_shstrndx);
+
+		if (elfHalf(&elf, &header->e_type) != ET_REL || elf.sectionEntrySize < sizeof(Elf32_Shdr) || elf.sectionNames >= elf.sectionCount || elf.sectionOffset + (uint64_t) elf.sectionCount * elf.sectionEntrySize > elf.size)
+		{
+			fprintf(stderr, "File '%s' isn't a valid kernel module, ignored.\n", fileName);
+		}
+		else if ((core = calloc(elf.sectionCount, sizeof(bool))) == NULL || (init = calloc(elf.sectionCount, sizeof(bool))) == NULL)
+		{
+			fprintf(stderr, "Error allocating memory for sections of '%s'.\n", fileName);
+		}
+		else
+		{
+			module->coreSize = layoutSections(&elf, false, core);
+			module->initSize = layoutSections(&elf, true, init);
+			layoutSymbols(&elf, core, &module->coreSize, &module->initSize);
+			statisticsAdd("moduleSections", elf.sectionCount);
+			result = true;
+		}
+	}
+
+	free(core);
+	free(init);
+	closeMemoryMappedFile(&file);
+
+	return result;
+}
+
+// the kernel uses the module name with dashes replaced by underscores
+void moduleName(const char *fileName, char *name)
+{
+	size_t				length = strlen(fileName) - 3;
+	size_t				i;
+
+	if (length >= MODULE_NAME_SIZE) length = MODULE_NAME_SIZE - 1;
+	for (i = 0; i < length; i++) name[i] = (fileName[i] == '-' ? '_' : fileName[i]);
+	name[length] = 0;
+}
+
+struct moduleFootprint * findModule(struct moduleList *list, const char *name)
+{
+	char				normalized[MODULE_NAME_SIZE];
+	size_t				i;
+
+	for (i = 0; i < MODULE_NAME_SIZE - 1 && name[i]; i++) normalized[i] = (name[i] == '-' ? '_' : name[i]);
+	normalized[i] = 0;
+
+	for (i = 0; i < list->count; i++)
+	{
+		if (strcmp(list->modules[i].name, normalized) == 0) return &list->modules[i];
+	}
+
+	return NULL;
+}
+
+bool scanModules(struct moduleList *list, const char *path)
+{
+	DIR *				dir;
+	struct dirent *		dirEntry;
+	bool				success = true;
+
+	if ((dir = opendir(path)) == NULL)
+	{
+		fprintf(stderr, "Error %d opening directory '%s'.\n", errno, path);
+		return false;
+	}
+
+	while (success && (dirEntry = readdir(dir)) != NULL)
+	{
+		char			fullName[PATH_MAX];
+		struct stat		st;
+		size_t			length = strlen(dirEntry->d_name);
+
+		if (strcmp(dirEntry->d_name, ".") == 0 || strcmp(dirEntry->d_name, "..") == 0) continue;
+		if (snprintf(fullName, sizeof(fullName), "%s/%s", path, dirEntry->d_name) >= (int) sizeof(fullName)) continue;
+		if (lstat(fullName, &st) != 0) continue;
+
+		// symbolic links are skipped, they would point to absolute paths on the box
+		if (S_ISDIR(st.st_mode))
+		{
+			success = scanModules(list, fullName);
+			continue;
+		}
+
+		if (!S_ISREG(st.st_mode) || length <= 3 || strcmp(dirEntry->d_name + length - 3, ".ko") != 0) continue;
+
+		if (list->count == list->allocated)
+		{
+			list->allocated = (list->allocated ? list->allocated * 2 : 64);
+			if ((list->modules = realloc(list->modules, list->allocated * sizeof(struct moduleFootprint))) == NULL)
+			{
+				fprintf(stderr, "Error allocating memory for module list.\n");
+				success = false;
+				break;
+			}
+		}
+
+		moduleName(dirEntry->d_name, list->modules[list->count].name);
+		// the same module may exist in more than one directory, the first one wins
+		if (findModule(list, list->modules[list->count].name) != NULL) continue;
+		if (readModuleFootprint(fullName, &list->modules[list->count]))
+		{
+			list->count++;
+			statisticsAdd("modules", 1);
+		}
+	}
+	closedir(dir);
+
+	return success;
+}
+
+int compareModules(const void *a, const void *b)
+{
+	return strcmp(((const struct moduleFootprint *) a)->name, ((const struct moduleFootprint *) b)->name);
+}
+
+uint32_t plannedSize(const struct moduleFootprint *module, bool coreOnly, uint32_t headroom, uint32_t alignment)
+{
+	uint64_t			size = module->coreSize + (coreOnly ? 0 : module->initSize);
+
+	size = size * (100 + headroom) / 100;
+
+	return (uint32_t) ALIGN(size, alignment);
+}
+
+void planModule(const char *name, uint32_t size, int number)
+{
+	fprintf(stdout, "\tAVM_MODULE_MEMORY\t%u, \"%s\", %u\n", number, name, size);
+}
+
+int main(int argc, char * argv[])
+{
+	struct moduleList		list = { NULL, 0, 0 };
+	struct memoryMappedFile	input;
+	struct _kernel_modulmemory_config *	reserved = NULL;
+	const char *			areaFile = NULL;
+	uint32_t				headroom = DEFAULT_HEADROOM;
+	uint32_t				alignment = DEFAULT_ALIGNMENT;
+	bool					coreOnly = false;
+	uint64_t				totalReserved = 0;
+	uint64_t				totalPlanned = 0;
+	int						number = 0;
+	int						i = 1;
+
+	initStatistics("plan_avm_module_memory", &argc, argv);
+
+	while (argc > i + 1 && argv[i][0] == '-')
+	{
+		if (strcmp(argv[i], "-c") == 0)
+		{
+			coreOnly = true;
+			i++;
+			continue;
+		}
+		if (argc <= i + 2) break;
+		if (strcmp(argv[i], "-r") == 0) headroom = strtoul(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "-a") == 0) alignment = strtoul(argv[i + 1], NULL, 0);
+		else if (strcmp(argv[i], "-s") == 0) areaFile = argv[i + 1];
+		else break;
+		i += 2;
+	}
+
+	if (argc != i + 1 || alignment == 0)
+	{
+		usage();
+		exit(1);
+	}
+
+	statisticsStartPhase("scan");
+	if (!scanModules(&list, argv[i])) exit(1);
+	qsort(list.modules, list.count, sizeof(struct moduleFootprint), compareModules);
+
+	if (areaFile != NULL)
+	{
+		struct _avm_kernel_config **	configArea;
+		struct _avm_kernel_config *	entry;
+
+		statisticsStartPhase("relocate");
+		if (!openMemoryMappedFile(&input, areaFile, "config area", O_RDONLY, PROT_READ | PROT_WRITE, MAP_PRIVATE, MAPPING_WILLNEED | MAPPING_POPULATE)) exit(1);
+
+		configArea = (struct _avm_kernel_config **) input.fileBuffer;
+		if (!relocateConfigArea(configArea, input.fileStat.st_size))
+		{
+			fprintf(stderr, "Unable to identify and relocate the specified config area dump file, may be it's empty.\n");
+			exit(1);
+		}
+
+		for (entry = *configArea; entry->tag <= avm_kernel_config_tags_last && entry->config != NULL; entry++)
+		{
+			if ((int) entry->tag == avm_kernel_config_tags_modulememory) reserved = (struct _kernel_modulmemory_config *) entry->config;
+		}
+
+		if (reserved == NULL) fprintf(stderr, "The config area from '%s' doesn't contain a module memory list.\n", areaFile);
+	}
+
+	statisticsStartPhase("output");
+	fprintf(stdout, "\n.L_avm_module_memory:\n");
+	fprintf(stderr, "%-24s %10s %10s %10s %10s %10s\n", "module", "reserved", "core", "init", "planned", "reclaimed");
+
+	if (reserved != NULL)
+	{
+		// the list from the config area defines, which modules get a reservation
+		for (; reserved->name != NULL; reserved++)
+		{
+			struct moduleFootprint *	module = findModule(&list, reserved->name);
+			uint32_t					size = reserved->size;
+
+			if (module == NULL) fprintf(stderr, "%-24s %10u %10s %10s %10u %10d (no module file found)\n", reserved->name, reserved->size, "-", "-", size, 0);
+			else
+			{
+				size = plannedSize(module, coreOnly, headroom, alignment);
+				fprintf(stderr, "%-24s %10u %10u %10u %10u %10" PRId64 "\n", reserved->name, reserved->size, module->coreSize, module->initSize, size, (int64_t) reserved->size - size);
+			}
+
+			planModule(reserved->name, size, ++number);
+			totalReserved += reserved->size;
+			totalPlanned += size;
+		}
+	}
+	else
+	{
+		for (size_t j = 0; j < list.count; j++)
+		{
+			struct moduleFootprint *	module = &list.modules[j];
+			uint32_t					size = plannedSize(module, coreOnly, headroom, alignment);
+
+			fprintf(stderr, "%-24s %10s %10u %10u %10u %10s\n", module->name, "-", module->coreSize, module->initSize, size, "-");
+			planModule(module->name, size, ++number);
+			totalPlanned += size;
+		}
+	}
+
+	fprintf(stdout, "\tAVM_MODULE_MEMORY\t0\n");
+
+	fprintf(stderr, "\n%d modules, %" PRIu64 " bytes planned (headroom %u%%, alignment %u)", number, totalPlanned, headroom, alignment);
+	if (areaFile != NULL) fprintf(stderr, ", %" PRIu64 " bytes reserved in '%s', %" PRId64 " bytes reclaimed", totalReserved, areaFile, (int64_t) totalReserved - (int64_t) totalPlanned);
+	fprintf(stderr, "\n");
+
+	if (areaFile != NULL) closeMemoryMappedFile(&input);
+	free(list.modules);
+
+	exit(0);
+}
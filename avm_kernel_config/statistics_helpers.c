@@ -0,0 +1,264 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+#include "statistics_helpers.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// a point in time with the resource usage of the process, phases and the whole run are measured
+// as the difference of two samples
+struct statisticsSample
+{
+	struct timespec		wall;
+	struct rusage		usage;
+};
+
+struct statisticsPhase
+{
+	const char *		name;
+	double				wall;
+	double				user;
+	double				system;
+	long				minorFaults;
+	long				majorFaults;
+};
+
+struct statisticsCounter
+{
+	const char *		name;
+	uint64_t			value;
+};
+
+// the tools are single-threaded, so there's no locking here
+static struct
+{
+	bool				enabled;
+	const char *		toolName;
+	const char *		output;			// NULL for STDERR
+	struct statisticsSample	start;
+	struct statisticsSample	phaseStart;
+	struct statisticsPhase	phases[STATISTICS_MAX_PHASES];
+	int					phaseCount;
+	bool				phaseOpen;
+	struct statisticsCounter	counters[STATISTICS_MAX_COUNTERS];
+	int					counterCount;
+} statistics;
+
+static void takeSample(struct statisticsSample *sample)
+{
+	clock_gettime(CLOCK_MONOTONIC, &sample->wall);
+	getrusage(RUSAGE_SELF, &sample->usage);
+}
+
+static double seconds(const struct timeval *from, const struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) + (to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+static void sampleDifference(const struct statisticsSample *from, const struct statisticsSample *to, struct statisticsPhase *phase)
+{
+	phase->wall = (to->wall.tv_sec - from->wall.tv_sec) + (to->wall.tv_nsec - from->wall.tv_nsec) / 1000000000.0;
+	phase->user = seconds(&from->usage.ru_utime, &to->usage.ru_utime);
+	phase->system = seconds(&from->usage.ru_stime, &to->usage.ru_stime);
+	phase->minorFaults = to->usage.ru_minflt - from->usage.ru_minflt;
+	phase->majorFaults = to->usage.ru_majflt - from->usage.ru_majflt;
+}
+
+// the kernel counts all bytes read and written by the process, '/proc' may be missing on some systems
+static bool readIoCounters(uint64_t *readBytes, uint64_t *writtenBytes)
+{
+	FILE *				io;
+	char				line[128];
+	int					found = 0;
+
+	if ((io = fopen("/proc/self/io", "r")) == NULL) return false;
+
+	while (fgets(line, sizeof(line), io) != NULL)
+	{
+		if (sscanf(line, "rchar: %" SCNu64, readBytes) == 1) found++;
+		else if (sscanf(line, "wchar: %" SCNu64, writtenBytes) == 1) found++;
+	}
+
+	fclose(io);
+
+	return (found == 2);
+}
+
+#define APPEND(...)		if (used < sizeof(line)) used += snprintf(line + used, sizeof(line) - used, __VA_ARGS__)
+
+static void writeStatistics(void)
+{
+	struct statisticsSample	end;
+	struct statisticsPhase	total;
+	char				line[4096];
+	size_t				used = 0;
+	uint64_t			readBytes;
+	uint64_t			writtenBytes;
+	int					fd = 2;
+	int					i;
+
+	if (!statistics.enabled) return;
+
+	// buffered output has to be counted, it would be written after this exit handler otherwise
+	fflush(stdout);
+	if (statistics.phaseOpen) statisticsEndPhase();
+
+	takeSample(&end);
+	sampleDifference(&statistics.start, &end, &total);
+
+	APPEND("{\"tool\":\"%s\",\"pid\":%d,\"time\":%ld", statistics.toolName, (int) getpid(), (long) time(NULL));
+	APPEND(",\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f", total.wall, total.user, total.system);
+	APPEND(",\"minflt\":%ld,\"majflt\":%ld,\"maxrss\":%ld", total.minorFaults, total.majorFaults, end.usage.ru_maxrss);
+	if (readIoCounters(&readBytes, &writtenBytes)) APPEND(",\"bytesRead\":%" PRIu64 ",\"bytesWritten\":%" PRIu64, readBytes, writtenBytes);
+
+	APPEND(",\"phases\":[");
+	for (i = 0; i < statistics.phaseCount; i++)
+	{
+		const struct statisticsPhase *	phase = &statistics.phases[i];
+
+		APPEND("%s{\"name\":\"%s\",\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"minflt\":%ld,\"majflt\":%ld}", (i ? "," : ""), phase->name, phase->wall, phase->user, phase->system, phase->minorFaults, phase->majorFaults);
+	}
+
+	APPEND("],\"counters\":{");
+	for (i = 0; i < statistics.counterCount; i++)
+	{
+		APPEND("%s\"%s\":%" PRIu64, (i ? "," : ""), statistics.counters[i].name, statistics.counters[i].value);
+	}
+	APPEND("}}\n");
+
+	if (used >= sizeof(line))
+	{
+		fprintf(stderr, "Statistics of '%s' are too large to be written.\n", statistics.toolName);
+		return;
+	}
+
+	// a single write to a file opened with O_APPEND keeps lines from concurrent runs intact
+	if (statistics.output != NULL && (fd = open(statistics.output, O_WRONLY | O_APPEND | O_CREAT, 0644)) == -1)
+	{
+		fprintf(stderr, "Error %d opening statistics file '%s'.\n", errno, statistics.output);
+		return;
+	}
+
+	if (write(fd, line, used) != (ssize_t) used) fprintf(stderr, "Error %d writing statistics.\n", errno);
+	if (fd != 2) close(fd);
+}
+
+#undef APPEND
+
+// statistics are enabled with the '--stats' option (anywhere on the command line, it's removed from
+// 'argv' here), '--stats=<file>' appends them to a file instead of writing them to STDERR
+void initStatistics(const char *toolName, int *argc, char *argv[])
+{
+	const char *		environment = getenv(STATISTICS_ENVIRONMENT);
+	int					i;
+	int					j;
+
+	statistics.toolName = toolName;
+	if (*argc < 1) return;
+
+	if (environment != NULL && *environment)
+	{
+		statistics.enabled = true;
+		statistics.output = (strcmp(environment, "stderr") == 0 || strcmp(environment, "1") == 0) ? NULL : environment;
+	}
+
+	for (i = 1, j = 1; i < *argc; i++)
+	{
+		if (strcmp(argv[i], STATISTICS_OPTION) == 0)
+		{
+			statistics.enabled = true;
+			statistics.output = NULL;
+		}
+		else if (strncmp(argv[i], STATISTICS_OPTION "=", sizeof(STATISTICS_OPTION)) == 0)
+		{
+			statistics.enabled = true;
+			statistics.output = argv[i] + sizeof(STATISTICS_OPTION);
+		}
+		else argv[j++] = argv[i];
+	}
+	argv[j] = NULL;
+	*argc = j;
+
+	if (!statistics.enabled) return;
+
+	takeSample(&statistics.start);
+	atexit(writeStatistics);
+}
+
+bool statisticsEnabled(void)
+{
+	return statistics.enabled;
+}
+
+// a new phase ends the previous one, so the phases of a tool may simply be started one after another
+void statisticsStartPhase(const char *name)
+{
+	if (!statistics.enabled) return;
+	if (statistics.phaseOpen) statisticsEndPhase();
+	if (statistics.phaseCount >= STATISTICS_MAX_PHASES) return;
+
+	statistics.phases[statistics.phaseCount].name = name;
+	statistics.phaseOpen = true;
+	takeSample(&statistics.phaseStart);
+}
+
+void statisticsEndPhase(void)
+{
+	struct statisticsSample	now;
+
+	if (!statistics.enabled || !statistics.phaseOpen) return;
+
+	takeSample(&now);
+	sampleDifference(&statistics.phaseStart, &now, &statistics.phases[statistics.phaseCount]);
+	statistics.phaseCount++;
+	statistics.phaseOpen = false;
+}
+
+// counters are identified by their name (a string constant), values are summed up
+void statisticsAdd(const char *name, uint64_t value)
+{
+	int					i;
+
+	if (!statistics.enabled) return;
+
+	for (i = 0; i < statistics.counterCount; i++)
+	{
+		if (strcmp(statistics.counters[i].name, name) == 0)
+		{
+			statistics.counters[i].value += value;
+			return;
+		}
+	}
+
+	if (statistics.counterCount >= STATISTICS_MAX_COUNTERS) return;
+	statistics.counters[statistics.counterCount].name = name;
+	statistics.counters[statistics.counterCount].value = value;
+	statistics.counterCount++;
+}
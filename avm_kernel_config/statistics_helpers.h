@@ -0,0 +1,22 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef STATISTICS_HELPERS_H
+#define STATISTICS_HELPERS_H
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+// the environment variable enables statistics without any change to the command line, its value is
+// 'stderr' (or '1') or the name of a file, where the JSON line will be appended
+#define STATISTICS_ENVIRONMENT		"YF_TOOL_STATISTICS"
+#define STATISTICS_OPTION			"--stats"
+#define STATISTICS_MAX_PHASES		16
+#define STATISTICS_MAX_COUNTERS		32
+
+void initStatistics(const char *toolName, int *argc, char *argv[]);
+bool statisticsEnabled(void);
+void statisticsStartPhase(const char *name);
+void statisticsEndPhase(void);
+void statisticsAdd(const char *name, uint64_t value);
+
+#endif
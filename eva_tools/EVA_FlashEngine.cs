@@ -0,0 +1,1010 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Net;
+using System.Net.Sockets;
+using System.Text;
+using System.Text.RegularExpressions;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace YourFritz.EVA
+{
+    public class EVAFlashEngineException : Exception
+    {
+        internal EVAFlashEngineException()
+        {
+        }
+
+        internal EVAFlashEngineException(string message) : base(message)
+        {
+        }
+
+        internal EVAFlashEngineException(string message, Exception inner) : base(message, inner)
+        {
+        }
+    }
+
+    // a single image to be written with "STOR", the target is the partition name (e.g. "mtd1")
+    public class EVAFlashImage
+    {
+        private string p_FileName;
+        private string p_Target;
+        private EVAMediaType p_MediaType;
+
+        public EVAFlashImage(string FileName, string Target) :
+            this(FileName, Target, EVAMediaType.Flash)
+        {
+        }
+
+        public EVAFlashImage(string FileName, string Target, EVAMediaType MediaType)
+        {
+            this.p_FileName = FileName;
+            this.p_Target = Target;
+            this.p_MediaType = MediaType;
+        }
+
+        public string FileName
+        {
+            get
+            {
+                return this.p_FileName;
+            }
+        }
+
+        public string Target
+        {
+            get
+            {
+                return this.p_Target;
+            }
+        }
+
+        public EVAMediaType MediaType
+        {
+            get
+            {
+                return this.p_MediaType;
+            }
+        }
+    }
+
+    public class EVAFlashResult
+    {
+        private IPAddress p_Address;
+        private long p_Bytes = 0;
+        private TimeSpan p_TransferTime = TimeSpan.Zero;
+        private TimeSpan p_TotalTime = TimeSpan.Zero;
+        private Exception p_Error = null;
+
+        internal EVAFlashResult(IPAddress Address)
+        {
+            this.p_Address = Address;
+        }
+
+        public IPAddress Address
+        {
+            get
+            {
+                return this.p_Address;
+            }
+        }
+
+        public bool Succeeded
+        {
+            get
+            {
+                return this.p_Error == null;
+            }
+        }
+
+        public Exception Error
+        {
+            get
+            {
+                return this.p_Error;
+            }
+            internal set
+            {
+                this.p_Error = value;
+            }
+        }
+
+        // payload bytes sent on data connections
+        public long Bytes
+        {
+            get
+            {
+                return this.p_Bytes;
+            }
+            internal set
+            {
+                this.p_Bytes = value;
+            }
+        }
+
+        // time between the first payload byte and the "226" answer for the last image, the
+        // flash erase/write time of the device is included here
+        public TimeSpan TransferTime
+        {
+            get
+            {
+                return this.p_TransferTime;
+            }
+            internal set
+            {
+                this.p_TransferTime = value;
+            }
+        }
+
+        // the whole session, including login and logout
+        public TimeSpan TotalTime
+        {
+            get
+            {
+                return this.p_TotalTime;
+            }
+            internal set
+            {
+                this.p_TotalTime = value;
+            }
+        }
+
+        public double Throughput
+        {
+            get
+            {
+                return (this.p_TransferTime.TotalSeconds > 0) ? this.p_Bytes / this.p_TransferTime.TotalSeconds : 0;
+            }
+        }
+    }
+
+    public class EVAFlashResults : Dictionary<IPAddress, EVAFlashResult>
+    {
+    }
+
+    public class FlashStartedEventArgs : EventArgs
+    {
+        private EVADevice p_Device;
+        private DateTime p_StartedAt = DateTime.Now;
+
+        internal FlashStartedEventArgs(EVADevice Device)
+        {
+            p_Device = Device;
+        }
+
+        public EVADevice Device
+        {
+            get
+            {
+                return p_Device;
+            }
+        }
+
+        public DateTime StartedAt
+        {
+            get
+            {
+                return p_StartedAt;
+            }
+        }
+    }
+
+    public class FlashImageCompletedEventArgs : EventArgs
+    {
+        private EVADevice p_Device;
+        private EVAFlashImage p_Image;
+        private long p_Bytes;
+        private TimeSpan p_Elapsed;
+
+        internal FlashImageCompletedEventArgs(EVADevice Device, EVAFlashImage Image, long Bytes, TimeSpan Elapsed)
+        {
+            p_Device = Device;
+            p_Image = Image;
+            p_Bytes = Bytes;
+            p_Elapsed = Elapsed;
+        }
+
+        public EVADevice Device
+        {
+            get
+            {
+                return p_Device;
+            }
+        }
+
+        public EVAFlashImage Image
+        {
+            get
+            {
+                return p_Image;
+            }
+        }
+
+        public long Bytes
+        {
+            get
+            {
+                return p_Bytes;
+            }
+        }
+
+        public TimeSpan Elapsed
+        {
+            get
+            {
+                return p_Elapsed;
+            }
+        }
+    }
+
+    public class FlashCompletedEventArgs : EventArgs
+    {
+        private EVADevice p_Device;
+        private EVAFlashResult p_Result;
+
+        internal FlashCompletedEventArgs(EVADevice Device, EVAFlashResult Result)
+        {
+            p_Device = Device;
+            p_Result = Result;
+        }
+
+        public EVADevice Device
+        {
+            get
+            {
+                return p_Device;
+            }
+        }
+
+        public EVAFlashResult Result
+        {
+            get
+            {
+                return p_Result;
+            }
+        }
+    }
+
+    // a minimal control connection to EVA's FTP server without any event or state machine
+    // overhead - commands may be sent in batches, the answers are read in the same order
+    // later, if a command does not depend on the answer to a previous one
+    public class EVASession : IDisposable
+    {
+        private static readonly Regex sp_MatchResponse = new Regex(@"^(?<code>\d{3})(?<delimiter>[ \t-])(?<message>.*)$", RegexOptions.Compiled);
+        private static readonly Regex sp_MatchPassive = new Regex(@"\((?<a1>\d{1,3}),(?<a2>\d{1,3}),(?<a3>\d{1,3}),(?<a4>\d{1,3}),(?<p1>\d{1,3}),(?<p2>\d{1,3})\)", RegexOptions.Compiled);
+
+        private IPAddress p_Address;
+        private TcpClient p_Control = null;
+        private NetworkStream p_Stream = null;
+        private StreamReader p_Reader = null;
+        private string p_PassiveCommand = EVACommandFactory.GetCommands()[EVACommandType.Passive_Alt].CommandValue;
+        private int p_DataBufferSize = 1024 * 1024;
+
+        public EVASession(IPAddress Address)
+        {
+            this.p_Address = Address;
+        }
+
+        public IPAddress Address
+        {
+            get
+            {
+                return this.p_Address;
+            }
+        }
+
+        public string PassiveCommand
+        {
+            get
+            {
+                return this.p_PassiveCommand;
+            }
+            set
+            {
+                this.p_PassiveCommand = value;
+            }
+        }
+
+        public int DataBufferSize
+        {
+            get
+            {
+                return this.p_DataBufferSize;
+            }
+            set
+            {
+                this.p_DataBufferSize = value;
+            }
+        }
+
+        public static string Command(EVACommandType CommandType)
+        {
+            return EVACommandFactory.GetCommands()[CommandType].CommandValue;
+        }
+
+        public static string Command(EVACommandType CommandType, string Parameter)
+        {
+            return String.Format("{0:s} {1:s}", EVASession.Command(CommandType), Parameter);
+        }
+
+        public async Task OpenAsync(int Port)
+        {
+            this.p_Control = new TcpClient
+            {
+                NoDelay = true
+            };
+            await this.p_Control.ConnectAsync(this.p_Address, Port);
+            this.p_Stream = this.p_Control.GetStream();
+            this.p_Reader = new StreamReader(this.p_Stream, Encoding.ASCII, false, 4096);
+
+            await this.ExpectAsync(220);
+        }
+
+        // all commands are sent with a single write operation
+        public async Task SendAsync(params string[] Commands)
+        {
+            StringBuilder batch = new StringBuilder();
+
+            foreach (string command in Commands)
+            {
+                batch.Append(command).Append("\r\n");
+            }
+
+            byte[] data = Encoding.ASCII.GetBytes(batch.ToString());
+            await this.p_Stream.WriteAsync(data, 0, data.Length);
+        }
+
+        public async Task<FTPResponse> ReadResponseAsync()
+        {
+            FTPResponse response = new FTPResponse();
+            int multiLineCode = -1;
+
+            while (true)
+            {
+                string line = await this.p_Reader.ReadLineAsync();
+
+                if (line == null)
+                {
+                    throw new EVAClientException(String.Format("Control connection to {0:s} closed unexpectedly.", this.p_Address.ToString()));
+                }
+
+                Match match = sp_MatchResponse.Match(line);
+
+                if (!match.Success)
+                {
+                    if (multiLineCode == -1)
+                    {
+                        throw new EVAClientException(String.Format("Unexpected answer '{0:s}' from {1:s}.", line, this.p_Address.ToString()));
+                    }
+                    response.AppendLine(line);
+                    continue;
+                }
+
+                int code = Convert.ToInt32(match.Groups["code"].Value);
+
+                if (match.Groups["delimiter"].Value.CompareTo("-") == 0)
+                {
+                    if (multiLineCode == -1)
+                    {
+                        multiLineCode = code;
+                        response.StartMultiLineResponse(line);
+                    }
+                    else
+                    {
+                        response.AppendLine(line);
+                    }
+                }
+                else if (multiLineCode == -1)
+                {
+                    response.SingleLineResponse(match.Groups["message"].Value, code);
+                    return response;
+                }
+                else if (code == multiLineCode)
+                {
+                    // keep the last line accessible with the 'Message' property
+                    response.SingleLineResponse(match.Groups["message"].Value, code);
+                    return response;
+                }
+                else
+                {
+                    response.AppendLine(line);
+                }
+            }
+        }
+
+        public async Task<FTPResponse> ExpectAsync(params int[] Codes)
+        {
+            FTPResponse response = await this.ReadResponseAsync();
+
+            foreach (int code in Codes)
+            {
+                if (response.Code == code)
+                {
+                    return response;
+                }
+            }
+
+            throw new EVAClientException(String.Format("Unexpected answer {0:d} '{1:s}' from {2:s}.", response.Code, response.Message, this.p_Address.ToString()));
+        }
+
+        // PASS is only sent, if the server asks for it - a "230" answer to USER means, we're
+        // logged in already and a password would be an unexpected command then
+        public async Task LoginAsync(string User, string Password)
+        {
+            await this.SendAsync(EVASession.Command(EVACommandType.User, User));
+
+            if ((await this.ExpectAsync(331, 230)).Code == 331)
+            {
+                await this.SendAsync(EVASession.Command(EVACommandType.Password, Password));
+                await this.ExpectAsync(230);
+            }
+
+            await this.SendAsync(EVASession.Command(EVACommandType.Type, EVADataModeFactory.GetModes()[EVADataMode.Binary].Name));
+            await this.ExpectAsync(200);
+        }
+
+        // MEDIA and the passive mode command share one round trip, the returned end point
+        // is the data connection address announced by the device
+        public async Task<IPEndPoint> PassiveAsync(EVAMediaType MediaType)
+        {
+            await this.SendAsync(
+                EVASession.Command(EVACommandType.MediaType, EVAMediaFactory.GetMedia()[MediaType].Name),
+                this.p_PassiveCommand
+            );
+
+            await this.ExpectAsync(200);
+
+            FTPResponse response = await this.ExpectAsync(227);
+            Match match = sp_MatchPassive.Match(response.Message);
+
+            if (!match.Success)
+            {
+                throw new EVAClientException(String.Format("Unable to parse passive mode answer '{0:s}' from {1:s}.", response.Message, this.p_Address.ToString()));
+            }
+
+            byte[] address = new byte[4];
+
+            address[0] = Convert.ToByte(match.Groups["a1"].Value);
+            address[1] = Convert.ToByte(match.Groups["a2"].Value);
+            address[2] = Convert.ToByte(match.Groups["a3"].Value);
+            address[3] = Convert.ToByte(match.Groups["a4"].Value);
+
+            int port = Convert.ToInt32(match.Groups["p1"].Value) * 256 + Convert.ToInt32(match.Groups["p2"].Value);
+
+            return new IPEndPoint(new IPAddress(address), port);
+        }
+
+        // the data connection is opened while "STOR" is still on its way, the payload
+        // is copied with large buffers after the device has answered with "150"
+        public async Task<long> StoreAsync(Stream Source, string Target, EVAMediaType MediaType)
+        {
+            IPEndPoint dataEndPoint = await this.PassiveAsync(MediaType);
+
+            using (TcpClient data = new TcpClient())
+            {
+                data.SendBufferSize = this.p_DataBufferSize;
+
+                Task sendStore = this.SendAsync(EVASession.Command(EVACommandType.Store, Target));
+                await data.ConnectAsync(dataEndPoint.Address, dataEndPoint.Port);
+                await sendStore;
+
+                await this.ExpectAsync(150);
+
+                long position = Source.CanSeek ? Source.Position : 0;
+
+                using (NetworkStream dataStream = data.GetStream())
+                {
+                    await Source.CopyToAsync(dataStream, this.p_DataBufferSize);
+                    data.Client.Shutdown(SocketShutdown.Send);
+                }
+
+                FTPResponse response = await this.ReadResponseAsync();
+
+                if (response.Code != 226)
+                {
+                    throw new EVAClientException(String.Format("Storing data to {0:s} on {1:s} failed: {2:d} {3:s}", Target, this.p_Address.ToString(), response.Code, response.Message));
+                }
+
+                return Source.CanSeek ? Source.Position - position : -1;
+            }
+        }
+
+        // the counterpart to StoreAsync, data is passed on to the destination while it arrives
+        public async Task<long> RetrieveAsync(string Source, EVAMediaType MediaType, Stream Destination)
+        {
+            IPEndPoint dataEndPoint = await this.PassiveAsync(MediaType);
+
+            using (TcpClient data = new TcpClient())
+            {
+                data.ReceiveBufferSize = this.p_DataBufferSize;
+
+                Task sendRetrieve = this.SendAsync(EVASession.Command(EVACommandType.Retrieve, Source));
+                await data.ConnectAsync(dataEndPoint.Address, dataEndPoint.Port);
+                await sendRetrieve;
+
+                await this.ExpectAsync(150);
+
+                long received = 0;
+
+                using (NetworkStream dataStream = data.GetStream())
+                {
+                    byte[] buffer = new byte[this.p_DataBufferSize];
+                    int read;
+
+                    while ((read = await dataStream.ReadAsync(buffer, 0, buffer.Length)) > 0)
+                    {
+                        await Destination.WriteAsync(buffer, 0, read);
+                        received += read;
+                    }
+                }
+
+                FTPResponse response = await this.ReadResponseAsync();
+
+                if (response.Code != 226)
+                {
+                    throw new EVAClientException(String.Format("Retrieving {0:s} from {1:s} failed: {2:d} {3:s}", Source, this.p_Address.ToString(), response.Code, response.Message));
+                }
+
+                return received;
+            }
+        }
+
+        public async Task QuitAsync(bool Reboot)
+        {
+            await this.SendAsync(EVASession.Command(Reboot ? EVACommandType.Reboot : EVACommandType.Quit));
+            await this.ExpectAsync(221);
+        }
+
+        public void Dispose()
+        {
+            if (this.p_Reader != null)
+            {
+                this.p_Reader.Dispose();
+                this.p_Reader = null;
+            }
+
+            if (this.p_Control != null)
+            {
+                this.p_Control.Close();
+                this.p_Control = null;
+            }
+        }
+    }
+
+    // discovers all EVA devices on a segment and flashes the same set of images to each of them,
+    // every device is handled by its own asynchronous session, so one slow device (e.g. while
+    // erasing flash blocks) does not delay the others
+    public class EVAFlashEngine
+    {
+        private IPAddress p_BroadcastAddress = IPAddress.Broadcast;
+        private List<IPAddress> p_ProbeAddresses = new List<IPAddress>();
+        private int p_DiscoveryPort = EVADefaults.EVADefaultDiscoveryPort;
+        private int p_LocalDiscoveryPort = EVADefaults.EVADefaultDiscoveryPort;
+        private int p_DiscoveryTimeout = EVADefaults.EVADiscoveryTimeout;
+        private int p_ExpectedDevices = 0;
+        private int p_FTPPort = 21;
+        private string p_User = "adam2";
+        private string p_Password = "adam2";
+        private string p_PassiveCommand = EVACommandFactory.GetCommands()[EVACommandType.Passive_Alt].CommandValue;
+        private int p_DataBufferSize = 1024 * 1024;
+        private int p_MaxConcurrency = 0;
+        private bool p_WriteBootloader = false;
+        private bool p_RebootAfterFlash = false;
+
+        public EventHandler<DiscoveryDeviceFoundEventArgs> DeviceFound;
+        public EventHandler<FlashStartedEventArgs> FlashStarted;
+        public EventHandler<FlashImageCompletedEventArgs> FlashImageCompleted;
+        public EventHandler<FlashCompletedEventArgs> FlashCompleted;
+
+        public EVAFlashEngine()
+        {
+        }
+
+        public IPAddress BroadcastAddress
+        {
+            get
+            {
+                return p_BroadcastAddress;
+            }
+            set
+            {
+                p_BroadcastAddress = value;
+            }
+        }
+
+        // additional unicast addresses for discovery requests, useful for routed setups
+        // and for local test responders
+        public List<IPAddress> ProbeAddresses
+        {
+            get
+            {
+                return p_ProbeAddresses;
+            }
+        }
+
+        public int DiscoveryPort
+        {
+            get
+            {
+                return p_DiscoveryPort;
+            }
+            set
+            {
+                p_DiscoveryPort = value;
+            }
+        }
+
+        // answers are sent to the source port of the request, so this is the port to listen on
+        public int LocalDiscoveryPort
+        {
+            get
+            {
+                return p_LocalDiscoveryPort;
+            }
+            set
+            {
+                p_LocalDiscoveryPort = value;
+            }
+        }
+
+        public int DiscoveryTimeout
+        {
+            get
+            {
+                return p_DiscoveryTimeout;
+            }
+            set
+            {
+                p_DiscoveryTimeout = value;
+            }
+        }
+
+        // discovery stops early, if this number of devices was found
+        public int ExpectedDevices
+        {
+            get
+            {
+                return p_ExpectedDevices;
+            }
+            set
+            {
+                p_ExpectedDevices = value;
+            }
+        }
+
+        public int FTPPort
+        {
+            get
+            {
+                return p_FTPPort;
+            }
+            set
+            {
+                p_FTPPort = value;
+            }
+        }
+
+        public string User
+        {
+            get
+            {
+                return p_User;
+            }
+            set
+            {
+                p_User = value;
+            }
+        }
+
+        public string Password
+        {
+            get
+            {
+                return p_Password;
+            }
+            set
+            {
+                p_Password = value;
+            }
+        }
+
+        public string PassiveCommand
+        {
+            get
+            {
+                return p_PassiveCommand;
+            }
+            set
+            {
+                p_PassiveCommand = value;
+            }
+        }
+
+        public int DataBufferSize
+        {
+            get
+            {
+                return p_DataBufferSize;
+            }
+            set
+            {
+                p_DataBufferSize = value;
+            }
+        }
+
+        // 0 means all found devices are flashed at the same time
+        public int MaxConcurrency
+        {
+            get
+            {
+                return p_MaxConcurrency;
+            }
+            set
+            {
+                p_MaxConcurrency = value;
+            }
+        }
+
+        // MTD2 is usually the boot-loader partition, see EVA-FTP-Client.ps1
+        public bool WriteBootloader
+        {
+            get
+            {
+                return p_WriteBootloader;
+            }
+            set
+            {
+                p_WriteBootloader = value;
+            }
+        }
+
+        public bool RebootAfterFlash
+        {
+            get
+            {
+                return p_RebootAfterFlash;
+            }
+            set
+            {
+                p_RebootAfterFlash = value;
+            }
+        }
+
+        // the request carries 0.0.0.0, so every device keeps its current address and answers
+        // with it - devices on a segment have to use different addresses already
+        //
+        // the found devices are keyed by their IP address: the answer contains no MAC address
+        // and the FTP sessions are opened by address too, so multiple devices with the same
+        // address (e.g. the default 192.168.178.1) can't be told apart and only the first one
+        // is returned - each device has to be connected to its own interface or segment with
+        // its own address (and a probe address) in this case
+        public async Task<EVADevices> DiscoverAsync(CancellationToken Token)
+        {
+            EVADevices foundDevices = new EVADevices();
+            byte[] request = new DiscoveryUdpPacket(new IPAddress(0)).ToBytes();
+
+            using (UdpClient socket = new UdpClient(new IPEndPoint(IPAddress.Any, p_LocalDiscoveryPort)))
+            using (CancellationTokenSource timeout = CancellationTokenSource.CreateLinkedTokenSource(Token))
+            {
+                socket.EnableBroadcast = true;
+                timeout.CancelAfter(p_DiscoveryTimeout * 1000);
+
+                Task sender = Task.Run(async () =>
+                {
+                    // the first packet is sent immediately, later the interval will grow up to 1000 ms
+                    int delay = 10;
+
+                    while (!timeout.IsCancellationRequested)
+                    {
+                        if (p_BroadcastAddress != null)
+                        {
+                            await socket.SendAsync(request, request.Length, new IPEndPoint(p_BroadcastAddress, p_DiscoveryPort));
+                        }
+
+                        foreach (IPAddress address in p_ProbeAddresses)
+                        {
+                            await socket.SendAsync(request, request.Length, new IPEndPoint(address, p_DiscoveryPort));
+                        }
+
+                        try
+                        {
+                            await Task.Delay(delay, timeout.Token);
+                        }
+                        catch (TaskCanceledException)
+                        {
+                        }
+
+                        delay = Math.Min(delay * 10, 1000);
+                    }
+                });
+
+                Task canceled = Task.Delay(Timeout.Infinite, timeout.Token);
+
+                while (!timeout.IsCancellationRequested)
+                {
+                    Task<UdpReceiveResult> receive = socket.ReceiveAsync();
+
+                    if (await Task.WhenAny(receive, canceled) != receive)
+                    {
+                        break;
+                    }
+
+                    UdpReceiveResult packet = receive.Result;
+
+                    // our own broadcast packets are received here too
+                    if (packet.Buffer.Length < 16 || !DiscoveryUdpPacket.IsAnswer(packet.Buffer))
+                    {
+                        continue;
+                    }
+
+                    EVADevice device;
+
+                    try
+                    {
+                        device = new EVADevice(packet.RemoteEndPoint, new DiscoveryUdpPacket(packet.Buffer));
+                    }
+                    catch (EVADiscoveryException)
+                    {
+                        continue;
+                    }
+
+                    if (!foundDevices.ContainsKey(device.Address))
+                    {
+                        foundDevices.Add(device.Address, device);
+                        OnDeviceFound(device);
+
+                        if (p_ExpectedDevices > 0 && foundDevices.Count >= p_ExpectedDevices)
+                        {
+                            timeout.Cancel();
+                        }
+                    }
+                }
+
+                timeout.Cancel();
+                await sender;
+            }
+
+            return foundDevices;
+        }
+
+        public async Task<EVAFlashResults> FlashAsync(EVADevices Devices, IList<EVAFlashImage> Images, CancellationToken Token)
+        {
+            foreach (EVAFlashImage image in Images)
+            {
+                if (image.Target.ToUpper().CompareTo("MTD2") == 0 && !p_WriteBootloader)
+                {
+                    throw new EVAFlashEngineException("Write access to MTD2 (boot-loader) was not enabled.");
+                }
+
+                if (!File.Exists(image.FileName))
+                {
+                    throw new EVAFlashEngineException(String.Format("Image file '{0:s}' not found.", image.FileName));
+                }
+            }
+
+            EVAFlashResults results = new EVAFlashResults();
+            List<Task<EVAFlashResult>> sessions = new List<Task<EVAFlashResult>>();
+
+            using (SemaphoreSlim slots = new SemaphoreSlim(p_MaxConcurrency > 0 ? p_MaxConcurrency : Math.Max(Devices.Count, 1)))
+            {
+                foreach (EVADevice device in Devices.Values)
+                {
+                    sessions.Add(Task.Run(async () =>
+                    {
+                        await slots.WaitAsync(Token);
+
+                        try
+                        {
+                            return await FlashDeviceAsync(device, Images, Token);
+                        }
+                        finally
+                        {
+                            slots.Release();
+                        }
+                    }));
+                }
+
+                foreach (EVAFlashResult result in await Task.WhenAll(sessions))
+                {
+                    results.Add(result.Address, result);
+                }
+            }
+
+            return results;
+        }
+
+        public async Task<EVAFlashResults> DiscoverAndFlashAsync(IList<EVAFlashImage> Images, CancellationToken Token)
+        {
+            return await FlashAsync(await DiscoverAsync(Token), Images, Token);
+        }
+
+        // errors are reported within the result, a failing device does not stop the others
+        private async Task<EVAFlashResult> FlashDeviceAsync(EVADevice Device, IList<EVAFlashImage> Images, CancellationToken Token)
+        {
+            EVAFlashResult result = new EVAFlashResult(Device.Address);
+            Stopwatch total = Stopwatch.StartNew();
+            Stopwatch transfer = new Stopwatch();
+
+            OnFlashStarted(Device);
+
+            try
+            {
+                using (EVASession session = new EVASession(Device.Address) { PassiveCommand = p_PassiveCommand, DataBufferSize = p_DataBufferSize })
+                using (Token.Register(() => session.Dispose()))
+                {
+                    await session.OpenAsync(p_FTPPort);
+                    await session.LoginAsync(p_User, p_Password);
+
+                    foreach (EVAFlashImage image in Images)
+                    {
+                        Token.ThrowIfCancellationRequested();
+
+                        using (FileStream source = new FileStream(image.FileName, FileMode.Open, FileAccess.Read, FileShare.Read, p_DataBufferSize, true))
+                        {
+                            TimeSpan started = transfer.Elapsed;
+
+                            transfer.Start();
+                            long written = await session.StoreAsync(source, image.Target, image.MediaType);
+                            transfer.Stop();
+
+                            result.Bytes += written;
+                            OnFlashImageCompleted(Device, image, written, transfer.Elapsed - started);
+                        }
+                    }
+
+                    await session.QuitAsync(p_RebootAfterFlash);
+                }
+            }
+            catch (Exception e)
+            {
+                result.Error = e;
+            }
+
+            total.Stop();
+            result.TransferTime = transfer.Elapsed;
+            result.TotalTime = total.Elapsed;
+
+            OnFlashCompleted(Device, result);
+
+            return result;
+        }
+
+        protected virtual void OnDeviceFound(EVADevice newDevice)
+        {
+            EventHandler<DiscoveryDeviceFoundEventArgs> handler = DeviceFound;
+            if (handler != null)
+            {
+                handler(this, new DiscoveryDeviceFoundEventArgs(newDevice));
+            }
+        }
+
+        protected virtual void OnFlashStarted(EVADevice device)
+        {
+            EventHandler<FlashStartedEventArgs> handler = FlashStarted;
+            if (handler != null)
+            {
+                handler(this, new FlashStartedEventArgs(device));
+            }
+        }
+
+        protected virtual void OnFlashImageCompleted(EVADevice device, EVAFlashImage image, long bytes, TimeSpan elapsed)
+        {
+            EventHandler<FlashImageCompletedEventArgs> handler = FlashImageCompleted;
+            if (handler != null)
+            {
+                handler(this, new FlashImageCompletedEventArgs(device, image, bytes, elapsed));
+            }
+        }
+
+        protected virtual void OnFlashCompleted(EVADevice device, EVAFlashResult result)
+        {
+            EventHandler<FlashCompletedEventArgs> handler = FlashCompleted;
+            if (handler != null)
+            {
+                handler(this, new FlashCompletedEventArgs(device, result));
+            }
+        }
+    }
+}
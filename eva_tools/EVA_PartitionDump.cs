@@ -0,0 +1,566 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Net;
+using System.Threading;
+using System.Threading.Tasks;
+using YourFritz.TFFS;
+
+namespace YourFritz.EVA
+{
+    public enum EVAPartitionKind
+    {
+        // saved only
+        Raw,
+        // compressed kernel, passed on to the kernel analyzer command
+        Kernel,
+        // TFFS content, indexed while it's received
+        TFFS,
+    }
+
+    public class EVAPartition
+    {
+        private string p_Name;
+        private EVAPartitionKind p_Kind;
+
+        public EVAPartition(string Name, EVAPartitionKind Kind)
+        {
+            this.p_Name = Name;
+            this.p_Kind = Kind;
+        }
+
+        public string Name
+        {
+            get
+            {
+                return this.p_Name;
+            }
+        }
+
+        public EVAPartitionKind Kind
+        {
+            get
+            {
+                return this.p_Kind;
+            }
+        }
+    }
+
+    public class EVAPartitionDumpResult
+    {
+        private EVAPartition p_Partition;
+        private string p_FileName;
+        private long p_Bytes = 0;
+        private TimeSpan p_TransferTime = TimeSpan.Zero;
+        private int p_AnalyzerExitCode = -1;
+        private TFFSNodes p_Nodes = null;
+        private Exception p_Error = null;
+
+        internal EVAPartitionDumpResult(EVAPartition Partition, string FileName)
+        {
+            this.p_Partition = Partition;
+            this.p_FileName = FileName;
+        }
+
+        public EVAPartition Partition
+        {
+            get
+            {
+                return this.p_Partition;
+            }
+        }
+
+        public string FileName
+        {
+            get
+            {
+                return this.p_FileName;
+            }
+        }
+
+        public long Bytes
+        {
+            get
+            {
+                return this.p_Bytes;
+            }
+            internal set
+            {
+                this.p_Bytes = value;
+            }
+        }
+
+        public TimeSpan TransferTime
+        {
+            get
+            {
+                return this.p_TransferTime;
+            }
+            internal set
+            {
+                this.p_TransferTime = value;
+            }
+        }
+
+        // -1, if no analyzer command was run for this partition
+        public int AnalyzerExitCode
+        {
+            get
+            {
+                return this.p_AnalyzerExitCode;
+            }
+            internal set
+            {
+                this.p_AnalyzerExitCode = value;
+            }
+        }
+
+        // the node index of a TFFS partition, null for other kinds
+        public TFFSNodes Nodes
+        {
+            get
+            {
+                return this.p_Nodes;
+            }
+            internal set
+            {
+                this.p_Nodes = value;
+            }
+        }
+
+        public Exception Error
+        {
+            get
+            {
+                return this.p_Error;
+            }
+            internal set
+            {
+                this.p_Error = value;
+            }
+        }
+
+        public bool Succeeded
+        {
+            get
+            {
+                return this.p_Error == null && this.p_AnalyzerExitCode <= 0;
+            }
+        }
+    }
+
+    public class EVAPartitionDumpResults : List<EVAPartitionDumpResult>
+    {
+    }
+
+    public class PartitionRetrievedEventArgs : EventArgs
+    {
+        private EVAPartitionDumpResult p_Result;
+        private DateTime p_RetrievedAt = DateTime.Now;
+
+        internal PartitionRetrievedEventArgs(EVAPartitionDumpResult Result)
+        {
+            p_Result = Result;
+        }
+
+        public EVAPartitionDumpResult Result
+        {
+            get
+            {
+                return p_Result;
+            }
+        }
+
+        public DateTime RetrievedAt
+        {
+            get
+            {
+                return p_RetrievedAt;
+            }
+        }
+    }
+
+    public class PartitionAnalyzedEventArgs : EventArgs
+    {
+        private EVAPartitionDumpResult p_Result;
+
+        internal PartitionAnalyzedEventArgs(EVAPartitionDumpResult Result)
+        {
+            p_Result = Result;
+        }
+
+        public EVAPartitionDumpResult Result
+        {
+            get
+            {
+                return p_Result;
+            }
+        }
+    }
+
+    // passes each written buffer on to all targets at once - the first target (the backup file) is
+    // mandatory, write errors for further targets (usually an analyzer, which may exit early) only
+    // detach this target
+    internal class EVATeeStream : Stream
+    {
+        private List<Stream> p_Targets = new List<Stream>();
+        private long p_Position = 0;
+
+        internal EVATeeStream(Stream Primary)
+        {
+            p_Targets.Add(Primary);
+        }
+
+        internal void Add(Stream Target)
+        {
+            p_Targets.Add(Target);
+        }
+
+        public override bool CanRead => false;
+        public override bool CanSeek => false;
+        public override bool CanWrite => true;
+        public override long Length => p_Position;
+
+        public override long Position
+        {
+            get
+            {
+                return p_Position;
+            }
+            set
+            {
+                throw new NotSupportedException();
+            }
+        }
+
+        public override async Task WriteAsync(byte[] buffer, int offset, int count, CancellationToken cancellationToken)
+        {
+            Task[] writes = new Task[p_Targets.Count];
+
+            for (int i = 0; i < p_Targets.Count; i++)
+            {
+                writes[i] = p_Targets[i].WriteAsync(buffer, offset, count, cancellationToken);
+            }
+
+            await writes[0];
+
+            for (int i = writes.Length - 1; i > 0; i--)
+            {
+                try
+                {
+                    await writes[i];
+                }
+                catch (IOException)
+                {
+                    p_Targets.RemoveAt(i);
+                }
+            }
+
+            p_Position += count;
+        }
+
+        public override void Write(byte[] buffer, int offset, int count)
+        {
+            this.WriteAsync(buffer, offset, count, CancellationToken.None).GetAwaiter().GetResult();
+        }
+
+        public override void Flush()
+        {
+        }
+
+        public override int Read(byte[] buffer, int offset, int count)
+        {
+            throw new NotSupportedException();
+        }
+
+        public override long Seek(long offset, SeekOrigin origin)
+        {
+            throw new NotSupportedException();
+        }
+
+        public override void SetLength(long value)
+        {
+            throw new NotSupportedException();
+        }
+    }
+
+    // retrieves partitions from EVA and feeds them directly into the analyzers, while the result of
+    // one partition is still processed, the next one is already on its way
+    public class EVAPartitionDump
+    {
+        private IPAddress p_Address = IPAddress.Parse(EVADefaults.EVADefaultIP);
+        private int p_FTPPort = 21;
+        private string p_User = "adam2";
+        private string p_Password = "adam2";
+        private string p_PassiveCommand = EVACommandFactory.GetCommands()[EVACommandType.Passive_Alt].CommandValue;
+        private int p_DataBufferSize = 1024 * 1024;
+        private string p_OutputDirectory = ".";
+        private string p_ToolsDirectory = null;
+        // the command is run by 'sh -c' with the name of the backup file in $0, the partition
+        // content is provided on STDIN
+        private string p_KernelAnalyzer = "unpack_kernel.sh >\"$0.unpacked\" && extract_avm_kernel_config \"$0.unpacked\" >\"$0.config\"";
+
+        public EventHandler<PartitionRetrievedEventArgs> PartitionRetrieved;
+        public EventHandler<PartitionAnalyzedEventArgs> PartitionAnalyzed;
+
+        public EVAPartitionDump()
+        {
+        }
+
+        public EVAPartitionDump(IPAddress Address)
+        {
+            this.p_Address = Address;
+        }
+
+        public IPAddress Address
+        {
+            get
+            {
+                return p_Address;
+            }
+            set
+            {
+                p_Address = value;
+            }
+        }
+
+        public int FTPPort
+        {
+            get
+            {
+                return p_FTPPort;
+            }
+            set
+            {
+                p_FTPPort = value;
+            }
+        }
+
+        public string User
+        {
+            get
+            {
+                return p_User;
+            }
+            set
+            {
+                p_User = value;
+            }
+        }
+
+        public string Password
+        {
+            get
+            {
+                return p_Password;
+            }
+            set
+            {
+                p_Password = value;
+            }
+        }
+
+        public string PassiveCommand
+        {
+            get
+            {
+                return p_PassiveCommand;
+            }
+            set
+            {
+                p_PassiveCommand = value;
+            }
+        }
+
+        public int DataBufferSize
+        {
+            get
+            {
+                return p_DataBufferSize;
+            }
+            set
+            {
+                p_DataBufferSize = value;
+            }
+        }
+
+        public string OutputDirectory
+        {
+            get
+            {
+                return p_OutputDirectory;
+            }
+            set
+            {
+                p_OutputDirectory = value;
+            }
+        }
+
+        // prepended to PATH for analyzer commands, e.g. the 'avm_kernel_config' folder
+        public string ToolsDirectory
+        {
+            get
+            {
+                return p_ToolsDirectory;
+            }
+            set
+            {
+                p_ToolsDirectory = value;
+            }
+        }
+
+        // an empty value disables kernel analysis, the partition is saved only
+        public string KernelAnalyzer
+        {
+            get
+            {
+                return p_KernelAnalyzer;
+            }
+            set
+            {
+                p_KernelAnalyzer = value;
+            }
+        }
+
+        public async Task<EVAPartitionDumpResults> DumpAsync(IList<EVAPartition> Partitions, CancellationToken Token)
+        {
+            EVAPartitionDumpResults results = new EVAPartitionDumpResults();
+            List<Task> analyzers = new List<Task>();
+
+            Directory.CreateDirectory(p_OutputDirectory);
+
+            using (EVASession session = new EVASession(p_Address) { PassiveCommand = p_PassiveCommand, DataBufferSize = p_DataBufferSize })
+            using (Token.Register(() => session.Dispose()))
+            {
+                await session.OpenAsync(p_FTPPort);
+                await session.LoginAsync(p_User, p_Password);
+
+                foreach (EVAPartition partition in Partitions)
+                {
+                    Token.ThrowIfCancellationRequested();
+
+                    EVAPartitionDumpResult result = new EVAPartitionDumpResult(partition, Path.Combine(p_OutputDirectory, partition.Name));
+                    Process analyzer = null;
+                    TFFSStreamIndexer indexer = null;
+                    Stopwatch transfer = Stopwatch.StartNew();
+
+                    results.Add(result);
+
+                    using (FileStream backup = new FileStream(result.FileName, FileMode.Create, FileAccess.Write, FileShare.Read, p_DataBufferSize, true))
+                    {
+                        EVATeeStream output = new EVATeeStream(backup);
+
+                        if (partition.Kind == EVAPartitionKind.Kernel && !String.IsNullOrEmpty(p_KernelAnalyzer))
+                        {
+                            analyzer = StartAnalyzer(p_KernelAnalyzer, result.FileName);
+                            output.Add(analyzer.StandardInput.BaseStream);
+                        }
+                        else if (partition.Kind == EVAPartitionKind.TFFS)
+                        {
+                            indexer = new TFFSStreamIndexer();
+                            output.Add(indexer);
+                        }
+
+                        try
+                        {
+                            result.Bytes = await session.RetrieveAsync(partition.Name, EVAMediaType.Flash, output);
+                        }
+                        catch (EVAClientException e)
+                        {
+                            // the device refused this partition, the session itself is still usable
+                            result.Error = e;
+                        }
+                    }
+
+                    transfer.Stop();
+                    result.TransferTime = transfer.Elapsed;
+
+                    if (result.Error != null && result.Bytes == 0)
+                    {
+                        File.Delete(result.FileName);
+                    }
+
+                    if (indexer != null)
+                    {
+                        result.Nodes = indexer.Nodes;
+                        File.WriteAllLines(result.FileName + ".nodelist", indexer.Nodes.ConvertAll(node => node.ToString()));
+                    }
+
+                    OnPartitionRetrieved(result);
+
+                    if (analyzer != null)
+                    {
+                        analyzers.Add(FinishAnalyzerAsync(analyzer, result));
+                    }
+                    else
+                    {
+                        OnPartitionAnalyzed(result);
+                    }
+                }
+
+                await session.QuitAsync(false);
+            }
+
+            await Task.WhenAll(analyzers);
+
+            return results;
+        }
+
+        private Process StartAnalyzer(string Command, string FileName)
+        {
+            ProcessStartInfo start = new ProcessStartInfo("/bin/sh")
+            {
+                RedirectStandardInput = true,
+                UseShellExecute = false,
+            };
+
+            start.ArgumentList.Add("-c");
+            start.ArgumentList.Add(Command);
+            start.ArgumentList.Add(FileName);
+
+            if (!String.IsNullOrEmpty(p_ToolsDirectory))
+            {
+                start.Environment["PATH"] = p_ToolsDirectory + Path.PathSeparator + start.Environment["PATH"];
+            }
+
+            return Process.Start(start);
+        }
+
+        private async Task FinishAnalyzerAsync(Process Analyzer, EVAPartitionDumpResult Result)
+        {
+            try
+            {
+                Analyzer.StandardInput.Close();
+            }
+            catch (IOException)
+            {
+            }
+
+            await Analyzer.WaitForExitAsync();
+
+            Result.AnalyzerExitCode = Analyzer.ExitCode;
+            Analyzer.Dispose();
+
+            OnPartitionAnalyzed(Result);
+        }
+
+        protected virtual void OnPartitionRetrieved(EVAPartitionDumpResult result)
+        {
+            EventHandler<PartitionRetrievedEventArgs> handler = PartitionRetrieved;
+            if (handler != null)
+            {
+                handler(this, new PartitionRetrievedEventArgs(result));
+            }
+        }
+
+        protected virtual void OnPartitionAnalyzed(EVAPartitionDumpResult result)
+        {
+            EventHandler<PartitionAnalyzedEventArgs> handler = PartitionAnalyzed;
+            if (handler != null)
+            {
+                handler(this, new PartitionAnalyzedEventArgs(result));
+            }
+        }
+    }
+}
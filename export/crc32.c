@@ -2,7 +2,13 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 #include <stdio.h>
 #include <inttypes.h>
+#ifdef RUN_STATISTICS
+/* build with '-DRUN_STATISTICS ../avm_kernel_config/statistics_helpers.c' to get the '--stats' option */
+#include "../avm_kernel_config/statistics_helpers.h"
+int main(int argc, char *argv[])
+#else
 int main()
+#endif
 {
 	const uint32_t polynom=0xEDB88320;
 	uint32_t lookupTable[256];
@@ -13,6 +19,11 @@ int main()
 	char *input;
 	int i;
 	int j;
+#ifdef RUN_STATISTICS
+	uint64_t totalBytes=0;
+	initStatistics("crc32", &argc, argv);
+	statisticsStartPhase("table");
+#endif
 	for (i = 0;i < 256;i++) {
 		uint32_t val = (uint32_t) i;
 		for (j = 0;j < 8;j++) {
@@ -24,6 +35,9 @@ int main()
 		}
 		lookupTable[i] = val;
 	}
+#ifdef RUN_STATISTICS
+	statisticsStartPhase("checksum");
+#endif
 	crcValue = ~crcValue;
 	do {
 		for (input = buffer;input < (buffer+readBytes);input++) {
@@ -31,8 +45,14 @@ int main()
 			crcValue = (crcValue >> 8) ^ lookupTable[(crcValue & 255) ^ byte];
 		}
 		readBytes = read(0, buffer, sizeof(buffer));
+#ifdef RUN_STATISTICS
+		if (readBytes > 0) totalBytes += readBytes;
+#endif
 	} while (readBytes > 0);
 	crcValue = ~crcValue;
 	printf("%08X\n",crcValue);
+#ifdef RUN_STATISTICS
+	statisticsAdd("inputBytes", totalBytes);
+#endif
 	return 0;
 }
@@ -0,0 +1,421 @@
+/* edit a settings export as one pipeline stage without temporary files */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * export_editor [ -s <name>=<file> ]... [ -d <name> ]... [ -v <name>=<value> ]...
+ *               [ -m <sid> [ -p <password> ] [ -b <boundary> ] ] < export > output
+ *
+ * The export file is read from STDIN and parsed line by line, the CRC32 value
+ * is computed while the (modified) content is written to memory, using the
+ * same rules as the "decompose", "checksum" and "compose" scripts:
+ *
+ * - header lines (in front of the first file) count without the first '='
+ *   and with a terminating zero byte
+ * - each file counts with its name and a terminating zero byte, followed by
+ *   the content of a CFGFILE (without its last line and with "\\" replaced by
+ *   a single backslash), the binary data of a BINFILE or the unchanged hex
+ *   lines of a CRYPTEDBINFILE
+ *
+ * -s <name>=<file>:   replace the content of the named file, a CFGFILE gets the
+ *                     text from <file>, a BINFILE gets the binary data from
+ *                     <file> as hex dump
+ * -d <name>:          remove the named file from the export
+ * -v <name>=<value>:  change the value of a header line
+ * -m <sid>:           emit the multipart/form-data body (with its Content-Type
+ *                     and Content-Length lines) for an upload to
+ *                     /cgi-bin/firmwarecfg instead of the export file, like
+ *                     'multipart_form postfile' does
+ * -p <password>:      value for the ImportExportPassword field
+ * -b <boundary>:      use the specified boundary string (for tests)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define MAX_EDITS	64
+
+struct edit {
+	char *name;
+	char *value;
+	int used;
+};
+
+struct buffer {
+	char *data;
+	size_t size;
+	size_t allocated;
+};
+
+static uint32_t lookupTable[256];
+static uint32_t crcValue = 0xFFFFFFFF;
+
+static struct edit replaceFiles[MAX_EDITS];
+static int replaceCount = 0;
+static struct edit deleteFiles[MAX_EDITS];
+static int deleteCount = 0;
+static struct edit headerValues[MAX_EDITS];
+static int headerCount = 0;
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static void buildTable()
+{
+	const uint32_t polynom = 0xEDB88320;
+	int i;
+	int j;
+	for (i = 0;i < 256;i++) {
+		uint32_t val = (uint32_t) i;
+		for (j = 0;j < 8;j++) {
+			val = (val & 1) ? (val >> 1) ^ polynom : (val >> 1);
+		}
+		lookupTable[i] = val;
+	}
+}
+
+static void crcUpdate(const void *data, size_t size)
+{
+	const uint8_t *input = data;
+	while (size--) {
+		crcValue = (crcValue >> 8) ^ lookupTable[(crcValue & 255) ^ *input++];
+	}
+}
+
+static void append(struct buffer *buffer, const void *data, size_t size)
+{
+	if (buffer->size + size > buffer->allocated) {
+		size_t allocated = buffer->allocated ? buffer->allocated : 256 * 1024;
+		while (allocated < buffer->size + size) allocated *= 2;
+		buffer->data = realloc(buffer->data, allocated);
+		if (buffer->data == NULL) {
+			fprintf(stderr, "Unable to allocate memory for the export content.\n");
+			exit(1);
+		}
+		buffer->allocated = allocated;
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void appendString(struct buffer *buffer, const char *string)
+{
+	append(buffer, string, strlen(string));
+}
+
+static int hexValue(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return -1;
+}
+
+static int addEdit(struct edit *list, int *count, char *arg, int needValue)
+{
+	char *separator = strchr(arg, '=');
+	if (*count >= MAX_EDITS) {
+		fprintf(stderr, "Too many changes specified, the limit is %u.\n", MAX_EDITS);
+		return 0;
+	}
+	if (needValue) {
+		if (separator == NULL || separator == arg) {
+			fprintf(stderr, "Invalid argument '%s', expected <name>=<value>.\n", arg);
+			return 0;
+		}
+		*separator++ = 0;
+	}
+	list[*count].name = arg;
+	list[*count].value = separator;
+	list[*count].used = 0;
+	(*count)++;
+	return 1;
+}
+
+static struct edit *findEdit(struct edit *list, int count, const char *name, size_t length)
+{
+	int i;
+	for (i = 0;i < count;i++) {
+		if (strlen(list[i].name) == length && strncmp(list[i].name, name, length) == 0) {
+			list[i].used = 1;
+			return &list[i];
+		}
+	}
+	return NULL;
+}
+
+static char *readFile(const char *name, size_t *size)
+{
+	FILE *file = fopen(name, "rb");
+	struct buffer content = { NULL, 0, 0 };
+	char block[8192];
+	size_t readBytes;
+	if (file == NULL) {
+		fprintf(stderr, "Unable to open replacement file '%s'.\n", name);
+		exit(1);
+	}
+	while ((readBytes = fread(block, 1, sizeof(block), file)) > 0) append(&content, block, readBytes);
+	fclose(file);
+	*size = content.size;
+	return content.data;
+}
+
+/* header line: count without the first '=' and the surrounding white space */
+static void headerLine(struct buffer *output, char *line, size_t length)
+{
+	char *start = line;
+	char *end = line + length;
+	char *separator;
+	struct edit *value;
+	while (start < end && (*start == ' ' || *start == '\t')) start++;
+	while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+	separator = memchr(start, '=', end - start);
+	if (separator != NULL && (value = findEdit(headerValues, headerCount, start, separator - start)) != NULL) {
+		append(output, line, separator + 1 - line);
+		appendString(output, value->value);
+		appendString(output, "\n");
+		crcUpdate(start, separator - start);
+		crcUpdate(value->value, strlen(value->value));
+	} else {
+		append(output, line, length);
+		if (separator != NULL) {
+			crcUpdate(start, separator - start);
+			crcUpdate(separator + 1, end - separator - 1);
+		} else {
+			crcUpdate(start, end - start);
+		}
+	}
+	crcUpdate("", 1);
+}
+
+static void binaryContent(struct buffer *output, const uint8_t *data, size_t size)
+{
+	char line[82];
+	size_t i;
+	size_t j;
+	if (size == 0) {
+		appendString(output, "\n");
+		return;
+	}
+	for (i = 0;i < size;i += 40) {
+		char *out = line;
+		for (j = i;j < size && j < i + 40;j++) {
+			*out++ = hexDigits[data[j] >> 4];
+			*out++ = hexDigits[data[j] & 15];
+		}
+		*out++ = '\n';
+		append(output, line, out - line);
+	}
+	crcUpdate(data, size);
+}
+
+/* the CFGFILE content counts without its last line and with "\\" as "\" */
+static void configContent(const char *data, size_t size)
+{
+	const char *end = data + size;
+	const char *lastLine = end;
+	const char *ptr;
+	if (size > 0) {
+		lastLine = end - 1;
+		while (lastLine > data && lastLine[-1] != '\n') lastLine--;
+	}
+	for (ptr = data;ptr < lastLine;ptr++) {
+		if (*ptr == '\\' && ptr + 1 < lastLine && ptr[1] == '\\') ptr++;
+		crcUpdate(ptr, 1);
+	}
+}
+
+static void hexContent(const char *data, size_t size)
+{
+	uint8_t block[4096];
+	size_t used = 0;
+	const char *ptr;
+	int high = -1;
+	for (ptr = data;ptr < data + size;ptr++) {
+		int value = hexValue(*ptr);
+		if (value < 0) continue;
+		if (high < 0) {
+			high = value;
+			continue;
+		}
+		block[used++] = (uint8_t) ((high << 4) | value);
+		high = -1;
+		if (used == sizeof(block)) {
+			crcUpdate(block, used);
+			used = 0;
+		}
+	}
+	crcUpdate(block, used);
+}
+
+static void fileSection(struct buffer *output, const char *type, const char *name, size_t nameLength, struct buffer *content)
+{
+	struct edit *replace;
+	if (findEdit(deleteFiles, deleteCount, name, nameLength) != NULL) return;
+	appendString(output, "**** ");
+	appendString(output, type);
+	appendString(output, ":");
+	append(output, name, nameLength);
+	appendString(output, "\n");
+	crcUpdate(name, nameLength);
+	crcUpdate("", 1);
+	replace = findEdit(replaceFiles, replaceCount, name, nameLength);
+	if (replace != NULL) {
+		size_t size;
+		char *data = readFile(replace->value, &size);
+		if (strcmp(type, "BINFILE") == 0) {
+			binaryContent(output, (uint8_t *) data, size);
+		} else {
+			size_t start = output->size;
+			append(output, data, size);
+			if (size > 0 && data[size - 1] != '\n') appendString(output, "\n");
+			if (strcmp(type, "CFGFILE") == 0) {
+				configContent(output->data + start, output->size - start);
+			} else {
+				crcUpdate(output->data + start, output->size - start);
+			}
+		}
+		free(data);
+	} else {
+		append(output, content->data, content->size);
+		if (strcmp(type, "CFGFILE") == 0) {
+			configContent(content->data, content->size);
+		} else if (strcmp(type, "BINFILE") == 0) {
+			hexContent(content->data, content->size);
+		} else {
+			crcUpdate(content->data, content->size);
+		}
+	}
+	appendString(output, "**** END OF FILE ****\n");
+}
+
+static int startsWith(const char *line, const char *prefix)
+{
+	return strncmp(line, prefix, strlen(prefix)) == 0;
+}
+
+static void multipartField(struct buffer *body, const char *boundary, const char *name, const char *type, const char *value, size_t size)
+{
+	if (body->size > 0) appendString(body, "\r\n");
+	appendString(body, "--");
+	appendString(body, boundary);
+	appendString(body, "\r\nContent-Disposition: form-data; name=\"");
+	appendString(body, name);
+	appendString(body, "\"");
+	if (type != NULL) {
+		appendString(body, "\r\nContent-Type: ");
+		appendString(body, type);
+	}
+	appendString(body, "\r\n\r\n");
+	append(body, value, size);
+}
+
+int main(int argc, char *argv[])
+{
+	struct buffer output = { NULL, 0, 0 };
+	struct buffer section = { NULL, 0, 0 };
+	char *sid = NULL;
+	char *password = "";
+	char *boundary = NULL;
+	char generated[33];
+	char *line = NULL;
+	size_t lineSize = 0;
+	ssize_t length;
+	char *type = NULL;
+	char *name = NULL;
+	int header = 1;
+	int opt;
+	int i;
+	while ((opt = getopt(argc, argv, "s:d:v:m:p:b:")) != -1) {
+		switch (opt) {
+		case 's':
+			if (!addEdit(replaceFiles, &replaceCount, optarg, 1)) return 1;
+			break;
+		case 'd':
+			if (!addEdit(deleteFiles, &deleteCount, optarg, 0)) return 1;
+			break;
+		case 'v':
+			if (!addEdit(headerValues, &headerCount, optarg, 1)) return 1;
+			break;
+		case 'm':
+			sid = optarg;
+			break;
+		case 'p':
+			password = optarg;
+			break;
+		case 'b':
+			boundary = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [ -s <name>=<file> ]... [ -d <name> ]... [ -v <name>=<value> ]...\n", argv[0]);
+			fprintf(stderr, "       [ -m <sid> [ -p <password> ] [ -b <boundary> ] ] < export > output\n");
+			return 1;
+		}
+	}
+	buildTable();
+	while ((length = getline(&line, &lineSize, stdin)) > 0) {
+		if (startsWith(line, "**** END OF EXPORT")) {
+			char result[64];
+			if (name != NULL) break;
+			snprintf(result, sizeof(result), "**** END OF EXPORT %08X ****\n", ~crcValue);
+			appendString(&output, result);
+			type = line; /* mark as complete */
+			break;
+		}
+		if (name != NULL) {
+			if (startsWith(line, "**** END OF FILE")) {
+				fileSection(&output, type, name, strlen(name), &section);
+				free(name);
+				name = NULL;
+				section.size = 0;
+			} else {
+				append(&section, line, length);
+			}
+			continue;
+		}
+		if (startsWith(line, "**** CFGFILE:") || startsWith(line, "**** BINFILE:") || startsWith(line, "**** CRYPTEDBINFILE:")) {
+			char *separator = strchr(line, ':');
+			header = 0;
+			type = startsWith(line, "**** CFGFILE:") ? "CFGFILE" : (startsWith(line, "**** BINFILE:") ? "BINFILE" : "CRYPTEDBINFILE");
+			name = strndup(separator + 1, strcspn(separator + 1, "\r\n"));
+			continue;
+		}
+		if (startsWith(line, "****")) {
+			append(&output, line, length);
+		} else if (header) {
+			headerLine(&output, line, length);
+		}
+	}
+	if (type != line) {
+		fprintf(stderr, "The input data is not a complete settings export.\n");
+		return 1;
+	}
+	for (i = 0;i < replaceCount;i++) if (!replaceFiles[i].used) fprintf(stderr, "File '%s' not found in export, replacement ignored.\n", replaceFiles[i].name);
+	for (i = 0;i < deleteCount;i++) if (!deleteFiles[i].used) fprintf(stderr, "File '%s' not found in export, nothing deleted.\n", deleteFiles[i].name);
+	for (i = 0;i < headerCount;i++) if (!headerValues[i].used) fprintf(stderr, "Header value '%s' not found in export, not changed.\n", headerValues[i].name);
+	if (sid != NULL) {
+		struct buffer body = { NULL, 0, 0 };
+		if (boundary == NULL) {
+			uint32_t seed = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+			crcValue = seed;
+			crcUpdate(output.data, output.size);
+			snprintf(generated, sizeof(generated), "%08x%08x%08x%08x", seed, crcValue, ~seed, ~crcValue);
+			boundary = generated;
+		}
+		multipartField(&body, boundary, "sid", NULL, sid, strlen(sid));
+		multipartField(&body, boundary, "ImportExportPassword", NULL, password, strlen(password));
+		multipartField(&body, boundary, "ConfigImportFile", "application/octet-stream", output.data, output.size);
+		multipartField(&body, boundary, "apply", NULL, "", 0);
+		appendString(&body, "\r\n--");
+		appendString(&body, boundary);
+		appendString(&body, "--");
+		printf("Content-Type: multipart/form-data; boundary=%s\r\n", boundary);
+		printf("Content-Length: %zu\r\n\r\n", body.size);
+		fwrite(body.data, 1, body.size, stdout);
+		printf("\r\n");
+	} else {
+		fwrite(output.data, 1, output.size, stdout);
+	}
+	return (fflush(stdout) == 0) ? 0 : 1;
+}
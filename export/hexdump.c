@@ -0,0 +1,223 @@
+/* native implementation of the "hexdump" script as short C program */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * hexdump [ -p ] [ -C [ -v ] | -r ] < input > output
+ *
+ * default: 40 bytes per line as upper-case hex digits, the same output as
+ *          the "hexdump" script or hexdump -v -e '40/1 "%02X" "\n"'
+ * -r:      raw hex mode, hex digits (from the default mode or from a
+ *          BINFILE section of an export file) are converted back to binary,
+ *          line ends and other white space are ignored
+ * -C:      canonical layout (16 bytes with offset and ASCII column), equal
+ *          lines are collapsed to a single '*' like "csharp/hexdump.cs" does
+ * -v:      do not collapse equal lines in canonical layout
+ * -p:      show the progress on STDERR (like any argument to the script)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#define EXPORT_LINE		40
+#define CANONICAL_LINE	16
+#define BLOCK_SIZE		(EXPORT_LINE * CANONICAL_LINE * 128)
+
+static char upperHex[256][2];
+static char lowerHex[256][2];
+static char printable[256];
+
+static uint8_t input[BLOCK_SIZE];
+static char output[BLOCK_SIZE * 5];
+
+static void buildTables()
+{
+	const char *upper = "0123456789ABCDEF";
+	const char *lower = "0123456789abcdef";
+	int i;
+	for (i = 0;i < 256;i++) {
+		upperHex[i][0] = upper[i >> 4];
+		upperHex[i][1] = upper[i & 15];
+		lowerHex[i][0] = lower[i >> 4];
+		lowerHex[i][1] = lower[i & 15];
+		printable[i] = ((i < 32) || (i > 127)) ? '.' : (char) i;
+	}
+}
+
+static size_t readBlock(uint8_t *buffer, size_t size)
+{
+	size_t filled = 0;
+	ssize_t readBytes;
+	/* fill the whole block, lines may not span two blocks */
+	while (filled < size) {
+		readBytes = read(0, buffer + filled, size - filled);
+		if (readBytes < 0) {
+			perror("hexdump");
+			exit(1);
+		}
+		if (readBytes == 0) break;
+		filled += readBytes;
+	}
+	return filled;
+}
+
+static void writeOutput(char *buffer, size_t size)
+{
+	if (fwrite(buffer, 1, size, stdout) != size) {
+		perror("hexdump");
+		exit(1);
+	}
+}
+
+static void showProgress(uint64_t offset, uint64_t fileSize)
+{
+	if (fileSize > 0) fprintf(stderr, "\r%u%%", (unsigned int) (offset * 100 / fileSize));
+}
+
+static void exportLayout(int progress, uint64_t fileSize)
+{
+	uint64_t offset = 0;
+	size_t readBytes;
+	while ((readBytes = readBlock(input, sizeof(input))) > 0) {
+		char *out = output;
+		size_t i;
+		for (i = 0;i < readBytes;i++) {
+			*out++ = upperHex[input[i]][0];
+			*out++ = upperHex[input[i]][1];
+			if ((i % EXPORT_LINE) == (EXPORT_LINE - 1)) *out++ = '\n';
+		}
+		if ((readBytes % EXPORT_LINE) != 0) *out++ = '\n';
+		writeOutput(output, out - output);
+		offset += readBytes;
+		if (progress) showProgress(offset, fileSize);
+		if (readBytes < sizeof(input)) break;
+	}
+}
+
+static char *canonicalLine(char *out, uint8_t *data, size_t size)
+{
+	size_t b;
+	for (b = 0;b < size;b++) {
+		*out++ = lowerHex[data[b]][0];
+		*out++ = lowerHex[data[b]][1];
+		*out++ = ' ';
+		if (b == 7) *out++ = ' ';
+	}
+	if (b < 8) *out++ = ' ';
+	while (b++ < CANONICAL_LINE) {
+		memcpy(out, "   ", 3);
+		out += 3;
+	}
+	*out++ = ' ';
+	*out++ = '|';
+	for (b = 0;b < size;b++) *out++ = printable[data[b]];
+	*out++ = '|';
+	return out;
+}
+
+static void canonicalLayout(int collapse, int progress, uint64_t fileSize)
+{
+	uint64_t offset = 0;
+	uint64_t lastIndex = 0;
+	uint8_t lastLine[CANONICAL_LINE];
+	size_t lastSize = 0;
+	size_t readBytes;
+	while ((readBytes = readBlock(input, sizeof(input))) > 0) {
+		char *out = output;
+		size_t i;
+		for (i = 0;i < readBytes;i += CANONICAL_LINE) {
+			uint64_t index = offset + i;
+			size_t size = (readBytes - i) < CANONICAL_LINE ? (readBytes - i) : CANONICAL_LINE;
+			if (collapse && (index > 0)) {
+				/* equal lines are skipped, the first line after them is preceded by '*' */
+				if ((size == lastSize) && (memcmp(lastLine, input + i, size) == 0)) continue;
+				if (lastIndex != (index - CANONICAL_LINE)) {
+					*out++ = '*';
+					*out++ = '\n';
+				}
+			}
+			out += sprintf(out, "%08" PRIx64 "  ", index);
+			out = canonicalLine(out, input + i, size);
+			*out++ = '\n';
+			memcpy(lastLine, input + i, size);
+			lastSize = size;
+			lastIndex = index;
+		}
+		writeOutput(output, out - output);
+		offset += readBytes;
+		if (progress) showProgress(offset, fileSize);
+		if (readBytes < sizeof(input)) break;
+	}
+	if (collapse && (offset > 0) && (lastIndex != ((offset - 1) / CANONICAL_LINE) * CANONICAL_LINE)) writeOutput("*\n", 2);
+	printf("%08" PRIx64 "\n", offset);
+}
+
+static void rawHexToBinary()
+{
+	static int8_t nibble[256];
+	uint8_t *out;
+	size_t readBytes;
+	int high = -1;
+	int i;
+	for (i = 0;i < 256;i++) nibble[i] = -1;
+	for (i = 0;i < 10;i++) nibble['0' + i] = i;
+	for (i = 0;i < 6;i++) nibble['A' + i] = nibble['a' + i] = 10 + i;
+	while ((readBytes = readBlock(input, sizeof(input))) > 0) {
+		size_t j;
+		out = (uint8_t *) output;
+		for (j = 0;j < readBytes;j++) {
+			int value = nibble[input[j]];
+			if (value < 0) continue;
+			if (high < 0) {
+				high = value;
+			} else {
+				*out++ = (uint8_t) ((high << 4) | value);
+				high = -1;
+			}
+		}
+		writeOutput(output, out - (uint8_t *) output);
+		if (readBytes < sizeof(input)) break;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int canonical = 0;
+	int collapse = 1;
+	int reverse = 0;
+	int progress = 0;
+	uint64_t fileSize = 0;
+	struct stat st;
+	int opt;
+	while ((opt = getopt(argc, argv, "Cvrp")) != -1) {
+		switch (opt) {
+		case 'C':
+			canonical = 1;
+			break;
+		case 'v':
+			collapse = 0;
+			break;
+		case 'r':
+			reverse = 1;
+			break;
+		case 'p':
+			progress = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [ -p ] [ -C [ -v ] | -r ] < input > output\n", argv[0]);
+			return 1;
+		}
+	}
+	buildTables();
+	if (progress && (fstat(0, &st) == 0) && S_ISREG(st.st_mode)) fileSize = st.st_size;
+	if (reverse) {
+		rawHexToBinary();
+	} else if (canonical) {
+		canonicalLayout(collapse, progress, fileSize);
+	} else {
+		exportLayout(progress, fileSize);
+	}
+	if (progress) fprintf(stderr, "\r\x1B[K");
+	return 0;
+}
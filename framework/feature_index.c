@@ -0,0 +1,695 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2017 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/xmlschemas.h>
+
+#define INDEX_MAGIC					"YFFI"
+#define INDEX_VERSION				1
+#define INDEX_BYTE_ORDER			0x01020304
+#define INDEX_SUFFIX				".idx"
+#define DATABASE_NAMESPACE			"urn:yourfritz-de:YourFritz"
+#define DEVICE_NAME					"DeviceName"
+#define NO_ENTRY					0xFFFFFFFF
+
+// the index is a cache on the local system, so it's stored in host byte order
+struct indexHeader
+{
+	char				magic[4];
+	uint32_t			version;
+	uint32_t			byteOrder;
+	uint32_t			modelCount;
+	uint64_t			databaseSize;
+	int64_t				databaseTime;
+	int64_t				databaseTimeNsec;
+	uint64_t			schemaSize;
+	int64_t				schemaTime;
+	int64_t				schemaTimeNsec;
+	uint32_t			nameCount;
+	uint32_t			pairCount;
+	uint32_t			modelsOffset;
+	uint32_t			namesOffset;
+	uint32_t			pairsOffset;
+	uint32_t			sortedOffset;
+	uint32_t			stringsOffset;
+	uint32_t			stringsSize;
+	uint32_t			deviceName;		// index of the 'DeviceName' attribute
+	uint32_t			totalSize;
+};
+
+// one model with its output line (in the format of 'get_feature_list') and its attributes
+struct indexModel
+{
+	uint32_t			line;
+	uint32_t			lineSize;
+	uint32_t			firstPair;
+	uint32_t			pairCount;
+};
+
+// attribute names are sorted, each one refers to its values in the sorted pair list
+struct indexName
+{
+	uint32_t			name;
+	uint32_t			firstSorted;
+	uint32_t			sortedCount;
+};
+
+struct indexPair
+{
+	uint32_t			name;
+	uint32_t			value;
+	uint32_t			model;
+};
+
+struct stringPool
+{
+	char *				data;
+	size_t				size;
+	size_t				allocated;
+};
+
+static const char *		databaseName = "feature_database.xml";
+static const char *		schemaName = "feature_database.xsd";
+static char *			indexName = NULL;
+static const uint8_t *	indexData = NULL;
+static size_t			indexSize = 0;
+static const struct indexHeader *	header = NULL;
+static const char *		strings = NULL;
+static struct stringPool	pool = { NULL, 0, 0 };
+static struct indexPair *	sortPairs = NULL;
+static struct indexName *	sortNames = NULL;
+
+void usage()
+{
+	fprintf(stderr, "feature_index - query the feature database with a precompiled index\n\n");
+	fprintf(stderr, "(C) 2017 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "feature_index [ -d <database> ] [ -s <schema> ] [ -i <index> ] [ -c ] [ -v <attribute> ]\n");
+	fprintf(stderr, "              [ [ <attribute> ] <value_to_lookup> ]\n");
+	fprintf(stderr, "\nThe output is the same as from 'get_feature_list': one line for each model with");
+	fprintf(stderr, "\nall its attributes as name/value pairs, only models containing the specified");
+	fprintf(stderr, "\ntext in their 'DeviceName' attribute (one argument) or with the specified value");
+	fprintf(stderr, "\nof an attribute (two arguments) are written. With '-v' only the value of the");
+	fprintf(stderr, "\nspecified attribute is written for each model.\n");
+	fprintf(stderr, "\nThe database (default: $YF_FEATURE_DATABASE_FILE or feature_database.xml) is");
+	fprintf(stderr, "\nvalidated with the schema (default: $YF_FEATURE_DATABASE_SCHEMA or");
+	fprintf(stderr, "\nfeature_database.xsd) and compiled into the index file (default:");
+	fprintf(stderr, "\n$YF_FEATURE_DATABASE_INDEX or a file in $XDG_CACHE_HOME/yourfritz, which");
+	fprintf(stderr, "\ndefaults to ~/.cache/yourfritz), if the index is missing or one of the");
+	fprintf(stderr, "\nfiles was changed since it was built.");
+	fprintf(stderr, "\nUse '-c' to rebuild the index without any query.\n");
+}
+
+uint32_t addString(const char *text, size_t size)
+{
+	uint32_t			offset = pool.size;
+
+	if (pool.size + size + 1 > pool.allocated)
+	{
+		pool.allocated = (pool.allocated ? pool.allocated * 2 : 4096);
+		while (pool.size + size + 1 > pool.allocated) pool.allocated *= 2;
+		if ((pool.data = realloc(pool.data, pool.allocated)) == NULL)
+		{
+			fprintf(stderr, "Memory exhausted while building the index.\n");
+			exit(1);
+		}
+	}
+
+	memcpy(pool.data + pool.size, text, size);
+	pool.data[pool.size + size] = 0;
+	pool.size += size + 1;
+
+	return offset;
+}
+
+int compareNames(const void *left, const void *right)
+{
+	return strcmp(pool.data + ((const struct indexName *) left)->name, pool.data + ((const struct indexName *) right)->name);
+}
+
+// pairs are sorted by attribute name first, then by value and the model keeps the document order
+int comparePairs(const void *left, const void *right)
+{
+	const struct indexPair *	l = &sortPairs[*(const uint32_t *) left];
+	const struct indexPair *	r = &sortPairs[*(const uint32_t *) right];
+	int					order;
+
+	if (l->name != r->name) return (l->name < r->name ? -1 : 1);
+	if ((order = strcmp(pool.data + l->value, pool.data + r->value)) != 0) return order;
+	return (l->model < r->model ? -1 : (l->model > r->model ? 1 : 0));
+}
+
+bool validateDatabase(xmlDocPtr document)
+{
+	xmlSchemaParserCtxtPtr	parserContext;
+	xmlSchemaPtr		schema = NULL;
+	xmlSchemaValidCtxtPtr	validContext = NULL;
+	bool				valid = false;
+
+	if ((parserContext = xmlSchemaNewParserCtxt(schemaName)) != NULL && (schema = xmlSchemaParse(parserContext)) != NULL &&
+		(validContext = xmlSchemaNewValidCtxt(schema)) != NULL)
+	{
+		valid = (xmlSchemaValidateDoc(validContext, document) == 0);
+	}
+
+	if (validContext != NULL) xmlSchemaFreeValidCtxt(validContext);
+	if (schema != NULL) xmlSchemaFree(schema);
+	if (parserContext != NULL) xmlSchemaFreeParserCtxt(parserContext);
+
+	if (!valid) fprintf(stderr, "Error validating database '%s' with schema '%s'.\n", databaseName, schemaName);
+	return valid;
+}
+
+bool isDatabaseElement(xmlNodePtr node, const char *name)
+{
+	return (node->type == XML_ELEMENT_NODE && xmlStrcmp(node->name, BAD_CAST name) == 0 &&
+		node->ns != NULL && xmlStrcmp(node->ns->href, BAD_CAST DATABASE_NAMESPACE) == 0);
+}
+
+// parse and validate the XML file and build the index in memory
+uint8_t * compileIndex(const struct stat *databaseStat, const struct stat *schemaStat, size_t *size)
+{
+	xmlDocPtr			document;
+	xmlNodePtr			root;
+	xmlNodePtr			devices;
+	xmlNodePtr			model;
+	struct indexModel *	models = NULL;
+	uint32_t *			sorted = NULL;
+	size_t				modelCount = 0;
+	size_t				nameCount = 0;
+	size_t				pairCount = 0;
+	char *				line = NULL;
+	size_t				lineAllocated = 0;
+	struct indexHeader	newHeader;
+	uint8_t *			buffer;
+	size_t				i;
+
+	if ((document = xmlReadFile(databaseName, NULL, XML_PARSE_NONET)) == NULL)
+	{
+		fprintf(stderr, "Error parsing database '%s'.\n", databaseName);
+		return NULL;
+	}
+
+	if (!validateDatabase(document))
+	{
+		xmlFreeDoc(document);
+		return NULL;
+	}
+
+	root = xmlDocGetRootElement(document);
+	for (devices = (root != NULL ? root->children : NULL); devices != NULL; devices = devices->next)
+	{
+		if (!isDatabaseElement(devices, "devices")) continue;
+
+		for (model = devices->children; model != NULL; model = model->next)
+		{
+			xmlAttrPtr	attribute;
+			size_t		lineSize = 0;
+
+			if (!isDatabaseElement(model, "model")) continue;
+
+			if ((modelCount % 64) == 0 && (models = realloc(models, (modelCount + 64) * sizeof(struct indexModel))) == NULL) exit(1);
+			models[modelCount].firstPair = pairCount;
+
+			for (attribute = model->properties; attribute != NULL; attribute = attribute->next)
+			{
+				xmlChar *	value = xmlNodeGetContent((xmlNodePtr) attribute);
+				size_t		needed = lineSize + strlen((const char *) attribute->name) + strlen((const char *) value) + 5;
+				size_t		name;
+
+				for (name = 0; name < nameCount; name++)
+				{
+					if (strcmp(pool.data + sortNames[name].name, (const char *) attribute->name) == 0) break;
+				}
+				if (name == nameCount)
+				{
+					if ((nameCount % 64) == 0 && (sortNames = realloc(sortNames, (nameCount + 64) * sizeof(struct indexName))) == NULL) exit(1);
+					sortNames[nameCount].name = addString((const char *) attribute->name, strlen((const char *) attribute->name));
+					nameCount++;
+				}
+
+				if ((pairCount % 256) == 0 && (sortPairs = realloc(sortPairs, (pairCount + 256) * sizeof(struct indexPair))) == NULL) exit(1);
+				sortPairs[pairCount].name = name;
+				sortPairs[pairCount].value = addString((const char *) value, strlen((const char *) value));
+				sortPairs[pairCount].model = modelCount;
+				pairCount++;
+
+				// the same text as the XSLT from 'get_feature_list' creates
+				if (needed > lineAllocated)
+				{
+					lineAllocated = needed * 2;
+					if ((line = realloc(line, lineAllocated)) == NULL) exit(1);
+				}
+				lineSize += sprintf(line + lineSize, "%s=\"%s\" ", (const char *) attribute->name, (const char *) value);
+				xmlFree(value);
+			}
+
+			if (lineSize + 1 > lineAllocated && (line = realloc(line, lineAllocated = lineSize + 1)) == NULL) exit(1);
+			line[lineSize++] = '\n';
+			models[modelCount].line = addString(line != NULL ? line : "", lineSize);
+			models[modelCount].lineSize = lineSize;
+			models[modelCount].pairCount = pairCount - models[modelCount].firstPair;
+			modelCount++;
+		}
+	}
+	xmlFreeDoc(document);
+	free(line);
+
+	// attribute names get sorted, the pairs have to refer to the new positions
+	if (nameCount > 0)
+	{
+		uint32_t *		newPosition = calloc(nameCount, sizeof(uint32_t));
+
+		for (i = 0; i < nameCount; i++) sortNames[i].firstSorted = i;
+		qsort(sortNames, nameCount, sizeof(struct indexName), compareNames);
+		for (i = 0; i < nameCount; i++) newPosition[sortNames[i].firstSorted] = i;
+		for (i = 0; i < pairCount; i++) sortPairs[i].name = newPosition[sortPairs[i].name];
+		free(newPosition);
+	}
+
+	if ((sorted = calloc(pairCount + 1, sizeof(uint32_t))) == NULL) exit(1);
+	for (i = 0; i < pairCount; i++) sorted[i] = i;
+	qsort(sorted, pairCount, sizeof(uint32_t), comparePairs);
+
+	for (i = 0; i < nameCount; i++)
+	{
+		sortNames[i].firstSorted = NO_ENTRY;
+		sortNames[i].sortedCount = 0;
+	}
+	for (i = 0; i < pairCount; i++)
+	{
+		struct indexName *	name = &sortNames[sortPairs[sorted[i]].name];
+
+		if (name->firstSorted == NO_ENTRY) name->firstSorted = i;
+		name->sortedCount++;
+	}
+
+	memset(&newHeader, 0, sizeof(newHeader));
+	memcpy(newHeader.magic, INDEX_MAGIC, sizeof(newHeader.magic));
+	newHeader.version = INDEX_VERSION;
+	newHeader.byteOrder = INDEX_BYTE_ORDER;
+	newHeader.modelCount = modelCount;
+	newHeader.databaseSize = databaseStat->st_size;
+	newHeader.databaseTime = databaseStat->st_mtim.tv_sec;
+	newHeader.databaseTimeNsec = databaseStat->st_mtim.tv_nsec;
+	newHeader.schemaSize = schemaStat->st_size;
+	newHeader.schemaTime = schemaStat->st_mtim.tv_sec;
+	newHeader.schemaTimeNsec = schemaStat->st_mtim.tv_nsec;
+	newHeader.nameCount = nameCount;
+	newHeader.pairCount = pairCount;
+	newHeader.modelsOffset = sizeof(struct indexHeader);
+	newHeader.namesOffset = newHeader.modelsOffset + modelCount * sizeof(struct indexModel);
+	newHeader.pairsOffset = newHeader.namesOffset + nameCount * sizeof(struct indexName);
+	newHeader.sortedOffset = newHeader.pairsOffset + pairCount * sizeof(struct indexPair);
+	newHeader.stringsOffset = newHeader.sortedOffset + pairCount * sizeof(uint32_t);
+	newHeader.stringsSize = pool.size;
+	newHeader.deviceName = NO_ENTRY;
+	newHeader.totalSize = newHeader.stringsOffset + pool.size;
+	for (i = 0; i < nameCount; i++)
+	{
+		if (strcmp(pool.data + sortNames[i].name, DEVICE_NAME) == 0) newHeader.deviceName = i;
+	}
+
+	if ((buffer = malloc(newHeader.totalSize)) == NULL) exit(1);
+	memcpy(buffer, &newHeader, sizeof(newHeader));
+	if (modelCount > 0) memcpy(buffer + newHeader.modelsOffset, models, modelCount * sizeof(struct indexModel));
+	if (nameCount > 0) memcpy(buffer + newHeader.namesOffset, sortNames, nameCount * sizeof(struct indexName));
+	if (pairCount > 0)
+	{
+		memcpy(buffer + newHeader.pairsOffset, sortPairs, pairCount * sizeof(struct indexPair));
+		memcpy(buffer + newHeader.sortedOffset, sorted, pairCount * sizeof(uint32_t));
+	}
+	if (pool.size > 0) memcpy(buffer + newHeader.stringsOffset, pool.data, pool.size);
+
+	free(models);
+	free(sorted);
+	free(sortNames);
+	free(sortPairs);
+	free(pool.data);
+
+	*size = newHeader.totalSize;
+	return buffer;
+}
+
+// the index is replaced atomically, a failure is not fatal - the new index is used from memory then
+void saveIndex(const uint8_t *buffer, size_t size)
+{
+	char *				tempName = malloc(strlen(indexName) + 8);
+	int					fd;
+
+	if (tempName == NULL) return;
+	sprintf(tempName, "%s.XXXXXX", indexName);
+
+	if ((fd = mkstemp(tempName)) == -1)
+	{
+		free(tempName);
+		return;
+	}
+
+	if (write(fd, buffer, size) != (ssize_t) size || fchmod(fd, 0644) != 0 || close(fd) != 0 || rename(tempName, indexName) != 0)
+	{
+		fprintf(stderr, "Error %d saving index file '%s'.\n", errno, indexName);
+		unlink(tempName);
+	}
+
+	free(tempName);
+}
+
+bool isCurrentIndex(const uint8_t *data, size_t size, const struct stat *databaseStat, const struct stat *schemaStat)
+{
+	const struct indexHeader *	h = (const struct indexHeader *) data;
+
+	if (size < sizeof(struct indexHeader) || memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0) return false;
+	if (h->version != INDEX_VERSION || h->byteOrder != INDEX_BYTE_ORDER || h->totalSize != size) return false;
+	if (h->databaseSize != (uint64_t) databaseStat->st_size || h->databaseTime != databaseStat->st_mtim.tv_sec || h->databaseTimeNsec != databaseStat->st_mtim.tv_nsec) return false;
+	if (h->schemaSize != (uint64_t) schemaStat->st_size || h->schemaTime != schemaStat->st_mtim.tv_sec || h->schemaTimeNsec != schemaStat->st_mtim.tv_nsec) return false;
+
+	return (h->stringsOffset + h->stringsSize == size);
+}
+
+// creates the missing directories of a path (without its last component), errors are ignored here -
+// the index can't be saved then, but it's still used from memory
+void createIndexDirectory(char *path)
+{
+	char *				slash;
+
+	for (slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+	{
+		*slash = 0;
+		mkdir(path, 0700);
+		*slash = '/';
+	}
+}
+
+// the index is a cache, so it's kept out of the directory with the database (which may be a source
+// tree): a file in $XDG_CACHE_HOME/yourfritz (default: ~/.cache/yourfritz, '/tmp' without a home
+// directory) with a hash of the database path in its name
+char * defaultIndexName(void)
+{
+	const char *		env;
+	const char *		base;
+	const char *		c;
+	char				directory[PATH_MAX];
+	char *				path;
+	char *				name;
+	uint32_t			hash = 2166136261U;
+
+	if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env == '/') snprintf(directory, sizeof(directory), "%s/yourfritz", env);
+	else if ((env = getenv("HOME")) != NULL && *env == '/' && strcmp(env, "/") != 0) snprintf(directory, sizeof(directory), "%s/.cache/yourfritz", env);
+	else strcpy(directory, "/tmp");
+
+	if ((path = realpath(databaseName, NULL)) == NULL && (path = strdup(databaseName)) == NULL) return NULL;
+	for (c = path; *c; c++) hash = (hash ^ (uint8_t) *c) * 16777619U;
+	base = ((base = strrchr(path, '/')) != NULL ? base + 1 : path);
+
+	if ((name = malloc(strlen(directory) + strlen(base) + 16 + sizeof(INDEX_SUFFIX))) != NULL)
+	{
+		sprintf(name, "%s/%s-%08x%s", directory, base, hash, INDEX_SUFFIX);
+		createIndexDirectory(name);
+	}
+
+	free(path);
+
+	return name;
+}
+
+bool openIndex(bool rebuild)
+{
+	struct stat			databaseStat;
+	struct stat			schemaStat;
+	struct stat			indexStat;
+	int					fd;
+
+	if (stat(databaseName, &databaseStat) == -1)
+	{
+		fprintf(stderr, "Missing feature database file '%s'.\n", databaseName);
+		return false;
+	}
+	if (stat(schemaName, &schemaStat) == -1)
+	{
+		fprintf(stderr, "Missing feature database schema '%s'.\n", schemaName);
+		return false;
+	}
+
+	if (!rebuild && (fd = open(indexName, O_RDONLY)) != -1)
+	{
+		// an index, which may be changed by somebody else, isn't used
+		if (fstat(fd, &indexStat) == 0 && indexStat.st_size > 0 && indexStat.st_uid == geteuid() && (indexStat.st_mode & (S_IWGRP | S_IWOTH)) == 0)
+		{
+			void *		mapped = mmap(NULL, indexStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (mapped != MAP_FAILED)
+			{
+				if (isCurrentIndex(mapped, indexStat.st_size, &databaseStat, &schemaStat))
+				{
+					indexData = mapped;
+					indexSize = indexStat.st_size;
+				}
+				else munmap(mapped, indexStat.st_size);
+			}
+		}
+		close(fd);
+	}
+
+	if (indexData == NULL)
+	{
+		uint8_t *		buffer;
+
+		if ((buffer = compileIndex(&databaseStat, &schemaStat, &indexSize)) == NULL) return false;
+		saveIndex(buffer, indexSize);
+		indexData = buffer;
+	}
+
+	header = (const struct indexHeader *) indexData;
+	strings = (const char *) indexData + header->stringsOffset;
+
+	return true;
+}
+
+const struct indexModel * getModel(uint32_t number)
+{
+	return &((const struct indexModel *) (indexData + header->modelsOffset))[number];
+}
+
+const struct indexName * getName(uint32_t number)
+{
+	return &((const struct indexName *) (indexData + header->namesOffset))[number];
+}
+
+const struct indexPair * getPair(uint32_t number)
+{
+	return &((const struct indexPair *) (indexData + header->pairsOffset))[number];
+}
+
+uint32_t getSorted(uint32_t number)
+{
+	return ((const uint32_t *) (indexData + header->sortedOffset))[number];
+}
+
+uint32_t findName(const char *name)
+{
+	uint32_t			low = 0;
+	uint32_t			high = header->nameCount;
+
+	while (low < high)
+	{
+		uint32_t		middle = (low + high) / 2;
+		int				order = strcmp(strings + getName(middle)->name, name);
+
+		if (order == 0) return middle;
+		if (order < 0) low = middle + 1;
+		else high = middle;
+	}
+
+	return NO_ENTRY;
+}
+
+// first position in the sorted range of the attribute with a value not less than the specified one
+uint32_t lowerBound(const struct indexName *name, const char *value)
+{
+	uint32_t			low = name->firstSorted;
+	uint32_t			high = name->firstSorted + name->sortedCount;
+
+	while (low < high)
+	{
+		uint32_t		middle = (low + high) / 2;
+
+		if (strcmp(strings + getPair(getSorted(middle))->value, value) < 0) low = middle + 1;
+		else high = middle;
+	}
+
+	return low;
+}
+
+// 'DeviceName' values are compared partially, all others have to be equal
+void findModels(const struct indexName *name, bool partial, const char *value, bool *matches)
+{
+	uint32_t			position;
+
+	if (partial)
+	{
+		for (position = name->firstSorted; position < name->firstSorted + name->sortedCount; position++)
+		{
+			const struct indexPair *	pair = getPair(getSorted(position));
+
+			if (strstr(strings + pair->value, value) != NULL) matches[pair->model] = true;
+		}
+		return;
+	}
+
+	for (position = lowerBound(name, value); position < name->firstSorted + name->sortedCount; position++)
+	{
+		const struct indexPair *	pair = getPair(getSorted(position));
+
+		if (strcmp(strings + pair->value, value) != 0) break;
+		matches[pair->model] = true;
+	}
+}
+
+void writeModel(uint32_t number, uint32_t valueName)
+{
+	const struct indexModel *	model = getModel(number);
+	uint32_t			i;
+
+	if (valueName == NO_ENTRY)
+	{
+		fwrite(strings + model->line, model->lineSize, 1, stdout);
+		return;
+	}
+
+	for (i = 0; i < model->pairCount; i++)
+	{
+		const struct indexPair *	pair = getPair(model->firstPair + i);
+
+		if (pair->name == valueName)
+		{
+			printf("%s\n", strings + pair->value);
+			break;
+		}
+	}
+}
+
+int main(int argc, char * argv[])
+{
+	const char *		attribute = NULL;
+	const char *		value = NULL;
+	const char *		valueAttribute = NULL;
+	uint32_t			valueName = NO_ENTRY;
+	bool				compileOnly = false;
+	const char *		env;
+	bool *				matches;
+	uint32_t			i;
+	int					opt;
+
+	if ((env = getenv("YF_FEATURE_DATABASE_FILE")) != NULL && *env) databaseName = env;
+	if ((env = getenv("YF_FEATURE_DATABASE_SCHEMA")) != NULL && *env) schemaName = env;
+	if ((env = getenv("YF_FEATURE_DATABASE_INDEX")) != NULL && *env) indexName = strdup(env);
+
+	while ((opt = getopt(argc, argv, "d:s:i:cv:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd':
+				databaseName = optarg;
+				break;
+
+			case 's':
+				schemaName = optarg;
+				break;
+
+			case 'i':
+				free(indexName);
+				indexName = strdup(optarg);
+				break;
+
+			case 'c':
+				compileOnly = true;
+				break;
+
+			case 'v':
+				valueAttribute = optarg;
+				break;
+
+			default:
+				usage();
+				exit(1);
+		}
+	}
+
+	if (argc - optind > 2)
+	{
+		fprintf(stderr, "Too much parameters.\n");
+		exit(1);
+	}
+	if (argc - optind == 2) attribute = argv[optind++];
+	if (argc - optind == 1) value = argv[optind++];
+	if (value != NULL && attribute == NULL) attribute = DEVICE_NAME;
+
+	if (indexName == NULL && (indexName = defaultIndexName()) == NULL) exit(1);
+
+	xmlInitParser();
+	if (!openIndex(compileOnly)) exit(1);
+	if (compileOnly) exit(0);
+
+	if (valueAttribute != NULL && (valueName = findName(valueAttribute)) == NO_ENTRY)
+	{
+		fprintf(stderr, "The specified attribute name '%s' was not found in the database.\n", valueAttribute);
+		exit(1);
+	}
+
+	if (attribute == NULL)
+	{
+		for (i = 0; i < header->modelCount; i++) writeModel(i, valueName);
+		exit(0);
+	}
+
+	if (findName(attribute) == NO_ENTRY)
+	{
+		fprintf(stderr, "The specified attribute name '%s' was not found in the database.\n", attribute);
+		exit(1);
+	}
+
+	// matches are collected first, the output uses the order from the database
+	if ((matches = calloc(header->modelCount + 1, sizeof(bool))) == NULL) exit(1);
+
+	findModels(getName(findName(attribute)), strcmp(attribute, DEVICE_NAME) == 0, value, matches);
+
+	for (i = 0; i < header->modelCount; i++)
+	{
+		if (matches[i]) writeModel(i, valueName);
+	}
+
+	exit(0);
+}
@@ -0,0 +1,1065 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2018 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <openssl/err.h>
+#include "signimage_pkcs1.h"
+
+// result codes are the same as the exit codes of 'juis_check'
+#define RESULT_FOUND				0
+#define RESULT_ERROR				1
+#define RESULT_NOT_FOUND			2
+#define RESULT_INCOMPLETE			3
+#define RESULT_BAD_RESPONSE			4
+#define RESULT_BAD_SIGNATURE		5
+
+#define JUIS_HOSTBASE				"jws.avm.de"
+#define JUIS_PORT					80
+#define JUIS_URL					"/Jason/UpdateInfoService"
+#define JUIS_TIMEOUT				20
+#define JUIS_NAMESPACE				"ns3"
+
+#define DEFAULT_THREADS				8
+#define DEFAULT_TTL					3600
+#define QUERY_BUCKETS				1024
+#define WORKER_CONNECTIONS			4
+#define SIGNATURE_MAX_SIZE			1024
+#define READ_CHUNK					16384
+
+// the names are the same as used by 'juis_check'
+enum queryField
+{
+	FIELD_NAME,
+	FIELD_HW,
+	FIELD_VERSION,
+	FIELD_SERIAL,
+	FIELD_OEM,
+	FIELD_LANG,
+	FIELD_ANNEX,
+	FIELD_COUNTRY,
+	FIELD_FLAG,
+	FIELD_PUBLIC,
+	FIELD_COUNT
+};
+
+static const char *	fieldNames[FIELD_COUNT] = { "Name", "HW", "Version", "Serial", "OEM", "Lang", "Annex", "Country", "Flag", "Public" };
+
+// one distinct tuple, identical lines from the input share the same query
+struct query
+{
+	char *				values[FIELD_COUNT];
+	char *				key;
+	char				cacheName[33];
+	char				host[256];
+	int					result;
+	bool				fromCache;
+	char *				version;
+	char *				url;
+	long				delay;
+	struct query *		nextInBucket;
+};
+
+struct checkLine
+{
+	char *				text;
+	struct query *		query;
+};
+
+struct checkJob
+{
+	struct checkLine *	lines;
+	size_t				lineCount;
+	struct query **		queries;
+	size_t				count;
+	size_t				next;
+	struct query *		buckets[QUERY_BUCKETS];
+	pthread_mutex_t		lock;
+	char *				defaults[FIELD_COUNT];
+	EVP_PKEY *			key;
+	uint8_t				keyDigest[32];		// SHA-256 of the public key, it's a part of the cache names
+	const char *		server;
+	unsigned int		port;
+	const char *		cacheDir;
+	long				ttl;
+	size_t				requests;
+	size_t				connections;
+	size_t				cached;
+};
+
+// a kept-alive connection, each worker owns a few of them for different hosts
+struct connection
+{
+	int					fd;
+	char				host[256];
+	char *				buffer;
+	size_t				size;
+	size_t				used;
+	unsigned long		lastUsed;
+};
+
+struct httpResponse
+{
+	int					status;
+	bool				close;
+	long				maxAge;
+	long				delay;
+	char *				body;
+	size_t				bodySize;
+};
+
+void usage()
+{
+	fprintf(stderr, "juis_batch_check - check many device/version tuples with AVM's JUIS at once\n\n");
+	fprintf(stderr, "(C) 2018 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "juis_batch_check [ -k <pem_file> | -n ] [ -c <cache_dir> [ -t <seconds> ] ] [ -j <threads> ]\n");
+	fprintf(stderr, "                 [ -s <server>[:<port>] ] [ -v <name>=<value> ]... [ -l <list_file> ]\n");
+	fprintf(stderr, "\nEach line of the list file (default: STDIN) describes one query with tab");
+	fprintf(stderr, "\nseparated <name>=<value> pairs, the names are the same as for 'juis_check'");
+	fprintf(stderr, "\n(Name, HW, Version, Serial, OEM, Lang, Annex, Country, Flag and Public).");
+	fprintf(stderr, "\nValues missing on a line are taken from the -v options.\n");
+	fprintf(stderr, "\nIdentical queries are sent only once, the queries are spread over the");
+	fprintf(stderr, "\nspecified number of threads (default: %u), each one keeps its connection", DEFAULT_THREADS);
+	fprintf(stderr, "\nalive between requests. Use -s to send all queries to another server.\n");
+	fprintf(stderr, "\nThe signature of each response is verified once with the public key from");
+	fprintf(stderr, "\nthe PEM file (default: juis_pubkey.pem), -n skips this check. Responses");
+	fprintf(stderr, "\nare kept in the cache directory for the time announced by the");
+	fprintf(stderr, "\nserver (Cache-Control: max-age) or for the time specified with -t");
+	fprintf(stderr, "\n(default: %u seconds).\n", DEFAULT_TTL);
+	fprintf(stderr, "\nOne line per input line is written to STDOUT with tab separated fields:");
+	fprintf(stderr, "\nthe input line, result code (like the exit code of 'juis_check', 5 for");
+	fprintf(stderr, "\nan invalid signature), source ('net' or 'cache'), the found version, the");
+	fprintf(stderr, "\ndownload URL and the download delay.\n");
+}
+
+uint32_t fnv1a(const char *text)
+{
+	uint32_t			hash = 2166136261U;
+
+	while (*text)
+	{
+		hash ^= (uint8_t) *text++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+int fieldIndex(const char *name, size_t length)
+{
+	int					i;
+
+	for (i = 0; i < FIELD_COUNT; i++)
+	{
+		if (strlen(fieldNames[i]) == length && strncasecmp(fieldNames[i], name, length) == 0) return i;
+	}
+
+	return -1;
+}
+
+bool setField(char **values, const char *pair)
+{
+	const char *		equal = strchr(pair, '=');
+	int					index;
+
+	if (equal == NULL || (index = fieldIndex(pair, equal - pair)) < 0) return false;
+	free(values[index]);
+	return ((values[index] = strdup(equal + 1)) != NULL);
+}
+
+struct query * addQuery(struct checkJob *job, char **values)
+{
+	struct query *		query;
+	struct query **		queries;
+	char				key[4096];
+	size_t				used = 0;
+	uint8_t				digest[EVP_MAX_MD_SIZE];
+	unsigned int		digestSize;
+	EVP_MD_CTX *		md;
+	uint32_t			bucket;
+	int					i;
+
+	for (i = 0; i < FIELD_COUNT; i++)
+	{
+		used += snprintf(key + used, sizeof(key) - used, "%s=%s\t", fieldNames[i], (values[i] ? values[i] : ""));
+		if (used >= sizeof(key)) return NULL;
+	}
+
+	bucket = fnv1a(key) % QUERY_BUCKETS;
+
+	for (query = job->buckets[bucket]; query != NULL; query = query->nextInBucket)
+	{
+		if (strcmp(query->key, key) == 0)
+		{
+			for (i = 0; i < FIELD_COUNT; i++) free(values[i]);
+			return query;
+		}
+	}
+
+	if ((query = calloc(1, sizeof(struct query))) == NULL) return NULL;
+	if ((queries = realloc(job->queries, (job->count + 1) * sizeof(struct query *))) == NULL) return NULL;
+	job->queries = queries;
+
+	memcpy(query->values, values, sizeof(query->values));
+	if ((query->key = strdup(key)) == NULL) return NULL;
+	query->delay = -1;
+
+	// responses verified with another key (or not verified at all) are cached with other names
+	if ((md = EVP_MD_CTX_new()) == NULL) return NULL;
+	EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+	EVP_DigestUpdate(md, key, strlen(key));
+	if (job->key) EVP_DigestUpdate(md, job->keyDigest, sizeof(job->keyDigest));
+	EVP_DigestFinal_ex(md, digest, &digestSize);
+	EVP_MD_CTX_free(md);
+	for (i = 0; i < 16; i++) sprintf(&query->cacheName[i * 2], "%02x", digest[i]);
+
+	snprintf(query->host, sizeof(query->host), "%s.%s", (values[FIELD_HW] ? values[FIELD_HW] : ""), JUIS_HOSTBASE);
+
+	query->nextInBucket = job->buckets[bucket];
+	job->buckets[bucket] = query;
+	job->queries[job->count++] = query;
+
+	return query;
+}
+
+bool readQueryList(struct checkJob *job, const char *listFile)
+{
+	FILE *				list = stdin;
+	char				line[4096];
+	bool				result = true;
+
+	if (strcmp(listFile, "-") != 0 && (list = fopen(listFile, "r")) == NULL)
+	{
+		fprintf(stderr, "Error %d opening query list '%s'.\n", errno, listFile);
+		return false;
+	}
+
+	while (result && fgets(line, sizeof(line), list) != NULL)
+	{
+		char *			values[FIELD_COUNT];
+		char			fields[4096];
+		char *			field;
+		char *			saved = NULL;
+		struct checkLine *	lines;
+		int				i;
+
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == 0 || line[0] == '#') continue;
+
+		for (i = 0; i < FIELD_COUNT; i++) values[i] = (job->defaults[i] ? strdup(job->defaults[i]) : NULL);
+
+		strcpy(fields, line);
+		for (field = strtok_r(fields, "\t", &saved); field != NULL; field = strtok_r(NULL, "\t", &saved))
+		{
+			if (!setField(values, field))
+			{
+				fprintf(stderr, "Invalid field '%s' in query list.\n", field);
+				result = false;
+				break;
+			}
+		}
+
+		if (!result) break;
+
+		if ((lines = realloc(job->lines, (job->lineCount + 1) * sizeof(struct checkLine))) == NULL) result = false;
+		else
+		{
+			job->lines = lines;
+			job->lines[job->lineCount].text = strdup(line);
+			if ((job->lines[job->lineCount].query = addQuery(job, values)) == NULL) result = false;
+			job->lineCount++;
+		}
+	}
+
+	if (list != stdin) fclose(list);
+
+	return result;
+}
+
+EVP_PKEY * loadPublicKey(const char *fileName)
+{
+	FILE *				file;
+	EVP_PKEY *			key;
+
+	if ((file = fopen(fileName, "r")) == NULL)
+	{
+		fprintf(stderr, "Error %d opening public key file '%s'.\n", errno, fileName);
+		return NULL;
+	}
+
+	key = PEM_read_PUBKEY(file, NULL, NULL, NULL);
+	fclose(file);
+
+	if (key == NULL || EVP_PKEY_base_id(key) != EVP_PKEY_RSA)
+	{
+		fprintf(stderr, "The file '%s' doesn't contain a public RSA key in PEM format.\n", fileName);
+		EVP_PKEY_free(key);
+		return NULL;
+	}
+
+	return key;
+}
+
+bool publicKeyDigest(EVP_PKEY *key, uint8_t *digest)
+{
+	unsigned char *		der = NULL;
+	int					size;
+	bool				result;
+
+	if ((size = i2d_PUBKEY(key, &der)) <= 0) return false;
+	result = (EVP_Digest(der, size, digest, NULL, EVP_sha256(), NULL) == 1);
+	OPENSSL_free(der);
+
+	return result;
+}
+
+// characters with a special meaning in XML are replaced by entities
+size_t appendXml(char *output, size_t size, const char *value)
+{
+	size_t				used = 0;
+
+	for (; value && *value && used + 7 < size; value++)
+	{
+		switch (*value)
+		{
+			case '&': used += sprintf(output + used, "&amp;"); break;
+			case '<': used += sprintf(output + used, "&lt;"); break;
+			case '>': used += sprintf(output + used, "&gt;"); break;
+			default: output[used++] = *value; break;
+		}
+	}
+	output[used] = 0;
+
+	return used;
+}
+
+// the same SOAP body as from 'juis_check'
+bool buildRequest(const struct query *query, const char *nonce, char *output, size_t size)
+{
+	unsigned int		major = 0, minor = 0, patch = 0;
+	char				buildnumber[32] = "";
+	char				escaped[FIELD_COUNT][512];
+	char				flags[1024] = "";
+	char				flagList[512];
+	char *				flag;
+	char *				saved = NULL;
+	size_t				flagsUsed = 0;
+	int					i;
+
+	if (query->values[FIELD_HW] == NULL || query->values[FIELD_VERSION] == NULL) return false;
+	if (sscanf(query->values[FIELD_VERSION], "%u.%u.%u-%31s", &major, &minor, &patch, buildnumber) < 3) return false;
+
+	for (i = 0; i < FIELD_COUNT; i++) appendXml(escaped[i], sizeof(escaped[i]), query->values[i]);
+
+	snprintf(flagList, sizeof(flagList), "%s", escaped[FIELD_FLAG]);
+	for (flag = strtok_r(flagList, ", ", &saved); flag != NULL; flag = strtok_r(NULL, ", ", &saved))
+	{
+		flagsUsed += snprintf(flags + flagsUsed, sizeof(flags) - flagsUsed, "%s%s", (flagsUsed ? "</q:Flag><q:Flag>" : ""), flag);
+		if (flagsUsed >= sizeof(flags)) return false;
+	}
+
+	return ((size_t) snprintf(output, size,
+		"<soap:Envelope xmlns:soap=\"http://schemas.xmlsoap.org/soap/envelope/\" xmlns:soap-enc=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\" xmlns:e=\"http://juis.avm.de/updateinfo\" xmlns:q=\"http://juis.avm.de/request\">\n"
+		"  <soap:Header/>\n"
+		"  <soap:Body>\n"
+		"    <e:BoxFirmwareUpdateCheck>\n"
+		"      <e:RequestHeader>\n"
+		"        <q:Nonce>%s</q:Nonce>\n"
+		"        <q:UserAgent>Box</q:UserAgent>\n"
+		"        <q:ManualRequest>true</q:ManualRequest>\n"
+		"      </e:RequestHeader>\n"
+		"      <e:BoxInfo>\n"
+		"        <q:Name>%s</q:Name>\n"
+		"        <q:HW>%s</q:HW>\n"
+		"        <q:Major>%u</q:Major>\n"
+		"        <q:Minor>%u</q:Minor>\n"
+		"        <q:Patch>%u</q:Patch>\n"
+		"        <q:Buildnumber>%s</q:Buildnumber>\n"
+		"        <q:Buildtype>100%s</q:Buildtype>\n"
+		"        <q:Serial>%s</q:Serial>\n"
+		"        <q:OEM>%s</q:OEM>\n"
+		"        <q:Lang>%s</q:Lang>\n"
+		"        <q:Country>%s</q:Country>\n"
+		"        <q:Annex>%s</q:Annex>\n"
+		"        <q:Flag>%s</q:Flag>\n"
+		"        <q:UpdateConfig>1</q:UpdateConfig>\n"
+		"        <q:Provider>oma_lan</q:Provider>\n"
+		"      </e:BoxInfo>\n"
+		"    </e:BoxFirmwareUpdateCheck>\n"
+		"  </soap:Body>\n"
+		"</soap:Envelope>\n",
+		nonce, escaped[FIELD_NAME], escaped[FIELD_HW], major, minor, patch, buildnumber,
+		(query->values[FIELD_PUBLIC] && *query->values[FIELD_PUBLIC] ? escaped[FIELD_PUBLIC] : "1"),
+		escaped[FIELD_SERIAL], escaped[FIELD_OEM], escaped[FIELD_LANG], escaped[FIELD_COUNTRY], escaped[FIELD_ANNEX], flags) < size);
+}
+
+// find '<ns3:tag>' and return the start of its content and the position of the closing tag
+const char * findElement(const char *body, size_t size, const char *tag, const char **end)
+{
+	char				open[64];
+	char				close[64];
+	const char *		start;
+
+	snprintf(open, sizeof(open), "<%s:%s>", JUIS_NAMESPACE, tag);
+	snprintf(close, sizeof(close), "</%s:%s>", JUIS_NAMESPACE, tag);
+
+	if ((start = memmem(body, size, open, strlen(open))) == NULL) return NULL;
+	start += strlen(open);
+	if ((*end = memmem(start, size - (start - body), close, strlen(close))) == NULL) return NULL;
+
+	return start;
+}
+
+char * extractElement(const char *body, size_t size, const char *tag)
+{
+	const char *		end;
+	const char *		start = findElement(body, size, tag, &end);
+
+	return (start ? strndup(start, end - start) : NULL);
+}
+
+// the signature covers the whole response with its own element removed, it's checked like an
+// image signature (see 'batch_check_signed_image') for each of the accepted hash algorithms
+int verifyResponse(EVP_PKEY *key, const char *body, size_t size, const char *nonce)
+{
+	const EVP_MD *		md[] = { EVP_sha256(), EVP_sha384(), EVP_sha512() };
+	uint8_t				digests[sizeof(md) / sizeof(md[0])][EVP_MAX_MD_SIZE];
+	const char *		sigStart;
+	const char *		sigEnd;
+	const char *		elementStart;
+	const char *		elementEnd;
+	uint8_t				signature[SIGNATURE_MAX_SIZE];
+	char *				echoed;
+	EVP_MD_CTX *		ctx;
+	int					signatureSize;
+	size_t				i;
+
+	// a response to another request (or without a nonce) may not be replayed
+	if ((echoed = extractElement(body, size, "Nonce")) == NULL) return RESULT_BAD_SIGNATURE;
+	if (strcmp(echoed, nonce) != 0)
+	{
+		free(echoed);
+		return RESULT_BAD_SIGNATURE;
+	}
+	free(echoed);
+
+	if ((sigStart = findElement(body, size, "Signature", &sigEnd)) == NULL) return RESULT_BAD_SIGNATURE;
+	if ((size_t) (sigEnd - sigStart) > (SIGNATURE_MAX_SIZE / 4) * 3) return RESULT_BAD_SIGNATURE;
+
+	elementStart = sigStart - strlen("<" JUIS_NAMESPACE ":Signature>");
+	elementEnd = sigEnd + strlen("</" JUIS_NAMESPACE ":Signature>");
+
+	if ((signatureSize = EVP_DecodeBlock(signature, (const unsigned char *) sigStart, sigEnd - sigStart)) < 0) return RESULT_BAD_SIGNATURE;
+	if (sigEnd - sigStart >= 2 && sigEnd[-1] == '=') signatureSize--;
+	if (sigEnd - sigStart >= 2 && sigEnd[-2] == '=') signatureSize--;
+
+	if ((ctx = EVP_MD_CTX_new()) == NULL) return RESULT_BAD_SIGNATURE;
+
+	for (i = 0; i < sizeof(md) / sizeof(md[0]); i++)
+	{
+		EVP_DigestInit_ex(ctx, md[i], NULL);
+		EVP_DigestUpdate(ctx, body, elementStart - body);
+		EVP_DigestUpdate(ctx, elementEnd, size - (elementEnd - body));
+		EVP_DigestFinal_ex(ctx, digests[i], NULL);
+	}
+	EVP_MD_CTX_free(ctx);
+
+	if (verifyPkcs1Signature(key, signature, signatureSize, sizeof(md) / sizeof(md[0]), md, digests, NULL) != PKCS1_VERIFIED)
+		return RESULT_BAD_SIGNATURE;
+
+	return RESULT_FOUND;
+}
+
+void evaluateResponse(struct query *query, const char *body, size_t size)
+{
+	char *				found = extractElement(body, size, "Found");
+
+	if (found == NULL)
+	{
+		query->result = RESULT_BAD_RESPONSE;
+		return;
+	}
+
+	if (strcmp(found, "true") == 0)
+	{
+		query->result = RESULT_FOUND;
+		query->version = extractElement(body, size, "Version");
+		query->url = extractElement(body, size, "DownloadURL");
+	}
+	else query->result = RESULT_NOT_FOUND;
+
+	free(found);
+}
+
+void closeConnection(struct connection *conn)
+{
+	if (conn->fd != -1) close(conn->fd);
+	conn->fd = -1;
+	conn->used = 0;
+}
+
+bool openConnection(struct checkJob *job, struct connection *conn, const char *host)
+{
+	struct addrinfo		hints;
+	struct addrinfo *	addresses;
+	struct addrinfo *	address;
+	struct timeval		timeout = { JUIS_TIMEOUT, 0 };
+	char				port[16];
+	int					one = 1;
+
+	if (conn->fd != -1 && strcmp(conn->host, host) == 0) return true;
+
+	closeConnection(conn);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port, sizeof(port), "%u", job->port);
+
+	if (getaddrinfo((job->server ? job->server : host), port, &hints, &addresses) != 0) return false;
+
+	for (address = addresses; address != NULL; address = address->ai_next)
+	{
+		if ((conn->fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol)) == -1) continue;
+		setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (connect(conn->fd, address->ai_addr, address->ai_addrlen) == 0) break;
+		close(conn->fd);
+		conn->fd = -1;
+	}
+
+	freeaddrinfo(addresses);
+
+	if (conn->fd == -1) return false;
+
+	snprintf(conn->host, sizeof(conn->host), "%s", host);
+
+	pthread_mutex_lock(&job->lock);
+	job->connections++;
+	pthread_mutex_unlock(&job->lock);
+
+	return true;
+}
+
+// read more data into the connection buffer, returns false on EOF or error
+bool fillBuffer(struct connection *conn)
+{
+	ssize_t				got;
+
+	if (conn->size - conn->used < READ_CHUNK)
+	{
+		char *			buffer = realloc(conn->buffer, conn->size + READ_CHUNK * 4);
+
+		if (buffer == NULL) return false;
+		conn->buffer = buffer;
+		conn->size += READ_CHUNK * 4;
+	}
+
+	while ((got = read(conn->fd, conn->buffer + conn->used, conn->size - conn->used - 1)) == -1 && errno == EINTR);
+	if (got <= 0) return false;
+
+	conn->used += got;
+	conn->buffer[conn->used] = 0;
+
+	return true;
+}
+
+// remove consumed data from the connection buffer
+void consumeBuffer(struct connection *conn, size_t size)
+{
+	memmove(conn->buffer, conn->buffer + size, conn->used - size);
+	conn->used -= size;
+	conn->buffer[conn->used] = 0;
+}
+
+bool appendBody(struct httpResponse *response, const char *data, size_t size)
+{
+	char *				body = realloc(response->body, response->bodySize + size + 1);
+
+	if (body == NULL) return false;
+	response->body = body;
+	memcpy(response->body + response->bodySize, data, size);
+	response->bodySize += size;
+	response->body[response->bodySize] = 0;
+
+	return true;
+}
+
+bool readResponse(struct connection *conn, struct httpResponse *response)
+{
+	char *				headerEnd;
+	char *				line;
+	long				contentLength = -1;
+	bool				chunked = false;
+	size_t				headerSize;
+
+	memset(response, 0, sizeof(struct httpResponse));
+	response->maxAge = -1;
+	response->delay = -1;
+
+	while ((headerEnd = strstr(conn->buffer ? conn->buffer : "", "\r\n\r\n")) == NULL)
+	{
+		if (!fillBuffer(conn)) return false;
+	}
+
+	*headerEnd = 0;
+	headerSize = headerEnd - conn->buffer + 4;
+
+	if (sscanf(conn->buffer, "HTTP/%*u.%*u %d", &response->status) != 1) return false;
+	if (strncmp(conn->buffer, "HTTP/1.0", 8) == 0) response->close = true;
+
+	for (line = strstr(conn->buffer, "\r\n"); line != NULL; line = strstr(line, "\r\n"))
+	{
+		const char *	value;
+
+		line += 2;
+		if ((value = strchr(line, ':')) == NULL) continue;
+		for (value++; *value == ' '; value++);
+
+		if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atol(value);
+		else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) chunked = (strncasecmp(value, "chunked", 7) == 0);
+		else if (strncasecmp(line, "Connection:", 11) == 0) response->close = (strncasecmp(value, "close", 5) == 0);
+		else if (strncasecmp(line, "Download-Delay:", 15) == 0) response->delay = atol(value);
+		else if (strncasecmp(line, "Cache-Control:", 14) == 0)
+		{
+			const char *	maxAge = strstr(value, "max-age=");
+
+			if (maxAge) response->maxAge = atol(maxAge + 8);
+		}
+	}
+
+	consumeBuffer(conn, headerSize);
+
+	if (chunked)
+	{
+		while (true)
+		{
+			char *		end;
+			size_t		chunkSize;
+
+			while ((end = strstr(conn->buffer, "\r\n")) == NULL)
+			{
+				if (!fillBuffer(conn)) return false;
+			}
+
+			chunkSize = strtoul(conn->buffer, NULL, 16);
+			consumeBuffer(conn, end - conn->buffer + 2);
+
+			while (conn->used < chunkSize + 2)
+			{
+				if (!fillBuffer(conn)) return false;
+			}
+
+			if (!appendBody(response, conn->buffer, chunkSize)) return false;
+			consumeBuffer(conn, chunkSize + 2);
+
+			// trailers aren't expected, the empty line after the last chunk was consumed above
+			if (chunkSize == 0) break;
+		}
+	}
+	else if (contentLength >= 0)
+	{
+		while (conn->used < (size_t) contentLength)
+		{
+			if (!fillBuffer(conn)) return false;
+		}
+
+		if (!appendBody(response, conn->buffer, contentLength)) return false;
+		consumeBuffer(conn, contentLength);
+	}
+	else
+	{
+		// the body ends with the connection
+		while (fillBuffer(conn));
+		if (!appendBody(response, conn->buffer, conn->used)) return false;
+		conn->used = 0;
+		response->close = true;
+	}
+
+	if (!response->body && !appendBody(response, "", 0)) return false;
+
+	return true;
+}
+
+bool sendRequest(struct checkJob *job, struct connection *conn, const struct query *query, const char *body)
+{
+	char				header[1024];
+	size_t				headerSize;
+	size_t				bodySize = strlen(body);
+	struct iovec		parts[2];
+
+	headerSize = snprintf(header, sizeof(header),
+		"POST %s HTTP/1.1\r\n"
+		"Host: %s:%u\r\n"
+		"Content-Length: %zu\r\n"
+		"Content-Type: text/xml; charset=\"utf-8\"\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n", JUIS_URL, query->host, job->port, bodySize);
+
+	parts[0].iov_base = header;
+	parts[0].iov_len = headerSize;
+	parts[1].iov_base = (void *) body;
+	parts[1].iov_len = bodySize;
+
+	return (writev(conn->fd, parts, 2) == (ssize_t) (headerSize + bodySize));
+}
+
+void cacheFileName(struct checkJob *job, const struct query *query, char *fileName, size_t size)
+{
+	snprintf(fileName, size, "%s/%s", job->cacheDir, query->cacheName);
+}
+
+// a cache file contains a line with expiration time and download delay, followed by the response
+bool readCache(struct checkJob *job, struct query *query)
+{
+	char				fileName[4096];
+	FILE *				file;
+	long				expires;
+	char *				body = NULL;
+	size_t				size = 0;
+	size_t				got;
+
+	if (job->cacheDir == NULL) return false;
+
+	cacheFileName(job, query, fileName, sizeof(fileName));
+	if ((file = fopen(fileName, "r")) == NULL) return false;
+
+	if (fscanf(file, "%ld %ld\n", &expires, &query->delay) != 2 || expires < time(NULL))
+	{
+		fclose(file);
+		return false;
+	}
+
+	do
+	{
+		char *			grown = realloc(body, size + READ_CHUNK + 1);
+
+		if (grown == NULL)
+		{
+			free(body);
+			fclose(file);
+			return false;
+		}
+		body = grown;
+		got = fread(body + size, 1, READ_CHUNK, file);
+		size += got;
+	} while (got > 0);
+
+	fclose(file);
+	body[size] = 0;
+
+	evaluateResponse(query, body, size);
+	free(body);
+
+	query->fromCache = true;
+
+	pthread_mutex_lock(&job->lock);
+	job->cached++;
+	pthread_mutex_unlock(&job->lock);
+
+	return true;
+}
+
+void writeCache(struct checkJob *job, const struct query *query, const struct httpResponse *response)
+{
+	char				fileName[4096];
+	char				tempName[4096 + 32];
+	FILE *				file;
+	long				ttl = (response->maxAge >= 0 ? response->maxAge : job->ttl);
+	bool				written;
+
+	if (job->cacheDir == NULL || ttl == 0) return;
+
+	cacheFileName(job, query, fileName, sizeof(fileName));
+	snprintf(tempName, sizeof(tempName), "%s.%lu.tmp", fileName, (unsigned long) pthread_self());
+
+	if ((file = fopen(tempName, "w")) == NULL) return;
+
+	written = (fprintf(file, "%ld %ld\n", (long) time(NULL) + ttl, response->delay) > 0);
+	written = written && (fwrite(response->body, 1, response->bodySize, file) == response->bodySize);
+
+	if (fclose(file) == 0 && written) rename(tempName, fileName);
+	else unlink(tempName);
+}
+
+void checkQuery(struct checkJob *job, struct connection *conn, struct query *query)
+{
+	uint8_t				random[16];
+	char				nonce[32];
+	char				body[8192];
+	struct httpResponse	response;
+	int					attempt;
+
+	if (readCache(job, query)) return;
+
+	RAND_bytes(random, sizeof(random));
+	EVP_EncodeBlock((unsigned char *) nonce, random, sizeof(random));
+
+	if (!buildRequest(query, nonce, body, sizeof(body)))
+	{
+		query->result = RESULT_INCOMPLETE;
+		return;
+	}
+
+	query->result = RESULT_ERROR;
+
+	// a kept-alive connection may have been closed by the server meanwhile, so we try it twice
+	for (attempt = 0; attempt < 2; attempt++)
+	{
+		if (!openConnection(job, conn, query->host)) return;
+
+		if (sendRequest(job, conn, query, body) && readResponse(conn, &response)) break;
+
+		closeConnection(conn);
+		if (attempt == 1) return;
+	}
+
+	pthread_mutex_lock(&job->lock);
+	job->requests++;
+	pthread_mutex_unlock(&job->lock);
+
+	if (response.close) closeConnection(conn);
+
+	if (response.status != 200)
+	{
+		query->result = RESULT_BAD_RESPONSE;
+	}
+	else if (job->key && verifyResponse(job->key, response.body, response.bodySize, nonce) != RESULT_FOUND)
+	{
+		query->result = RESULT_BAD_SIGNATURE;
+	}
+	else
+	{
+		query->delay = response.delay;
+		evaluateResponse(query, response.body, response.bodySize);
+		if (query->result != RESULT_BAD_RESPONSE) writeCache(job, query, &response);
+	}
+
+	free(response.body);
+}
+
+// the connection to the host of this query or the least recently used one
+struct connection * selectConnection(struct connection *conns, const char *host, unsigned long now)
+{
+	struct connection *	selected = &conns[0];
+	int					i;
+
+	for (i = 0; i < WORKER_CONNECTIONS; i++)
+	{
+		if (conns[i].fd != -1 && strcmp(conns[i].host, host) == 0)
+		{
+			selected = &conns[i];
+			break;
+		}
+		if (conns[i].lastUsed < selected->lastUsed) selected = &conns[i];
+	}
+
+	selected->lastUsed = now;
+
+	return selected;
+}
+
+void * checkWorker(void *arg)
+{
+	struct checkJob *	job = (struct checkJob *) arg;
+	struct connection	conns[WORKER_CONNECTIONS];
+	unsigned long		used = 0;
+	size_t				index;
+	int					i;
+
+	memset(conns, 0, sizeof(conns));
+	for (i = 0; i < WORKER_CONNECTIONS; i++) conns[i].fd = -1;
+
+	while (true)
+	{
+		pthread_mutex_lock(&job->lock);
+		index = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (index >= job->count) break;
+		checkQuery(job, selectConnection(conns, job->queries[index]->host, ++used), job->queries[index]);
+	}
+
+	for (i = 0; i < WORKER_CONNECTIONS; i++)
+	{
+		closeConnection(&conns[i]);
+		free(conns[i].buffer);
+	}
+
+	return NULL;
+}
+
+// queries for the same host are processed one after another, so connections may be reused
+int compareQueries(const void *left, const void *right)
+{
+	return strcmp((*(struct query **) left)->host, (*(struct query **) right)->host);
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 0;
+	const char *		keyFile = "juis_pubkey.pem";
+	const char *		listFile = "-";
+	bool				verify = true;
+	struct checkJob		job;
+	long				threadCount = DEFAULT_THREADS;
+	pthread_t *			threads;
+	char *				colon;
+	size_t				i;
+	int					arg;
+
+	memset(&job, 0, sizeof(job));
+	pthread_mutex_init(&job.lock, NULL);
+	job.port = JUIS_PORT;
+	job.ttl = DEFAULT_TTL;
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc) keyFile = argv[++arg];
+		else if (strcmp(argv[arg], "-n") == 0) verify = false;
+		else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc) job.cacheDir = argv[++arg];
+		else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) job.ttl = atol(argv[++arg]);
+		else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) threadCount = atol(argv[++arg]);
+		else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) listFile = argv[++arg];
+		else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc)
+		{
+			job.server = argv[++arg];
+			if ((colon = strrchr(job.server, ':')) != NULL)
+			{
+				*colon = 0;
+				job.port = atoi(colon + 1);
+			}
+		}
+		else if (strcmp(argv[arg], "-v") == 0 && arg + 1 < argc)
+		{
+			if (!setField(job.defaults, argv[++arg]))
+			{
+				fprintf(stderr, "Invalid setting '%s' specified.\n", argv[arg]);
+				exit(1);
+			}
+		}
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (verify && (job.key = loadPublicKey(keyFile)) == NULL) exit(1);
+	if (job.key != NULL && !publicKeyDigest(job.key, job.keyDigest)) exit(1);
+
+	if (job.cacheDir != NULL && mkdir(job.cacheDir, 0755) == -1 && errno != EEXIST)
+	{
+		fprintf(stderr, "Error %d creating cache directory '%s'.\n", errno, job.cacheDir);
+		exit(1);
+	}
+
+	if (!readQueryList(&job, listFile)) exit(1);
+
+	if (job.lineCount == 0)
+	{
+		usage();
+		exit(1);
+	}
+
+	qsort(job.queries, job.count, sizeof(struct query *), compareQueries);
+
+	if (threadCount < 1) threadCount = 1;
+	if ((size_t) threadCount > job.count) threadCount = job.count;
+
+	if ((threads = calloc(threadCount, sizeof(pthread_t))) == NULL) exit(1);
+
+	for (i = 0; i < (size_t) threadCount; i++)
+	{
+		if (pthread_create(&threads[i], NULL, checkWorker, &job) != 0)
+		{
+			fprintf(stderr, "Error creating worker thread, continuing with %zu thread(s).\n", i);
+			threadCount = i;
+			break;
+		}
+	}
+
+	if (threadCount == 0) checkWorker(&job);
+	for (i = 0; i < (size_t) threadCount; i++) pthread_join(threads[i], NULL);
+
+	for (i = 0; i < job.lineCount; i++)
+	{
+		struct query *	query = job.lines[i].query;
+
+		fprintf(stdout, "%s\t%d\t%s\t%s\t%s\t", job.lines[i].text, query->result, (query->fromCache ? "cache" : "net"),
+			(query->version ? query->version : "-"), (query->url ? query->url : "-"));
+		if (query->delay >= 0) fprintf(stdout, "%ld\n", query->delay);
+		else fprintf(stdout, "-\n");
+
+		if (query->result != RESULT_FOUND && query->result != RESULT_NOT_FOUND && query->result > returnCode) returnCode = query->result;
+		free(job.lines[i].text);
+	}
+
+	fprintf(stderr, "%zu line(s), %zu distinct queries, %zu from cache, %zu request(s) on %zu connection(s)\n",
+		job.lineCount, job.count, job.cached, job.requests, job.connections);
+
+	for (i = 0; i < job.count; i++)
+	{
+		int				j;
+
+		for (j = 0; j < FIELD_COUNT; j++) free(job.queries[i]->values[j]);
+		free(job.queries[i]->key);
+		free(job.queries[i]->version);
+		free(job.queries[i]->url);
+		free(job.queries[i]);
+	}
+
+	for (i = 0; i < FIELD_COUNT; i++) free(job.defaults[i]);
+	free(job.queries);
+	free(job.lines);
+	free(threads);
+	EVP_PKEY_free(job.key);
+	pthread_mutex_destroy(&job.lock);
+
+	exit(returnCode);
+}
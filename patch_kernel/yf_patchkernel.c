@@ -6,7 +6,7 @@
  * @see         https://www.ip-phone-forum.de/threads/fritz-os7-openvpn-auf-7590-kein-tun-      *
  *              modul.300433/page-3#post-2309487                                                *
  * @brief       patch kernel instructions while loading this module                             *
- * @version     0.2                                                                             *
+ * @version     0.3                                                                             *
  * @author      PeH                                                                             *
  * @date        17.01.2019                                                                      *
  *                                                                                              *
@@ -30,6 +30,16 @@
  * running kernel and replaces them (in case of a hit) with another instruction (only in-place  *
  * patches are supported).                                                                      *
  *                                                                                              *
+ * Additional patches may be loaded at runtime via 'debugfs' - every patch gets its own index   *
+ * and may be applied or reversed separately. The following files are created below the        *
+ * 'yf_patchkernel' directory of a mounted 'debugfs' instance:                                  *
+ *                                                                                              *
+ * load    - write one or more binary descriptors (struct patchDescriptor, native byte order)   *
+ *           here, each complete descriptor is added as a new (not yet applied) patch entry     *
+ * control - write 'apply <index>' or 'revert <index>' to this file                             *
+ * state   - read the state of all patches (index, symbol, address, original value, hit or      *
+ *           miss and the time needed to apply the patch in nanoseconds)                        *
+ *                                                                                              *
  ************************************************************************************************
 */
 
@@ -46,11 +56,18 @@
 #include <linux/init.h>
 #include <linux/skbuff.h>
 #include <linux/kallsyms.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <asm/cacheflush.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Peter Haemmerlein");
 MODULE_DESCRIPTION("Patches some forgotten AVM traps on MIPS kernels.");
-MODULE_VERSION("0.2");
+MODULE_VERSION("0.3");
 
 #define MIPS_NOP       0x00000000 // it's a shift instruction, which does nothing: sll zero, zero, 0
 #define MIPS_ADDIU     0x24000000 // add immediate value to RS and store the result in RT
@@ -71,6 +88,15 @@ MODULE_VERSION("0.2");
 
 #define YF_INFO(args...) pr_info("[%s] ",__this_module.name);pr_cont(args)
 
+#define YF_MAX_RUNTIME_PATCHES  32         // maximum number of patches, which may be loaded at runtime
+#define YF_DESCRIPTOR_MAGIC     0x59465044 // 'YFPD' as value in native byte order
+#define YF_SYMBOL_NAME_LEN      64         // maximum length of a symbol name in a descriptor, including the final NUL
+#define YF_MAX_OFFSET           1024       // upper limit for each offset and count (in instructions) in a descriptor
+
+#define YF_STATE_UNTRIED        0          // patch wasn't tried to apply yet
+#define YF_STATE_HIT            1          // instruction to patch was found (and patched)
+#define YF_STATE_MISS           2          // symbol or instruction wasn't found
+
 typedef struct patchEntry
 {
 	unsigned char   *fname;         // kernel symbol name, where to start with a search
@@ -89,10 +115,33 @@ typedef struct patchEntry
 	unsigned int    *patchAddress;  // the address, where the change was applied
 	unsigned int    originalValue;  // the original value prior to patching
 	int             isPatched;      // not zero, if this patch was applied successfully
+	int             lastResult;     // YF_STATE_* value from last try to apply this patch
+	s64             applyTime;      // nanoseconds needed for the last try to apply this patch
 } patchEntry_t;
 
+// binary layout of a patch descriptor written to 'load' file, all values in native byte order
+
+typedef struct patchDescriptor
+{
+	u32             magic;                      // YF_DESCRIPTOR_MAGIC
+	char            fname[YF_SYMBOL_NAME_LEN];  // kernel symbol name, NUL terminated
+	u32             startOffset;                // see patchEntry for the meaning of the following members
+	u32             maxOffset;
+	u32             lookFor;
+	u32             andMask;
+	u32             orMask;
+	u32             verifyOffset;
+	u32             verifyValue;
+	u32             verifyAndMask;
+	u32             verifyOrMask;
+	u32             patchOffset;
+	u32             patchValue;
+} __attribute__((packed)) patchDescriptor_t;
+
 static unsigned int yf_patchkernel_patch(patchEntry_t *);
 static void yf_patchkernel_restore(patchEntry_t *);
+static int yf_patchkernel_apply_one(patchEntry_t *);
+static int yf_patchkernel_revert_one(patchEntry_t *);
 
 // entries to patch for TUN device on 7490/75x0 devices, starting with FRITZ!OS version 07.0x
 
@@ -131,67 +180,133 @@ static patchEntry_t patchesForTunDevice[] = {
 	}
 };
 
+// entries loaded at runtime via 'debugfs', the symbol names are stored separately
+
+static patchEntry_t runtimePatches[YF_MAX_RUNTIME_PATCHES + 1];
+static unsigned char runtimeNames[YF_MAX_RUNTIME_PATCHES][YF_SYMBOL_NAME_LEN];
+static unsigned int runtimePatchCount = 0;
+
 static unsigned int	patches_applied = 0;	// number of patches applied successfully
 
-static unsigned int yf_patchkernel_patch(patchEntry_t *patches)
+static DEFINE_MUTEX(yf_patchkernel_lock);	// serializes changes from 'debugfs' and module exit
+static struct dentry *yf_patchkernel_dir = NULL;
+
+// number of bytes, which may be accessed from the symbol start, while searching and patching
+
+static unsigned long yf_patchkernel_window(patchEntry_t *patch)
 {
-	unsigned int	patches_applied = 0;
-	patchEntry_t	*patch = patches;
+	unsigned int	extra = (patch->verifyOffset > patch->patchOffset ? patch->verifyOffset : patch->patchOffset);
+
+	return ((unsigned long)patch->startOffset + patch->maxOffset + extra) * sizeof(unsigned int);
+}
+
+// the size of a symbol from the 'name+offset/size' format of sprint_symbol, 0 if it's unknown
+
+static unsigned long yf_patchkernel_symbol_size(unsigned int *address)
+{
+	char			buffer[KSYM_SYMBOL_LEN];
+	char			*size;
 
+	sprint_symbol(buffer, (unsigned long)address);
+	if ((size = strchr(buffer, '/')) == NULL) return 0;
+
+	return simple_strtoul(size + 1, NULL, 16);
+}
+
+static int yf_patchkernel_apply_one(patchEntry_t *patch)
+{
+	unsigned long	size;
 	unsigned int	*ptr;
 	unsigned int	offset;
 	unsigned int	value;
 	unsigned int	orgValue;
 	unsigned int	verify;
+	ktime_t			start = ktime_get();
 
-	while (patch->fname)
+	if (patch->isPatched)
 	{
-		ptr = (unsigned int *)kallsyms_lookup_name(patch->fname);
+		YF_INFO("Patch for '%s' was applied already at address %#010x.\n", patch->fname, (unsigned int)(patch->patchAddress));
+		return 0;
+	}
 
-		if (!ptr)
-		{
-			YF_INFO("Unable to locate kernel symbol '%s', patch skipped.\n", patch->fname);
-		}
-		else
+	patch->lastResult = YF_STATE_MISS;
+	ptr = (unsigned int *)kallsyms_lookup_name(patch->fname);
+
+	if (!ptr)
+	{
+		YF_INFO("Unable to locate kernel symbol '%s', patch skipped.\n", patch->fname);
+	}
+	else if ((size = yf_patchkernel_symbol_size(ptr)) == 0 || yf_patchkernel_window(patch) > size)
+	{
+		YF_INFO("Patch for '%s' needs %lu bytes, but the symbol size is %lu bytes, patch skipped.\n", patch->fname, yf_patchkernel_window(patch), size);
+	}
+	else
+	{
+		YF_INFO("Patching kernel function '%s' at address %#010x.\n", patch->fname, (unsigned int)ptr);
+
+		for (offset = 0, patch->startAddress = ptr, ptr += patch->startOffset; offset < patch->maxOffset; offset++, ptr++)
 		{
-			YF_INFO("Patching kernel function '%s' at address %#010x.\n", patch->fname, (unsigned int)ptr);
+			value = (*ptr & patch->andMask) | patch->orMask;
+			orgValue = *(ptr + patch->patchOffset);
 
-			for (offset = 0, patch->startAddress = ptr, ptr += patch->startOffset; offset < patch->maxOffset; offset++, ptr++)
+			if (orgValue == patch->patchValue)
 			{
-				value = (*ptr & patch->andMask) | patch->orMask;
-				orgValue = *(ptr + patch->patchOffset);
+				YF_INFO("Found patched instruction (%#010x) at address %#010x, looks like this patch was applied already or is not necessary.\n", orgValue, (unsigned int)(ptr + patch->patchOffset));
+				break;
+			}
 
-				if (orgValue == patch->patchValue)
+			if (value == patch->lookFor)
+			{
+				if (patch->verifyOffset != 0)
 				{
-					YF_INFO("Found patched instruction (%#010x) at address %#010x, looks like this patch was applied already or is not necessary.\n", orgValue, (unsigned int)(ptr + patch->patchOffset));
-					break;
+					verify = (*(ptr + patch->verifyOffset) & patch->verifyAndMask) | patch->verifyOrMask;
+					if (verify != patch->verifyValue) continue;
 				}
 
-				if (value == patch->lookFor)
-				{
-					if (patch->verifyOffset != 0)
-					{
-						verify = (*(ptr + patch->verifyOffset) & patch->verifyAndMask) | patch->verifyOrMask;
-						if (verify != patch->verifyValue) continue;
-					}
-
-					patch->patchAddress = ptr + patch->patchOffset;
-					patch->originalValue = *(patch->patchAddress);
-					*(patch->patchAddress) = patch->patchValue;
-					patch->isPatched = 1;
-					patches_applied++;
+				patch->patchAddress = ptr + patch->patchOffset;
+				patch->originalValue = *(patch->patchAddress);
+				*(patch->patchAddress) = patch->patchValue;
+				flush_icache_range((unsigned long)patch->patchAddress, (unsigned long)(patch->patchAddress + 1));
+				patch->isPatched = 1;
+				patch->lastResult = YF_STATE_HIT;
 
-					YF_INFO("Found instruction to patch (%#010x) at address %#010x, replaced it with %#010x.\n", patch->originalValue, (unsigned int)(patch->patchAddress), *(patch->patchAddress));
+				YF_INFO("Found instruction to patch (%#010x) at address %#010x, replaced it with %#010x.\n", patch->originalValue, (unsigned int)(patch->patchAddress), *(patch->patchAddress));
 
-					break;
-				}
+				break;
 			}
+		}
 
-			if (!(patch->isPatched))
-			{
-				YF_INFO("No instruction to patch found in function '%s', patch skipped.\n", patch->fname);
-			}
+		if (!(patch->isPatched))
+		{
+			YF_INFO("No instruction to patch found in function '%s', patch skipped.\n", patch->fname);
 		}
+	}
+
+	patch->applyTime = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	return patch->isPatched;
+}
+
+static int yf_patchkernel_revert_one(patchEntry_t *patch)
+{
+	if (!(patch->isPatched)) return 0;
+
+	*(patch->patchAddress) = patch->originalValue;
+	flush_icache_range((unsigned long)patch->patchAddress, (unsigned long)(patch->patchAddress + 1));
+	patch->isPatched = 0;
+
+	YF_INFO("Reversed patch in '%s' at address %#010x to original value %#010x.\n", patch->fname, (unsigned int)(patch->patchAddress), patch->originalValue);
+
+	return 1;
+}
+
+static unsigned int yf_patchkernel_patch(patchEntry_t *patch)
+{
+	unsigned int	patches_applied = 0;
+
+	while (patch->fname)
+	{
+		patches_applied += yf_patchkernel_apply_one(patch);
 		patch++;
 	}
 
@@ -202,16 +317,190 @@ static void yf_patchkernel_restore(patchEntry_t *patch)
 {
 	while (patch->fname)
 	{
-		if (patch->isPatched)
+		yf_patchkernel_revert_one(patch);
+		patch++;
+	}
+}
+
+// compiled-in entries get the lower indexes, runtime entries are numbered subsequently
+
+static patchEntry_t *yf_patchkernel_entry(unsigned int index)
+{
+	unsigned int	builtin = ARRAY_SIZE(patchesForTunDevice) - 1;
+
+	if (index < builtin) return &patchesForTunDevice[index];
+	if (index - builtin < runtimePatchCount) return &runtimePatches[index - builtin];
+
+	return NULL;
+}
+
+static int yf_patchkernel_state_show(struct seq_file *m, void *v)
+{
+	patchEntry_t	*patch;
+	unsigned int	index;
+	static const char *results[] = { "untried", "hit", "miss" };
+
+	mutex_lock(&yf_patchkernel_lock);
+
+	seq_printf(m, "index symbol address original patched result time_ns\n");
+
+	for (index = 0; (patch = yf_patchkernel_entry(index)) != NULL; index++)
+	{
+		seq_printf(m, "%u %s %#010x %#010x %d %s %lld\n", index, (char *)patch->fname, (unsigned int)(patch->patchAddress), patch->originalValue,
+			patch->isPatched, results[patch->lastResult], (long long)patch->applyTime);
+	}
+
+	mutex_unlock(&yf_patchkernel_lock);
+
+	return 0;
+}
+
+static int yf_patchkernel_state_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, yf_patchkernel_state_show, NULL);
+}
+
+static ssize_t yf_patchkernel_load_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos)
+{
+	patchDescriptor_t	descriptor;
+	patchEntry_t		*patch;
+	unsigned int		*address;
+	size_t				processed = 0;
+
+	if (count == 0 || (count % sizeof(descriptor)) != 0)
+	{
+		YF_INFO("Descriptor data has to be a multiple of %u bytes, got %u bytes.\n", (unsigned int)sizeof(descriptor), (unsigned int)count);
+		return -EINVAL;
+	}
+
+	mutex_lock(&yf_patchkernel_lock);
+
+	while (processed < count)
+	{
+		if (copy_from_user(&descriptor, buffer + processed, sizeof(descriptor)))
+		{
+			mutex_unlock(&yf_patchkernel_lock);
+			return (processed ? processed : -EFAULT);
+		}
+
+		if (descriptor.magic != YF_DESCRIPTOR_MAGIC || descriptor.fname[0] == 0 || descriptor.fname[YF_SYMBOL_NAME_LEN - 1] != 0 || descriptor.maxOffset == 0 ||
+			descriptor.maxOffset > YF_MAX_OFFSET || descriptor.startOffset > YF_MAX_OFFSET || descriptor.verifyOffset > YF_MAX_OFFSET || descriptor.patchOffset > YF_MAX_OFFSET)
+		{
+			YF_INFO("Invalid patch descriptor at offset %u, loading stopped.\n", (unsigned int)processed);
+			mutex_unlock(&yf_patchkernel_lock);
+			return (processed ? processed : -EINVAL);
+		}
+
+		if (runtimePatchCount >= YF_MAX_RUNTIME_PATCHES)
 		{
-			*(patch->patchAddress) = patch->originalValue;
-			patch->isPatched = 0;
+			YF_INFO("Maximum number of %u runtime patches reached, loading stopped.\n", YF_MAX_RUNTIME_PATCHES);
+			mutex_unlock(&yf_patchkernel_lock);
+			return (processed ? processed : -ENOSPC);
+		}
 
-			YF_INFO("Reversed patch in '%s' at address %#010x to original value %#010x.\n", patch->fname, (unsigned int)(patch->patchAddress), patch->originalValue);
+		memcpy(runtimeNames[runtimePatchCount], descriptor.fname, YF_SYMBOL_NAME_LEN);
+
+		patch = &runtimePatches[runtimePatchCount];
+		memset(patch, 0, sizeof(*patch));
+		patch->fname = runtimeNames[runtimePatchCount];
+		patch->startOffset = descriptor.startOffset;
+		patch->maxOffset = descriptor.maxOffset;
+		patch->lookFor = descriptor.lookFor;
+		patch->andMask = descriptor.andMask;
+		patch->orMask = descriptor.orMask;
+		patch->verifyOffset = descriptor.verifyOffset;
+		patch->verifyValue = descriptor.verifyValue;
+		patch->verifyAndMask = descriptor.verifyAndMask;
+		patch->verifyOrMask = descriptor.verifyOrMask;
+		patch->patchOffset = descriptor.patchOffset;
+		patch->patchValue = descriptor.patchValue;
+
+		// symbols from modules, which aren't loaded yet, are checked while applying the patch
+		if ((address = (unsigned int *)kallsyms_lookup_name(patch->fname)) != NULL && yf_patchkernel_window(patch) > yf_patchkernel_symbol_size(address))
+		{
+			YF_INFO("Patch descriptor at offset %u exceeds the size of symbol '%s', loading stopped.\n", (unsigned int)processed, patch->fname);
+			mutex_unlock(&yf_patchkernel_lock);
+			return (processed ? processed : -EINVAL);
 		}
 
-		patch++;
+		YF_INFO("Loaded patch for '%s' as index %u.\n", patch->fname, (unsigned int)(ARRAY_SIZE(patchesForTunDevice) - 1 + runtimePatchCount));
+
+		runtimePatchCount++;
+		processed += sizeof(descriptor);
+	}
+
+	mutex_unlock(&yf_patchkernel_lock);
+
+	return processed;
+}
+
+static ssize_t yf_patchkernel_control_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos)
+{
+	char				command[32];
+	unsigned int		index;
+	patchEntry_t		*patch;
+	ssize_t				result = count;
+
+	if (count >= sizeof(command)) return -EINVAL;
+	if (copy_from_user(command, buffer, count)) return -EFAULT;
+	command[count] = 0;
+
+	mutex_lock(&yf_patchkernel_lock);
+
+	if (sscanf(command, "apply %u", &index) == 1)
+	{
+		if ((patch = yf_patchkernel_entry(index)) == NULL) result = -ENOENT;
+		else if (yf_patchkernel_apply_one(patch)) patches_applied++;
+		else if (!(patch->isPatched)) result = -ENXIO;
+	}
+	else if (sscanf(command, "revert %u", &index) == 1)
+	{
+		if ((patch = yf_patchkernel_entry(index)) == NULL) result = -ENOENT;
+		else if (yf_patchkernel_revert_one(patch)) patches_applied--;
+	}
+	else
+	{
+		YF_INFO("Unknown command written to control file, use 'apply <index>' or 'revert <index>'.\n");
+		result = -EINVAL;
+	}
+
+	mutex_unlock(&yf_patchkernel_lock);
+
+	return result;
+}
+
+static const struct file_operations yf_patchkernel_state_fops = {
+	.owner = THIS_MODULE,
+	.open = yf_patchkernel_state_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations yf_patchkernel_load_fops = {
+	.owner = THIS_MODULE,
+	.write = yf_patchkernel_load_write,
+};
+
+static const struct file_operations yf_patchkernel_control_fops = {
+	.owner = THIS_MODULE,
+	.write = yf_patchkernel_control_write,
+};
+
+static void yf_patchkernel_debugfs_init(void)
+{
+	yf_patchkernel_dir = debugfs_create_dir("yf_patchkernel", NULL);
+
+	if (IS_ERR_OR_NULL(yf_patchkernel_dir))
+	{
+		YF_INFO("Unable to create 'debugfs' directory, runtime patches are not available.\n");
+		yf_patchkernel_dir = NULL;
+		return;
 	}
+
+	debugfs_create_file("state", S_IRUSR, yf_patchkernel_dir, NULL, &yf_patchkernel_state_fops);
+	debugfs_create_file("load", S_IWUSR, yf_patchkernel_dir, NULL, &yf_patchkernel_load_fops);
+	debugfs_create_file("control", S_IWUSR, yf_patchkernel_dir, NULL, &yf_patchkernel_control_fops);
 }
 
 static int __init yf_patchkernel_init(void)
@@ -223,6 +512,8 @@ static int __init yf_patchkernel_init(void)
 
 	YF_INFO("%u patches applied.\n", patches_applied);
 
+	yf_patchkernel_debugfs_init();
+
 	return 0;
 }
 
@@ -230,7 +521,12 @@ static void __exit yf_patchkernel_exit(void)
 {
 	YF_INFO("Module will be removed now.\n");
 
+	debugfs_remove_recursive(yf_patchkernel_dir);
+
+	mutex_lock(&yf_patchkernel_lock);
 	yf_patchkernel_restore(patchesForTunDevice);
+	yf_patchkernel_restore(runtimePatches);
+	mutex_unlock(&yf_patchkernel_lock);
 
 	YF_INFO("All applied patches have been reversed.\n");
 }
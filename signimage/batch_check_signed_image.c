@@ -0,0 +1,357 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_keyindex.h"
+#include "signimage_verify.h"
+#include <pthread.h>
+
+struct imageResult
+{
+	const char *		fileName;
+	int					result;
+	const struct signingKey *	key;
+	const char *		hashName;
+	size_t				imageSize;
+};
+
+struct verifyJob
+{
+	struct imageResult *	images;
+	size_t					count;
+	size_t					next;
+	pthread_mutex_t			lock;
+	const struct keyList *	keys;
+	const char *			hashNames;
+};
+
+void usage()
+{
+	fprintf(stderr, "batch_check_signed_image - verify signatures of many firmware images at once\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "batch_check_signed_image [ -d <key_database> ] [ -i <index_file> | -n ] [ -p <pem_file> ]...\n");
+	fprintf(stderr, "                         [ -a <hash>[,<hash>...] ] [ -j <threads> ]\n");
+	fprintf(stderr, "                         [ -l <list_file> | <imagefile>... ]\n");
+	fprintf(stderr, "\nAll keys from the key database (default: key_database.xml) and from the");
+	fprintf(stderr, "\nspecified PEM files are loaded once, each image is read and hashed only");
+	fprintf(stderr, "\nonce and its signature is checked against every key. The images are");
+	fprintf(stderr, "\nspread over the specified number of threads (default: number of CPUs).\n");
+	fprintf(stderr, "\nThe key database is read from its compiled index (default: see");
+	fprintf(stderr, "\n'find_signing_key'), which is rebuilt, if the database was changed.");
+	fprintf(stderr, "\nWith -n no key database is used, only the keys from the PEM files.\n");
+	fprintf(stderr, "\nOnly MD5 (as used by AVM) is computed by default, specify a list of hash");
+	fprintf(stderr, "\nalgorithms with option -a, if images may be signed with other ones.\n");
+	fprintf(stderr, "\nA list of image names (one per line, '-' for STDIN) may be used instead");
+	fprintf(stderr, "\nof command line arguments.\n");
+	fprintf(stderr, "\nOne line per image is written to STDOUT with tab separated fields:");
+	fprintf(stderr, "\nimage name, result code (like 'check_signed_image'), hash algorithm");
+	fprintf(stderr, "\nand the owners of the matching key (HWRevision:original_name).\n");
+}
+
+int readImage(struct imageResult *image, struct hashSet *hashes, uint8_t *signature, size_t *signatureSize)
+{
+	static const struct tarHeader	zero;
+	struct tarHeader *	buffer;
+	int					fd;
+	int					result = RESULT_OK;
+	size_t				dataBlocks = 0;
+	size_t				signatureBlocks = 0;
+	bool				endOfArchive = false;
+	ssize_t				got;
+
+	if ((fd = open(image->fileName, O_RDONLY)) == -1) return RESULT_NOT_FOUND;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if ((buffer = malloc(STREAM_BLOCKS * sizeof(struct tarHeader))) == NULL)
+	{
+		close(fd);
+		return RESULT_INVALID_IMAGE;
+	}
+
+	while ((got = readBlocks(fd, buffer, STREAM_BLOCKS * sizeof(struct tarHeader))) > 0)
+	{
+		size_t			blocks = got / sizeof(struct tarHeader);
+		size_t			runStart = 0;
+		size_t			used = 0;
+
+		image->imageSize += got;
+
+		while (used < blocks && !endOfArchive)
+		{
+			struct tarHeader *	block = buffer + used;
+
+			if (signatureBlocks > 0) // signature header and content are replaced by empty blocks
+			{
+				if (signatureBlocks == 1)
+				{
+					memcpy(signature, block, *signatureSize);
+					dataBlocks--;
+				}
+				hashData(hashes, buffer + runStart, (used - runStart) * sizeof(struct tarHeader), NULL);
+				hashData(hashes, block, sizeof(struct tarHeader), &zero);
+				runStart = ++used;
+				signatureBlocks--;
+				continue;
+			}
+
+			if (dataBlocks > 0)
+			{
+				size_t		skip = (dataBlocks > blocks - used ? blocks - used : dataBlocks);
+
+				dataBlocks -= skip;
+				used += skip;
+				continue;
+			}
+
+			if (tarHeaderIsEmpty(block))
+			{
+				endOfArchive = true;
+				break;
+			}
+
+			if (!tarHeaderIsValid(block))
+			{
+				result = RESULT_INVALID_IMAGE;
+				break;
+			}
+
+			dataBlocks = tarHeaderBlocks(block) - 1;
+
+			if (tarHeaderIsMember(block, SIGNATURE_MEMBER_NAME))
+			{
+				*signatureSize = tarHeaderSize(block);
+				if (*signatureSize == 0 || *signatureSize > SIGNATURE_MAX_SIZE)
+				{
+					result = RESULT_SIGNATURE_SIZE;
+					break;
+				}
+				hashData(hashes, buffer + runStart, (used - runStart) * sizeof(struct tarHeader), NULL);
+				runStart = used;
+				startSignature(hashes);
+				signatureBlocks = 2;
+				continue;
+			}
+
+			used++;
+		}
+
+		if (result != RESULT_OK) break;
+
+		// the remaining data (up to the end of file) is hashed, even after the EoA marker
+		hashData(hashes, buffer + runStart, got - (runStart * sizeof(struct tarHeader)), NULL);
+	}
+
+	if (got == -1) result = RESULT_INVALID_IMAGE;
+	if (result == RESULT_OK && !hashes->signatureSeen) result = RESULT_NO_SIGNATURE;
+	if (result == RESULT_OK && signatureBlocks > 0) result = RESULT_INVALID_IMAGE;
+
+	free(buffer);
+	close(fd);
+
+	return result;
+}
+
+void verifyImage(struct imageResult *image, const struct keyList *keys, const char *hashNames)
+{
+	struct hashSet		hashes;
+	uint8_t				signature[SIGNATURE_MAX_SIZE];
+	size_t				signatureSize = 0;
+
+	initHashSet(&hashes, hashNames);
+
+	if ((image->result = readImage(image, &hashes, signature, &signatureSize)) == RESULT_OK)
+	{
+		image->result = checkSignature(&hashes, keys, signature, signatureSize, &image->key, &image->hashName);
+	}
+
+	freeHashSet(&hashes);
+}
+
+void * verifyWorker(void *arg)
+{
+	struct verifyJob *	job = (struct verifyJob *) arg;
+	size_t				index;
+
+	while (true)
+	{
+		pthread_mutex_lock(&job->lock);
+		index = job->next++;
+		pthread_mutex_unlock(&job->lock);
+
+		if (index >= job->count) break;
+		verifyImage(&job->images[index], job->keys, job->hashNames);
+	}
+
+	return NULL;
+}
+
+bool addImage(struct verifyJob *job, const char *fileName)
+{
+	struct imageResult *	images;
+
+	if ((images = realloc(job->images, (job->count + 1) * sizeof(struct imageResult))) == NULL) return false;
+	job->images = images;
+	memset(&job->images[job->count], 0, sizeof(struct imageResult));
+	if ((job->images[job->count].fileName = strdup(fileName)) == NULL) return false;
+	job->count++;
+
+	return true;
+}
+
+bool readImageList(struct verifyJob *job, const char *listFile)
+{
+	FILE *				list = stdin;
+	char				line[4096];
+	bool				result = true;
+
+	if (strcmp(listFile, "-") != 0 && (list = fopen(listFile, "r")) == NULL)
+	{
+		fprintf(stderr, "Error %d opening image list '%s'.\n", errno, listFile);
+		return false;
+	}
+
+	while (result && fgets(line, sizeof(line), list) != NULL)
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == 0) continue;
+		result = addImage(job, line);
+	}
+
+	if (list != stdin) fclose(list);
+
+	return result;
+}
+
+void printResult(const struct imageResult *image)
+{
+	size_t				i;
+
+	fprintf(stdout, "%s\t%d\t%s\t", image->fileName, image->result, (image->hashName ? image->hashName : "-"));
+
+	if (image->key == NULL) fprintf(stdout, "-");
+	else
+	{
+		for (i = 0; i < image->key->ownerCount; i++)
+		{
+			fprintf(stdout, "%s%u:%s", (i ? "," : ""), image->key->owners[i].hwRevision, image->key->owners[i].keyName);
+		}
+	}
+
+	fprintf(stdout, "\n");
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 0;
+	const char *		database = "key_database.xml";
+	const char *		indexFile = NULL;
+	struct keyList		keys = { NULL, 0 };
+	struct verifyJob	job;
+	long				threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *			threads;
+	struct hashSet		check;
+	bool				databaseUsed = true;
+	size_t				i;
+	int					arg;
+
+	memset(&job, 0, sizeof(job));
+	pthread_mutex_init(&job.lock, NULL);
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) database = argv[++arg];
+		else if (strcmp(argv[arg], "-i") == 0 && arg + 1 < argc) indexFile = argv[++arg];
+		else if (strcmp(argv[arg], "-n") == 0) databaseUsed = false;
+		else if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc) job.hashNames = argv[++arg];
+		else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) threadCount = atol(argv[++arg]);
+		else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+		{
+			if (!addKeyFromPemFile(&keys, argv[++arg])) exit(12);
+		}
+		else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc)
+		{
+			if (!readImageList(&job, argv[++arg])) exit(1);
+		}
+		else if (argv[arg][0] == '-' && argv[arg][1] != 0)
+		{
+			usage();
+			exit(1);
+		}
+		else if (!addImage(&job, argv[arg])) exit(1);
+	}
+
+	if (job.count == 0)
+	{
+		usage();
+		exit(2);
+	}
+
+	if (!initHashSet(&check, job.hashNames))
+	{
+		fprintf(stderr, "Unknown, unsupported or too many hash algorithm(s) '%s' specified.\n", job.hashNames);
+		exit(9);
+	}
+	freeHashSet(&check);
+
+	if (databaseUsed && !loadKeyIndex(&keys, database, indexFile)) exit(12);
+
+	if (keys.count == 0)
+	{
+		fprintf(stderr, "None of the specified public key sources was able to provide a key.\n");
+		exit(11);
+	}
+
+	job.keys = &keys;
+
+	if (threadCount < 1) threadCount = 1;
+	if ((size_t) threadCount > job.count) threadCount = job.count;
+
+	if ((threads = calloc(threadCount, sizeof(pthread_t))) == NULL) exit(1);
+
+	for (i = 0; i < (size_t) threadCount; i++)
+	{
+		if (pthread_create(&threads[i], NULL, verifyWorker, &job) != 0)
+		{
+			fprintf(stderr, "Error creating worker thread, continuing with %zu thread(s).\n", i);
+			threadCount = i;
+			break;
+		}
+	}
+
+	if (threadCount == 0) verifyWorker(&job);
+	for (i = 0; i < (size_t) threadCount; i++) pthread_join(threads[i], NULL);
+
+	for (i = 0; i < job.count; i++)
+	{
+		printResult(&job.images[i]);
+		if (job.images[i].result != RESULT_OK) returnCode = RESULT_FAILED;
+		free((void *) job.images[i].fileName);
+	}
+
+	free(threads);
+	free(job.images);
+	freeKeyList(&keys);
+	pthread_mutex_destroy(&job.lock);
+
+	exit(returnCode);
+}
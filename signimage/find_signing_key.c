@@ -0,0 +1,142 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_keyindex.h"
+#include <ctype.h>
+
+void usage()
+{
+	fprintf(stderr, "find_signing_key - look up public keys in the compiled key database\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "find_signing_key [ -d <key_database> ] [ -i <index_file> ] [ -c ]\n");
+	fprintf(stderr, "                 [ -m <modulus> | -p <pem_file> | -r <HWRevision> ]...\n");
+	fprintf(stderr, "\nThe key database (default: key_database.xml) is compiled into an index file");
+	fprintf(stderr, "\n(default: $YF_KEY_DATABASE_INDEX or a file in $XDG_CACHE_HOME/yourfritz,");
+	fprintf(stderr, "\nwhich defaults to ~/.cache/yourfritz), if the index is missing or older");
+	fprintf(stderr, "\nthan the database. Use '-c' to rebuild it without any query.\n");
+	fprintf(stderr, "\nKeys are looked up by their modulus (hexadecimal, option -m), by the public");
+	fprintf(stderr, "\nkey from a PEM file (option -p) or by the HWRevision of a device (option -r).\n");
+	fprintf(stderr, "\nOne line per key owner is written to STDOUT with tab separated fields:");
+	fprintf(stderr, "\nHWRevision, device name, original key name, key source and modulus.");
+	fprintf(stderr, "\nThe exit code is 3, if any of the lookups didn't find a key.\n");
+}
+
+void printOwner(const struct keyIndex *index, uint32_t number)
+{
+	const struct keyIndexOwner *	owner = keyIndexGetOwner(index, number);
+	const struct keyIndexKey *	key = keyIndexGetKey(index, owner->key);
+
+	fprintf(stdout, "%u\t%s\t%s\t%s\t%s\n", owner->hwRevision, keyIndexString(index, owner->deviceName), keyIndexString(index, owner->keyName), (owner->vendorKey ? "vendor" : "customer"), keyIndexString(index, key->modulus));
+}
+
+bool printKey(const struct keyIndex *index, const struct keyIndexKey *key)
+{
+	uint32_t			i;
+
+	if (key == NULL) return false;
+	for (i = 0; i < key->ownerCount; i++) printOwner(index, key->firstOwner + i);
+
+	return true;
+}
+
+bool findModulus(const struct keyIndex *index, const char *modulus)
+{
+	char				normalized[KEY_MODULUS_SIZE + 3];
+	size_t				length = 0;
+
+	for (; *modulus && length < sizeof(normalized) - 1; modulus++)
+	{
+		if (!isspace((unsigned char) *modulus) && *modulus != ':') normalized[length++] = tolower((unsigned char) *modulus);
+	}
+	normalized[length] = 0;
+
+	// output of 'openssl rsa -modulus' starts with 'Modulus='
+	if (strncmp(normalized, "modulus=", 8) == 0) return printKey(index, findKeyByModulus(index, normalized + 8));
+
+	return printKey(index, findKeyByModulus(index, normalized));
+}
+
+bool findPemFile(const struct keyIndex *index, const char *fileName)
+{
+	struct keyList		list = { NULL, 0 };
+	bool				result = false;
+
+	if (addKeyFromPemFile(&list, fileName)) result = printKey(index, findKeyByModulus(index, list.keys[0].modulus));
+	freeKeyList(&list);
+
+	return result;
+}
+
+bool findRevision(const struct keyIndex *index, const char *revision)
+{
+	uint32_t			first;
+	uint32_t			count;
+	uint32_t			i;
+
+	first = findOwnersByRevision(index, strtoul(revision, NULL, 10), &count);
+	for (i = 0; i < count; i++) printOwner(index, keyIndexRevisionOwner(index, first + i));
+
+	return (count > 0);
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 0;
+	const char *		database = "key_database.xml";
+	const char *		indexFile = NULL;
+	struct keyIndex		index;
+	bool				rebuild = false;
+	int					arg;
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) database = argv[++arg];
+		else if (strcmp(argv[arg], "-i") == 0 && arg + 1 < argc) indexFile = argv[++arg];
+		else if (strcmp(argv[arg], "-c") == 0) rebuild = true;
+		else if ((strcmp(argv[arg], "-m") == 0 || strcmp(argv[arg], "-p") == 0 || strcmp(argv[arg], "-r") == 0) && arg + 1 < argc) arg++;
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (!openKeyIndex(&index, database, indexFile, rebuild)) exit(12);
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		bool			found = true;
+
+		if (strcmp(argv[arg], "-m") == 0) found = findModulus(&index, argv[++arg]);
+		else if (strcmp(argv[arg], "-p") == 0) found = findPemFile(&index, argv[++arg]);
+		else if (strcmp(argv[arg], "-r") == 0) found = findRevision(&index, argv[++arg]);
+		else if (strcmp(argv[arg], "-d") == 0 || strcmp(argv[arg], "-i") == 0) arg++;
+
+		if (!found) returnCode = 3;
+	}
+
+	closeKeyIndex(&index);
+
+	exit(returnCode);
+}
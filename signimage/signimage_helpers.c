@@ -0,0 +1,193 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_helpers.h"
+
+bool tarHeaderIsEmpty(const struct tarHeader *header)
+{
+	const uint8_t *		ptr = header->data;
+
+	while (ptr < header->data + TAR_BLOCK_SIZE)
+	{
+		if (*(ptr++) != 0) return false;
+	}
+
+	return true;
+}
+
+bool tarHeaderIsValid(const struct tarHeader *header)
+{
+	uint32_t			stored = 0;
+	const uint8_t *		ptr = header->data + TAR_CHECKSUM_OFFSET;
+
+	// only the old "ustar" format is supported - like AVM's components do it
+	if (memcmp(header->data + TAR_MAGIC_OFFSET, "ustar", 5) != 0) return false;
+
+	while (ptr < header->data + TAR_CHECKSUM_OFFSET + TAR_CHECKSUM_SIZE && *ptr == ' ') ptr++;
+	while (ptr < header->data + TAR_CHECKSUM_OFFSET + TAR_CHECKSUM_SIZE && *ptr >= '0' && *ptr <= '7')
+	{
+		stored = (stored << 3) + (*ptr - '0');
+		ptr++;
+	}
+
+	return (stored == tarHeaderComputeChecksum(header));
+}
+
+bool tarHeaderIsExtended(const struct tarHeader *header)
+{
+	uint8_t				type = header->data[TAR_TYPEFLAG_OFFSET];
+
+	// PAX headers (global and per file) and GNU long names can't be handled like AVM does it
+	return (type == 'x' || type == 'g' || type == 'L' || type == 'K');
+}
+
+bool tarHeaderIsMember(const struct tarHeader *header, const char *name)
+{
+	return (strncmp((const char *) header->data + TAR_NAME_OFFSET, name, TAR_NAME_SIZE) == 0);
+}
+
+static size_t octalField(const struct tarHeader *header, size_t offset, size_t size)
+{
+	size_t				value = 0;
+	const uint8_t *		ptr = header->data + offset;
+
+	while (ptr < header->data + offset + size && *ptr == ' ') ptr++;
+	while (ptr < header->data + offset + size && *ptr >= '0' && *ptr <= '7')
+	{
+		value = (value << 3) + (*ptr - '0');
+		ptr++;
+	}
+
+	return value;
+}
+
+size_t tarHeaderSize(const struct tarHeader *header)
+{
+	return octalField(header, TAR_SIZE_OFFSET, TAR_SIZE_SIZE);
+}
+
+mode_t tarHeaderMode(const struct tarHeader *header)
+{
+	return (mode_t) (octalField(header, TAR_MODE_OFFSET, TAR_MODE_SIZE) & 07777);
+}
+
+// the "ustar" prefix field is prepended, if it's used for long names
+void tarHeaderName(const struct tarHeader *header, char *name, size_t size)
+{
+	const char *		prefix = (const char *) header->data + TAR_PREFIX_OFFSET;
+	const char *		member = (const char *) header->data + TAR_NAME_OFFSET;
+
+	if (*prefix) snprintf(name, size, "%.*s/%.*s", TAR_PREFIX_SIZE, prefix, TAR_NAME_SIZE, member);
+	else snprintf(name, size, "%.*s", TAR_NAME_SIZE, member);
+}
+
+void tarHeaderLinkName(const struct tarHeader *header, char *name, size_t size)
+{
+	snprintf(name, size, "%.*s", TAR_LINKNAME_SIZE, (const char *) header->data + TAR_LINKNAME_OFFSET);
+}
+
+size_t tarHeaderBlocks(const struct tarHeader *header)
+{
+	return 1 + ((tarHeaderSize(header) + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE);
+}
+
+uint32_t tarHeaderComputeChecksum(const struct tarHeader *header)
+{
+	uint32_t			sum = 0;
+	int					i;
+
+	// the checksum field itself is counted as if it would contain spaces
+	for (i = 0; i < TAR_BLOCK_SIZE; i++)
+	{
+		if (i >= TAR_CHECKSUM_OFFSET && i < TAR_CHECKSUM_OFFSET + TAR_CHECKSUM_SIZE) sum += ' ';
+		else sum += header->data[i];
+	}
+
+	return sum;
+}
+
+void tarHeaderSetChecksum(struct tarHeader *header)
+{
+	char				checksum[TAR_CHECKSUM_SIZE + 1];
+
+	// six octal digits, followed by a NUL byte and a space (see 'sign_image' script)
+	snprintf(checksum, sizeof(checksum), "%06o", tarHeaderComputeChecksum(header) & 0777777);
+	memcpy(header->data + TAR_CHECKSUM_OFFSET, checksum, 6);
+	header->data[TAR_CHECKSUM_OFFSET + 6] = 0;
+	header->data[TAR_CHECKSUM_OFFSET + 7] = ' ';
+}
+
+const EVP_MD * hashAlgorithmByName(const char *name)
+{
+	static const char *	supported[] = { "md5", "sha1", "sha224", "sha256", "sha384", "sha512", NULL };
+	const char **		algo = supported;
+
+	if (name == NULL || *name == 0) return EVP_md5();
+
+	while (*algo)
+	{
+		if (strcasecmp(*algo, name) == 0) return EVP_get_digestbyname(*algo);
+		algo++;
+	}
+
+	return NULL;
+}
+
+ssize_t readBlocks(int fd, void *buffer, size_t count)
+{
+	size_t				done = 0;
+	ssize_t				got;
+
+	// read as much as possible, pipes may deliver less than requested
+	while (done < count)
+	{
+		got = read(fd, (uint8_t *) buffer + done, count - done);
+		if (got == 0) break;
+		if (got == -1)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		done += got;
+	}
+
+	return done;
+}
+
+bool writeBlocks(int fd, const void *buffer, size_t count)
+{
+	size_t				done = 0;
+	ssize_t				written;
+
+	while (done < count)
+	{
+		written = write(fd, (const uint8_t *) buffer + done, count - done);
+		if (written == -1)
+		{
+			if (errno == EINTR) continue;
+			return false;
+		}
+		done += written;
+	}
+
+	return true;
+}
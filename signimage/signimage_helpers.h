@@ -0,0 +1,67 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef SIGNIMAGE_HELPERS_H
+#define SIGNIMAGE_HELPERS_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <openssl/err.h>
+
+#define TAR_BLOCK_SIZE				512
+#define TAR_NAME_OFFSET				0
+#define TAR_NAME_SIZE				100
+#define TAR_MODE_OFFSET				100
+#define TAR_MODE_SIZE				8
+#define TAR_SIZE_OFFSET				124
+#define TAR_SIZE_SIZE				12
+#define TAR_CHECKSUM_OFFSET			148
+#define TAR_CHECKSUM_SIZE			8
+#define TAR_TYPEFLAG_OFFSET			156
+#define TAR_LINKNAME_OFFSET			157
+#define TAR_LINKNAME_SIZE			100
+#define TAR_MAGIC_OFFSET			257
+#define TAR_PREFIX_OFFSET			345
+#define TAR_PREFIX_SIZE				155
+
+#define SIGNATURE_MEMBER_NAME		"./var/signature"
+#define SIGNATURE_MAX_SIZE			TAR_BLOCK_SIZE
+
+// number of 512 byte blocks read or written at once while streaming an image
+#define STREAM_BLOCKS				256
+
+struct tarHeader
+{
+	uint8_t				data[TAR_BLOCK_SIZE];
+};
+
+bool tarHeaderIsEmpty(const struct tarHeader *header);
+bool tarHeaderIsValid(const struct tarHeader *header);
+bool tarHeaderIsExtended(const struct tarHeader *header);
+bool tarHeaderIsMember(const struct tarHeader *header, const char *name);
+size_t tarHeaderSize(const struct tarHeader *header);
+mode_t tarHeaderMode(const struct tarHeader *header);
+void tarHeaderName(const struct tarHeader *header, char *name, size_t size);
+void tarHeaderLinkName(const struct tarHeader *header, char *name, size_t size);
+size_t tarHeaderBlocks(const struct tarHeader *header);
+uint32_t tarHeaderComputeChecksum(const struct tarHeader *header);
+void tarHeaderSetChecksum(struct tarHeader *header);
+
+const EVP_MD * hashAlgorithmByName(const char *name);
+
+ssize_t readBlocks(int fd, void *buffer, size_t count);
+bool writeBlocks(int fd, const void *buffer, size_t count);
+
+#endif
@@ -0,0 +1,575 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_keyindex.h"
+#include <sys/mman.h>
+#include <limits.h>
+
+#define INDEX_MAGIC					"YFKI"
+#define INDEX_VERSION				1
+#define INDEX_BYTE_ORDER			0x01020304
+
+// the index is a cache on the local system, so it's stored in host byte order
+struct keyIndexHeader
+{
+	char				magic[4];
+	uint32_t			version;
+	uint32_t			byteOrder;
+	uint32_t			keyCount;
+	uint64_t			databaseSize;
+	int64_t				databaseTime;
+	int64_t				databaseTimeNsec;
+	uint32_t			ownerCount;
+	uint32_t			bucketCount;	// a power of two, open addressing with linear probing
+	uint32_t			keysOffset;
+	uint32_t			ownersOffset;
+	uint32_t			revisionsOffset;	// owner numbers, sorted by HWRevision
+	uint32_t			bucketsOffset;
+	uint32_t			stringsOffset;
+	uint32_t			stringsSize;
+	uint32_t			totalSize;
+	uint32_t			reserved;
+};
+
+struct stringPool
+{
+	char *				data;
+	size_t				size;
+	size_t				allocated;
+};
+
+static uint32_t addString(struct stringPool *pool, const char *text)
+{
+	uint32_t			offset = pool->size;
+	size_t				size = strlen(text) + 1;
+
+	if (pool->size + size > pool->allocated)
+	{
+		size_t			allocated = (pool->allocated ? pool->allocated * 2 : 4096);
+		char *			data;
+
+		while (allocated < pool->size + size) allocated *= 2;
+		if ((data = realloc(pool->data, allocated)) == NULL) return KEY_INDEX_NONE;
+		pool->data = data;
+		pool->allocated = allocated;
+	}
+
+	memcpy(pool->data + pool->size, text, size);
+	pool->size += size;
+
+	return offset;
+}
+
+static uint32_t fingerprintHash(const uint8_t *fingerprint)
+{
+	uint32_t			hash;
+
+	memcpy(&hash, fingerprint, sizeof(hash));
+	return hash;
+}
+
+// the fingerprint is computed from the binary modulus without any leading zero bytes
+bool keyFingerprint(const char *modulus, uint8_t *fingerprint)
+{
+	uint8_t				binary[KEY_MODULUS_SIZE / 2];
+	size_t				length;
+	size_t				i;
+	unsigned int		value;
+	unsigned int		size = KEY_FINGERPRINT_SIZE;
+
+	while (modulus[0] == '0' && modulus[1] == '0') modulus += 2;
+	length = strlen(modulus);
+	if (length == 0 || (length % 2) != 0 || length / 2 > sizeof(binary)) return false;
+
+	for (i = 0; i < length / 2; i++)
+	{
+		if (sscanf(modulus + (i * 2), "%2x", &value) != 1) return false;
+		binary[i] = (uint8_t) value;
+	}
+
+	return (EVP_Digest(binary, length / 2, fingerprint, &size, EVP_sha256(), NULL) == 1 && size == KEY_FINGERPRINT_SIZE);
+}
+
+static const struct keyIndexOwner *	sortOwners = NULL;
+
+static int compareRevisions(const void *left, const void *right)
+{
+	uint32_t			l = *((const uint32_t *) left);
+	uint32_t			r = *((const uint32_t *) right);
+
+	if (sortOwners[l].hwRevision != sortOwners[r].hwRevision) return (sortOwners[l].hwRevision < sortOwners[r].hwRevision ? -1 : 1);
+	return (l < r ? -1 : (l > r ? 1 : 0));
+}
+
+static uint8_t * compileKeyIndex(const char *database, const struct stat *databaseStat, size_t *size)
+{
+	struct keyList		list = { NULL, 0 };
+	struct stringPool	pool = { NULL, 0, 0 };
+	struct keyIndexHeader	header;
+	struct keyIndexKey *	keys = NULL;
+	struct keyIndexOwner *	owners = NULL;
+	uint32_t *			revisions = NULL;
+	uint32_t *			buckets = NULL;
+	uint8_t *			buffer = NULL;
+	size_t				ownerCount = 0;
+	size_t				i;
+	size_t				j;
+	bool				failed = false;
+
+	if (!loadKeyDatabase(&list, database))
+	{
+		freeKeyList(&list);
+		return NULL;
+	}
+
+	for (i = 0; i < list.count; i++) ownerCount += list.keys[i].ownerCount;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.version = INDEX_VERSION;
+	header.byteOrder = INDEX_BYTE_ORDER;
+	header.databaseSize = databaseStat->st_size;
+	header.databaseTime = databaseStat->st_mtim.tv_sec;
+	header.databaseTimeNsec = databaseStat->st_mtim.tv_nsec;
+	header.keyCount = list.count;
+	header.ownerCount = ownerCount;
+	for (header.bucketCount = 8; header.bucketCount < list.count * 2; header.bucketCount *= 2);
+
+	keys = calloc(list.count + 1, sizeof(struct keyIndexKey));
+	owners = calloc(ownerCount + 1, sizeof(struct keyIndexOwner));
+	revisions = calloc(ownerCount + 1, sizeof(uint32_t));
+	buckets = malloc(header.bucketCount * sizeof(uint32_t));
+
+	if (keys == NULL || owners == NULL || revisions == NULL || buckets == NULL) failed = true;
+	else memset(buckets, 0xFF, header.bucketCount * sizeof(uint32_t));
+
+	for (i = 0, ownerCount = 0; !failed && i < list.count; i++)
+	{
+		const struct signingKey *	key = &list.keys[i];
+		uint32_t		bucket;
+
+		if (!keyFingerprint(key->modulus, keys[i].fingerprint))
+		{
+			fprintf(stderr, "Invalid modulus '%.16s...' in key database '%s'.\n", key->modulus, database);
+			failed = true;
+			break;
+		}
+		keys[i].modulus = addString(&pool, key->modulus);
+		keys[i].exponent = addString(&pool, key->exponent);
+		keys[i].firstOwner = ownerCount;
+		keys[i].ownerCount = key->ownerCount;
+
+		for (j = 0; j < key->ownerCount; j++, ownerCount++)
+		{
+			owners[ownerCount].hwRevision = key->owners[j].hwRevision;
+			owners[ownerCount].deviceName = addString(&pool, key->owners[j].deviceName);
+			owners[ownerCount].keyName = addString(&pool, key->owners[j].keyName);
+			owners[ownerCount].key = i;
+			owners[ownerCount].vendorKey = key->owners[j].vendorKey;
+			revisions[ownerCount] = ownerCount;
+			if (owners[ownerCount].deviceName == KEY_INDEX_NONE || owners[ownerCount].keyName == KEY_INDEX_NONE) failed = true;
+		}
+		if (keys[i].modulus == KEY_INDEX_NONE || keys[i].exponent == KEY_INDEX_NONE) failed = true;
+
+		bucket = fingerprintHash(keys[i].fingerprint) & (header.bucketCount - 1);
+		while (buckets[bucket] != KEY_INDEX_NONE) bucket = (bucket + 1) & (header.bucketCount - 1);
+		buckets[bucket] = i;
+	}
+
+	if (!failed)
+	{
+		sortOwners = owners;
+		qsort(revisions, ownerCount, sizeof(uint32_t), compareRevisions);
+		sortOwners = NULL;
+
+		header.keysOffset = sizeof(header);
+		header.ownersOffset = header.keysOffset + list.count * sizeof(struct keyIndexKey);
+		header.revisionsOffset = header.ownersOffset + ownerCount * sizeof(struct keyIndexOwner);
+		header.bucketsOffset = header.revisionsOffset + ownerCount * sizeof(uint32_t);
+		header.stringsOffset = header.bucketsOffset + header.bucketCount * sizeof(uint32_t);
+		header.stringsSize = pool.size;
+		header.totalSize = header.stringsOffset + header.stringsSize;
+
+		if ((buffer = malloc(header.totalSize)) != NULL)
+		{
+			memcpy(buffer, &header, sizeof(header));
+			memcpy(buffer + header.keysOffset, keys, list.count * sizeof(struct keyIndexKey));
+			memcpy(buffer + header.ownersOffset, owners, ownerCount * sizeof(struct keyIndexOwner));
+			memcpy(buffer + header.revisionsOffset, revisions, ownerCount * sizeof(uint32_t));
+			memcpy(buffer + header.bucketsOffset, buckets, header.bucketCount * sizeof(uint32_t));
+			if (pool.size) memcpy(buffer + header.stringsOffset, pool.data, pool.size);
+			*size = header.totalSize;
+		}
+	}
+
+	free(keys);
+	free(owners);
+	free(revisions);
+	free(buckets);
+	free(pool.data);
+	freeKeyList(&list);
+
+	return buffer;
+}
+
+// the index is replaced atomically, a failure is not fatal - the new index is used from memory then
+static void saveKeyIndex(const char *indexFile, const uint8_t *buffer, size_t size)
+{
+	char *				tempName = malloc(strlen(indexFile) + 8);
+	int					fd;
+
+	if (tempName == NULL) return;
+	sprintf(tempName, "%s.XXXXXX", indexFile);
+
+	if ((fd = mkstemp(tempName)) == -1)
+	{
+		free(tempName);
+		return;
+	}
+
+	if (write(fd, buffer, size) != (ssize_t) size || fchmod(fd, 0644) != 0 || close(fd) != 0 || rename(tempName, indexFile) != 0)
+	{
+		fprintf(stderr, "Error %d saving key index file '%s'.\n", errno, indexFile);
+		unlink(tempName);
+	}
+
+	free(tempName);
+}
+
+// checks, if an array with 'count' entries of 'entrySize' bytes at 'offset' lies completely within
+// 'size' bytes, the computation is done with 64 bits, so the 32-bit values from the file can't wrap
+static bool isInside(uint32_t offset, uint32_t count, size_t entrySize, size_t size)
+{
+	if ((offset % sizeof(uint32_t)) != 0) return false;
+	return ((uint64_t) offset + (uint64_t) count * entrySize <= (uint64_t) size);
+}
+
+// the index is a file on disk, which may be damaged or truncated - every offset, count and reference
+// is checked here once, so the accessor functions may use them without any further check
+static bool isCurrentKeyIndex(const uint8_t *data, size_t size, const struct stat *databaseStat)
+{
+	const struct keyIndexHeader *	h = (const struct keyIndexHeader *) data;
+	const struct keyIndexKey *	keys;
+	const struct keyIndexOwner *	owners;
+	const uint32_t *	revisions;
+	const uint32_t *	buckets;
+	const char *		strings;
+	bool				emptyBucket = false;
+	uint32_t			i;
+
+	if (size < sizeof(struct keyIndexHeader) || memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0) return false;
+	if (h->version != INDEX_VERSION || h->byteOrder != INDEX_BYTE_ORDER || h->totalSize != size) return false;
+	if (h->databaseSize != (uint64_t) databaseStat->st_size || h->databaseTime != databaseStat->st_mtim.tv_sec || h->databaseTimeNsec != databaseStat->st_mtim.tv_nsec) return false;
+
+	if (h->keysOffset < sizeof(struct keyIndexHeader) || !isInside(h->keysOffset, h->keyCount, sizeof(struct keyIndexKey), size)) return false;
+	if (!isInside(h->ownersOffset, h->ownerCount, sizeof(struct keyIndexOwner), size)) return false;
+	if (!isInside(h->revisionsOffset, h->ownerCount, sizeof(uint32_t), size)) return false;
+	if (!isInside(h->bucketsOffset, h->bucketCount, sizeof(uint32_t), size)) return false;
+	if ((uint64_t) h->stringsOffset + h->stringsSize != size) return false;
+	if (h->stringsSize == 0 ? (h->keyCount != 0 || h->ownerCount != 0) : data[size - 1] != 0) return false;
+	if (h->bucketCount == 0 || (h->bucketCount & (h->bucketCount - 1)) != 0 || h->bucketCount <= h->keyCount) return false;
+
+	keys = (const struct keyIndexKey *) (data + h->keysOffset);
+	owners = (const struct keyIndexOwner *) (data + h->ownersOffset);
+	revisions = (const uint32_t *) (data + h->revisionsOffset);
+	buckets = (const uint32_t *) (data + h->bucketsOffset);
+	strings = (const char *) data + h->stringsOffset;
+
+	for (i = 0; i < h->keyCount; i++)
+	{
+		if (keys[i].modulus >= h->stringsSize || keys[i].exponent >= h->stringsSize) return false;
+		if (keys[i].firstOwner > h->ownerCount || keys[i].ownerCount > h->ownerCount - keys[i].firstOwner) return false;
+		if (strlen(strings + keys[i].modulus) > KEY_MODULUS_SIZE || strlen(strings + keys[i].exponent) > KEY_EXPONENT_SIZE) return false;
+	}
+
+	for (i = 0; i < h->ownerCount; i++)
+	{
+		if (owners[i].key >= h->keyCount || revisions[i] >= h->ownerCount) return false;
+		if (owners[i].deviceName >= h->stringsSize || owners[i].keyName >= h->stringsSize) return false;
+	}
+
+	// the lookup loop needs at least one empty bucket to terminate
+	for (i = 0; i < h->bucketCount; i++)
+	{
+		if (buckets[i] == KEY_INDEX_NONE) emptyBucket = true;
+		else if (buckets[i] >= h->keyCount) return false;
+	}
+
+	return emptyBucket;
+}
+
+// creates the missing directories of a path (without its last component), errors are ignored here -
+// the index can't be saved then, but it's still used from memory
+static void createIndexDirectory(char *path)
+{
+	char *				slash;
+
+	for (slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+	{
+		*slash = 0;
+		mkdir(path, 0700);
+		*slash = '/';
+	}
+}
+
+// the index is a cache, so it's kept out of the directory with the database (which may be a source
+// tree): $YF_KEY_DATABASE_INDEX or a file in $XDG_CACHE_HOME/yourfritz (default: ~/.cache/yourfritz,
+// '/tmp' without a home directory) - its name contains a hash of the database path, so databases
+// with the same name in different directories get their own index
+static char * defaultIndexName(const char *database)
+{
+	const char *		env;
+	const char *		base;
+	const char *		c;
+	char				directory[PATH_MAX];
+	char *				path;
+	char *				name;
+	uint32_t			hash = 2166136261U;
+
+	if ((env = getenv("YF_KEY_DATABASE_INDEX")) != NULL && *env) return strdup(env);
+
+	if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env == '/') snprintf(directory, sizeof(directory), "%s/yourfritz", env);
+	else if ((env = getenv("HOME")) != NULL && *env == '/' && strcmp(env, "/") != 0) snprintf(directory, sizeof(directory), "%s/.cache/yourfritz", env);
+	else strcpy(directory, "/tmp");
+
+	if ((path = realpath(database, NULL)) == NULL && (path = strdup(database)) == NULL) return NULL;
+	for (c = path; *c; c++) hash = (hash ^ (uint8_t) *c) * 16777619U;
+	base = ((base = strrchr(path, '/')) != NULL ? base + 1 : path);
+
+	if ((name = malloc(strlen(directory) + strlen(base) + 16 + sizeof(KEY_INDEX_SUFFIX))) != NULL)
+	{
+		sprintf(name, "%s/%s-%08x%s", directory, base, hash, KEY_INDEX_SUFFIX);
+		createIndexDirectory(name);
+	}
+
+	free(path);
+
+	return name;
+}
+
+// map the index for the database (default: see 'defaultIndexName'), it's rebuilt, if it's missing or
+// outdated
+bool openKeyIndex(struct keyIndex *index, const char *database, const char *indexFile, bool rebuild)
+{
+	struct stat			databaseStat;
+	struct stat			indexStat;
+	char *				defaultName = NULL;
+	int					fd;
+
+	memset(index, 0, sizeof(struct keyIndex));
+
+	if (stat(database, &databaseStat) == -1)
+	{
+		fprintf(stderr, "Error %d opening key database '%s'.\n", errno, database);
+		return false;
+	}
+
+	if (indexFile == NULL)
+	{
+		if ((defaultName = defaultIndexName(database)) == NULL) return false;
+		indexFile = defaultName;
+	}
+
+	if (!rebuild && (fd = open(indexFile, O_RDONLY)) != -1)
+	{
+		// the keys from an index are trusted for signature checks, so it has to be our own file and
+		// nobody else may change it
+		if (fstat(fd, &indexStat) == 0 && indexStat.st_size > 0 && indexStat.st_uid == geteuid() && (indexStat.st_mode & (S_IWGRP | S_IWOTH)) == 0)
+		{
+			void *		mapped = mmap(NULL, indexStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (mapped != MAP_FAILED)
+			{
+				if (isCurrentKeyIndex(mapped, indexStat.st_size, &databaseStat))
+				{
+					index->data = mapped;
+					index->size = indexStat.st_size;
+					index->mapped = true;
+				}
+				else munmap(mapped, indexStat.st_size);
+			}
+		}
+		close(fd);
+	}
+
+	if (index->data == NULL)
+	{
+		uint8_t *		buffer;
+
+		if ((buffer = compileKeyIndex(database, &databaseStat, &index->size)) == NULL)
+		{
+			free(defaultName);
+			return false;
+		}
+		saveKeyIndex(indexFile, buffer, index->size);
+		index->data = buffer;
+	}
+
+	free(defaultName);
+
+	index->header = (const struct keyIndexHeader *) index->data;
+	index->strings = (const char *) index->data + index->header->stringsOffset;
+
+	return true;
+}
+
+void closeKeyIndex(struct keyIndex *index)
+{
+	if (index->mapped) munmap((void *) index->data, index->size);
+	else free((void *) index->data);
+
+	memset(index, 0, sizeof(struct keyIndex));
+}
+
+uint32_t keyIndexCount(const struct keyIndex *index)
+{
+	return index->header->keyCount;
+}
+
+const struct keyIndexKey * keyIndexGetKey(const struct keyIndex *index, uint32_t number)
+{
+	return &((const struct keyIndexKey *) (index->data + index->header->keysOffset))[number];
+}
+
+const struct keyIndexOwner * keyIndexGetOwner(const struct keyIndex *index, uint32_t number)
+{
+	return &((const struct keyIndexOwner *) (index->data + index->header->ownersOffset))[number];
+}
+
+const char * keyIndexString(const struct keyIndex *index, uint32_t offset)
+{
+	return index->strings + offset;
+}
+
+uint32_t keyIndexRevisionOwner(const struct keyIndex *index, uint32_t number)
+{
+	return ((const uint32_t *) (index->data + index->header->revisionsOffset))[number];
+}
+
+const struct keyIndexKey * findKeyByFingerprint(const struct keyIndex *index, const uint8_t *fingerprint)
+{
+	const uint32_t *	buckets = (const uint32_t *) (index->data + index->header->bucketsOffset);
+	uint32_t			mask = index->header->bucketCount - 1;
+	uint32_t			bucket = fingerprintHash(fingerprint) & mask;
+
+	// there's always at least one empty bucket, the table is never filled more than half
+	while (buckets[bucket] != KEY_INDEX_NONE)
+	{
+		const struct keyIndexKey *	key = keyIndexGetKey(index, buckets[bucket]);
+
+		if (memcmp(key->fingerprint, fingerprint, KEY_FINGERPRINT_SIZE) == 0) return key;
+		bucket = (bucket + 1) & mask;
+	}
+
+	return NULL;
+}
+
+const struct keyIndexKey * findKeyByModulus(const struct keyIndex *index, const char *modulus)
+{
+	uint8_t				fingerprint[KEY_FINGERPRINT_SIZE];
+
+	if (!keyFingerprint(modulus, fingerprint)) return NULL;
+	return findKeyByFingerprint(index, fingerprint);
+}
+
+// returns the position of the first owner with this HWRevision in the sorted list, use
+// 'keyIndexRevisionOwner' to get the owner number for each of the 'count' entries
+uint32_t findOwnersByRevision(const struct keyIndex *index, unsigned int hwRevision, uint32_t *count)
+{
+	uint32_t			low = 0;
+	uint32_t			high = index->header->ownerCount;
+	uint32_t			first;
+
+	while (low < high)
+	{
+		uint32_t		middle = low + (high - low) / 2;
+
+		if (keyIndexGetOwner(index, keyIndexRevisionOwner(index, middle))->hwRevision < hwRevision) low = middle + 1;
+		else high = middle;
+	}
+
+	first = low;
+	while (low < index->header->ownerCount && keyIndexGetOwner(index, keyIndexRevisionOwner(index, low))->hwRevision == hwRevision) low++;
+	*count = low - first;
+
+	return first;
+}
+
+// a replacement for 'loadKeyDatabase', the XML file is only parsed, if the index is outdated - the keys
+// in the index are distinct already, so they're appended to the list in a single pass without the
+// duplicate search from 'addKey' and the public keys are created on first use by 'checkSignature'
+bool loadKeyIndex(struct keyList *list, const char *database, const char *indexFile)
+{
+	struct keyIndex		index;
+	struct signingKey *	keys;
+	uint32_t			count;
+	uint32_t			i;
+	uint32_t			j;
+	bool				result = true;
+
+	if (!openKeyIndex(&index, database, indexFile, false)) return false;
+
+	if ((count = keyIndexCount(&index)) == 0)
+	{
+		closeKeyIndex(&index);
+		return true;
+	}
+
+	if ((keys = realloc(list->keys, (list->count + count) * sizeof(struct signingKey))) == NULL)
+	{
+		closeKeyIndex(&index);
+		return false;
+	}
+	list->keys = keys;
+
+	for (i = 0; result && i < count; i++)
+	{
+		const struct keyIndexKey *	indexKey = keyIndexGetKey(&index, i);
+		struct signingKey *	key = &list->keys[list->count];
+
+		memset(key, 0, sizeof(struct signingKey));
+		strcpy(key->modulus, keyIndexString(&index, indexKey->modulus));
+		strcpy(key->exponent, keyIndexString(&index, indexKey->exponent));
+
+		if (indexKey->ownerCount && (key->owners = calloc(indexKey->ownerCount, sizeof(struct keyOwner))) == NULL)
+		{
+			result = false;
+			break;
+		}
+		list->count++;
+
+		for (j = 0; j < indexKey->ownerCount; j++)
+		{
+			const struct keyIndexOwner *	owner = keyIndexGetOwner(&index, indexKey->firstOwner + j);
+			struct keyOwner *	keyOwner = &key->owners[key->ownerCount++];
+
+			keyOwner->hwRevision = owner->hwRevision;
+			keyOwner->vendorKey = (owner->vendorKey != 0);
+			snprintf(keyOwner->deviceName, sizeof(keyOwner->deviceName), "%s", keyIndexString(&index, owner->deviceName));
+			snprintf(keyOwner->keyName, sizeof(keyOwner->keyName), "%s", keyIndexString(&index, owner->keyName));
+		}
+	}
+
+	closeKeyIndex(&index);
+
+	return result;
+}
@@ -0,0 +1,54 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef SIGNIMAGE_KEYINDEX_H
+#define SIGNIMAGE_KEYINDEX_H
+
+#include "signimage_keys.h"
+
+#define KEY_INDEX_SUFFIX			".idx"
+#define KEY_FINGERPRINT_SIZE		32		// SHA-256 of the binary modulus
+#define KEY_INDEX_NONE				0xFFFFFFFF
+
+// one distinct key from the database, its owners are stored consecutively
+struct keyIndexKey
+{
+	uint8_t				fingerprint[KEY_FINGERPRINT_SIZE];
+	uint32_t			modulus;
+	uint32_t			exponent;
+	uint32_t			firstOwner;
+	uint32_t			ownerCount;
+};
+
+struct keyIndexOwner
+{
+	uint32_t			hwRevision;
+	uint32_t			deviceName;
+	uint32_t			keyName;
+	uint32_t			key;
+	uint32_t			vendorKey;
+};
+
+// a loaded (memory mapped or freshly compiled) index
+struct keyIndex
+{
+	const uint8_t *		data;
+	size_t				size;
+	bool				mapped;
+	const struct keyIndexHeader *	header;
+	const char *		strings;
+};
+
+bool openKeyIndex(struct keyIndex *index, const char *database, const char *indexFile, bool rebuild);
+void closeKeyIndex(struct keyIndex *index);
+bool keyFingerprint(const char *modulus, uint8_t *fingerprint);
+uint32_t keyIndexCount(const struct keyIndex *index);
+const struct keyIndexKey * keyIndexGetKey(const struct keyIndex *index, uint32_t number);
+const struct keyIndexOwner * keyIndexGetOwner(const struct keyIndex *index, uint32_t number);
+const char * keyIndexString(const struct keyIndex *index, uint32_t offset);
+const struct keyIndexKey * findKeyByFingerprint(const struct keyIndex *index, const uint8_t *fingerprint);
+const struct keyIndexKey * findKeyByModulus(const struct keyIndex *index, const char *modulus);
+uint32_t findOwnersByRevision(const struct keyIndex *index, unsigned int hwRevision, uint32_t *count);
+uint32_t keyIndexRevisionOwner(const struct keyIndex *index, uint32_t number);
+bool loadKeyIndex(struct keyList *list, const char *database, const char *indexFile);
+
+#endif
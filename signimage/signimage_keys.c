@@ -0,0 +1,436 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_keys.h"
+#include <ctype.h>
+#include <openssl/x509.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#define KEY_DATABASE_NAMESPACE		"urn:yourfritz-de:signimage"
+
+// the database is parsed with libxml2, like the feature database from 'framework/feature_index.c'
+static bool isKeyDatabaseElement(xmlNodePtr node, const char *name)
+{
+	return (node->type == XML_ELEMENT_NODE && xmlStrcmp(node->name, BAD_CAST name) == 0 &&
+		node->ns != NULL && xmlStrcmp(node->ns->href, BAD_CAST KEY_DATABASE_NAMESPACE) == 0);
+}
+
+static bool copyAttribute(xmlNodePtr node, const char *name, char *value, size_t valueSize)
+{
+	xmlChar *			content = xmlGetProp(node, BAD_CAST name);
+
+	if (content == NULL) return false;
+	snprintf(value, valueSize, "%s", (const char *) content);
+	xmlFree(content);
+
+	return true;
+}
+
+// the schema uses 'xs:token' for the values, so any whitespace is skipped - a value, which
+// doesn't fit into the buffer, is an error
+static bool copyElementText(xmlNodePtr parent, const char *name, char *value, size_t valueSize)
+{
+	xmlNodePtr			node;
+
+	for (node = parent->children; node != NULL; node = node->next)
+	{
+		xmlChar *		content;
+		const xmlChar *	ptr;
+		size_t			length = 0;
+
+		if (!isKeyDatabaseElement(node, name)) continue;
+		if ((content = xmlNodeGetContent(node)) == NULL) return false;
+
+		for (ptr = content; *ptr && length < valueSize; ptr++)
+		{
+			if (!isspace(*ptr)) value[length++] = tolower(*ptr);
+		}
+		xmlFree(content);
+
+		if (length == 0 || length >= valueSize) return false;
+		value[length] = 0;
+		return true;
+	}
+
+	return false;
+}
+
+static size_t hexToBinary(const char *hex, uint8_t *binary, size_t binarySize)
+{
+	size_t				length = strlen(hex);
+	size_t				i;
+	unsigned int		value;
+
+	if ((length % 2) != 0 || length / 2 > binarySize) return 0;
+
+	for (i = 0; i < length / 2; i++)
+	{
+		if (sscanf(hex + (i * 2), "%2x", &value) != 1) return 0;
+		binary[i] = (uint8_t) value;
+	}
+
+	return i;
+}
+
+static size_t derLength(uint8_t *der, size_t length)
+{
+	if (length < 128)
+	{
+		der[0] = (uint8_t) length;
+		return 1;
+	}
+	if (length < 256)
+	{
+		der[0] = 0x81;
+		der[1] = (uint8_t) length;
+		return 2;
+	}
+	der[0] = 0x82;
+	der[1] = (uint8_t) (length >> 8);
+	der[2] = (uint8_t) length;
+	return 3;
+}
+
+static size_t derInteger(uint8_t *der, const uint8_t *value, size_t length)
+{
+	size_t				used = 0;
+	bool				pad;
+
+	// skip leading zeros, but add one, if the highest bit is set (it's a signed value)
+	while (length > 1 && *value == 0)
+	{
+		value++;
+		length--;
+	}
+	pad = ((*value & 0x80) != 0);
+
+	der[used++] = 0x02;
+	used += derLength(der + used, length + (pad ? 1 : 0));
+	if (pad) der[used++] = 0;
+	memcpy(der + used, value, length);
+
+	return used + length;
+}
+
+// build the SubjectPublicKeyInfo structure like 'modulus_to_der' in 'check_signed_image' does it
+EVP_PKEY * publicKeyFromModulus(const char *modulus, const char *exponent)
+{
+	static const uint8_t	algorithm[] = { 0x30, 0x0D, 0x06, 0x09, 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x01, 0x01, 0x01, 0x05, 0x00 };
+	uint8_t					mod[KEY_MODULUS_SIZE / 2];
+	uint8_t					exp[KEY_EXPONENT_SIZE / 2];
+	uint8_t					integers[sizeof(mod) + sizeof(exp) + 16];
+	uint8_t					publicKey[sizeof(integers) + 16];
+	uint8_t					der[sizeof(publicKey) + sizeof(algorithm) + 16];
+	size_t					modSize;
+	size_t					expSize;
+	size_t					intSize = 0;
+	size_t					pkSize = 0;
+	size_t					derSize = 0;
+	const uint8_t *			ptr = der;
+
+	if ((modSize = hexToBinary(modulus, mod, sizeof(mod))) == 0) return NULL;
+	if ((expSize = hexToBinary(exponent, exp, sizeof(exp))) == 0) return NULL;
+
+	intSize += derInteger(integers, mod, modSize);
+	intSize += derInteger(integers + intSize, exp, expSize);
+
+	// BIT STRING with a SEQUENCE of both integers
+	publicKey[pkSize++] = 0x03;
+	pkSize += derLength(publicKey + pkSize, intSize + derLength(der, intSize) + 2);
+	publicKey[pkSize++] = 0x00;
+	publicKey[pkSize++] = 0x30;
+	pkSize += derLength(publicKey + pkSize, intSize);
+	memcpy(publicKey + pkSize, integers, intSize);
+	pkSize += intSize;
+
+	der[derSize++] = 0x30;
+	derSize += derLength(der + derSize, sizeof(algorithm) + pkSize);
+	memcpy(der + derSize, algorithm, sizeof(algorithm));
+	derSize += sizeof(algorithm);
+	memcpy(der + derSize, publicKey, pkSize);
+	derSize += pkSize;
+
+	return d2i_PUBKEY(NULL, &ptr, derSize);
+}
+
+struct signingKey * addKey(struct keyList *list, const char *modulus, const char *exponent, const struct keyOwner *owner)
+{
+	struct signingKey *	key = NULL;
+	size_t				i;
+
+	// strip a leading zero byte (from ASN.1 output), it's not contained in the database
+	while (modulus[0] == '0' && modulus[1] == '0') modulus += 2;
+
+	for (i = 0; i < list->count; i++)
+	{
+		if (strcmp(list->keys[i].modulus, modulus) == 0 && strcmp(list->keys[i].exponent, exponent) == 0)
+		{
+			key = &list->keys[i];
+			break;
+		}
+	}
+
+	if (key == NULL)
+	{
+		struct signingKey *	keys;
+
+		if (strlen(modulus) > KEY_MODULUS_SIZE || strlen(exponent) > KEY_EXPONENT_SIZE) return NULL;
+		if ((keys = realloc(list->keys, (list->count + 1) * sizeof(struct signingKey))) == NULL) return NULL;
+		list->keys = keys;
+		key = &list->keys[list->count];
+		memset(key, 0, sizeof(struct signingKey));
+		strcpy(key->modulus, modulus);
+		strcpy(key->exponent, exponent);
+
+		if ((key->key = publicKeyFromModulus(modulus, exponent)) == NULL)
+		{
+			fprintf(stderr, "Unable to create a public key from modulus '%.16s...'.\n", modulus);
+			return NULL;
+		}
+		list->count++;
+	}
+
+	if (owner != NULL)
+	{
+		struct keyOwner *	owners;
+
+		if ((owners = realloc(key->owners, (key->ownerCount + 1) * sizeof(struct keyOwner))) == NULL) return NULL;
+		key->owners = owners;
+		memcpy(&key->owners[key->ownerCount++], owner, sizeof(struct keyOwner));
+	}
+
+	return key;
+}
+
+// the size of the key in bytes, computed from the modulus (without any leading zero bytes) - it's
+// used to skip keys, which can't match a signature, without creating their public key
+size_t signingKeySize(const struct signingKey *key)
+{
+	return ((strlen(key->modulus) + 1) / 2);
+}
+
+// keys from an index are loaded without their public key, it's created on first use - the list may
+// be shared by threads, so the pointer is set atomically and a concurrently created key is discarded
+EVP_PKEY * signingKeyPublic(const struct signingKey *key)
+{
+	EVP_PKEY *			current = __atomic_load_n(&key->key, __ATOMIC_ACQUIRE);
+	EVP_PKEY *			created;
+
+	if (current != NULL) return current;
+	if ((created = publicKeyFromModulus(key->modulus, key->exponent)) == NULL) return NULL;
+
+	if (!__atomic_compare_exchange_n((EVP_PKEY **) &key->key, &current, created, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		EVP_PKEY_free(created);
+		return current;
+	}
+
+	return created;
+}
+
+bool loadKeyDatabase(struct keyList *list, const char *fileName)
+{
+	xmlDocPtr			document;
+	xmlNodePtr			root;
+	xmlNodePtr			devices;
+	xmlNodePtr			device;
+	xmlNodePtr			key;
+	bool				result = true;
+
+	if ((document = xmlReadFile(fileName, NULL, XML_PARSE_NONET)) == NULL)
+	{
+		fprintf(stderr, "Error parsing key database '%s'.\n", fileName);
+		return false;
+	}
+
+	root = xmlDocGetRootElement(document);
+	for (devices = (root != NULL ? root->children : NULL); result && devices != NULL; devices = devices->next)
+	{
+		if (!isKeyDatabaseElement(devices, "devices")) continue;
+
+		for (device = devices->children; result && device != NULL; device = device->next)
+		{
+			struct keyOwner		owner;
+			char				value[32];
+
+			if (!isKeyDatabaseElement(device, "device")) continue;
+
+			memset(&owner, 0, sizeof(owner));
+			if (copyAttribute(device, "HWRevision", value, sizeof(value))) owner.hwRevision = strtoul(value, NULL, 10);
+			copyAttribute(device, "name", owner.deviceName, sizeof(owner.deviceName));
+
+			for (key = device->children; result && key != NULL; key = key->next)
+			{
+				char			modulus[KEY_MODULUS_SIZE + 1];
+				char			exponent[KEY_EXPONENT_SIZE + 1];
+
+				if (!isKeyDatabaseElement(key, "key")) continue;
+
+				owner.keyName[0] = 0;
+				copyAttribute(key, "original_name", owner.keyName, sizeof(owner.keyName));
+				owner.vendorKey = (copyAttribute(key, "source", value, sizeof(value)) && strcmp(value, "vendor") == 0);
+
+				if (!copyElementText(key, "modulus", modulus, sizeof(modulus)))
+				{
+					fprintf(stderr, "Missing or invalid modulus for key '%s' of device '%s' in key database '%s'.\n", owner.keyName, owner.deviceName, fileName);
+					result = false;
+					break;
+				}
+				if (!copyElementText(key, "exponent", exponent, sizeof(exponent))) strcpy(exponent, "010001");
+				if (addKey(list, modulus, exponent, &owner) == NULL) result = false;
+			}
+		}
+	}
+
+	xmlFreeDoc(document);
+
+	return result;
+}
+
+bool addKeyFromPemFile(struct keyList *list, const char *fileName)
+{
+	FILE *				file;
+	EVP_PKEY *			key;
+	BIGNUM *			n = NULL;
+	BIGNUM *			e = NULL;
+	char *				modulus = NULL;
+	char *				exponent = NULL;
+	char *				ptr;
+	struct keyOwner		owner;
+	bool				result = false;
+
+	if ((file = fopen(fileName, "r")) == NULL)
+	{
+		fprintf(stderr, "Error %d opening public key file '%s'.\n", errno, fileName);
+		return false;
+	}
+
+	key = PEM_read_PUBKEY(file, NULL, NULL, NULL);
+	fclose(file);
+
+	if (key == NULL || EVP_PKEY_base_id(key) != EVP_PKEY_RSA)
+	{
+		fprintf(stderr, "The file '%s' doesn't contain a public RSA key in PEM format.\n", fileName);
+		EVP_PKEY_free(key);
+		return false;
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_PKEY_get_bn_param(key, "n", &n);
+	EVP_PKEY_get_bn_param(key, "e", &e);
+#else
+	RSA_get0_key(EVP_PKEY_get0_RSA(key), (const BIGNUM **) &n, (const BIGNUM **) &e, NULL);
+#endif
+
+	if (n != NULL && e != NULL && (modulus = BN_bn2hex(n)) != NULL && (exponent = BN_bn2hex(e)) != NULL)
+	{
+		for (ptr = modulus; *ptr; ptr++) *ptr = tolower((unsigned char) *ptr);
+		for (ptr = exponent; *ptr; ptr++) *ptr = tolower((unsigned char) *ptr);
+
+		memset(&owner, 0, sizeof(owner));
+		snprintf(owner.keyName, sizeof(owner.keyName), "%s", fileName);
+		strcpy(owner.deviceName, "-");
+
+		// the database stores the exponent with an even number of digits (010001)
+		if (strlen(exponent) % 2)
+		{
+			char		padded[KEY_EXPONENT_SIZE + 1];
+
+			snprintf(padded, sizeof(padded), "0%s", exponent);
+			result = (addKey(list, modulus, padded, &owner) != NULL);
+		}
+		else result = (addKey(list, modulus, exponent, &owner) != NULL);
+	}
+
+	OPENSSL_free(modulus);
+	OPENSSL_free(exponent);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	BN_free(n);
+	BN_free(e);
+#endif
+	EVP_PKEY_free(key);
+
+	return result;
+}
+
+// AVM's key files (/etc/avm_firmware_public_key?) contain the modulus and the exponent as lines of hexadecimal digits
+bool addKeyFromAvmFile(struct keyList *list, const char *fileName)
+{
+	FILE *				file;
+	char				modulus[KEY_MODULUS_SIZE + 2];
+	char				exponent[KEY_EXPONENT_SIZE + 2];
+	char *				ptr;
+	struct keyOwner		owner;
+
+	if ((file = fopen(fileName, "r")) == NULL)
+	{
+		fprintf(stderr, "Error %d opening public key file '%s'.\n", errno, fileName);
+		return false;
+	}
+
+	if (fgets(modulus, sizeof(modulus), file) == NULL || fgets(exponent, sizeof(exponent), file) == NULL)
+	{
+		modulus[0] = 0;
+	}
+	fclose(file);
+
+	modulus[strcspn(modulus, "\r\n")] = 0;
+	exponent[strcspn(exponent, "\r\n")] = 0;
+
+	if (modulus[0] == 0 || exponent[0] == 0 || modulus[strspn(modulus, "0123456789abcdefABCDEF")] != 0 || exponent[strspn(exponent, "0123456789abcdefABCDEF")] != 0)
+	{
+		fprintf(stderr, "The file '%s' doesn't contain a public key in AVM's format.\n", fileName);
+		return false;
+	}
+
+	for (ptr = modulus; *ptr; ptr++) *ptr = tolower((unsigned char) *ptr);
+	for (ptr = exponent; *ptr; ptr++) *ptr = tolower((unsigned char) *ptr);
+
+	// an even number of digits is needed, like in the database
+	if (strlen(exponent) % 2)
+	{
+		memmove(exponent + 1, exponent, strlen(exponent) + 1);
+		exponent[0] = '0';
+	}
+
+	memset(&owner, 0, sizeof(owner));
+	snprintf(owner.keyName, sizeof(owner.keyName), "%s", fileName);
+	strcpy(owner.deviceName, "-");
+
+	return (addKey(list, modulus, exponent, &owner) != NULL);
+}
+
+void freeKeyList(struct keyList *list)
+{
+	size_t				i;
+
+	for (i = 0; i < list->count; i++)
+	{
+		EVP_PKEY_free(list->keys[i].key);
+		free(list->keys[i].owners);
+	}
+
+	free(list->keys);
+	list->keys = NULL;
+	list->count = 0;
+}
@@ -0,0 +1,47 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef SIGNIMAGE_KEYS_H
+#define SIGNIMAGE_KEYS_H
+
+#include "signimage_helpers.h"
+
+#define KEY_MODULUS_SIZE			1024	// hexadecimal characters, enough for 4096 bit keys
+#define KEY_EXPONENT_SIZE			16
+#define KEY_NAME_SIZE				64
+#define KEY_DEVICE_SIZE				64
+
+// a device (or another source), where a key was found
+struct keyOwner
+{
+	unsigned int		hwRevision;
+	char				deviceName[KEY_DEVICE_SIZE];
+	char				keyName[KEY_NAME_SIZE];
+	bool				vendorKey;
+};
+
+// one distinct public key, identical keys from different devices are merged
+struct signingKey
+{
+	char				modulus[KEY_MODULUS_SIZE + 1];
+	char				exponent[KEY_EXPONENT_SIZE + 1];
+	EVP_PKEY *			key;		// may be NULL, use 'signingKeyPublic' to get it
+	struct keyOwner *	owners;
+	size_t				ownerCount;
+};
+
+struct keyList
+{
+	struct signingKey *	keys;
+	size_t				count;
+};
+
+bool loadKeyDatabase(struct keyList *list, const char *fileName);
+bool addKeyFromPemFile(struct keyList *list, const char *fileName);
+bool addKeyFromAvmFile(struct keyList *list, const char *fileName);
+struct signingKey * addKey(struct keyList *list, const char *modulus, const char *exponent, const struct keyOwner *owner);
+EVP_PKEY * publicKeyFromModulus(const char *modulus, const char *exponent);
+size_t signingKeySize(const struct signingKey *key);
+EVP_PKEY * signingKeyPublic(const struct signingKey *key);
+void freeKeyList(struct keyList *list);
+
+#endif
@@ -0,0 +1,92 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_pkcs1.h"
+#include <openssl/err.h>
+#include <openssl/objects.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+// the signature is checked by OpenSSL for each computed digest, it encodes the expected DigestInfo
+// and compares the whole decrypted block, so no other encoding or algorithm is accepted
+//
+// only if none of them matches, the DigestInfo is recovered leniently to tell the reason and the
+// name of the hash algorithm
+int verifyPkcs1Signature(EVP_PKEY *key, const uint8_t *signature, size_t signatureSize, int count, const EVP_MD * const *md, uint8_t (*digests)[EVP_MAX_MD_SIZE], const char **hashName)
+{
+	EVP_PKEY_CTX *		ctx;
+	uint8_t				decoded[PKCS1_MAX_SIZE];
+	size_t				decodedSize = sizeof(decoded);
+	const uint8_t *		ptr = decoded;
+	X509_SIG *			digestInfo;
+	const X509_ALGOR *	algorithm;
+	int					result = PKCS1_UNSUPPORTED_HASH;
+	int					nid;
+	int					i;
+
+	if ((size_t) EVP_PKEY_size(key) != signatureSize) return PKCS1_WRONG_KEY;
+
+	for (i = 0; i < count; i++)
+	{
+		bool			verified;
+
+		if ((ctx = EVP_PKEY_CTX_new(key, NULL)) == NULL) continue;
+		verified = (EVP_PKEY_verify_init(ctx) > 0 &&
+			EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) > 0 &&
+			EVP_PKEY_CTX_set_signature_md(ctx, md[i]) > 0 &&
+			EVP_PKEY_verify(ctx, signature, signatureSize, digests[i], EVP_MD_size(md[i])) == 1);
+		EVP_PKEY_CTX_free(ctx);
+
+		if (verified)
+		{
+			if (hashName) *hashName = OBJ_nid2sn(EVP_MD_type(md[i]));
+			return PKCS1_VERIFIED;
+		}
+	}
+	ERR_clear_error();
+
+	if (signatureSize > sizeof(decoded) || (ctx = EVP_PKEY_CTX_new(key, NULL)) == NULL) return PKCS1_WRONG_KEY;
+
+	if (EVP_PKEY_verify_recover_init(ctx) <= 0 ||
+		EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0 ||
+		EVP_PKEY_verify_recover(ctx, decoded, &decodedSize, signature, signatureSize) <= 0 ||
+		(digestInfo = d2i_X509_SIG(NULL, &ptr, decodedSize)) == NULL)
+	{
+		EVP_PKEY_CTX_free(ctx);
+		ERR_clear_error();
+		return PKCS1_WRONG_KEY;
+	}
+	EVP_PKEY_CTX_free(ctx);
+
+	X509_SIG_get0(digestInfo, &algorithm, NULL);
+	nid = OBJ_obj2nid(algorithm->algorithm);
+	if (hashName) *hashName = OBJ_nid2sn(nid);
+
+	for (i = 0; i < count; i++)
+	{
+		if (EVP_MD_type(md[i]) == nid) result = PKCS1_MISMATCH;
+	}
+
+	X509_SIG_free(digestInfo);
+
+	return result;
+}
@@ -0,0 +1,21 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef SIGNIMAGE_PKCS1_H
+#define SIGNIMAGE_PKCS1_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+#define PKCS1_MAX_SIZE				1024	// 8192 bit keys
+
+// results of a signature check with one key
+#define PKCS1_VERIFIED				0		// the signature matches one of the digests
+#define PKCS1_WRONG_KEY				1		// the signature wasn't made with this key
+#define PKCS1_MISMATCH				2		// made with this key, but over other data
+#define PKCS1_UNSUPPORTED_HASH		3		// made with this key and a hash algorithm without digest
+
+int verifyPkcs1Signature(EVP_PKEY *key, const uint8_t *signature, size_t signatureSize, int count, const EVP_MD * const *md, uint8_t (*digests)[EVP_MAX_MD_SIZE], const char **hashName);
+
+#endif
@@ -0,0 +1,116 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_verify.h"
+#include "signimage_pkcs1.h"
+
+bool initHashSet(struct hashSet *hashes, const char *names)
+{
+	char				list[256];
+	char *				name;
+	char *				saved = NULL;
+
+	memset(hashes, 0, sizeof(struct hashSet));
+	snprintf(list, sizeof(list), "%s", (names ? names : "md5"));
+
+	for (name = strtok_r(list, ",", &saved); name != NULL; name = strtok_r(NULL, ",", &saved))
+	{
+		const EVP_MD *	md = hashAlgorithmByName(name);
+
+		if (md == NULL || hashes->count >= MAX_HASHES) return false;
+		hashes->md[hashes->count] = md;
+		hashes->image[hashes->count] = EVP_MD_CTX_new();
+		hashes->withoutSignature[hashes->count] = EVP_MD_CTX_new();
+		EVP_DigestInit_ex(hashes->image[hashes->count], md, NULL);
+		hashes->count++;
+	}
+
+	return (hashes->count > 0);
+}
+
+void freeHashSet(struct hashSet *hashes)
+{
+	int					i;
+
+	for (i = 0; i < hashes->count; i++)
+	{
+		EVP_MD_CTX_free(hashes->image[i]);
+		EVP_MD_CTX_free(hashes->withoutSignature[i]);
+	}
+}
+
+void hashData(struct hashSet *hashes, const void *data, size_t size, const void *signedData)
+{
+	int					i;
+
+	for (i = 0; i < hashes->count; i++)
+	{
+		EVP_DigestUpdate(hashes->image[i], data, size);
+		if (hashes->signatureSeen) EVP_DigestUpdate(hashes->withoutSignature[i], (signedData ? signedData : data), size);
+	}
+}
+
+// the last signature member is the one to verify, like 'tar' would extract it last
+void startSignature(struct hashSet *hashes)
+{
+	int					i;
+
+	for (i = 0; i < hashes->count; i++) EVP_MD_CTX_copy_ex(hashes->withoutSignature[i], hashes->image[i]);
+	hashes->signatureSeen = true;
+}
+
+int checkSignature(struct hashSet *hashes, const struct keyList *keys, const uint8_t *signature, size_t signatureSize, const struct signingKey **key, const char **hashName)
+{
+	uint8_t				digests[MAX_HASHES][EVP_MAX_MD_SIZE];
+	size_t				k;
+	int					i;
+
+	for (i = 0; i < hashes->count; i++) EVP_DigestFinal_ex(hashes->withoutSignature[i], digests[i], NULL);
+
+	for (k = 0; k < keys->count; k++)
+	{
+		EVP_PKEY *		publicKey;
+
+		if (signingKeySize(&keys->keys[k]) != signatureSize) continue;
+		if ((publicKey = signingKeyPublic(&keys->keys[k])) == NULL) continue;
+
+		switch (verifyPkcs1Signature(publicKey, signature, signatureSize, hashes->count, hashes->md, digests, hashName))
+		{
+			case PKCS1_WRONG_KEY:
+				continue;
+
+			case PKCS1_VERIFIED:
+				*key = &keys->keys[k];
+				return RESULT_OK;
+
+			case PKCS1_UNSUPPORTED_HASH:
+				*key = &keys->keys[k];
+				return RESULT_UNSUPPORTED_HASH;
+
+			default:
+				*key = &keys->keys[k];
+				return RESULT_FAILED;
+		}
+	}
+
+	return RESULT_NO_KEY;
+}
@@ -0,0 +1,35 @@
+// vim: set tabstop=4 syntax=c :
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef SIGNIMAGE_VERIFY_H
+#define SIGNIMAGE_VERIFY_H
+
+#include "signimage_keys.h"
+
+#define MAX_HASHES					6
+
+// result codes are the same as from 'check_signed_image'
+#define RESULT_OK					0
+#define RESULT_NOT_FOUND			3
+#define RESULT_NO_SIGNATURE			4
+#define RESULT_SIGNATURE_SIZE		5
+#define RESULT_NO_KEY				7
+#define RESULT_UNSUPPORTED_HASH		9
+#define RESULT_INVALID_IMAGE		12
+#define RESULT_FAILED				64
+
+struct hashSet
+{
+	int					count;
+	const EVP_MD *		md[MAX_HASHES];
+	EVP_MD_CTX *		image[MAX_HASHES];		// image content as it is
+	EVP_MD_CTX *		withoutSignature[MAX_HASHES];		// image content with empty signature member
+	bool				signatureSeen;
+};
+
+bool initHashSet(struct hashSet *hashes, const char *names);
+void freeHashSet(struct hashSet *hashes);
+void hashData(struct hashSet *hashes, const void *data, size_t size, const void *signedData);
+void startSignature(struct hashSet *hashes);
+int checkSignature(struct hashSet *hashes, const struct keyList *keys, const uint8_t *signature, size_t signatureSize, const struct signingKey **key, const char **hashName);
+
+#endif
@@ -0,0 +1,334 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_helpers.h"
+
+void usage()
+{
+	fprintf(stderr, "stream_sign_image - sign a TAR archive as firmware image for FRITZ!OS devices\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "stream_sign_image [ -a <hash> ] [ -k <key_file> ] [ -p <password> ] [ <imagefile> | - ]\n");
+	fprintf(stderr, "\nThe archive is read once (from STDIN, if no file or '-' was specified),");
+	fprintf(stderr, "\nits content is hashed while it's copied to STDOUT and the signature");
+	fprintf(stderr, "\nmember './var/signature' is appended at the end of the stream.\n");
+	fprintf(stderr, "\nThe default hash algorithm is MD5 (as used by AVM), another one may be");
+	fprintf(stderr, "\nselected with option -a or with the USEHASH environment variable.\n");
+	fprintf(stderr, "\nThe private key file defaults to '<name_prefix>.key' with the same");
+	fprintf(stderr, "\nprefix rules as in 'image_signing_files.inc', its password will be");
+	fprintf(stderr, "\nread from the terminal, if it wasn't specified with option -p.\n");
+}
+
+char * defaultKeyFile()
+{
+	static char		keyFile[4096];
+	const char *	prefix = getenv("name_prefix");
+
+	if (prefix == NULL || *prefix == 0) prefix = getenv("FREETZ_IMAGE_SIGNING_PREFIX");
+	if (prefix == NULL || *prefix == 0)
+	{
+		const char *	home = getenv("HOME");
+
+		snprintf(keyFile, sizeof(keyFile), "%s/image_signing.key", (home ? home : "."));
+	}
+	else snprintf(keyFile, sizeof(keyFile), "%s.key", prefix);
+
+	return keyFile;
+}
+
+EVP_PKEY * loadPrivateKey(const char *keyFile, const char *password)
+{
+	FILE *			file;
+	EVP_PKEY *		key = NULL;
+
+	if ((file = fopen(keyFile, "r")) == NULL)
+	{
+		fprintf(stderr, "Error %d opening private key file '%s'.\n", errno, keyFile);
+		return NULL;
+	}
+
+	// a NULL password lets OpenSSL ask on the terminal
+	if ((key = PEM_read_PrivateKey(file, NULL, NULL, (void *) password)) == NULL)
+	{
+		fprintf(stderr, "Unable to read private key from '%s', wrong password?\n", keyFile);
+	}
+	else if (EVP_PKEY_base_id(key) != EVP_PKEY_RSA || EVP_PKEY_size(key) > SIGNATURE_MAX_SIZE)
+	{
+		fprintf(stderr, "The key from '%s' is not an RSA key or it's too large.\n", keyFile);
+		EVP_PKEY_free(key);
+		key = NULL;
+	}
+
+	fclose(file);
+
+	return key;
+}
+
+size_t signDigest(EVP_PKEY *key, const EVP_MD *md, const uint8_t *digest, unsigned int digestSize, uint8_t *signature)
+{
+	EVP_PKEY_CTX *	ctx;
+	size_t			signatureSize = SIGNATURE_MAX_SIZE;
+
+	if ((ctx = EVP_PKEY_CTX_new(key, NULL)) == NULL) return 0;
+
+	if (EVP_PKEY_sign_init(ctx) <= 0 ||
+		EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0 ||
+		EVP_PKEY_CTX_set_signature_md(ctx, md) <= 0 ||
+		EVP_PKEY_sign(ctx, signature, &signatureSize, digest, digestSize) <= 0)
+	{
+		signatureSize = 0;
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+
+	return signatureSize;
+}
+
+// build the signature member's header from the first header of the archive, like the script does it
+void buildSignatureHeader(struct tarHeader *header, const struct tarHeader *first, size_t signatureSize)
+{
+	memcpy(header, first, sizeof(struct tarHeader));
+	memset(header->data + TAR_NAME_OFFSET, 0, TAR_NAME_SIZE);
+	memcpy(header->data + TAR_NAME_OFFSET, SIGNATURE_MEMBER_NAME, strlen(SIGNATURE_MEMBER_NAME));
+	snprintf((char *) header->data + TAR_SIZE_OFFSET, TAR_SIZE_SIZE, "%011o", (unsigned int) signatureSize);
+	header->data[TAR_TYPEFLAG_OFFSET] = '0';
+	memset(header->data + TAR_TYPEFLAG_OFFSET + 1, 0, TAR_MAGIC_OFFSET - TAR_TYPEFLAG_OFFSET - 1); // no link name
+	tarHeaderSetChecksum(header);
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 1;
+	const char *		hashName = getenv("USEHASH");
+	const char *		keyFile = NULL;
+	const char *		password = NULL;
+	const char *		imageFile = NULL;
+	int					input = 0;
+	const EVP_MD *		md;
+	EVP_PKEY *			key;
+	EVP_MD_CTX *		hash;
+	struct tarHeader *	buffer;
+	struct tarHeader	first;
+	struct tarHeader	zero;
+	struct tarHeader	signatureHeader;
+	uint8_t				digest[EVP_MAX_MD_SIZE];
+	unsigned int		digestSize;
+	uint8_t				signature[SIGNATURE_MAX_SIZE];
+	size_t				signatureSize;
+	size_t				copyBlocks = 0;		// blocks of archive members (without EoA)
+	size_t				dataBlocks = 0;		// remaining data blocks of the current member
+	bool				endOfArchive = false;
+	bool				failed = false;
+	size_t				fillerBlocks = 0;
+	int					i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) hashName = argv[++i];
+		else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) keyFile = argv[++i];
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) password = argv[++i];
+		else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+		{
+			usage();
+			exit(1);
+		}
+		else if (imageFile == NULL) imageFile = argv[i];
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (isatty(1))
+	{
+		fprintf(stderr, "The output stream is a terminal device, please redirect output to a file.\n");
+		exit(1);
+	}
+
+	if ((md = hashAlgorithmByName(hashName)) == NULL)
+	{
+		fprintf(stderr, "Unknown or unsupported hash algorithm '%s' specified.\n", hashName);
+		exit(1);
+	}
+
+	if (imageFile != NULL && strcmp(imageFile, "-") != 0)
+	{
+		if ((input = open(imageFile, O_RDONLY)) == -1)
+		{
+			fprintf(stderr, "Error %d opening image file '%s'.\n", errno, imageFile);
+			exit(1);
+		}
+	}
+
+	// load the key prior to any output, a wrong password should not leave a truncated image
+	if ((key = loadPrivateKey((keyFile ? keyFile : defaultKeyFile()), password)) == NULL) exit(1);
+
+	if ((buffer = malloc(STREAM_BLOCKS * sizeof(struct tarHeader))) == NULL)
+	{
+		fprintf(stderr, "Error allocating stream buffer.\n");
+		exit(1);
+	}
+
+	hash = EVP_MD_CTX_new();
+	EVP_DigestInit_ex(hash, md, NULL);
+	memset(&zero, 0, sizeof(zero));
+
+	while (!endOfArchive && !failed)
+	{
+		ssize_t		got = readBlocks(input, buffer, STREAM_BLOCKS * sizeof(struct tarHeader));
+		size_t		blocks;
+		size_t		used = 0;
+
+		if (got == -1)
+		{
+			fprintf(stderr, "Error %d reading image data.\n", errno);
+			failed = true;
+			break;
+		}
+
+		if (got % sizeof(struct tarHeader))
+		{
+			fprintf(stderr, "Input size is not a multiple of %u bytes, it's not a valid TAR archive.\n", TAR_BLOCK_SIZE);
+			failed = true;
+			break;
+		}
+
+		if ((blocks = got / sizeof(struct tarHeader)) == 0) break;
+
+		while (used < blocks)
+		{
+			struct tarHeader *	block = buffer + used;
+
+			if (dataBlocks > 0) // skip member content, it's only copied
+			{
+				size_t		skip = (dataBlocks > blocks - used ? blocks - used : dataBlocks);
+
+				dataBlocks -= skip;
+				used += skip;
+				continue;
+			}
+
+			if (tarHeaderIsEmpty(block))
+			{
+				endOfArchive = true;
+				break;
+			}
+
+			if (!tarHeaderIsValid(block))
+			{
+				fprintf(stderr, "Invalid TAR header found at offset %zu, the input doesn't look like an (old-style) TAR archive.\n", (copyBlocks + used) * TAR_BLOCK_SIZE);
+				failed = true;
+				break;
+			}
+
+			if (tarHeaderIsExtended(block))
+			{
+				fprintf(stderr, "Input file contains extended headers (PaxHeaders) and may not be signed this way.\n");
+				failed = true;
+				break;
+			}
+
+			if (tarHeaderIsMember(block, SIGNATURE_MEMBER_NAME))
+			{
+				fprintf(stderr, "The input file already contains a member '%s' and may not be signed (again).\n", SIGNATURE_MEMBER_NAME);
+				failed = true;
+				break;
+			}
+
+			if (copyBlocks == 0 && used == 0) memcpy(&first, block, sizeof(first));
+
+			dataBlocks = tarHeaderBlocks(block) - 1;
+			used++;
+		}
+
+		if (failed) break;
+
+		// everything in front of the EoA marker is hashed and copied to STDOUT
+		EVP_DigestUpdate(hash, buffer, used * sizeof(struct tarHeader));
+		if (!writeBlocks(1, buffer, used * sizeof(struct tarHeader)))
+		{
+			fprintf(stderr, "Error %d writing output data.\n", errno);
+			failed = true;
+			break;
+		}
+		copyBlocks += used;
+
+		if ((size_t) got < STREAM_BLOCKS * sizeof(struct tarHeader)) break;
+	}
+
+	if (!failed && (copyBlocks == 0 || dataBlocks > 0))
+	{
+		fprintf(stderr, "Unexpected end of input, the archive is empty or truncated.\n");
+		failed = true;
+	}
+
+	if (!failed)
+	{
+		// repeat the first entry as filler to circumvent AVM's hash errors (see 'sign_image' script)
+		if ((copyBlocks + 2) % 20 == 0) fillerBlocks = 1;
+		else if ((copyBlocks % 8) == 5 || (copyBlocks % 8) == 6) fillerBlocks = 2;
+
+		for (i = 0; i < (int) fillerBlocks; i++)
+		{
+			EVP_DigestUpdate(hash, &first, sizeof(first));
+			if (!writeBlocks(1, &first, sizeof(first))) failed = true;
+		}
+
+		// the signature member is hashed as two empty blocks, followed by the EoA marker
+		for (i = 0; i < 4; i++) EVP_DigestUpdate(hash, &zero, sizeof(zero));
+		EVP_DigestFinal_ex(hash, digest, &digestSize);
+
+		if (failed)
+		{
+			fprintf(stderr, "Error %d writing output data.\n", errno);
+		}
+		else if ((signatureSize = signDigest(key, md, digest, digestSize, signature)) == 0)
+		{
+			fprintf(stderr, "Error signing the image hash.\n");
+			ERR_print_errors_fp(stderr);
+			failed = true;
+		}
+		else
+		{
+			memset(signature + signatureSize, 0, sizeof(signature) - signatureSize);
+			buildSignatureHeader(&signatureHeader, &first, signatureSize);
+
+			if (writeBlocks(1, &signatureHeader, sizeof(signatureHeader)) &&
+				writeBlocks(1, signature, sizeof(signature)) &&
+				writeBlocks(1, &zero, sizeof(zero)) &&
+				writeBlocks(1, &zero, sizeof(zero)))
+			{
+				returnCode = 0;
+			}
+			else fprintf(stderr, "Error %d writing output data.\n", errno);
+		}
+	}
+
+	EVP_MD_CTX_free(hash);
+	EVP_PKEY_free(key);
+	free(buffer);
+	if (input != 0) close(input);
+
+	exit(returnCode);
+}
@@ -0,0 +1,832 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include "signimage_keyindex.h"
+#include "signimage_verify.h"
+#include <glob.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <mtd/mtd-user.h>
+
+#define AVM_KEY_FILES				"/etc/avm_firmware_public_key[1-9]"
+#define RESULT_NO_KEYS				11		// like 'check_signed_image', if no key source provided a key
+#define STAGED_SUFFIX				".staged"
+#define MEMBER_NAME_SIZE			(TAR_PREFIX_SIZE + TAR_NAME_SIZE + 2)
+#define TARGET_BUFFER_SIZE			(64 * 1024)		// used for files, MTD devices use their erase block size
+#define MAX_OPTIONS					32
+
+// additional result code, if the image couldn't be installed
+#define RESULT_COMMIT_FAILED		65
+
+// a member name from the command line, with the target of its content or only to be required
+struct memberOption
+{
+	const char *		name;
+	const char *		target;
+	bool				seen;
+};
+
+// a member, which was staged while the archive was read
+struct stagedMember
+{
+	char				name[MEMBER_NAME_SIZE];
+	char				target[PATH_MAX];
+	char				staged[PATH_MAX + sizeof(STAGED_SUFFIX)];		// empty, if the target was written directly, the source or target of links
+	char				type;
+};
+
+// the output for the content of the current member
+struct memberOutput
+{
+	int					fd;
+	bool				mtd;
+	size_t				remaining;		// bytes of content still to be written
+	uint8_t *			buffer;
+	size_t				bufferSize;
+	size_t				filled;
+	size_t				writeSize;
+};
+
+struct updateJob
+{
+	const char *		root;
+	struct memberOption	targets[MAX_OPTIONS];
+	size_t				targetCount;
+	struct memberOption	required[MAX_OPTIONS];
+	size_t				requiredCount;
+	struct stagedMember *	members;
+	size_t				count;
+	char **				directories;	// created while staging, removed again, if the verification fails
+	size_t				directoryCount;
+	struct memberOutput	output;
+	bool				verbose;
+};
+
+void usage()
+{
+	fprintf(stderr, "stream_update_image - verify and stage a firmware image, while it's read from a stream\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "stream_update_image [ -k <avm_key_file> ]... [ -p <pem_file> ]... [ -d <key_database> [ -i <index_file> ] ]\n");
+	fprintf(stderr, "                    [ -a <hash>[,<hash>...] ] [ -C <directory> ] [ -m <member>=<target> ]...\n");
+	fprintf(stderr, "                    [ -r <member> ]... [ -x <commit_command> ] [ -u ] [ -v ] [ <imagefile> | - ]\n");
+	fprintf(stderr, "\nThe image is read once (from STDIN, if no file or '-' was specified), the");
+	fprintf(stderr, "\nTAR archive is parsed and hashed while it arrives and each member is");
+	fprintf(stderr, "\nwritten at once below the specified directory (default: /) - as a file");
+	fprintf(stderr, "\nwith the suffix '%s' next to its final location.\n", STAGED_SUFFIX);
+	fprintf(stderr, "\nOnly after the signature of the complete stream was verified, the staged");
+	fprintf(stderr, "\nfiles are renamed to their final names (and links are created) and the");
+	fprintf(stderr, "\ncommit command (option -x) is called, if any. If the verification fails,");
+	fprintf(stderr, "\nthe staged files and the directories created for them are removed again.\n");
+	fprintf(stderr, "\nWith option -u, a complete image is installed, even if its signature can't");
+	fprintf(stderr, "\nbe checked: if it has no signature (%d), if it was signed with a hash", RESULT_NO_SIGNATURE);
+	fprintf(stderr, "\nalgorithm, which wasn't computed (%d), or if no key was found (%d). The", RESULT_UNSUPPORTED_HASH, RESULT_NO_KEYS);
+	fprintf(stderr, "\nresult code is set as without this option. A failed verification is never");
+	fprintf(stderr, "\naccepted.\n");
+	fprintf(stderr, "\nThe content of a member may be written to another target with option -m,");
+	fprintf(stderr, "\nthis may be a file or a MTD device (its erase blocks are erased prior to");
+	fprintf(stderr, "\nwriting, bad blocks are not skipped). Such targets are written directly,");
+	fprintf(stderr, "\nthey should be partitions, which are not in use (e.g. the inactive system");
+	fprintf(stderr, "\nof a dual-boot device), and the commit command has to activate them. An");
+	fprintf(stderr, "\nexisting regular file is handled like a partition of this size.\n");
+	fprintf(stderr, "\nThe keys are read from AVM's key files (default: %s),", AVM_KEY_FILES);
+	fprintf(stderr, "\nfrom PEM files or from a key database. The default hash algorithm is MD5");
+	fprintf(stderr, "\n(as used by AVM), a list of other algorithms may be specified with -a.\n");
+	fprintf(stderr, "\nThe result code is the same as from 'check_signed_image', %d is returned,", RESULT_COMMIT_FAILED);
+	fprintf(stderr, "\nif a member couldn't be staged or committed or if the commit command");
+	fprintf(stderr, "\nfailed. The names of the installed members and their targets are written");
+	fprintf(stderr, "\nto STDOUT with option -v.\n");
+}
+
+// the leading "./" or "/" is removed, empty and "." components are dropped, names leaving the target directory are rejected
+bool normalizeName(char *name)
+{
+	char *				component = name;
+	char *				next;
+	char *				output = name;
+
+	for (; component != NULL; component = next)
+	{
+		size_t			length;
+
+		if ((next = strchr(component, '/')) != NULL) *(next++) = 0;
+		if ((length = strlen(component)) == 0 || strcmp(component, ".") == 0) continue;
+		if (strcmp(component, "..") == 0) return false;
+		if (output != name) *(output++) = '/';
+		memmove(output, component, length);
+		output += length;
+	}
+	*output = 0;
+
+	return true;
+}
+
+bool addMemberOption(struct memberOption *options, size_t *count, char *value, bool withTarget)
+{
+	char *				target = NULL;
+
+	if (*count >= MAX_OPTIONS) return false;
+
+	if (withTarget)
+	{
+		if ((target = strchr(value, '=')) == NULL || target == value || target[1] == 0) return false;
+		*(target++) = 0;
+	}
+
+	if (!normalizeName(value) || *value == 0) return false;
+	options[*count].name = value;
+	options[*count].target = target;
+	options[*count].seen = false;
+	(*count)++;
+
+	return true;
+}
+
+struct memberOption * findMemberOption(struct memberOption *options, size_t count, const char *name)
+{
+	size_t				i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (strcmp(options[i].name, name) == 0) return &options[i];
+	}
+
+	return NULL;
+}
+
+bool isBelow(const char *path, const char *parent)
+{
+	size_t				length = strlen(parent);
+
+	return (length > 0 && strncmp(path, parent, length) == 0 && path[length] == '/');
+}
+
+// symbolic links from the stream are created while committing, no other member may be stored or linked through them
+bool crossesStreamLink(const struct updateJob *job, const char *path, bool isLink)
+{
+	size_t				i;
+
+	for (i = 0; i < job->count; i++)
+	{
+		const struct stagedMember *	member = &job->members[i];
+
+		if (member->type == '2' && isBelow(path, member->target)) return true;
+		if (!isLink) continue;
+		if (isBelow(member->target, path)) return true;
+		if (member->type == '1' && isBelow(member->staged, path)) return true;
+	}
+
+	return false;
+}
+
+bool createDirectories(struct updateJob *job, const char *path, mode_t mode)
+{
+	char				directory[PATH_MAX];
+	char **				directories;
+	char *				slash;
+
+	snprintf(directory, sizeof(directory), "%s", path);
+
+	for (slash = strchr(directory + 1, '/'); ; slash = strchr(slash + 1, '/'))
+	{
+		if (slash) *slash = 0;
+		if (mkdir(directory, (slash ? 0755 : mode)) == 0)
+		{
+			if ((directories = realloc(job->directories, (job->directoryCount + 1) * sizeof(char *))) == NULL ||
+				(directories[job->directoryCount] = strdup(directory)) == NULL)
+			{
+				if (directories) job->directories = directories;
+				fprintf(stderr, "Unable to allocate memory.\n");
+				return false;
+			}
+			job->directories = directories;
+			job->directoryCount++;
+		}
+		else if (errno != EEXIST)
+		{
+			fprintf(stderr, "Error %d creating directory '%s'.\n", errno, directory);
+			return false;
+		}
+		if (slash == NULL) break;
+		*slash = '/';
+	}
+
+	return true;
+}
+
+bool createParent(struct updateJob *job, const char *path)
+{
+	char				parent[PATH_MAX];
+	char *				slash;
+
+	snprintf(parent, sizeof(parent), "%s", path);
+	if ((slash = strrchr(parent, '/')) == NULL || slash == parent) return true;
+	*slash = 0;
+
+	return createDirectories(job, parent, 0755);
+}
+
+// a MTD partition is erased, as far as the content will need it - bad blocks are reported as error
+bool prepareMtdTarget(struct memberOutput *output, const char *target, size_t size)
+{
+	struct mtd_info_user	info;
+	struct erase_info_user	erase;
+	loff_t				offset;
+
+	if (ioctl(output->fd, MEMGETINFO, &info) == -1)
+	{
+		fprintf(stderr, "Error %d reading MTD information for '%s'.\n", errno, target);
+		return false;
+	}
+
+	if (size > info.size)
+	{
+		fprintf(stderr, "The content (%zu bytes) doesn't fit into '%s' (%u bytes).\n", size, target, info.size);
+		return false;
+	}
+
+	output->mtd = true;
+	output->bufferSize = info.erasesize;
+	output->writeSize = (info.writesize ? info.writesize : 1);
+
+	for (erase.start = 0; erase.start < size; erase.start += info.erasesize)
+	{
+		offset = erase.start;
+		if (ioctl(output->fd, MEMGETBADBLOCK, &offset) > 0)
+		{
+			fprintf(stderr, "Bad block found at offset 0x%08x of '%s'.\n", erase.start, target);
+			return false;
+		}
+		erase.length = info.erasesize;
+		if (ioctl(output->fd, MEMERASE, &erase) == -1)
+		{
+			fprintf(stderr, "Error %d erasing block at offset 0x%08x of '%s'.\n", errno, erase.start, target);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool openTarget(struct memberOutput *output, const char *target, size_t size)
+{
+	struct stat			st;
+
+	memset(output, 0, sizeof(struct memberOutput));
+	output->remaining = size;
+	output->bufferSize = TARGET_BUFFER_SIZE;
+	output->writeSize = 1;
+
+	if ((output->fd = open(target, O_WRONLY | O_CREAT, 0644)) == -1 || fstat(output->fd, &st) == -1)
+	{
+		fprintf(stderr, "Error %d opening target '%s'.\n", errno, target);
+		return false;
+	}
+
+	if (S_ISCHR(st.st_mode))
+	{
+		if (!prepareMtdTarget(output, target, size)) return false;
+	}
+	else if (S_ISREG(st.st_mode) && st.st_size > 0 && size > (size_t) st.st_size)
+	{
+		fprintf(stderr, "The content (%zu bytes) doesn't fit into '%s' (%zu bytes).\n", size, target, (size_t) st.st_size);
+		return false;
+	}
+
+	if ((output->buffer = malloc(output->bufferSize)) == NULL)
+	{
+		fprintf(stderr, "Error allocating write buffer for '%s'.\n", target);
+		return false;
+	}
+
+	return true;
+}
+
+bool writeOutput(struct memberOutput *output, const void *data, size_t size)
+{
+	const uint8_t *		ptr = data;
+
+	if (size > output->remaining) size = output->remaining;
+	output->remaining -= size;
+
+	if (output->buffer == NULL) return writeBlocks(output->fd, data, size);
+
+	// MTD devices are written in whole erase blocks, the last one is padded to the page size
+	while (size > 0)
+	{
+		size_t			chunk = output->bufferSize - output->filled;
+
+		if (chunk > size) chunk = size;
+		memcpy(output->buffer + output->filled, ptr, chunk);
+		output->filled += chunk;
+		ptr += chunk;
+		size -= chunk;
+
+		if (output->filled == output->bufferSize)
+		{
+			if (!writeBlocks(output->fd, output->buffer, output->filled)) return false;
+			output->filled = 0;
+		}
+	}
+
+	return true;
+}
+
+bool closeOutput(struct memberOutput *output)
+{
+	bool				result = true;
+
+	if (output->fd == -1) return true;
+
+	if (output->buffer != NULL)
+	{
+		if (output->filled > 0)
+		{
+			size_t		padding = (output->writeSize - (output->filled % output->writeSize)) % output->writeSize;
+
+			memset(output->buffer + output->filled, 0xFF, padding);
+			result = writeBlocks(output->fd, output->buffer, output->filled + padding);
+		}
+		if (result && fdatasync(output->fd) == -1 && errno != EINVAL) result = false;
+		free(output->buffer);
+	}
+
+	if (close(output->fd) == -1) result = false;
+	memset(output, 0, sizeof(struct memberOutput));
+	output->fd = -1;
+
+	return result;
+}
+
+// a new member starts, its content is written at once to the staged file or the target
+int startMember(struct updateJob *job, const struct tarHeader *header)
+{
+	struct stagedMember *	members;
+	struct stagedMember *	member;
+	struct memberOption *	option;
+	char				linkName[TAR_LINKNAME_SIZE + 1];
+	char				type = header->data[TAR_TYPEFLAG_OFFSET];
+	size_t				size = tarHeaderSize(header);
+	mode_t				mode = tarHeaderMode(header);
+
+	if ((members = realloc(job->members, (job->count + 1) * sizeof(struct stagedMember))) == NULL) return RESULT_INVALID_IMAGE;
+	job->members = members;
+	member = &job->members[job->count];
+	memset(member, 0, sizeof(struct stagedMember));
+
+	tarHeaderName(header, member->name, sizeof(member->name));
+	if (!normalizeName(member->name))
+	{
+		fprintf(stderr, "Member '%s' would be stored outside of the target directory.\n", member->name);
+		return RESULT_INVALID_IMAGE;
+	}
+	if (member->name[0] == 0) return RESULT_OK;
+	member->type = (type == 0 ? '0' : type);
+
+	if ((option = findMemberOption(job->required, job->requiredCount, member->name)) != NULL) option->seen = true;
+
+	if ((option = findMemberOption(job->targets, job->targetCount, member->name)) != NULL)
+	{
+		if (member->type != '0')
+		{
+			fprintf(stderr, "Member '%s' is not a regular file, it can't be written to '%s'.\n", member->name, option->target);
+			return RESULT_INVALID_IMAGE;
+		}
+		option->seen = true;
+		snprintf(member->target, sizeof(member->target), "%s", option->target);
+		if (!openTarget(&job->output, member->target, size)) return RESULT_COMMIT_FAILED;
+		job->count++;
+		return RESULT_OK;
+	}
+
+	snprintf(member->target, sizeof(member->target), "%s/%s", (strcmp(job->root, "/") ? job->root : ""), member->name);
+	if (crossesStreamLink(job, member->target, member->type == '2'))
+	{
+		fprintf(stderr, "Member '%s' would be stored through or replaced by a symbolic link from the image.\n", member->name);
+		return RESULT_INVALID_IMAGE;
+	}
+
+	switch (member->type)
+	{
+		case '5':
+			// directories are created at once (and remembered), staged files are stored next to their final location
+			return (createDirectories(job, member->target, mode) ? RESULT_OK : RESULT_COMMIT_FAILED);
+
+		case '0':
+			snprintf(member->staged, sizeof(member->staged), "%s%s", member->target, STAGED_SUFFIX);
+			job->count++;
+			if (!createParent(job, member->target)) return RESULT_COMMIT_FAILED;
+			memset(&job->output, 0, sizeof(struct memberOutput));
+			job->output.remaining = size;
+			if ((job->output.fd = open(member->staged, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, mode)) == -1)
+			{
+				fprintf(stderr, "Error %d creating file '%s'.\n", errno, member->staged);
+				return RESULT_COMMIT_FAILED;
+			}
+			return RESULT_OK;
+
+		case '2':
+			// symbolic links are created while committing, the staged name holds the link's target
+			tarHeaderLinkName(header, linkName, sizeof(linkName));
+			if (linkName[0] == 0)
+			{
+				fprintf(stderr, "Symbolic link '%s' has no target.\n", member->name);
+				return RESULT_INVALID_IMAGE;
+			}
+			snprintf(member->staged, sizeof(member->staged), "%s", linkName);
+			job->count++;
+			return RESULT_OK;
+
+		case '1':
+			// hard links are created while committing, the staged name holds the link's source
+			tarHeaderLinkName(header, linkName, sizeof(linkName));
+			if (!normalizeName(linkName))
+			{
+				fprintf(stderr, "Link target of member '%s' is outside of the target directory.\n", member->name);
+				return RESULT_INVALID_IMAGE;
+			}
+			snprintf(member->staged, sizeof(member->staged), "%s/%s", (strcmp(job->root, "/") ? job->root : ""), linkName);
+			if (crossesStreamLink(job, member->staged, false))
+			{
+				fprintf(stderr, "Link target of member '%s' is reached through a symbolic link from the image.\n", member->name);
+				return RESULT_INVALID_IMAGE;
+			}
+			job->count++;
+			return RESULT_OK;
+
+		default:
+			fprintf(stderr, "Member '%s' with type '%c' is ignored.\n", member->name, member->type);
+			return RESULT_OK;
+	}
+}
+
+int streamImage(int input, struct updateJob *job, struct hashSet *hashes, uint8_t *signature, size_t *signatureSize)
+{
+	static const struct tarHeader	zero;
+	struct tarHeader *	buffer;
+	int					result = RESULT_OK;
+	size_t				dataBlocks = 0;
+	size_t				signatureBlocks = 0;
+	bool				endOfArchive = false;
+	ssize_t				got;
+
+	if ((buffer = malloc(STREAM_BLOCKS * sizeof(struct tarHeader))) == NULL) return RESULT_INVALID_IMAGE;
+
+	while ((got = readBlocks(input, buffer, STREAM_BLOCKS * sizeof(struct tarHeader))) > 0)
+	{
+		size_t			blocks = got / sizeof(struct tarHeader);
+		size_t			runStart = 0;
+		size_t			used = 0;
+
+		while (used < blocks && !endOfArchive)
+		{
+			struct tarHeader *	block = buffer + used;
+
+			if (signatureBlocks > 0) // signature header and content are replaced by empty blocks
+			{
+				if (signatureBlocks == 1)
+				{
+					memcpy(signature, block, *signatureSize);
+					dataBlocks--;
+				}
+				hashData(hashes, buffer + runStart, (used - runStart) * sizeof(struct tarHeader), NULL);
+				hashData(hashes, block, sizeof(struct tarHeader), &zero);
+				runStart = ++used;
+				signatureBlocks--;
+				continue;
+			}
+
+			if (dataBlocks > 0)
+			{
+				size_t		skip = (dataBlocks > blocks - used ? blocks - used : dataBlocks);
+
+				if (job->output.fd != -1 && !writeOutput(&job->output, block, skip * sizeof(struct tarHeader)))
+				{
+					fprintf(stderr, "Error %d writing content of member '%s'.\n", errno, job->members[job->count - 1].name);
+					result = RESULT_COMMIT_FAILED;
+					break;
+				}
+				dataBlocks -= skip;
+				used += skip;
+				if (dataBlocks == 0 && !closeOutput(&job->output))
+				{
+					fprintf(stderr, "Error %d closing output of member '%s'.\n", errno, job->members[job->count - 1].name);
+					result = RESULT_COMMIT_FAILED;
+					break;
+				}
+				continue;
+			}
+
+			if (tarHeaderIsEmpty(block))
+			{
+				endOfArchive = true;
+				break;
+			}
+
+			if (!tarHeaderIsValid(block) || tarHeaderIsExtended(block))
+			{
+				result = RESULT_INVALID_IMAGE;
+				break;
+			}
+
+			dataBlocks = tarHeaderBlocks(block) - 1;
+
+			if (tarHeaderIsMember(block, SIGNATURE_MEMBER_NAME))
+			{
+				*signatureSize = tarHeaderSize(block);
+				if (*signatureSize == 0 || *signatureSize > SIGNATURE_MAX_SIZE)
+				{
+					result = RESULT_SIGNATURE_SIZE;
+					break;
+				}
+				hashData(hashes, buffer + runStart, (used - runStart) * sizeof(struct tarHeader), NULL);
+				runStart = used;
+				startSignature(hashes);
+				signatureBlocks = 2;
+				continue;
+			}
+
+			if ((result = startMember(job, block)) != RESULT_OK) break;
+			if (dataBlocks == 0 && !closeOutput(&job->output)) result = RESULT_COMMIT_FAILED;
+			if (result != RESULT_OK) break;
+
+			used++;
+		}
+
+		if (result != RESULT_OK) break;
+
+		// the remaining data (up to the end of stream) is hashed, even after the EoA marker
+		hashData(hashes, buffer + runStart, got - (runStart * sizeof(struct tarHeader)), NULL);
+	}
+
+	if (got == -1) result = RESULT_INVALID_IMAGE;
+	if (result == RESULT_OK && (signatureBlocks > 0 || dataBlocks > 0 || !endOfArchive)) result = RESULT_INVALID_IMAGE;
+	if (result == RESULT_OK && !hashes->signatureSeen) result = RESULT_NO_SIGNATURE;
+
+	if (!closeOutput(&job->output) && result == RESULT_OK) result = RESULT_COMMIT_FAILED;
+	free(buffer);
+
+	return result;
+}
+
+void discardMembers(struct updateJob *job)
+{
+	size_t				i;
+
+	for (i = 0; i < job->count; i++)
+	{
+		struct stagedMember *	member = &job->members[i];
+
+		if (member->staged[0] == 0) fprintf(stderr, "Target '%s' was written, but it's not committed.\n", member->target);
+		else if (member->type == '0') unlink(member->staged);
+	}
+
+	// the deepest directories were created last
+	for (i = job->directoryCount; i > 0; i--)
+	{
+		if (rmdir(job->directories[i - 1]) == -1) fprintf(stderr, "Error %d removing directory '%s'.\n", errno, job->directories[i - 1]);
+	}
+}
+
+bool commitMembers(struct updateJob *job)
+{
+	size_t				i;
+	bool				result = true;
+
+	for (i = 0; i < job->count; i++)
+	{
+		struct stagedMember *	member = &job->members[i];
+
+		if (member->staged[0] == 0) // written directly
+		{
+		}
+		else if (member->type == '1')
+		{
+			unlink(member->target);
+			if (link(member->staged, member->target) == -1)
+			{
+				fprintf(stderr, "Error %d linking '%s' to '%s'.\n", errno, member->target, member->staged);
+				result = false;
+				continue;
+			}
+		}
+		else if (member->type == '2')
+		{
+			unlink(member->target);
+			if (symlink(member->staged, member->target) == -1)
+			{
+				fprintf(stderr, "Error %d creating symbolic link '%s' to '%s'.\n", errno, member->target, member->staged);
+				result = false;
+				continue;
+			}
+		}
+		else if (rename(member->staged, member->target) == -1)
+		{
+			fprintf(stderr, "Error %d renaming '%s' to '%s'.\n", errno, member->staged, member->target);
+			unlink(member->staged);
+			result = false;
+			continue;
+		}
+
+		if (job->verbose) fprintf(stdout, "%s\t%s\n", member->name, member->target);
+	}
+
+	return result;
+}
+
+bool loadAvmKeys(struct keyList *keys)
+{
+	glob_t				files;
+	size_t				i;
+
+	if (glob(AVM_KEY_FILES, 0, NULL, &files) != 0) return false;
+	for (i = 0; i < files.gl_pathc; i++) addKeyFromAvmFile(keys, files.gl_pathv[i]);
+	globfree(&files);
+
+	return (keys->count > 0);
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode;
+	const char *		database = NULL;
+	const char *		indexFile = NULL;
+	const char *		hashNames = NULL;
+	const char *		imageFile = NULL;
+	const char *		commitCommand = NULL;
+	const struct signingKey *	key = NULL;
+	const char *		hashName = NULL;
+	struct keyList		keys = { NULL, 0 };
+	struct updateJob	job;
+	struct hashSet		hashes;
+	uint8_t				signature[SIGNATURE_MAX_SIZE];
+	size_t				signatureSize = 0;
+	bool				keysSpecified = false;
+	bool				unverified = false;
+	int					input = 0;
+	size_t				i;
+	int					arg;
+
+	memset(&job, 0, sizeof(job));
+	job.root = "/";
+	job.output.fd = -1;
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) database = argv[++arg];
+		else if (strcmp(argv[arg], "-i") == 0 && arg + 1 < argc) indexFile = argv[++arg];
+		else if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc) hashNames = argv[++arg];
+		else if (strcmp(argv[arg], "-C") == 0 && arg + 1 < argc) job.root = argv[++arg];
+		else if (strcmp(argv[arg], "-x") == 0 && arg + 1 < argc) commitCommand = argv[++arg];
+		else if (strcmp(argv[arg], "-v") == 0) job.verbose = true;
+		else if (strcmp(argv[arg], "-u") == 0) unverified = true;
+		else if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc)
+		{
+			if (!addKeyFromAvmFile(&keys, argv[++arg])) exit(12);
+			keysSpecified = true;
+		}
+		else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+		{
+			if (!addKeyFromPemFile(&keys, argv[++arg])) exit(12);
+			keysSpecified = true;
+		}
+		else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc)
+		{
+			if (!addMemberOption(job.targets, &job.targetCount, argv[++arg], true))
+			{
+				fprintf(stderr, "Invalid target specification '%s' or too many targets.\n", argv[arg]);
+				exit(1);
+			}
+		}
+		else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc)
+		{
+			if (!addMemberOption(job.required, &job.requiredCount, argv[++arg], false))
+			{
+				fprintf(stderr, "Invalid member name '%s' or too many required members.\n", argv[arg]);
+				exit(1);
+			}
+		}
+		else if (strcmp(argv[arg], "-h") == 0 || strcmp(argv[arg], "--help") == 0)
+		{
+			usage();
+			exit(1);
+		}
+		else if (imageFile == NULL) imageFile = argv[arg];
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (isatty(0) && (imageFile == NULL || strcmp(imageFile, "-") == 0))
+	{
+		usage();
+		exit(1);
+	}
+
+	if (!initHashSet(&hashes, hashNames))
+	{
+		fprintf(stderr, "Unknown, unsupported or too many hash algorithm(s) '%s' specified.\n", hashNames);
+		exit(9);
+	}
+
+	if (database != NULL)
+	{
+		if (!loadKeyIndex(&keys, database, indexFile)) exit(12);
+	}
+	else if (!keysSpecified) loadAvmKeys(&keys);
+
+	// the stream can't be read again, the keys are checked prior to any output
+	if (keys.count == 0 && !unverified)
+	{
+		fprintf(stderr, "None of the specified public key sources was able to provide a key.\n");
+		exit(RESULT_NO_KEYS);
+	}
+
+	if (imageFile != NULL && strcmp(imageFile, "-") != 0)
+	{
+		if ((input = open(imageFile, O_RDONLY)) == -1)
+		{
+			fprintf(stderr, "Error %d opening image file '%s'.\n", errno, imageFile);
+			exit(RESULT_NOT_FOUND);
+		}
+	}
+
+	returnCode = streamImage(input, &job, &hashes, signature, &signatureSize);
+	if (returnCode == RESULT_OK || returnCode == RESULT_NO_SIGNATURE)
+	{
+		for (i = 0; i < job.requiredCount; i++)
+		{
+			if (job.required[i].seen) continue;
+			fprintf(stderr, "The required member '%s' is missing in the image.\n", job.required[i].name);
+			returnCode = RESULT_INVALID_IMAGE;
+		}
+		for (i = 0; i < job.targetCount; i++)
+		{
+			if (job.targets[i].seen) continue;
+			fprintf(stderr, "The member '%s' for target '%s' is missing in the image.\n", job.targets[i].name, job.targets[i].target);
+			returnCode = RESULT_INVALID_IMAGE;
+		}
+	}
+	if (returnCode == RESULT_INVALID_IMAGE) fprintf(stderr, "The input stream isn't a valid (old-style) TAR archive or it's truncated.\n");
+	else if (returnCode == RESULT_NO_SIGNATURE) fprintf(stderr, "The image doesn't contain a signature.\n");
+	else if (returnCode == RESULT_SIGNATURE_SIZE) fprintf(stderr, "The signature member of the image has an invalid size.\n");
+
+	if (returnCode == RESULT_OK && keys.count == 0) returnCode = RESULT_NO_KEYS;
+	else if (returnCode == RESULT_OK)
+	{
+		returnCode = checkSignature(&hashes, &keys, signature, signatureSize, &key, &hashName);
+		if (returnCode == RESULT_NO_KEY) fprintf(stderr, "None of the keys matches the signature of the image.\n");
+		else if (returnCode == RESULT_UNSUPPORTED_HASH) fprintf(stderr, "The image was signed with hash algorithm '%s', it wasn't computed.\n", hashName);
+		else if (returnCode == RESULT_FAILED) fprintf(stderr, "Signature verification failed.\n");
+	}
+
+	if (returnCode == RESULT_OK) fprintf(stderr, "Signature (%s) verified with key '%s'.\n", hashName, (key->ownerCount ? key->owners[0].keyName : "-"));
+	else if (unverified && (returnCode == RESULT_NO_SIGNATURE || returnCode == RESULT_UNSUPPORTED_HASH || returnCode == RESULT_NO_KEYS))
+		fprintf(stderr, "The signature of the image couldn't be checked, it's installed anyway (option -u).\n");
+
+	if (returnCode == RESULT_OK || (unverified && (returnCode == RESULT_NO_SIGNATURE || returnCode == RESULT_UNSUPPORTED_HASH || returnCode == RESULT_NO_KEYS)))
+	{
+		if (!commitMembers(&job)) returnCode = RESULT_COMMIT_FAILED;
+		else if (commitCommand != NULL)
+		{
+			fflush(stdout);
+			if (system(commitCommand) != 0)
+			{
+				fprintf(stderr, "The commit command '%s' failed.\n", commitCommand);
+				returnCode = RESULT_COMMIT_FAILED;
+			}
+		}
+	}
+	else discardMembers(&job);
+
+	freeHashSet(&hashes);
+	freeKeyList(&keys);
+	free(job.members);
+	for (i = 0; i < job.directoryCount; i++) free(job.directories[i]);
+	free(job.directories);
+	if (input != 0) close(input);
+
+	exit(returnCode);
+}
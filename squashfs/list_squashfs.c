@@ -0,0 +1,269 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "squashfs_image.h"
+
+#define TOTALCHARS					25		// column width used by 'unsquashfs -lls'
+
+static const char *		dest = "squashfs-root";
+static FILE *			listFile = NULL;
+static FILE *			pseudoFile = NULL;
+
+void usage()
+{
+	fprintf(stderr, "list_squashfs - list a SquashFS image without extracting it\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "list_squashfs [ -d <dest> ] [ -ls | -lls ] [ -pseudo <file> ] [ -j <threads> ] <image>\n");
+	fprintf(stderr, "\nOnly the inode, directory and id tables of the (version 4) image are");
+	fprintf(stderr, "\nread and their metadata blocks are decompressed in parallel. The");
+	fprintf(stderr, "\nlisting is written to STDOUT in the same format as 'unsquashfs -ls'");
+	fprintf(stderr, "\nor 'unsquashfs -lls' (default) uses it, with <dest> (default:");
+	fprintf(stderr, "\nsquashfs-root) as the path prefix.\n");
+	fprintf(stderr, "\nDevice inodes are written to the file specified with '-pseudo' as");
+	fprintf(stderr, "\npseudo file definitions for 'mksquashfs', like the patched 'unsquashfs'");
+	fprintf(stderr, "\ndoes it.\n");
+	fprintf(stderr, "\nThe supported compression methods are gzip, lzma and xz.\n");
+}
+
+char * modeString(char *str, mode_t mode)
+{
+	int					i;
+
+	strcpy(str, "----------");
+
+	for (i = 0; i < 9; i++)
+	{
+		if (mode & (0400 >> i)) str[i + 1] = "rwxrwxrwx"[i];
+	}
+
+	switch (mode & S_IFMT)
+	{
+		case S_IFSOCK:	str[0] = 's'; break;
+		case S_IFLNK:	str[0] = 'l'; break;
+		case S_IFBLK:	str[0] = 'b'; break;
+		case S_IFDIR:	str[0] = 'd'; break;
+		case S_IFCHR:	str[0] = 'c'; break;
+		case S_IFIFO:	str[0] = 'p'; break;
+	}
+
+	if (mode & S_ISUID) str[3] = (str[3] == 'x' ? 's' : 'S');
+	if (mode & S_ISGID) str[6] = (str[6] == 'x' ? 's' : 'S');
+	if (mode & S_ISVTX) str[9] = (str[9] == 'x' ? 't' : 'T');
+
+	return str;
+}
+
+// the same output as print_filename() from (patched) unsquashfs
+void printFileName(const char *pathName, const struct inodeInfo *inode, bool shortList)
+{
+	char				str[11];
+	char				user[12];
+	char				group[12];
+	const char *		userString = user;
+	const char *		groupString = group;
+	struct passwd *		pw;
+	struct group *		gr;
+	int					padChars;
+	struct tm *			t;
+
+	if (shortList)
+	{
+		fprintf(listFile, "%s\n", pathName);
+		return;
+	}
+
+	if ((pw = getpwuid(inode->uid)) == NULL) snprintf(user, sizeof(user), "%u", inode->uid);
+	else userString = pw->pw_name;
+	if ((gr = getgrgid(inode->gid)) == NULL) snprintf(group, sizeof(group), "%u", inode->gid);
+	else groupString = gr->gr_name;
+
+	fprintf(listFile, "%s %s/%s ", modeString(str, inode->mode), userString, groupString);
+
+	switch (inode->mode & S_IFMT)
+	{
+		case S_IFCHR:
+		case S_IFBLK:
+			padChars = TOTALCHARS - strlen(userString) - strlen(groupString) - 7;
+			fprintf(listFile, "%*s%3d,%3d ", padChars > 0 ? padChars : 0, "", (int) inode->data >> 8, (int) inode->data & 0xff);
+			break;
+
+		default:
+			padChars = TOTALCHARS - strlen(userString) - strlen(groupString);
+			fprintf(listFile, "%*lld ", padChars > 0 ? padChars : 0, inode->data);
+			break;
+	}
+
+	t = localtime(&inode->time);
+	fprintf(listFile, "%d-%02d-%02d %02d:%02d %s", t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, pathName);
+	if ((inode->mode & S_IFMT) == S_IFLNK) fprintf(listFile, " -> %.*s", inode->symlinkSize, inode->symlink);
+	fprintf(listFile, "\n");
+}
+
+// the same format as written by the '-pseudo' option of patched unsquashfs
+void printPseudoDefinition(const char *pathName, const struct inodeInfo *inode)
+{
+	if (pseudoFile == NULL) return;
+	if (!S_ISCHR(inode->mode) && !S_ISBLK(inode->mode)) return;
+
+	fprintf(pseudoFile, "%s %c %3o %u %u %u %u\n", pathName + strlen(dest), S_ISCHR(inode->mode) ? 'c' : 'b',
+		(unsigned int) (inode->mode & 0777), inode->uid, inode->gid,
+		(unsigned int) (inode->data >> 8) & 0xff, (unsigned int) inode->data & 0xff);
+}
+
+bool scanDirectory(const char *pathName, const struct inodeInfo *directory, bool shortList)
+{
+	size_t				remaining;
+	const uint8_t *		ptr;
+	uint32_t			offset = directory->dirOffset;
+
+	printFileName(pathName, directory, shortList);
+
+	// the stored size contains 3 additional bytes for the '.' and '..' entries
+	if (directory->dirSize <= 3) return true;
+	remaining = directory->dirSize - 3;
+
+	if ((ptr = metadataPointer(&directoryTable, directory->dirStartBlock, offset, remaining)) == NULL)
+	{
+		fprintf(stderr, "Invalid directory reference for '%s'.\n", pathName);
+		return false;
+	}
+
+	while (remaining >= 12)
+	{
+		uint32_t		count = get32(ptr) + 1;
+		uint32_t		startBlock = get32(ptr + 4);
+
+		ptr += 12;
+		remaining -= 12;
+
+		while (count-- > 0 && remaining >= 8)
+		{
+			uint16_t		entryOffset = get16(ptr);
+			uint16_t		nameSize = get16(ptr + 6) + 1;
+			struct inodeInfo	inode;
+			char *			entryName;
+
+			if (remaining < (size_t) 8 + nameSize) return false;
+			if ((entryName = malloc(strlen(pathName) + nameSize + 2)) == NULL) return false;
+			sprintf(entryName, "%s/%.*s", pathName, (int) nameSize, (const char *) ptr + 8);
+
+			ptr += 8 + nameSize;
+			remaining -= 8 + nameSize;
+
+			if (!readInode(((uint64_t) startBlock << 16) | entryOffset, &inode))
+			{
+				fprintf(stderr, "Unable to read inode for '%s'.\n", entryName);
+				free(entryName);
+				return false;
+			}
+
+			if (S_ISDIR(inode.mode))
+			{
+				if (!scanDirectory(entryName, &inode, shortList))
+				{
+					free(entryName);
+					return false;
+				}
+			}
+			else
+			{
+				printFileName(entryName, &inode, shortList);
+				printPseudoDefinition(entryName, &inode);
+			}
+
+			free(entryName);
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 1;
+	int					fd;
+	const char *		imageName = NULL;
+	const char *		pseudoName = NULL;
+	long				threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	bool				shortList = false;
+	struct inodeInfo	root;
+	int					i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "-dest") == 0) && i + 1 < argc) dest = argv[++i];
+		else if ((strcmp(argv[i], "-pseudo") == 0 || strcmp(argv[i], "-ps") == 0) && i + 1 < argc) pseudoName = argv[++i];
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threadCount = atol(argv[++i]);
+		else if (strcmp(argv[i], "-ls") == 0) shortList = true;
+		else if (strcmp(argv[i], "-lls") == 0) shortList = false;
+		else if (imageName == NULL && argv[i][0] != '-') imageName = argv[i];
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (imageName == NULL)
+	{
+		usage();
+		exit(1);
+	}
+
+	if (!mapImage(imageName, &fd)) exit(1);
+
+	listFile = stdout;
+
+	if (pseudoName != NULL && (pseudoFile = fopen(pseudoName, "w")) == NULL)
+	{
+		fprintf(stderr, "Error %d creating pseudo file definitions file '%s'.\n", errno, pseudoName);
+	}
+	else if (readSuperBlock())
+	{
+		// the data blocks are never touched, only the tables are read
+		madvise((void *) image, imageSize, MADV_RANDOM);
+
+		if (readImageTables(threadCount) && readInode(sBlk.rootInode, &root) && scanDirectory(dest, &root, shortList))
+			returnCode = 0;
+	}
+
+	if (pseudoFile != NULL) fclose(pseudoFile);
+	unmapImage(fd);
+
+	exit(returnCode);
+}
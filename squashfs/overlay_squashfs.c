@@ -0,0 +1,1557 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include <lzma.h>
+
+#include "squashfs_image.h"
+
+#define WHITEOUT_PREFIX				".wh."
+#define OPAQUE_MARKER				".wh..wh..opq"
+#define DEFAULT_BLOCK_SIZE			131072
+#define BLOCK_MAP_SIZE				4096
+#define SQUASHFS_NAME_LEN			256
+#define SQUASHFS_DIR_COUNT			256
+#define OUTPUT_ALIGNMENT			4096
+
+// one name in a directory of the merged tree, the entries are sorted like mksquashfs does it
+struct entry
+{
+	char *				name;
+	struct inode *		inode;
+	struct entry *		next;
+};
+
+struct inode
+{
+	unsigned int		type;			// basic type, the extended one is selected while writing
+	mode_t				mode;			// permissions only
+	uint32_t			uid;
+	uint32_t			gid;
+	uint32_t			time;
+	uint32_t			number;
+	uint32_t			nlink;
+	uint32_t			rdev;
+	struct entry *		children;
+	struct inode *		parent;
+	char *				symlink;
+	size_t				symlinkSize;
+	uint64_t			fileSize;
+	char *				path;			// overlay file with the new content
+	bool				fromBase;		// data blocks are copied from the base image
+	uint64_t			baseStart;
+	const uint8_t *		baseBlockList;
+	uint32_t			baseFragment;
+	uint64_t			start;
+	uint32_t *			blocks;
+	uint32_t			blockCount;
+	uint32_t			fragment;
+	uint32_t			fragmentOffset;
+	uint32_t			listingStart;
+	uint32_t			listingOffset;
+	uint32_t			listingSize;
+	uint64_t			reference;
+	bool				written;
+	struct inode *		allNext;
+};
+
+// a metadata table under construction, complete blocks are compressed at once
+struct metaWriter
+{
+	uint8_t *			data;
+	size_t				size;
+	size_t				allocated;
+	uint8_t				block[SQUASHFS_METADATA_SIZE];
+	size_t				fill;
+};
+
+struct fragmentEntry
+{
+	uint64_t			start;
+	uint32_t			size;
+};
+
+struct blockMapEntry
+{
+	uint64_t			baseStart;
+	uint64_t			length;
+	uint64_t			start;
+	struct blockMapEntry *	next;
+};
+
+struct hardLink
+{
+	dev_t				device;
+	ino_t				inode;
+	struct inode *		target;
+	struct hardLink *	next;
+};
+
+struct variant
+{
+	const char *		overlay;
+	const char *		output;
+	FILE *				out;
+	uint64_t			position;
+	struct inode *		root;
+	struct inode *		allInodes;
+	struct inode **		baseInodes;		// by inode number, hard links in the base share one inode
+	struct hardLink *	hardLinks;
+	uint32_t			inodeCount;
+	uint64_t *			lookup;
+	uint32_t *			ids;
+	size_t				idCount;
+	struct metaWriter	inodes;
+	struct metaWriter	directories;
+	struct fragmentEntry *	fragments;
+	size_t				fragmentCount;
+	size_t				fragmentsAllocated;
+	uint32_t *			fragmentMap;	// base fragment index + 1 to new index + 1
+	uint8_t *			fragmentBuffer;
+	size_t				fragmentFill;
+	uint32_t			pendingFragment;
+	struct blockMapEntry *	blockMap[BLOCK_MAP_SIZE];
+	uint8_t *			blockBuffer;
+	uint8_t *			compressBuffer;
+	uint64_t			copiedBytes;
+	uint64_t			readBytes;
+	uint64_t			compressedBytes;
+	bool				failed;
+};
+
+static bool				haveBase = false;
+static bool				rootOwned = false;
+static uint16_t			outputFlags = 0;
+static uint32_t			dictionarySize = 0;
+static int				gzipLevel = Z_BEST_COMPRESSION;
+static const uint8_t *	compressionOptions = NULL;
+static size_t			compressionOptionsSize = 0;
+static struct variant *	variants = NULL;
+static size_t			variantCount = 0;
+static size_t			nextVariant = 0;
+static pthread_mutex_t	variantLock = PTHREAD_MUTEX_INITIALIZER;
+
+void usage()
+{
+	fprintf(stderr, "overlay_squashfs - build SquashFS image variants from a base image and overlay directories\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "overlay_squashfs [ -j <threads> ] [ -root-owned ] [ -comp <gzip|lzma|xz> ] [ -b <block_size> ]\n");
+	fprintf(stderr, "                 <base_image> <overlay_dir> <output_image> [ <overlay_dir> <output_image> ]...\n");
+	fprintf(stderr, "\nThe metadata of the (version 4) base image is read once, then each output");
+	fprintf(stderr, "\nimage is built from the base image with the content of its overlay directory");
+	fprintf(stderr, "\nput on top of it. The variants are built in parallel (default: one thread");
+	fprintf(stderr, "\nper CPU). Data blocks and fragments of unchanged files are copied from the");
+	fprintf(stderr, "\nbase image as they are, only the files from the overlay are compressed.\n");
+	fprintf(stderr, "\nA file or directory in the overlay replaces the entry with the same name,");
+	fprintf(stderr, "\ndirectories are merged. Entries are removed with whiteouts - a character");
+	fprintf(stderr, "\ndevice 0/0 (like overlayfs uses it) or an empty file named '.wh.<name>' -");
+	fprintf(stderr, "\nand '.wh..wh..opq' in a directory hides all entries of the base image there.");
+	fprintf(stderr, "\nOwner and group of a replaced entry are kept, new entries get the ones from");
+	fprintf(stderr, "\nthe overlay or root's with '-root-owned'.\n");
+	fprintf(stderr, "\nUse '-' as base image to build an image from the overlay alone, '-comp'");
+	fprintf(stderr, "\n(default: gzip) and '-b' (default: %u) are used in this case only, and", DEFAULT_BLOCK_SIZE);
+	fprintf(stderr, "\n'-' as overlay to get a copy of the base image with new metadata.\n");
+	fprintf(stderr, "\nThe supported compression methods are gzip, lzma and xz.\n");
+}
+
+static void put16(uint8_t *ptr, uint16_t value)
+{
+	if (swapNeeded)
+	{
+		ptr[0] = value >> 8;
+		ptr[1] = value;
+	}
+	else
+	{
+		ptr[0] = value;
+		ptr[1] = value >> 8;
+	}
+}
+
+static void put32(uint8_t *ptr, uint32_t value)
+{
+	if (swapNeeded)
+	{
+		put16(ptr, value >> 16);
+		put16(ptr + 2, value);
+	}
+	else
+	{
+		put16(ptr, value);
+		put16(ptr + 2, value >> 16);
+	}
+}
+
+static void put64(uint8_t *ptr, uint64_t value)
+{
+	if (swapNeeded)
+	{
+		put32(ptr, value >> 32);
+		put32(ptr + 4, value);
+	}
+	else
+	{
+		put32(ptr, value);
+		put32(ptr + 4, value >> 32);
+	}
+}
+
+// returns the compressed size or 0, if the data should be stored uncompressed
+size_t compressBlock(const uint8_t *source, size_t sourceSize, uint8_t *target)
+{
+	if (sBlk.compression == ZLIB_COMPRESSION)
+	{
+		uLongf			size = sourceSize;
+
+		if (compress2(target, &size, source, sourceSize, gzipLevel) != Z_OK) return 0;
+		return (size < sourceSize ? size : 0);
+	}
+	else
+	{
+		lzma_options_lzma	options;
+		size_t			size = 0;
+
+		if (lzma_lzma_preset(&options, LZMA_PRESET_DEFAULT)) return 0;
+		options.dict_size = dictionarySize;
+
+		if (sBlk.compression == XZ_COMPRESSION)
+		{
+			lzma_filter	filters[] = { { .id = LZMA_FILTER_LZMA2, .options = &options }, { .id = LZMA_VLI_UNKNOWN } };
+
+			if (lzma_stream_buffer_encode(filters, LZMA_CHECK_CRC32, NULL, source, sourceSize, target, &size, sourceSize) != LZMA_OK) return 0;
+		}
+		else // LZMA_COMPRESSION uses the 'lzma_alone' format
+		{
+			lzma_stream	stream = LZMA_STREAM_INIT;
+
+			if (lzma_alone_encoder(&stream, &options) != LZMA_OK) return 0;
+			stream.next_in = source;
+			stream.avail_in = sourceSize;
+			stream.next_out = target;
+			stream.avail_out = sourceSize;
+			if (lzma_code(&stream, LZMA_FINISH) == LZMA_STREAM_END) size = sourceSize - stream.avail_out;
+			lzma_end(&stream);
+		}
+
+		return (size < sourceSize ? size : 0);
+	}
+}
+
+bool writeOutput(struct variant *v, const void *data, size_t size)
+{
+	if (size > 0 && fwrite(data, size, 1, v->out) != 1)
+	{
+		fprintf(stderr, "Error %d writing image file '%s'.\n", errno, v->output);
+		v->failed = true;
+		return false;
+	}
+	v->position += size;
+	return true;
+}
+
+// write one metadata block with its length header
+void writeMetadataBlock(uint8_t *target, const uint8_t *source, size_t size, size_t *written)
+{
+	size_t				compressed = compressBlock(source, size, target + 2);
+
+	if (compressed > 0) put16(target, compressed);
+	else
+	{
+		put16(target, size | SQUASHFS_COMPRESSED_BIT);
+		memcpy(target + 2, source, size);
+		compressed = size;
+	}
+	*written = 2 + compressed;
+}
+
+bool flushMetadata(struct variant *v, struct metaWriter *writer)
+{
+	size_t				written;
+
+	if (writer->fill == 0) return true;
+
+	if (writer->size + 2 + SQUASHFS_METADATA_SIZE > writer->allocated)
+	{
+		writer->allocated = (writer->allocated ? writer->allocated * 2 : 64 * SQUASHFS_METADATA_SIZE);
+		if ((writer->data = realloc(writer->data, writer->allocated)) == NULL)
+		{
+			v->failed = true;
+			return false;
+		}
+	}
+
+	writeMetadataBlock(writer->data + writer->size, writer->block, writer->fill, &written);
+	writer->size += written;
+	writer->fill = 0;
+
+	return true;
+}
+
+bool appendMetadata(struct variant *v, struct metaWriter *writer, const uint8_t *data, size_t size)
+{
+	while (size > 0)
+	{
+		size_t			chunk = SQUASHFS_METADATA_SIZE - writer->fill;
+
+		if (chunk > size) chunk = size;
+		memcpy(writer->block + writer->fill, data, chunk);
+		writer->fill += chunk;
+		data += chunk;
+		size -= chunk;
+		if (writer->fill == SQUASHFS_METADATA_SIZE && !flushMetadata(v, writer)) return false;
+	}
+
+	return true;
+}
+
+// the reference of the next byte written, a block is flushed as soon as it's full
+uint64_t metadataReference(const struct metaWriter *writer)
+{
+	return ((uint64_t) writer->size << 16) | writer->fill;
+}
+
+// id, fragment and lookup tables are stored as metadata blocks followed by an index of their positions
+bool writeIndexedTable(struct variant *v, const uint8_t *data, size_t size, uint64_t *indexStart)
+{
+	size_t				count = (size + SQUASHFS_METADATA_SIZE - 1) / SQUASHFS_METADATA_SIZE;
+	uint8_t *			index = malloc(count * 8 + 1);
+	uint8_t				block[2 + SQUASHFS_METADATA_SIZE];
+	size_t				i;
+
+	if (index == NULL)
+	{
+		v->failed = true;
+		return false;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		size_t			chunk = (size - i * SQUASHFS_METADATA_SIZE < SQUASHFS_METADATA_SIZE ? size - i * SQUASHFS_METADATA_SIZE : SQUASHFS_METADATA_SIZE);
+		size_t			written;
+
+		put64(index + i * 8, v->position);
+		writeMetadataBlock(block, data + i * SQUASHFS_METADATA_SIZE, chunk, &written);
+		if (!writeOutput(v, block, written)) break;
+	}
+
+	*indexStart = v->position;
+	if (i == count) writeOutput(v, index, count * 8);
+	free(index);
+
+	return !v->failed;
+}
+
+unsigned int typeFromMode(mode_t mode)
+{
+	switch (mode & S_IFMT)
+	{
+		case S_IFDIR:	return SQUASHFS_DIR_TYPE;
+		case S_IFREG:	return SQUASHFS_REG_TYPE;
+		case S_IFLNK:	return SQUASHFS_SYMLINK_TYPE;
+		case S_IFBLK:	return SQUASHFS_BLKDEV_TYPE;
+		case S_IFCHR:	return SQUASHFS_CHRDEV_TYPE;
+		case S_IFIFO:	return SQUASHFS_FIFO_TYPE;
+		default:		return SQUASHFS_SOCKET_TYPE;
+	}
+}
+
+struct inode * newInode(struct variant *v, mode_t mode)
+{
+	struct inode *		inode = calloc(1, sizeof(struct inode));
+
+	if (inode == NULL)
+	{
+		fprintf(stderr, "Memory exhausted while building '%s'.\n", v->output);
+		v->failed = true;
+		return NULL;
+	}
+
+	inode->type = typeFromMode(mode);
+	inode->mode = mode & 07777;
+	inode->fragment = SQUASHFS_INVALID_FRAG;
+	inode->baseFragment = SQUASHFS_INVALID_FRAG;
+	inode->allNext = v->allInodes;
+	v->allInodes = inode;
+
+	return inode;
+}
+
+struct inode * inodeFromBase(struct variant *v, const struct inodeInfo *info)
+{
+	struct inode *		inode;
+
+	if (!S_ISDIR(info->mode) && info->number > 0 && info->number <= sBlk.inodes && v->baseInodes[info->number] != NULL) return v->baseInodes[info->number];
+
+	if ((inode = newInode(v, info->mode)) == NULL) return NULL;
+
+	inode->uid = info->uid;
+	inode->gid = info->gid;
+	inode->time = info->time;
+
+	if (S_ISREG(info->mode))
+	{
+		inode->fromBase = true;
+		inode->fileSize = info->data;
+		inode->baseStart = info->startBlock;
+		inode->baseBlockList = info->blockList;
+		inode->blockCount = info->blockCount;
+		inode->baseFragment = info->fragment;
+		inode->fragmentOffset = info->fragmentOffset;
+	}
+	else if (S_ISLNK(info->mode))
+	{
+		if ((inode->symlink = malloc(info->symlinkSize + 1)) == NULL)
+		{
+			v->failed = true;
+			return NULL;
+		}
+		memcpy(inode->symlink, info->symlink, info->symlinkSize);
+		inode->symlinkSize = info->symlinkSize;
+	}
+	else if (S_ISCHR(info->mode) || S_ISBLK(info->mode)) inode->rdev = info->data;
+
+	if (!S_ISDIR(info->mode) && info->number > 0 && info->number <= sBlk.inodes) v->baseInodes[info->number] = inode;
+
+	return inode;
+}
+
+struct entry * newEntry(struct variant *v, const char *name, size_t nameSize, struct inode *inode)
+{
+	struct entry *		entry = malloc(sizeof(struct entry));
+
+	if (entry == NULL || (entry->name = malloc(nameSize + 1)) == NULL)
+	{
+		fprintf(stderr, "Memory exhausted while building '%s'.\n", v->output);
+		free(entry);
+		v->failed = true;
+		return NULL;
+	}
+
+	memcpy(entry->name, name, nameSize);
+	entry->name[nameSize] = 0;
+	entry->inode = inode;
+	entry->next = NULL;
+
+	return entry;
+}
+
+// copy the directory tree of the base image, it's read from the shared (decompressed) tables
+bool loadDirectory(struct variant *v, struct inode *directory, const struct inodeInfo *info)
+{
+	struct entry **		tail = &directory->children;
+	size_t				remaining;
+	const uint8_t *		ptr;
+
+	if (info->dirSize <= 3) return true;
+	remaining = info->dirSize - 3;
+
+	if ((ptr = metadataPointer(&directoryTable, info->dirStartBlock, info->dirOffset, remaining)) == NULL)
+	{
+		fprintf(stderr, "Invalid directory reference in base image.\n");
+		return false;
+	}
+
+	while (remaining >= 12)
+	{
+		uint32_t		count = get32(ptr) + 1;
+		uint32_t		startBlock = get32(ptr + 4);
+
+		ptr += 12;
+		remaining -= 12;
+
+		while (count-- > 0 && remaining >= 8)
+		{
+			uint16_t		entryOffset = get16(ptr);
+			uint16_t		nameSize = get16(ptr + 6) + 1;
+			struct inodeInfo	entryInfo;
+			struct inode *	inode;
+
+			if (remaining < (size_t) 8 + nameSize) return false;
+
+			if (!readInode(((uint64_t) startBlock << 16) | entryOffset, &entryInfo))
+			{
+				fprintf(stderr, "Unable to read inode for '%.*s' from base image.\n", (int) nameSize, (const char *) ptr + 8);
+				return false;
+			}
+
+			if ((inode = inodeFromBase(v, &entryInfo)) == NULL) return false;
+			if ((*tail = newEntry(v, (const char *) ptr + 8, nameSize, inode)) == NULL) return false;
+			tail = &(*tail)->next;
+
+			ptr += 8 + nameSize;
+			remaining -= 8 + nameSize;
+
+			if (S_ISDIR(entryInfo.mode) && !loadDirectory(v, inode, &entryInfo)) return false;
+		}
+	}
+
+	return true;
+}
+
+struct entry * findEntry(struct inode *directory, const char *name)
+{
+	struct entry *		entry;
+
+	for (entry = directory->children; entry != NULL; entry = entry->next)
+	{
+		if (strcmp(entry->name, name) == 0) return entry;
+	}
+
+	return NULL;
+}
+
+void removeEntry(struct inode *directory, const char *name)
+{
+	struct entry **		link = &directory->children;
+
+	while (*link != NULL)
+	{
+		if (strcmp((*link)->name, name) == 0)
+		{
+			struct entry *	entry = *link;
+
+			*link = entry->next;
+			free(entry->name);
+			free(entry);
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+
+bool setEntry(struct variant *v, struct inode *directory, const char *name, struct inode *inode)
+{
+	struct entry **		link = &directory->children;
+	struct entry *		entry;
+	int					order = 1;
+
+	while (*link != NULL && (order = strcmp((*link)->name, name)) < 0) link = &(*link)->next;
+
+	if (*link != NULL && order == 0)
+	{
+		(*link)->inode = inode;
+		return true;
+	}
+
+	if ((entry = newEntry(v, name, strlen(name), inode)) == NULL) return false;
+	entry->next = *link;
+	*link = entry;
+
+	return true;
+}
+
+int compareNames(const void *left, const void *right)
+{
+	return strcmp(*(char * const *) left, *(char * const *) right);
+}
+
+bool applyOverlay(struct variant *v, struct inode *directory, const char *path);
+
+bool applyOverlayEntry(struct variant *v, struct inode *directory, const char *path, const char *name)
+{
+	char				fullName[PATH_MAX];
+	struct stat			st;
+	struct entry *		existing;
+	struct inode *		inode = NULL;
+	struct hardLink *	link;
+
+	if (strncmp(name, WHITEOUT_PREFIX, strlen(WHITEOUT_PREFIX)) == 0)
+	{
+		removeEntry(directory, name + strlen(WHITEOUT_PREFIX));
+		return true;
+	}
+
+	if (strlen(name) > SQUASHFS_NAME_LEN || snprintf(fullName, sizeof(fullName), "%s/%s", path, name) >= (int) sizeof(fullName))
+	{
+		fprintf(stderr, "Name '%s/%s' is too long.\n", path, name);
+		return false;
+	}
+
+	if (lstat(fullName, &st) == -1)
+	{
+		fprintf(stderr, "Error %d reading attributes of '%s'.\n", errno, fullName);
+		return false;
+	}
+
+	// overlayfs marks removed entries with a character device 0/0
+	if (S_ISCHR(st.st_mode) && st.st_rdev == 0)
+	{
+		removeEntry(directory, name);
+		return true;
+	}
+
+	existing = findEntry(directory, name);
+
+	if (S_ISDIR(st.st_mode) && existing != NULL && existing->inode->type == SQUASHFS_DIR_TYPE)
+	{
+		existing->inode->mode = st.st_mode & 07777;
+		existing->inode->time = st.st_mtime;
+		return applyOverlay(v, existing->inode, fullName);
+	}
+
+	if (!S_ISDIR(st.st_mode) && st.st_nlink > 1)
+	{
+		for (link = v->hardLinks; link != NULL; link = link->next)
+		{
+			if (link->device == st.st_dev && link->inode == st.st_ino) return setEntry(v, directory, name, link->target);
+		}
+	}
+
+	if ((inode = newInode(v, st.st_mode)) == NULL) return false;
+
+	inode->time = st.st_mtime;
+	if (existing != NULL)
+	{
+		inode->uid = existing->inode->uid;
+		inode->gid = existing->inode->gid;
+	}
+	else if (!rootOwned)
+	{
+		inode->uid = st.st_uid;
+		inode->gid = st.st_gid;
+	}
+
+	if (S_ISREG(st.st_mode))
+	{
+		inode->fileSize = st.st_size;
+		if ((inode->path = strdup(fullName)) == NULL) return false;
+	}
+	else if (S_ISLNK(st.st_mode))
+	{
+		ssize_t			size;
+
+		if ((inode->symlink = malloc(st.st_size + 1)) == NULL) return false;
+		if ((size = readlink(fullName, inode->symlink, st.st_size + 1)) < 0 || size > st.st_size)
+		{
+			fprintf(stderr, "Error %d reading symbolic link '%s'.\n", errno, fullName);
+			return false;
+		}
+		inode->symlinkSize = size;
+	}
+	else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode))
+	{
+		unsigned int	major = major(st.st_rdev);
+		unsigned int	minor = minor(st.st_rdev);
+
+		// the new_encode_dev() format used by the kernel
+		inode->rdev = (minor & 0xff) | (major << 8) | ((minor & ~0xff) << 12);
+	}
+
+	if (!S_ISDIR(st.st_mode) && st.st_nlink > 1)
+	{
+		if ((link = malloc(sizeof(struct hardLink))) == NULL) return false;
+		link->device = st.st_dev;
+		link->inode = st.st_ino;
+		link->target = inode;
+		link->next = v->hardLinks;
+		v->hardLinks = link;
+	}
+
+	if (!setEntry(v, directory, name, inode)) return false;
+
+	return (S_ISDIR(st.st_mode) ? applyOverlay(v, inode, fullName) : true);
+}
+
+bool applyOverlay(struct variant *v, struct inode *directory, const char *path)
+{
+	DIR *				dir;
+	struct dirent *		dirEntry;
+	char **				names = NULL;
+	size_t				count = 0;
+	size_t				allocated = 0;
+	bool				success = true;
+	size_t				i;
+
+	if ((dir = opendir(path)) == NULL)
+	{
+		fprintf(stderr, "Error %d opening overlay directory '%s'.\n", errno, path);
+		return false;
+	}
+
+	while ((dirEntry = readdir(dir)) != NULL)
+	{
+		if (strcmp(dirEntry->d_name, ".") == 0 || strcmp(dirEntry->d_name, "..") == 0) continue;
+
+		if (count == allocated)
+		{
+			allocated = (allocated ? allocated * 2 : 64);
+			if ((names = realloc(names, allocated * sizeof(char *))) == NULL)
+			{
+				closedir(dir);
+				return false;
+			}
+		}
+		if ((names[count++] = strdup(dirEntry->d_name)) == NULL) success = false;
+	}
+	closedir(dir);
+
+	qsort(names, count, sizeof(char *), compareNames);
+
+	// an opaque directory hides everything from below, it has to be processed first
+	for (i = 0; i < count && success; i++)
+	{
+		if (strcmp(names[i], OPAQUE_MARKER) == 0)
+		{
+			while (directory->children != NULL) removeEntry(directory, directory->children->name);
+		}
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (success && strcmp(names[i], OPAQUE_MARKER) != 0) success = applyOverlayEntry(v, directory, path, names[i]);
+		free(names[i]);
+	}
+	free(names);
+
+	return (success && !v->failed);
+}
+
+// numbers are assigned in the same order as the inodes are written later
+void numberDirectory(struct variant *v, struct inode *directory)
+{
+	struct entry *		entry;
+	uint32_t			subDirectories = 0;
+
+	for (entry = directory->children; entry != NULL; entry = entry->next)
+	{
+		struct inode *	inode = entry->inode;
+
+		if (inode->type == SQUASHFS_DIR_TYPE)
+		{
+			inode->parent = directory;
+			numberDirectory(v, inode);
+			subDirectories++;
+		}
+		else
+		{
+			if (inode->number == 0) inode->number = ++v->inodeCount;
+			inode->nlink++;
+		}
+	}
+
+	directory->nlink = 2 + subDirectories;
+	directory->number = ++v->inodeCount;
+}
+
+int idIndex(struct variant *v, uint32_t id)
+{
+	size_t				i;
+
+	for (i = 0; i < v->idCount; i++)
+	{
+		if (v->ids[i] == id) return i;
+	}
+
+	if (v->idCount == 65536)
+	{
+		fprintf(stderr, "Too many different owners and groups for '%s'.\n", v->output);
+		v->failed = true;
+		return 0;
+	}
+
+	if ((v->idCount % 64) == 0 && (v->ids = realloc(v->ids, (v->idCount + 64) * sizeof(uint32_t))) == NULL)
+	{
+		v->failed = true;
+		return 0;
+	}
+	v->ids[v->idCount] = id;
+
+	return v->idCount++;
+}
+
+uint32_t reserveFragment(struct variant *v)
+{
+	if (v->fragmentCount == v->fragmentsAllocated)
+	{
+		v->fragmentsAllocated = (v->fragmentsAllocated ? v->fragmentsAllocated * 2 : 64);
+		if ((v->fragments = realloc(v->fragments, v->fragmentsAllocated * sizeof(struct fragmentEntry))) == NULL)
+		{
+			v->failed = true;
+			return 0;
+		}
+	}
+
+	return v->fragmentCount++;
+}
+
+bool flushFragment(struct variant *v)
+{
+	size_t				size;
+
+	if (v->fragmentFill == 0) return true;
+
+	v->fragments[v->pendingFragment].start = v->position;
+	v->readBytes += v->fragmentFill;
+	if ((size = compressBlock(v->fragmentBuffer, v->fragmentFill, v->compressBuffer)) > 0)
+	{
+		v->fragments[v->pendingFragment].size = size;
+		if (!writeOutput(v, v->compressBuffer, size)) return false;
+	}
+	else
+	{
+		size = v->fragmentFill;
+		v->fragments[v->pendingFragment].size = size | SQUASHFS_COMPRESSED_BIT_BLOCK;
+		if (!writeOutput(v, v->fragmentBuffer, size)) return false;
+	}
+	v->compressedBytes += size;
+	v->fragmentFill = 0;
+
+	return true;
+}
+
+// a fragment block of the base image is copied once, if any of its files is still used
+uint32_t copyFragment(struct variant *v, uint32_t baseIndex)
+{
+	uint64_t			start;
+	uint32_t			size;
+	uint32_t			index;
+
+	if (v->fragmentMap[baseIndex] > 0) return v->fragmentMap[baseIndex] - 1;
+
+	if (!fragmentEntry(baseIndex, &start, &size))
+	{
+		fprintf(stderr, "Invalid fragment %u in base image.\n", baseIndex);
+		v->failed = true;
+		return 0;
+	}
+
+	index = reserveFragment(v);
+	if (v->failed) return 0;
+	v->fragments[index].start = v->position;
+	v->fragments[index].size = size;
+	writeOutput(v, image + start, size & ~SQUASHFS_COMPRESSED_BIT_BLOCK);
+	v->copiedBytes += size & ~SQUASHFS_COMPRESSED_BIT_BLOCK;
+	v->fragmentMap[baseIndex] = index + 1;
+
+	return index;
+}
+
+bool copyFileData(struct variant *v, struct inode *inode)
+{
+	uint64_t			length = 0;
+	struct blockMapEntry *	mapped;
+	uint32_t			i;
+
+	for (i = 0; i < inode->blockCount; i++) length += get32(inode->baseBlockList + i * 4) & ~SQUASHFS_COMPRESSED_BIT_BLOCK;
+
+	inode->start = v->position;
+	if (length > 0)
+	{
+		size_t			bucket = (inode->baseStart / 4) % BLOCK_MAP_SIZE;
+
+		if (inode->baseStart + length > imageSize)
+		{
+			fprintf(stderr, "Data blocks of a file are beyond the end of the base image.\n");
+			v->failed = true;
+			return false;
+		}
+
+		// files deduplicated in the base image share their blocks in the new one, too
+		for (mapped = v->blockMap[bucket]; mapped != NULL; mapped = mapped->next)
+		{
+			if (mapped->baseStart == inode->baseStart && mapped->length == length) break;
+		}
+
+		if (mapped != NULL) inode->start = mapped->start;
+		else
+		{
+			if ((mapped = malloc(sizeof(struct blockMapEntry))) == NULL)
+			{
+				v->failed = true;
+				return false;
+			}
+			mapped->baseStart = inode->baseStart;
+			mapped->length = length;
+			mapped->start = v->position;
+			mapped->next = v->blockMap[bucket];
+			v->blockMap[bucket] = mapped;
+
+			if (!writeOutput(v, image + inode->baseStart, length)) return false;
+			v->copiedBytes += length;
+		}
+	}
+
+	if (inode->baseFragment != SQUASHFS_INVALID_FRAG) inode->fragment = copyFragment(v, inode->baseFragment);
+
+	return !v->failed;
+}
+
+bool readFully(int fd, uint8_t *buffer, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t			readSize = read(fd, buffer, size);
+
+		if (readSize <= 0) return false;
+		buffer += readSize;
+		size -= readSize;
+	}
+
+	return true;
+}
+
+bool isZeroBlock(const uint8_t *data, size_t size)
+{
+	return (size > 0 && data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
+
+bool compressFileData(struct variant *v, struct inode *inode)
+{
+	uint64_t			remaining = inode->fileSize;
+	bool				useFragment;
+	uint32_t			i;
+	int					fd;
+
+	// tails of files bigger than a block get a fragment only with '-always-use-fragments'
+	useFragment = !(outputFlags & SQUASHFS_NO_FRAG) && (inode->fileSize % sBlk.blockSize) != 0 &&
+		(inode->fileSize < sBlk.blockSize || (outputFlags & SQUASHFS_ALWAYS_FRAG));
+	inode->blockCount = (inode->fileSize / sBlk.blockSize) + ((!useFragment && (inode->fileSize % sBlk.blockSize) != 0) ? 1 : 0);
+	inode->start = v->position;
+
+	if (inode->fileSize == 0) return true;
+
+	if ((inode->blocks = calloc(inode->blockCount + 1, sizeof(uint32_t))) == NULL || (fd = open(inode->path, O_RDONLY)) == -1)
+	{
+		fprintf(stderr, "Error %d opening overlay file '%s'.\n", errno, inode->path);
+		v->failed = true;
+		return false;
+	}
+
+	for (i = 0; i < inode->blockCount; i++)
+	{
+		size_t			size = (remaining < sBlk.blockSize ? remaining : sBlk.blockSize);
+		size_t			compressed;
+
+		if (!readFully(fd, v->blockBuffer, size)) break;
+		remaining -= size;
+		v->readBytes += size;
+
+		// sparse blocks aren't stored at all
+		if (isZeroBlock(v->blockBuffer, size)) inode->blocks[i] = 0;
+		else if ((compressed = compressBlock(v->blockBuffer, size, v->compressBuffer)) > 0)
+		{
+			inode->blocks[i] = compressed;
+			if (!writeOutput(v, v->compressBuffer, compressed)) break;
+			v->compressedBytes += compressed;
+		}
+		else
+		{
+			inode->blocks[i] = size | SQUASHFS_COMPRESSED_BIT_BLOCK;
+			if (!writeOutput(v, v->blockBuffer, size)) break;
+			v->compressedBytes += size;
+		}
+	}
+
+	if (i == inode->blockCount && remaining > 0)
+	{
+		if (v->fragmentFill + remaining > sBlk.blockSize && !flushFragment(v)) i = 0;
+		else
+		{
+			if (v->fragmentFill == 0) v->pendingFragment = reserveFragment(v);
+			if (!readFully(fd, v->fragmentBuffer + v->fragmentFill, remaining)) i = 0;
+			else
+			{
+				inode->fragment = v->pendingFragment;
+				inode->fragmentOffset = v->fragmentFill;
+				v->fragmentFill += remaining;
+				remaining = 0;
+			}
+		}
+	}
+	close(fd);
+
+	if (remaining > 0 || i < inode->blockCount)
+	{
+		if (!v->failed) fprintf(stderr, "Error reading overlay file '%s', it was changed while packing.\n", inode->path);
+		v->failed = true;
+		return false;
+	}
+
+	return !v->failed;
+}
+
+bool writeInode(struct variant *v, struct inode *inode)
+{
+	uint8_t				buffer[64 + SQUASHFS_NAME_LEN];
+	uint8_t *			ptr = buffer + 16;
+	uint32_t			parent = (inode->parent != NULL ? inode->parent->number : v->inodeCount + 1);
+	unsigned int		type = inode->type;
+	uint32_t			i;
+
+	switch (inode->type)
+	{
+		case SQUASHFS_DIR_TYPE:
+			if (inode->listingSize > 0xFFFF)
+			{
+				type = SQUASHFS_LDIR_TYPE;
+				put32(ptr, inode->nlink);
+				put32(ptr + 4, inode->listingSize);
+				put32(ptr + 8, inode->listingStart);
+				put32(ptr + 12, parent);
+				put16(ptr + 16, 0);
+				put16(ptr + 18, inode->listingOffset);
+				put32(ptr + 20, SQUASHFS_INVALID_XATTR);
+				ptr += 24;
+			}
+			else
+			{
+				put32(ptr, inode->listingStart);
+				put32(ptr + 4, inode->nlink);
+				put16(ptr + 8, inode->listingSize);
+				put16(ptr + 10, inode->listingOffset);
+				put32(ptr + 12, parent);
+				ptr += 16;
+			}
+			break;
+
+		case SQUASHFS_REG_TYPE:
+			if (inode->nlink > 1 || inode->fileSize > 0xFFFFFFFF || inode->start > 0xFFFFFFFF)
+			{
+				type = SQUASHFS_LREG_TYPE;
+				put64(ptr, inode->start);
+				put64(ptr + 8, inode->fileSize);
+				put64(ptr + 16, 0);
+				put32(ptr + 24, inode->nlink);
+				put32(ptr + 28, inode->fragment);
+				put32(ptr + 32, inode->fragmentOffset);
+				put32(ptr + 36, SQUASHFS_INVALID_XATTR);
+				ptr += 40;
+			}
+			else
+			{
+				put32(ptr, inode->start);
+				put32(ptr + 4, inode->fragment);
+				put32(ptr + 8, inode->fragmentOffset);
+				put32(ptr + 12, inode->fileSize);
+				ptr += 16;
+			}
+			break;
+
+		case SQUASHFS_SYMLINK_TYPE:
+			put32(ptr, inode->nlink);
+			put32(ptr + 4, inode->symlinkSize);
+			ptr += 8;
+			break;
+
+		case SQUASHFS_BLKDEV_TYPE:
+		case SQUASHFS_CHRDEV_TYPE:
+			put32(ptr, inode->nlink);
+			put32(ptr + 4, inode->rdev);
+			ptr += 8;
+			break;
+
+		default:
+			put32(ptr, inode->nlink);
+			ptr += 4;
+			break;
+	}
+
+	put16(buffer, type);
+	put16(buffer + 2, inode->mode);
+	put16(buffer + 4, idIndex(v, inode->uid));
+	put16(buffer + 6, idIndex(v, inode->gid));
+	put32(buffer + 8, inode->time);
+	put32(buffer + 12, inode->number);
+
+	inode->reference = metadataReference(&v->inodes);
+	inode->written = true;
+	if (v->lookup != NULL) v->lookup[inode->number - 1] = inode->reference;
+
+	if (!appendMetadata(v, &v->inodes, buffer, ptr - buffer)) return false;
+
+	if (inode->type == SQUASHFS_SYMLINK_TYPE) return appendMetadata(v, &v->inodes, (const uint8_t *) inode->symlink, inode->symlinkSize);
+
+	if (inode->type == SQUASHFS_REG_TYPE)
+	{
+		// the block list of an unchanged file is already in the right byte order
+		if (inode->fromBase) return appendMetadata(v, &v->inodes, inode->baseBlockList, (size_t) inode->blockCount * 4);
+
+		for (i = 0; i < inode->blockCount; i++)
+		{
+			put32(buffer, inode->blocks[i]);
+			if (!appendMetadata(v, &v->inodes, buffer, 4)) return false;
+		}
+	}
+
+	return !v->failed;
+}
+
+bool writeListing(struct variant *v, struct inode *directory)
+{
+	struct entry *		entry = directory->children;
+	uint8_t				buffer[8 + SQUASHFS_NAME_LEN];
+	uint32_t			size = 0;
+
+	directory->listingStart = v->directories.size;
+	directory->listingOffset = v->directories.fill;
+
+	while (entry != NULL)
+	{
+		uint64_t		block = entry->inode->reference >> 16;
+		uint32_t		number = entry->inode->number;
+		struct entry *	last;
+		uint32_t		count = 0;
+
+		// a header covers entries with inodes in the same metadata block and near inode numbers
+		for (last = entry; last != NULL && count < SQUASHFS_DIR_COUNT; last = last->next, count++)
+		{
+			int64_t		delta = (int64_t) last->inode->number - number;
+
+			if ((last->inode->reference >> 16) != block || delta < -32768 || delta > 32767) break;
+		}
+
+		put32(buffer, count - 1);
+		put32(buffer + 4, block);
+		put32(buffer + 8, number);
+		if (!appendMetadata(v, &v->directories, buffer, 12)) return false;
+		size += 12;
+
+		for (; entry != last; entry = entry->next)
+		{
+			size_t		nameSize = strlen(entry->name);
+
+			put16(buffer, entry->inode->reference & 0xFFFF);
+			put16(buffer + 2, (uint16_t) (int16_t) ((int64_t) entry->inode->number - number));
+			put16(buffer + 4, entry->inode->type);
+			put16(buffer + 6, nameSize - 1);
+			memcpy(buffer + 8, entry->name, nameSize);
+			if (!appendMetadata(v, &v->directories, buffer, 8 + nameSize)) return false;
+			size += 8 + nameSize;
+		}
+	}
+
+	// the stored size contains 3 additional bytes for the '.' and '..' entries
+	directory->listingSize = size + 3;
+
+	return true;
+}
+
+bool writeDirectory(struct variant *v, struct inode *directory)
+{
+	struct entry *		entry;
+
+	for (entry = directory->children; entry != NULL && !v->failed; entry = entry->next)
+	{
+		struct inode *	inode = entry->inode;
+
+		if (inode->written) continue;
+
+		if (inode->type == SQUASHFS_DIR_TYPE)
+		{
+			if (!writeDirectory(v, inode)) return false;
+			continue;
+		}
+
+		if (inode->type == SQUASHFS_REG_TYPE)
+		{
+			if (inode->fromBase ? !copyFileData(v, inode) : !compressFileData(v, inode)) return false;
+		}
+
+		if (!writeInode(v, inode)) return false;
+	}
+
+	return (!v->failed && writeListing(v, directory) && writeInode(v, directory));
+}
+
+bool writeImage(struct variant *v)
+{
+	uint8_t				superBlock[SQUASHFS_SUPERBLOCK_SIZE];
+	uint64_t			inodeTableStart;
+	uint64_t			directoryTableStart;
+	uint64_t			fragmentTableStart;
+	uint64_t			lookupTableStart = SQUASHFS_INVALID_BLK;
+	uint64_t			idTableStart;
+	uint64_t			bytesUsed;
+	uint8_t *			table;
+	size_t				i;
+
+	memset(superBlock, 0, sizeof(superBlock));
+	if (!writeOutput(v, superBlock, sizeof(superBlock))) return false;
+	if (compressionOptions != NULL && !writeOutput(v, compressionOptions, compressionOptionsSize)) return false;
+
+	if (!writeDirectory(v, v->root) || !flushFragment(v) || !flushMetadata(v, &v->inodes) || !flushMetadata(v, &v->directories)) return false;
+
+	inodeTableStart = v->position;
+	if (!writeOutput(v, v->inodes.data, v->inodes.size)) return false;
+	directoryTableStart = v->position;
+	if (!writeOutput(v, v->directories.data, v->directories.size)) return false;
+
+	fragmentTableStart = v->position;
+	if (v->fragmentCount > 0)
+	{
+		if ((table = calloc(v->fragmentCount, SQUASHFS_FRAGMENT_ENTRY_SIZE)) == NULL) return false;
+		for (i = 0; i < v->fragmentCount; i++)
+		{
+			put64(table + i * SQUASHFS_FRAGMENT_ENTRY_SIZE, v->fragments[i].start);
+			put32(table + i * SQUASHFS_FRAGMENT_ENTRY_SIZE + 8, v->fragments[i].size);
+		}
+		writeIndexedTable(v, table, v->fragmentCount * SQUASHFS_FRAGMENT_ENTRY_SIZE, &fragmentTableStart);
+		free(table);
+	}
+
+	if (v->lookup != NULL)
+	{
+		if ((table = malloc((size_t) v->inodeCount * 8)) == NULL) return false;
+		for (i = 0; i < v->inodeCount; i++) put64(table + i * 8, v->lookup[i]);
+		writeIndexedTable(v, table, (size_t) v->inodeCount * 8, &lookupTableStart);
+		free(table);
+	}
+
+	if ((table = malloc(v->idCount * 4)) == NULL) return false;
+	for (i = 0; i < v->idCount; i++) put32(table + i * 4, v->ids[i]);
+	writeIndexedTable(v, table, v->idCount * 4, &idTableStart);
+	free(table);
+
+	bytesUsed = v->position;
+	if (v->failed) return false;
+
+	// the image is padded to a multiple of 4K like mksquashfs does it
+	if ((bytesUsed % OUTPUT_ALIGNMENT) != 0)
+	{
+		uint8_t			padding[OUTPUT_ALIGNMENT];
+
+		memset(padding, 0, sizeof(padding));
+		if (!writeOutput(v, padding, OUTPUT_ALIGNMENT - (bytesUsed % OUTPUT_ALIGNMENT))) return false;
+	}
+
+	put32(superBlock, SQUASHFS_MAGIC);
+	put32(superBlock + 4, v->inodeCount);
+	put32(superBlock + 8, time(NULL));
+	put32(superBlock + 12, sBlk.blockSize);
+	put32(superBlock + 16, v->fragmentCount);
+	put16(superBlock + 20, sBlk.compression);
+	put16(superBlock + 22, sBlk.blockLog);
+	put16(superBlock + 24, outputFlags);
+	put16(superBlock + 26, v->idCount);
+	put16(superBlock + 28, 4);
+	put16(superBlock + 30, 0);
+	put64(superBlock + 32, v->root->reference);
+	put64(superBlock + 40, bytesUsed);
+	put64(superBlock + 48, idTableStart);
+	put64(superBlock + 56, SQUASHFS_INVALID_BLK);
+	put64(superBlock + 64, inodeTableStart);
+	put64(superBlock + 72, directoryTableStart);
+	put64(superBlock + 80, fragmentTableStart);
+	put64(superBlock + 88, lookupTableStart);
+
+	if (fseek(v->out, 0, SEEK_SET) != 0 || fwrite(superBlock, sizeof(superBlock), 1, v->out) != 1)
+	{
+		fprintf(stderr, "Error %d writing superblock to '%s'.\n", errno, v->output);
+		return false;
+	}
+
+	return true;
+}
+
+void freeVariant(struct variant *v)
+{
+	struct inode *		inode;
+	struct hardLink *	link;
+	size_t				i;
+
+	while ((inode = v->allInodes) != NULL)
+	{
+		v->allInodes = inode->allNext;
+		while (inode->children != NULL) removeEntry(inode, inode->children->name);
+		free(inode->symlink);
+		free(inode->path);
+		free(inode->blocks);
+		free(inode);
+	}
+
+	while ((link = v->hardLinks) != NULL)
+	{
+		v->hardLinks = link->next;
+		free(link);
+	}
+
+	for (i = 0; i < BLOCK_MAP_SIZE; i++)
+	{
+		struct blockMapEntry *	mapped;
+
+		while ((mapped = v->blockMap[i]) != NULL)
+		{
+			v->blockMap[i] = mapped->next;
+			free(mapped);
+		}
+	}
+
+	free(v->baseInodes);
+	free(v->fragmentMap);
+	free(v->lookup);
+	free(v->ids);
+	free(v->fragments);
+	free(v->inodes.data);
+	free(v->directories.data);
+	free(v->fragmentBuffer);
+	free(v->blockBuffer);
+	free(v->compressBuffer);
+}
+
+bool buildVariant(struct variant *v)
+{
+	struct stat			st;
+
+	if ((v->baseInodes = calloc((size_t) sBlk.inodes + 1, sizeof(struct inode *))) == NULL ||
+		(v->fragmentMap = calloc((size_t) sBlk.fragments + 1, sizeof(uint32_t))) == NULL ||
+		(v->fragmentBuffer = malloc(sBlk.blockSize)) == NULL ||
+		(v->blockBuffer = malloc(sBlk.blockSize)) == NULL ||
+		(v->compressBuffer = malloc(sBlk.blockSize)) == NULL ||
+		(v->root = newInode(v, S_IFDIR | 0755)) == NULL)
+	{
+		fprintf(stderr, "Memory exhausted while building '%s'.\n", v->output);
+		return false;
+	}
+
+	v->root->time = time(NULL);
+
+	if (haveBase)
+	{
+		struct inodeInfo	root;
+
+		if (!readInode(sBlk.rootInode, &root)) return false;
+		v->root->mode = root.mode & 07777;
+		v->root->uid = root.uid;
+		v->root->gid = root.gid;
+		v->root->time = root.time;
+		if (!loadDirectory(v, v->root, &root)) return false;
+	}
+	else if (stat(v->overlay, &st) == 0)
+	{
+		v->root->mode = st.st_mode & 07777;
+		v->root->time = st.st_mtime;
+		if (!rootOwned)
+		{
+			v->root->uid = st.st_uid;
+			v->root->gid = st.st_gid;
+		}
+	}
+
+	if (strcmp(v->overlay, "-") != 0 && !applyOverlay(v, v->root, v->overlay)) return false;
+
+	numberDirectory(v, v->root);
+
+	if ((outputFlags & SQUASHFS_EXPORT) && (v->lookup = calloc(v->inodeCount, sizeof(uint64_t))) == NULL) return false;
+
+	if ((v->out = fopen(v->output, "wb")) == NULL)
+	{
+		fprintf(stderr, "Error %d creating image file '%s'.\n", errno, v->output);
+		return false;
+	}
+
+	if (!writeImage(v))
+	{
+		fclose(v->out);
+		unlink(v->output);
+		return false;
+	}
+
+	if (fclose(v->out) != 0)
+	{
+		fprintf(stderr, "Error %d closing image file '%s'.\n", errno, v->output);
+		unlink(v->output);
+		return false;
+	}
+
+	return true;
+}
+
+void * variantWorker(void *arg)
+{
+	(void) arg;
+
+	while (true)
+	{
+		struct variant *	v;
+		size_t				index;
+
+		pthread_mutex_lock(&variantLock);
+		index = nextVariant++;
+		pthread_mutex_unlock(&variantLock);
+
+		if (index >= variantCount) break;
+
+		v = &variants[index];
+		v->failed = !buildVariant(v) || v->failed;
+		if (!v->failed)
+		{
+			pthread_mutex_lock(&variantLock);
+			fprintf(stdout, "%s: %u inodes, %" PRIu64 " bytes copied, %" PRIu64 " bytes compressed to %" PRIu64 " bytes, image size %" PRIu64 " bytes\n",
+				v->output, v->inodeCount, v->copiedBytes, v->readBytes, v->compressedBytes, v->position);
+			pthread_mutex_unlock(&variantLock);
+		}
+		freeVariant(v);
+	}
+
+	return NULL;
+}
+
+// use the block size and compressor settings of the base image
+bool setupOutput(const char *compressor, uint32_t blockSize)
+{
+	if (haveBase)
+	{
+		outputFlags = (sBlk.flags & (SQUASHFS_NO_FRAG | SQUASHFS_ALWAYS_FRAG | SQUASHFS_DUPLICATE | SQUASHFS_EXPORT | SQUASHFS_COMP_OPT)) | SQUASHFS_NO_XATTR;
+		dictionarySize = sBlk.blockSize;
+
+		if (sBlk.xattrIdTableStart != SQUASHFS_INVALID_BLK) fprintf(stderr, "Extended attributes from the base image are not copied.\n");
+
+		if (sBlk.flags & SQUASHFS_COMP_OPT)
+		{
+			uint16_t	header;
+
+			// the options are stored uncompressed in a metadata block behind the superblock
+			if (imageSize < SQUASHFS_SUPERBLOCK_SIZE + 2) return false;
+			header = get16(image + SQUASHFS_SUPERBLOCK_SIZE);
+			compressionOptions = image + SQUASHFS_SUPERBLOCK_SIZE;
+			compressionOptionsSize = 2 + (header & ~SQUASHFS_COMPRESSED_BIT);
+			if (!(header & SQUASHFS_COMPRESSED_BIT) || compressionOptionsSize < 6 || SQUASHFS_SUPERBLOCK_SIZE + compressionOptionsSize > imageSize)
+			{
+				fprintf(stderr, "Unable to read the compression options from base image.\n");
+				return false;
+			}
+			if (sBlk.compression == XZ_COMPRESSION) dictionarySize = get32(compressionOptions + 2);
+			else if (sBlk.compression == ZLIB_COMPRESSION) gzipLevel = get32(compressionOptions + 2);
+		}
+
+		return true;
+	}
+
+	if (blockSize < 4096 || blockSize > 1048576 || (blockSize & (blockSize - 1)) != 0)
+	{
+		fprintf(stderr, "Invalid block size %u, it has to be a power of 2 from 4096 to 1048576.\n", blockSize);
+		return false;
+	}
+
+	if (strcmp(compressor, "gzip") == 0) sBlk.compression = ZLIB_COMPRESSION;
+	else if (strcmp(compressor, "lzma") == 0) sBlk.compression = LZMA_COMPRESSION;
+	else if (strcmp(compressor, "xz") == 0) sBlk.compression = XZ_COMPRESSION;
+	else
+	{
+		fprintf(stderr, "Unsupported compression method '%s'.\n", compressor);
+		return false;
+	}
+
+	sBlk.blockSize = blockSize;
+	for (sBlk.blockLog = 0; (1U << sBlk.blockLog) < blockSize; sBlk.blockLog++);
+	dictionarySize = blockSize;
+	outputFlags = SQUASHFS_DUPLICATE | SQUASHFS_NO_XATTR;
+
+	return true;
+}
+
+int main(int argc, char * argv[])
+{
+	int					returnCode = 1;
+	int					fd = -1;
+	const char *		baseName = NULL;
+	const char *		compressor = "gzip";
+	uint32_t			blockSize = DEFAULT_BLOCK_SIZE;
+	long				threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *			threads = NULL;
+	long				started = 0;
+	size_t				index;
+	int					i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threadCount = atol(argv[++i]);
+		else if (strcmp(argv[i], "-comp") == 0 && i + 1 < argc) compressor = argv[++i];
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) blockSize = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-root-owned") == 0) rootOwned = true;
+		else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) break;
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (i + 3 > argc || ((argc - i - 1) % 2) != 0)
+	{
+		usage();
+		exit(1);
+	}
+
+	baseName = argv[i++];
+	variantCount = (argc - i) / 2;
+	if ((variants = calloc(variantCount, sizeof(struct variant))) == NULL) exit(1);
+	for (index = 0; index < variantCount; index++)
+	{
+		variants[index].overlay = argv[i++];
+		variants[index].output = argv[i++];
+	}
+
+	if (strcmp(baseName, "-") != 0)
+	{
+		if (!mapImage(baseName, &fd)) exit(1);
+		haveBase = true;
+		if (!readSuperBlock() || !readImageTables(threadCount) || !readFragmentTable(threadCount))
+		{
+			unmapImage(fd);
+			exit(1);
+		}
+	}
+
+	if (setupOutput(compressor, blockSize))
+	{
+		if (threadCount > (long) variantCount) threadCount = variantCount;
+		if (threadCount > 1 && (threads = calloc(threadCount, sizeof(pthread_t))) != NULL)
+		{
+			for (started = 0; started < threadCount; started++)
+			{
+				if (pthread_create(&threads[started], NULL, variantWorker, NULL) != 0) break;
+			}
+			for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+			free(threads);
+		}
+		if (started == 0) variantWorker(NULL);
+
+		returnCode = 0;
+		for (index = 0; index < variantCount; index++)
+		{
+			if (variants[index].failed) returnCode = 1;
+		}
+	}
+
+	if (haveBase) unmapImage(fd);
+	free(variants);
+
+	exit(returnCode);
+}
@@ -0,0 +1,517 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include <lzma.h>
+
+#include "squashfs_image.h"
+
+// minimum inode sizes (without the common header) by type, index 0 is used for unknown types
+static const size_t		inodeSizes[] = { 0, 16, 16, 8, 8, 8, 4, 4, 24, 40, 8, 12, 12, 8, 8 };
+
+const uint8_t *			image = NULL;
+size_t					imageSize = 0;
+bool					swapNeeded = false;
+struct superBlock		sBlk;
+struct metadataTable	inodeTable = { .name = "inode" };
+struct metadataTable	directoryTable = { .name = "directory" };
+struct metadataTable	idTable = { .name = "id" };
+struct metadataTable	fragmentTable = { .name = "fragment" };
+
+uint16_t get16(const uint8_t *ptr)
+{
+	return (swapNeeded ? (ptr[0] << 8) | ptr[1] : ptr[0] | (ptr[1] << 8));
+}
+
+uint32_t get32(const uint8_t *ptr)
+{
+	return (swapNeeded ? ((uint32_t) ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3] : ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t) ptr[3] << 24));
+}
+
+uint64_t get64(const uint8_t *ptr)
+{
+	return (swapNeeded ? ((uint64_t) get32(ptr) << 32) | get32(ptr + 4) : get32(ptr) | ((uint64_t) get32(ptr + 4) << 32));
+}
+
+bool mapImage(const char *name, int *fd)
+{
+	struct stat			fileStat;
+
+	if ((*fd = open(name, O_RDONLY)) == -1)
+	{
+		fprintf(stderr, "Error %d opening image file '%s'.\n", errno, name);
+		return false;
+	}
+
+	if (fstat(*fd, &fileStat) == -1 || (image = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, *fd, 0)) == MAP_FAILED)
+	{
+		fprintf(stderr, "Error %d mapping image file '%s' to memory.\n", errno, name);
+		close(*fd);
+		image = NULL;
+		return false;
+	}
+	imageSize = fileStat.st_size;
+
+	return true;
+}
+
+void unmapImage(int fd)
+{
+	munmap((void *) image, imageSize);
+	close(fd);
+	image = NULL;
+	imageSize = 0;
+}
+
+bool readSuperBlock(void)
+{
+	uint32_t			magic;
+
+	if (imageSize < SQUASHFS_SUPERBLOCK_SIZE) return false;
+
+	magic = image[0] | (image[1] << 8) | (image[2] << 16) | ((uint32_t) image[3] << 24);
+	if (magic == SQUASHFS_MAGIC_SWAP) swapNeeded = true;
+	else if (magic != SQUASHFS_MAGIC)
+	{
+		fprintf(stderr, "The specified file doesn't contain a SquashFS image.\n");
+		return false;
+	}
+
+	sBlk.inodes = get32(image + 4);
+	sBlk.mkfsTime = get32(image + 8);
+	sBlk.blockSize = get32(image + 12);
+	sBlk.fragments = get32(image + 16);
+	sBlk.compression = get16(image + 20);
+	sBlk.blockLog = get16(image + 22);
+	sBlk.flags = get16(image + 24);
+	sBlk.noIds = get16(image + 26);
+	sBlk.major = get16(image + 28);
+	sBlk.minor = get16(image + 30);
+	sBlk.rootInode = get64(image + 32);
+	sBlk.bytesUsed = get64(image + 40);
+	sBlk.idTableStart = get64(image + 48);
+	sBlk.xattrIdTableStart = get64(image + 56);
+	sBlk.inodeTableStart = get64(image + 64);
+	sBlk.directoryTableStart = get64(image + 72);
+	sBlk.fragmentTableStart = get64(image + 80);
+	sBlk.lookupTableStart = get64(image + 88);
+
+	if (sBlk.major != 4)
+	{
+		fprintf(stderr, "Only SquashFS version 4 images are supported, this one has version %u.%u.\n", sBlk.major, sBlk.minor);
+		return false;
+	}
+
+	if (sBlk.compression != ZLIB_COMPRESSION && sBlk.compression != LZMA_COMPRESSION && sBlk.compression != XZ_COMPRESSION)
+	{
+		fprintf(stderr, "Unsupported compression method %u used in image.\n", sBlk.compression);
+		return false;
+	}
+
+	if (sBlk.blockSize < 4096 || sBlk.blockSize > 1048576 || (sBlk.blockSize & (sBlk.blockSize - 1)) != 0 ||
+		sBlk.bytesUsed > imageSize || sBlk.inodeTableStart >= sBlk.directoryTableStart || sBlk.directoryTableStart > sBlk.bytesUsed)
+	{
+		fprintf(stderr, "The image is truncated or its superblock is invalid.\n");
+		return false;
+	}
+
+	return true;
+}
+
+size_t decompressBlock(const uint8_t *source, size_t sourceSize, uint8_t *target, size_t targetSize)
+{
+	if (sBlk.compression == ZLIB_COMPRESSION)
+	{
+		uLongf			size = targetSize;
+
+		if (uncompress(target, &size, source, sourceSize) != Z_OK) return 0;
+		return size;
+	}
+	else if (sBlk.compression == XZ_COMPRESSION)
+	{
+		uint64_t		memlimit = UINT64_MAX;
+		size_t			inPos = 0;
+		size_t			outPos = 0;
+
+		if (lzma_stream_buffer_decode(&memlimit, 0, NULL, source, &inPos, sourceSize, target, &outPos, targetSize) != LZMA_OK) return 0;
+		return outPos;
+	}
+	else // LZMA_COMPRESSION uses the 'lzma_alone' format
+	{
+		lzma_stream		stream = LZMA_STREAM_INIT;
+		size_t			size = 0;
+		lzma_ret		ret;
+
+		if (lzma_alone_decoder(&stream, UINT64_MAX) != LZMA_OK) return 0;
+		stream.next_in = source;
+		stream.avail_in = sourceSize;
+		stream.next_out = target;
+		stream.avail_out = targetSize;
+		ret = lzma_code(&stream, LZMA_FINISH);
+		if (ret == LZMA_OK || ret == LZMA_STREAM_END) size = targetSize - stream.avail_out;
+		lzma_end(&stream);
+		return size;
+	}
+}
+
+// walk through the block headers first, the lengths are needed to find the start of each block
+bool scanMetadataTable(struct metadataTable *table, uint64_t start, uint64_t end)
+{
+	uint64_t			pos = start;
+	size_t				allocated = 0;
+
+	table->tableStart = start;
+
+	while (pos < end)
+	{
+		uint16_t		length;
+
+		if (pos + 2 > imageSize) return false;
+		length = get16(image + pos) & ~SQUASHFS_COMPRESSED_BIT;
+		if (length > SQUASHFS_METADATA_SIZE || pos + 2 + length > imageSize) return false;
+
+		if (table->count == allocated)
+		{
+			allocated = (allocated ? allocated * 2 : 64);
+			if ((table->blockStart = realloc(table->blockStart, allocated * sizeof(uint64_t))) == NULL) return false;
+		}
+
+		table->blockStart[table->count++] = pos - start;
+		pos += 2 + length;
+	}
+
+	if ((table->dataOffset = calloc(table->count + 1, sizeof(size_t))) == NULL) return false;
+	if ((table->data = malloc((table->count + 1) * SQUASHFS_METADATA_SIZE)) == NULL) return false;
+	pthread_mutex_init(&table->lock, NULL);
+
+	return true;
+}
+
+static void * decompressWorker(void *arg)
+{
+	struct metadataTable *	table = (struct metadataTable *) arg;
+	size_t					index;
+
+	while (true)
+	{
+		const uint8_t *		block;
+		uint16_t			header;
+		size_t				length;
+		size_t				size;
+
+		pthread_mutex_lock(&table->lock);
+		index = table->next++;
+		pthread_mutex_unlock(&table->lock);
+
+		if (index >= table->count) break;
+
+		block = image + table->tableStart + table->blockStart[index];
+		header = get16(block);
+		length = header & ~SQUASHFS_COMPRESSED_BIT;
+
+		// each block gets its own slot, the slots are compacted afterwards
+		if (header & SQUASHFS_COMPRESSED_BIT)
+		{
+			memcpy(table->data + index * SQUASHFS_METADATA_SIZE, block + 2, length);
+			size = length;
+		}
+		else size = decompressBlock(block + 2, length, table->data + index * SQUASHFS_METADATA_SIZE, SQUASHFS_METADATA_SIZE);
+
+		if (size == 0)
+		{
+			fprintf(stderr, "Error decompressing %s table block at offset %" PRIu64 ".\n", table->name, table->tableStart + table->blockStart[index]);
+			table->failed = true;
+		}
+
+		table->dataOffset[index] = size; // size for now, converted to an offset later
+	}
+
+	return NULL;
+}
+
+bool decompressMetadataTable(struct metadataTable *table, long threadCount)
+{
+	pthread_t *			threads;
+	long				started = 0;
+	size_t				offset = 0;
+	size_t				i;
+
+	if (threadCount > (long) table->count) threadCount = table->count;
+	if (threadCount > 1 && (threads = calloc(threadCount, sizeof(pthread_t))) != NULL)
+	{
+		for (started = 0; started < threadCount; started++)
+		{
+			if (pthread_create(&threads[started], NULL, decompressWorker, table) != 0) break;
+		}
+		for (i = 0; i < (size_t) started; i++) pthread_join(threads[i], NULL);
+		free(threads);
+	}
+	if (started == 0) decompressWorker(table);
+
+	if (table->failed) return false;
+
+	for (i = 0; i < table->count; i++)
+	{
+		size_t			size = table->dataOffset[i];
+
+		if (offset != i * SQUASHFS_METADATA_SIZE) memmove(table->data + offset, table->data + i * SQUASHFS_METADATA_SIZE, size);
+		table->dataOffset[i] = offset;
+		offset += size;
+	}
+	table->dataOffset[table->count] = offset;
+	table->size = offset;
+
+	return true;
+}
+
+// convert a (block, offset) reference into a pointer to decompressed data
+const uint8_t * metadataPointer(const struct metadataTable *table, uint64_t block, unsigned int offset, size_t needed)
+{
+	size_t				low = 0;
+	size_t				high = table->count;
+
+	while (low < high)
+	{
+		size_t			middle = (low + high) / 2;
+
+		if (table->blockStart[middle] < block) low = middle + 1;
+		else high = middle;
+	}
+
+	if (low >= table->count || table->blockStart[low] != block) return NULL;
+	if (table->dataOffset[low] + offset + needed > table->size) return NULL;
+
+	return table->data + table->dataOffset[low] + offset;
+}
+
+// the directory table ends, where the next table's metadata blocks start
+static uint64_t directoryTableEnd(void)
+{
+	uint64_t			end = sBlk.bytesUsed;
+	uint64_t			first;
+
+	if (sBlk.fragments > 0 && sBlk.fragmentTableStart + 8 <= imageSize)
+	{
+		first = get64(image + sBlk.fragmentTableStart);
+		if (first < end) end = first;
+		if (sBlk.fragmentTableStart < end) end = sBlk.fragmentTableStart;
+	}
+	if (sBlk.lookupTableStart != SQUASHFS_INVALID_BLK && sBlk.lookupTableStart + 8 <= imageSize)
+	{
+		first = get64(image + sBlk.lookupTableStart);
+		if (first < end) end = first;
+	}
+	if (sBlk.idTableStart + 8 <= imageSize)
+	{
+		first = get64(image + sBlk.idTableStart);
+		if (first < end) end = first;
+	}
+
+	return end;
+}
+
+// id and fragment tables: the metadata blocks are stored consecutively in front of their index
+static bool readIndexedTable(struct metadataTable *table, uint64_t indexStart, size_t entries, size_t entrySize, long threadCount)
+{
+	size_t				indexCount = ((entries * entrySize) + SQUASHFS_METADATA_SIZE - 1) / SQUASHFS_METADATA_SIZE;
+	uint64_t			first;
+	uint64_t			last;
+	uint16_t			length;
+
+	if (entries == 0 || indexStart + indexCount * 8 > imageSize) return false;
+
+	first = get64(image + indexStart);
+	last = get64(image + indexStart + (indexCount - 1) * 8);
+	if (last + 2 > imageSize) return false;
+	length = get16(image + last) & ~SQUASHFS_COMPRESSED_BIT;
+
+	return (scanMetadataTable(table, first, last + 2 + length) && decompressMetadataTable(table, threadCount) && table->size >= entries * entrySize);
+}
+
+bool readImageTables(long threadCount)
+{
+	struct inodeInfo	root;
+
+	if (!readIndexedTable(&idTable, sBlk.idTableStart, sBlk.noIds, 4, threadCount))
+		fprintf(stderr, "Unable to read the id table from image.\n");
+	else if (!scanMetadataTable(&inodeTable, sBlk.inodeTableStart, sBlk.directoryTableStart) || !decompressMetadataTable(&inodeTable, threadCount))
+		fprintf(stderr, "Unable to read the inode table from image.\n");
+	else if (!scanMetadataTable(&directoryTable, sBlk.directoryTableStart, directoryTableEnd()) || !decompressMetadataTable(&directoryTable, threadCount))
+		fprintf(stderr, "Unable to read the directory table from image.\n");
+	else if (!readInode(sBlk.rootInode, &root) || !S_ISDIR(root.mode))
+		fprintf(stderr, "Unable to read the root directory inode.\n");
+	else
+		return true;
+
+	return false;
+}
+
+bool readFragmentTable(long threadCount)
+{
+	if (sBlk.fragments == 0) return true;
+	if (readIndexedTable(&fragmentTable, sBlk.fragmentTableStart, sBlk.fragments, SQUASHFS_FRAGMENT_ENTRY_SIZE, threadCount)) return true;
+
+	fprintf(stderr, "Unable to read the fragment table from image.\n");
+	return false;
+}
+
+bool fragmentEntry(uint32_t index, uint64_t *start, uint32_t *size)
+{
+	const uint8_t *		entry;
+
+	if (index >= sBlk.fragments) return false;
+	entry = fragmentTable.data + (size_t) index * SQUASHFS_FRAGMENT_ENTRY_SIZE;
+	*start = get64(entry);
+	*size = get32(entry + 8);
+
+	return (*start + (*size & ~SQUASHFS_COMPRESSED_BIT_BLOCK) <= imageSize);
+}
+
+uint32_t lookupId(unsigned int index)
+{
+	if (index >= sBlk.noIds) return 0;
+	return get32(idTable.data + index * 4);
+}
+
+bool readInode(uint64_t reference, struct inodeInfo *inode)
+{
+	const uint8_t *		base = metadataPointer(&inodeTable, reference >> 16, reference & 0xFFFF, 16);
+	const uint8_t *		ptr;
+	size_t				available;
+
+	if (base == NULL) return false;
+	available = inodeTable.size - (base - inodeTable.data);
+	ptr = base;
+
+	memset(inode, 0, sizeof(struct inodeInfo));
+	inode->type = get16(ptr);
+	inode->mode = get16(ptr + 2);
+	inode->uid = lookupId(get16(ptr + 4));
+	inode->gid = lookupId(get16(ptr + 6));
+	inode->time = get32(ptr + 8);
+	inode->number = get32(ptr + 12);
+	inode->nlink = 1;
+	inode->fragment = SQUASHFS_INVALID_FRAG;
+	inode->xattr = SQUASHFS_INVALID_XATTR;
+
+	// the decompressed blocks are consecutive, so an inode may span block boundaries
+	ptr = base + 16;
+	if (available < 16 + inodeSizes[(inode->type <= SQUASHFS_LSOCKET_TYPE ? inode->type : 0)]) return false;
+
+	switch (inode->type)
+	{
+		case SQUASHFS_DIR_TYPE:
+			inode->mode |= S_IFDIR;
+			inode->dirStartBlock = get32(ptr);
+			inode->nlink = get32(ptr + 4);
+			inode->dirSize = get16(ptr + 8);
+			inode->dirOffset = get16(ptr + 10);
+			inode->data = inode->dirSize;
+			break;
+
+		case SQUASHFS_LDIR_TYPE:
+			inode->mode |= S_IFDIR;
+			inode->nlink = get32(ptr);
+			inode->dirSize = get32(ptr + 4);
+			inode->dirStartBlock = get32(ptr + 8);
+			inode->dirOffset = get16(ptr + 18);
+			inode->xattr = get32(ptr + 20);
+			inode->data = inode->dirSize;
+			break;
+
+		case SQUASHFS_REG_TYPE:
+		case SQUASHFS_LREG_TYPE:
+			inode->mode |= S_IFREG;
+			if (inode->type == SQUASHFS_REG_TYPE)
+			{
+				inode->startBlock = get32(ptr);
+				inode->fragment = get32(ptr + 4);
+				inode->fragmentOffset = get32(ptr + 8);
+				inode->data = get32(ptr + 12);
+				inode->blockList = ptr + 16;
+			}
+			else
+			{
+				inode->startBlock = get64(ptr);
+				inode->data = get64(ptr + 8);
+				inode->nlink = get32(ptr + 24);
+				inode->fragment = get32(ptr + 28);
+				inode->fragmentOffset = get32(ptr + 32);
+				inode->xattr = get32(ptr + 36);
+				inode->blockList = ptr + 40;
+			}
+			// a file without fragment has a (probably partial) last block of its own
+			inode->blockCount = (inode->data / sBlk.blockSize) + ((inode->fragment == SQUASHFS_INVALID_FRAG && (inode->data % sBlk.blockSize) != 0) ? 1 : 0);
+			if (available < (size_t) (inode->blockList - base) + (size_t) inode->blockCount * 4) return false;
+			break;
+
+		case SQUASHFS_SYMLINK_TYPE:
+		case SQUASHFS_LSYMLINK_TYPE:
+			inode->mode |= S_IFLNK;
+			inode->nlink = get32(ptr);
+			inode->symlinkSize = get32(ptr + 4);
+			inode->data = inode->symlinkSize;
+			inode->symlink = (const char *) ptr + 8;
+			if (available < (size_t) 24 + inode->symlinkSize) return false;
+			break;
+
+		case SQUASHFS_BLKDEV_TYPE:
+		case SQUASHFS_LBLKDEV_TYPE:
+			inode->mode |= S_IFBLK;
+			inode->nlink = get32(ptr);
+			inode->data = get32(ptr + 4);
+			break;
+
+		case SQUASHFS_CHRDEV_TYPE:
+		case SQUASHFS_LCHRDEV_TYPE:
+			inode->mode |= S_IFCHR;
+			inode->nlink = get32(ptr);
+			inode->data = get32(ptr + 4);
+			break;
+
+		case SQUASHFS_FIFO_TYPE:
+		case SQUASHFS_LFIFO_TYPE:
+			inode->mode |= S_IFIFO;
+			inode->nlink = get32(ptr);
+			break;
+
+		case SQUASHFS_SOCKET_TYPE:
+		case SQUASHFS_LSOCKET_TYPE:
+			inode->mode |= S_IFSOCK;
+			inode->nlink = get32(ptr);
+			break;
+
+		default:
+			fprintf(stderr, "Unknown inode type %u found.\n", inode->type);
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,162 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#ifndef SQUASHFS_IMAGE_H
+
+#define SQUASHFS_IMAGE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+// SquashFS 4.0 on-disk constants (see 'squashfs_fs.h' from squashfs-tools)
+
+#define SQUASHFS_MAGIC				0x73717368
+#define SQUASHFS_MAGIC_SWAP			0x68737173
+#define SQUASHFS_METADATA_SIZE		8192
+#define SQUASHFS_COMPRESSED_BIT		0x8000
+#define SQUASHFS_COMPRESSED_BIT_BLOCK	(1 << 24)
+#define SQUASHFS_INVALID_BLK		((uint64_t) -1)
+#define SQUASHFS_INVALID_FRAG		0xFFFFFFFF
+#define SQUASHFS_INVALID_XATTR		0xFFFFFFFF
+#define SQUASHFS_SUPERBLOCK_SIZE	96
+#define SQUASHFS_FRAGMENT_ENTRY_SIZE	16
+
+#define SQUASHFS_NOI				0x0001
+#define SQUASHFS_NOD				0x0002
+#define SQUASHFS_NOF				0x0008
+#define SQUASHFS_NO_FRAG			0x0010
+#define SQUASHFS_ALWAYS_FRAG		0x0020
+#define SQUASHFS_DUPLICATE			0x0040
+#define SQUASHFS_EXPORT				0x0080
+#define SQUASHFS_NOX				0x0100
+#define SQUASHFS_NO_XATTR			0x0200
+#define SQUASHFS_COMP_OPT			0x0400
+
+#define ZLIB_COMPRESSION			1
+#define LZMA_COMPRESSION			2
+#define XZ_COMPRESSION				4
+
+#define SQUASHFS_DIR_TYPE			1
+#define SQUASHFS_REG_TYPE			2
+#define SQUASHFS_SYMLINK_TYPE		3
+#define SQUASHFS_BLKDEV_TYPE		4
+#define SQUASHFS_CHRDEV_TYPE		5
+#define SQUASHFS_FIFO_TYPE			6
+#define SQUASHFS_SOCKET_TYPE		7
+#define SQUASHFS_LDIR_TYPE			8
+#define SQUASHFS_LREG_TYPE			9
+#define SQUASHFS_LSYMLINK_TYPE		10
+#define SQUASHFS_LBLKDEV_TYPE		11
+#define SQUASHFS_LCHRDEV_TYPE		12
+#define SQUASHFS_LFIFO_TYPE			13
+#define SQUASHFS_LSOCKET_TYPE		14
+
+struct superBlock
+{
+	uint32_t			inodes;
+	uint32_t			mkfsTime;
+	uint32_t			blockSize;
+	uint32_t			fragments;
+	uint16_t			compression;
+	uint16_t			blockLog;
+	uint16_t			flags;
+	uint16_t			noIds;
+	uint16_t			major;
+	uint16_t			minor;
+	uint64_t			rootInode;
+	uint64_t			bytesUsed;
+	uint64_t			idTableStart;
+	uint64_t			xattrIdTableStart;
+	uint64_t			inodeTableStart;
+	uint64_t			directoryTableStart;
+	uint64_t			fragmentTableStart;
+	uint64_t			lookupTableStart;
+};
+
+// a decompressed metadata table (inode, directory, id or fragment table)
+struct metadataTable
+{
+	const char *		name;
+	uint8_t *			data;			// decompressed content, blocks are stored consecutively
+	size_t				size;
+	size_t				count;			// number of metadata blocks
+	uint64_t *			blockStart;		// offsets of compressed blocks, relative to table start
+	size_t *			dataOffset;		// offsets of decompressed blocks in 'data'
+	uint64_t			tableStart;
+	size_t				next;			// next block to decompress (shared by threads)
+	pthread_mutex_t		lock;
+	bool				failed;
+};
+
+struct inodeInfo
+{
+	unsigned int		type;
+	mode_t				mode;
+	uint32_t			uid;
+	uint32_t			gid;
+	time_t				time;
+	uint32_t			number;
+	uint32_t			nlink;
+	long long			data;			// size or device number, like 'struct inode' from unsquashfs
+	const char *		symlink;
+	int					symlinkSize;
+	uint32_t			dirStartBlock;	// directory inodes only
+	uint32_t			dirOffset;
+	uint32_t			dirSize;
+	uint64_t			startBlock;		// regular files only
+	uint32_t			fragment;
+	uint32_t			fragmentOffset;
+	uint32_t			blockCount;
+	const uint8_t *		blockList;		// sizes of the data blocks, in image byte order
+	uint32_t			xattr;
+};
+
+extern const uint8_t *	image;
+extern size_t			imageSize;
+extern bool				swapNeeded;
+extern struct superBlock	sBlk;
+extern struct metadataTable	inodeTable;
+extern struct metadataTable	directoryTable;
+extern struct metadataTable	idTable;
+extern struct metadataTable	fragmentTable;
+
+uint16_t get16(const uint8_t *ptr);
+uint32_t get32(const uint8_t *ptr);
+uint64_t get64(const uint8_t *ptr);
+bool mapImage(const char *name, int *fd);
+void unmapImage(int fd);
+bool readSuperBlock(void);
+size_t decompressBlock(const uint8_t *source, size_t sourceSize, uint8_t *target, size_t targetSize);
+bool scanMetadataTable(struct metadataTable *table, uint64_t start, uint64_t end);
+bool decompressMetadataTable(struct metadataTable *table, long threadCount);
+const uint8_t * metadataPointer(const struct metadataTable *table, uint64_t block, unsigned int offset, size_t needed);
+bool readImageTables(long threadCount);
+bool readFragmentTable(long threadCount);
+bool fragmentEntry(uint32_t index, uint64_t *start, uint32_t *size);
+uint32_t lookupId(unsigned int index);
+bool readInode(uint64_t reference, struct inodeInfo *inode);
+
+#endif
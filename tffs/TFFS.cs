@@ -800,4 +800,173 @@ public static TFFSNameTable GetLatest()
             return TFFSNameTable.GetNameTable("@N");
         }
     }
+
+    public class TFFSNode
+    {
+        private int p_ID;
+        private long p_Offset;
+        private int p_Length;
+
+        public TFFSNode(int ID, long Offset, int Length)
+        {
+            p_ID = ID;
+            p_Offset = Offset;
+            p_Length = Length;
+        }
+
+        public int ID
+        {
+            get
+            {
+                return p_ID;
+            }
+        }
+
+        // offset of the node header within the dump
+        public long Offset
+        {
+            get
+            {
+                return p_Offset;
+            }
+        }
+
+        public int Length
+        {
+            get
+            {
+                return p_Length;
+            }
+        }
+
+        // the same line format as the 'nodelist' file from 'dissect_tffs_dump'
+        public override string ToString()
+        {
+            return String.Format("NODE={0:d} OFFSET={1:d} LENGTH={2:d}{3:s}", p_ID, p_Offset, p_Length, (p_ID == (int)TFFSEnvironmentID.NameTableID) ? " - this is the name table" : String.Empty);
+        }
+    }
+
+    public class TFFSNodes : List<TFFSNode>
+    {
+    }
+
+    // a write-only stream, which indexes the nodes of a (NOR) TFFS dump while it's written, so a
+    // partition may be indexed while it's read from another source - the data itself isn't kept
+    public class TFFSStreamIndexer : System.IO.Stream
+    {
+        private TFFSNodes p_Nodes = new TFFSNodes();
+        private long p_Position = 0;
+        private long p_NextHeader = 0;
+        private byte[] p_Header = new byte[4];
+        private int p_HeaderFilled = 0;
+        private bool p_EndFound = false;
+
+        public TFFSStreamIndexer()
+        {
+        }
+
+        public TFFSNodes Nodes
+        {
+            get
+            {
+                return p_Nodes;
+            }
+        }
+
+        // true, if the end of the used area (an ID of 0xFFFF) was reached
+        public bool EndFound
+        {
+            get
+            {
+                return p_EndFound;
+            }
+        }
+
+        public override bool CanRead => false;
+        public override bool CanSeek => false;
+        public override bool CanWrite => true;
+        public override long Length => p_Position;
+
+        public override long Position
+        {
+            get
+            {
+                return p_Position;
+            }
+            set
+            {
+                throw new NotSupportedException();
+            }
+        }
+
+        public override void Write(byte[] buffer, int offset, int count)
+        {
+            while (count > 0 && !p_EndFound)
+            {
+                if (p_Position < p_NextHeader)
+                {
+                    // skip node data
+                    int skip = (int)Math.Min(count, p_NextHeader - p_Position);
+                    offset += skip;
+                    count -= skip;
+                    p_Position += skip;
+                    continue;
+                }
+
+                int copy = Math.Min(count, 4 - p_HeaderFilled);
+                Array.Copy(buffer, offset, p_Header, p_HeaderFilled, copy);
+                p_HeaderFilled += copy;
+                offset += copy;
+                count -= copy;
+                p_Position += copy;
+
+                if (p_HeaderFilled < 4)
+                {
+                    break;
+                }
+
+                int id = (p_Header[0] << 8) | p_Header[1];
+                int length = (p_Header[2] << 8) | p_Header[3];
+
+                p_HeaderFilled = 0;
+
+                if (id == 0xFFFF)
+                {
+                    p_EndFound = true;
+                    break;
+                }
+
+                if (id != (int)TFFSEnvironmentID.Removed)
+                {
+                    p_Nodes.Add(new TFFSNode(id, p_NextHeader, length));
+                }
+
+                p_NextHeader += 4 + ((length + 3) & ~3);
+            }
+
+            if (count > 0)
+            {
+                p_Position += count;
+            }
+        }
+
+        public override void Flush()
+        {
+        }
+
+        public override int Read(byte[] buffer, int offset, int count)
+        {
+            throw new NotSupportedException();
+        }
+
+        public override long Seek(long offset, System.IO.SeekOrigin origin)
+        {
+            throw new NotSupportedException();
+        }
+
+        public override void SetLength(long value)
+        {
+            throw new NotSupportedException();
+        }
+    }
 }
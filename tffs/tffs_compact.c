@@ -0,0 +1,693 @@
+// vim: set tabstop=4 syntax=c :
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ *                                                                     *
+ * Copyright (C) 2016 P.Hämmerlein (http://www.yourfritz.de)           *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <fcntl.h>
+
+// TFFS entries (NOR format) are built of a 16-bit ID and a 16-bit length (big endian), followed
+// by the data, which is padded to the next 4-byte boundary - an ID of 0xFFFF marks the end of
+// the used area, an ID of 0 a removed entry and ID 1 holds the segment number of the image
+#define TFFS_HEADER_SIZE			4
+#define TFFS_ID_REMOVED				0x0000
+#define TFFS_ID_SEGMENT				0x0001
+#define TFFS_ID_END					0xFFFF
+#define TFFS_MAX_LENGTH				0xFFFF
+#define TFFS_ENTRY_SIZE(length)		(TFFS_HEADER_SIZE + (((length) + 3) & ~3))
+
+#define DEFAULT_ERASE_SIZE			4096	// SPI flash, like 'tffs_add_file' assumes it
+#define MAX_CHANGES					1024
+#define MAX_IMAGE_SIZE				(16 * 1024 * 1024)
+
+struct tffsEntry
+{
+	uint16_t			id;
+	uint16_t			length;
+	const uint8_t *		data;
+	size_t				oldOffset;		// offset in the current image, if it's unchanged
+	bool				anchored;		// kept at its offset in the current image
+	bool				placed;
+};
+
+struct tffsImage
+{
+	uint8_t *			data;
+	size_t				size;
+	size_t				used;			// offset of the end marker
+	struct tffsEntry *	entries;
+	size_t				count;
+	size_t				garbage;		// size of removed and superseded entries
+};
+
+// a change from the command line or from a partial image, NULL data deletes the entry
+struct tffsChange
+{
+	uint16_t			id;
+	uint16_t			length;
+	const uint8_t *		data;
+};
+
+struct layoutResult
+{
+	size_t				anchored;
+	size_t				moved;
+	size_t				fillers;
+	size_t				fillerBytes;
+};
+
+void usage()
+{
+	fprintf(stderr, "tffs_compact - compact a TFFS image with as few changed flash blocks as possible\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "tffs_compact [ -a <id>=<file> ]... [ -d <id> ]... [ -m <entries_file> ]... [ -o <offset> ]\n");
+	fprintf(stderr, "             [ -b <erase_size> ] [ -g <bytes> ] [ -s <size> ] [ -r ] [ -n ] <image_file> | -\n");
+	fprintf(stderr, "\nThe current TFFS image (a dump of the partition) is read and the changes");
+	fprintf(stderr, "\nare applied: -a stores the content of a file (already deflated, if it's");
+	fprintf(stderr, "\na compressed node) with the specified ID (decimal or 0x-prefixed), -d");
+	fprintf(stderr, "\nremoves an ID and -m merges all entries from a partial image, like the");
+	fprintf(stderr, "\noutput of 'environment_to_tffs' or 'counter_to_tffs' ('-' for STDIN).\n");
+	fprintf(stderr, "\nThe new image contains only the latest generation of each ID. Unchanged");
+	fprintf(stderr, "\nentries are kept at their current offsets, as long as the changed and new");
+	fprintf(stderr, "\nentries can be placed into the space of removed entries in front of them,");
+	fprintf(stderr, "\nso the erase blocks (default size: %u bytes) after such a gap remain", DEFAULT_ERASE_SIZE);
+	fprintf(stderr, "\nunchanged. Option -g allows up to the specified number of bytes for");
+	fprintf(stderr, "\nremoved entries as fillers, if no exact fit was found (default: 0).\n");
+	fprintf(stderr, "\nThe segment number is decremented by the specified offset (option -o),");
+	fprintf(stderr, "\nlike 'tffs_add_file' does it. The new image has the size of the current");
+	fprintf(stderr, "\none (or the size from option -s) and is written to STDOUT, -n suppresses");
+	fprintf(stderr, "\nthe output. A report with the number of unchanged erase blocks, the ones");
+	fprintf(stderr, "\nwhich may be written without erasing them (only bits are cleared) and the");
+	fprintf(stderr, "\nones to erase is written to STDERR with option -r.\n");
+}
+
+uint16_t getUint16(const uint8_t *ptr)
+{
+	return (uint16_t) ((ptr[0] << 8) | ptr[1]);
+}
+
+void putUint16(uint8_t *ptr, uint16_t value)
+{
+	ptr[0] = (value >> 8) & 0xFF;
+	ptr[1] = value & 0xFF;
+}
+
+uint8_t * readFile(const char *fileName, size_t *size)
+{
+	uint8_t *			buffer = NULL;
+	size_t				allocated = 0;
+	ssize_t				got;
+	int					fd = 0;
+
+	*size = 0;
+
+	if (strcmp(fileName, "-") != 0 && (fd = open(fileName, O_RDONLY)) == -1)
+	{
+		fprintf(stderr, "Error %d opening file '%s'.\n", errno, fileName);
+		return NULL;
+	}
+
+	while (true)
+	{
+		if (*size == allocated)
+		{
+			uint8_t *	grown;
+
+			// one byte more than the maximum is read, a full buffer of this size means the file is too large
+			if (allocated > MAX_IMAGE_SIZE) grown = NULL;
+			else
+			{
+				allocated = (allocated ? allocated * 2 : 64 * 1024);
+				if (allocated > MAX_IMAGE_SIZE) allocated = MAX_IMAGE_SIZE + 1;
+				grown = realloc(buffer, allocated);
+			}
+			if (grown == NULL)
+			{
+				fprintf(stderr, "The file '%s' is too large.\n", fileName);
+				free(buffer);
+				buffer = NULL;
+				break;
+			}
+			buffer = grown;
+		}
+
+		if ((got = read(fd, buffer + *size, allocated - *size)) == 0) break;
+		if (got == -1)
+		{
+			if (errno == EINTR) continue;
+			fprintf(stderr, "Error %d reading file '%s'.\n", errno, fileName);
+			free(buffer);
+			buffer = NULL;
+			break;
+		}
+		*size += got;
+	}
+
+	if (fd != 0) close(fd);
+
+	// an empty file gets a buffer, too
+	if (buffer == NULL && allocated == 0) buffer = malloc(1);
+
+	return buffer;
+}
+
+// the entries are collected up to the end marker (or the end of data for a partial image)
+bool parseEntries(const uint8_t *data, size_t size, struct tffsEntry **entries, size_t *count, size_t *used, const char *fileName)
+{
+	size_t				offset = 0;
+
+	*count = 0;
+	*entries = NULL;
+
+	while (offset + TFFS_HEADER_SIZE <= size)
+	{
+		uint16_t		id = getUint16(data + offset);
+		uint16_t		length = getUint16(data + offset + 2);
+		struct tffsEntry *	grown;
+
+		if (id == TFFS_ID_END) break;
+
+		if (offset + TFFS_ENTRY_SIZE(length) > size)
+		{
+			fprintf(stderr, "The entry with ID 0x%04x at offset %zu exceeds the end of '%s'.\n", id, offset, fileName);
+			return false;
+		}
+
+		if ((grown = realloc(*entries, (*count + 1) * sizeof(struct tffsEntry))) == NULL) return false;
+		*entries = grown;
+		memset(&(*entries)[*count], 0, sizeof(struct tffsEntry));
+		(*entries)[*count].id = id;
+		(*entries)[*count].length = length;
+		(*entries)[*count].data = data + offset + TFFS_HEADER_SIZE;
+		(*entries)[*count].oldOffset = offset;
+		(*count)++;
+
+		offset += TFFS_ENTRY_SIZE(length);
+	}
+
+	if (used) *used = offset;
+
+	return true;
+}
+
+bool addChange(struct tffsChange *changes, size_t *count, uint16_t id, const uint8_t *data, size_t length)
+{
+	size_t				i;
+
+	if (id == TFFS_ID_REMOVED || id == TFFS_ID_END || length > TFFS_MAX_LENGTH)
+	{
+		fprintf(stderr, "Invalid ID 0x%04x or content too large (%zu bytes).\n", id, length);
+		return false;
+	}
+
+	// a later change for the same ID replaces an earlier one
+	for (i = 0; i < *count; i++)
+	{
+		if (changes[i].id == id) break;
+	}
+
+	if (i == *count)
+	{
+		if (*count >= MAX_CHANGES)
+		{
+			fprintf(stderr, "Too many changes specified.\n");
+			return false;
+		}
+		(*count)++;
+	}
+
+	changes[i].id = id;
+	changes[i].data = data;
+	changes[i].length = (uint16_t) length;
+
+	return true;
+}
+
+bool parseId(const char *value, uint16_t *id)
+{
+	char *				end;
+	unsigned long		number = strtoul(value, &end, 0);
+
+	if (end == value || (*end != 0 && *end != '=') || number == TFFS_ID_REMOVED || number >= TFFS_ID_END) return false;
+	*id = (uint16_t) number;
+
+	return true;
+}
+
+const struct tffsChange * findChange(const struct tffsChange *changes, size_t count, uint16_t id)
+{
+	size_t				i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (changes[i].id == id) return &changes[i];
+	}
+
+	return NULL;
+}
+
+// the latest generation of each ID (with the changes applied) is collected in 'live', unchanged
+// entries and changed ones with the same size are anchored to their current offset
+bool collectLiveEntries(struct tffsImage *image, const struct tffsChange *changes, size_t changeCount, struct tffsEntry **live, size_t *liveCount)
+{
+	struct tffsEntry *	result;
+	size_t				count = 0;
+	size_t				i;
+	size_t				j;
+
+	if ((result = calloc(image->count + changeCount + 1, sizeof(struct tffsEntry))) == NULL) return false;
+
+	for (i = 0; i < image->count; i++)
+	{
+		struct tffsEntry *	entry = &image->entries[i];
+		const struct tffsChange *	change;
+		bool			superseded = false;
+
+		for (j = i + 1; j < image->count && !superseded; j++)
+		{
+			if (image->entries[j].id == entry->id) superseded = true;
+		}
+
+		if (entry->id == TFFS_ID_REMOVED || superseded)
+		{
+			image->garbage += TFFS_ENTRY_SIZE(entry->length);
+			continue;
+		}
+
+		memcpy(&result[count], entry, sizeof(struct tffsEntry));
+
+		if ((change = findChange(changes, changeCount, entry->id)) != NULL)
+		{
+			image->garbage += TFFS_ENTRY_SIZE(entry->length);
+			if (change->data == NULL) continue;	// removed
+
+			result[count].data = change->data;
+			result[count].length = change->length;
+			// a new content with the same size may be written in place
+			result[count].anchored = (TFFS_ENTRY_SIZE(change->length) == TFFS_ENTRY_SIZE(entry->length));
+			if (result[count].anchored) image->garbage -= TFFS_ENTRY_SIZE(entry->length);
+		}
+		else result[count].anchored = true;
+
+		count++;
+	}
+
+	for (i = 0; i < changeCount; i++)
+	{
+		bool			found = false;
+
+		if (changes[i].data == NULL) continue;
+
+		for (j = 0; j < count && !found; j++)
+		{
+			if (result[j].id == changes[i].id) found = true;
+		}
+		if (found) continue;
+
+		result[count].id = changes[i].id;
+		result[count].length = changes[i].length;
+		result[count].data = changes[i].data;
+		count++;
+	}
+
+	*live = result;
+	*liveCount = count;
+
+	return true;
+}
+
+// choose the entries to fill a gap - an exact fit is preferred, else the largest sum below
+size_t fillGap(struct tffsEntry *live, size_t count, size_t gap, size_t *selected, size_t *selectedCount)
+{
+	size_t				units = gap / 4;
+	int *				from;
+	size_t				best = 0;
+	size_t				i;
+	size_t				t;
+
+	*selectedCount = 0;
+	if (units == 0) return 0;
+
+	if ((from = malloc((units + 1) * sizeof(int))) == NULL) return 0;
+	for (t = 0; t <= units; t++) from[t] = -1;
+	from[0] = (int) count;	// reachable without any entry
+
+	for (i = 0; i < count && from[units] == -1; i++)
+	{
+		size_t			size = TFFS_ENTRY_SIZE(live[i].length) / 4;
+
+		if (live[i].anchored || live[i].placed || size > units) continue;
+
+		for (t = units; t >= size; t--)
+		{
+			if (from[t] == -1 && from[t - size] != -1) from[t] = (int) i;
+			if (t == size) break;
+		}
+	}
+
+	for (t = units; t > 0; t--)
+	{
+		if (from[t] != -1)
+		{
+			best = t;
+			break;
+		}
+	}
+
+	for (t = best; t > 0; t -= TFFS_ENTRY_SIZE(live[from[t]].length) / 4)
+	{
+		selected[(*selectedCount)++] = from[t];
+	}
+
+	free(from);
+
+	return best * 4;
+}
+
+size_t placeEntry(uint8_t *output, size_t offset, uint16_t id, uint16_t length, const uint8_t *data)
+{
+	size_t				size = TFFS_ENTRY_SIZE(length);
+
+	putUint16(output + offset, id);
+	putUint16(output + offset + 2, length);
+	if (data != NULL)
+	{
+		memcpy(output + offset + TFFS_HEADER_SIZE, data, length);
+		memset(output + offset + TFFS_HEADER_SIZE + length, 0, size - TFFS_HEADER_SIZE - length);
+	}
+
+	return size;
+}
+
+// the new image is built from the anchored entries, the gaps in front of them are filled with
+// other entries - the remaining ones follow the last anchored entry
+bool layoutImage(const struct tffsImage *image, struct tffsEntry *live, size_t count, uint8_t *output, size_t outputSize, size_t fillerBudget, struct layoutResult *result)
+{
+	size_t *			selected;
+	size_t				selectedCount;
+	size_t				cursor = 0;
+	size_t				i;
+	size_t				j;
+
+	memset(result, 0, sizeof(struct layoutResult));
+	memset(output, 0xFF, outputSize);
+	if ((selected = malloc((count + 1) * sizeof(size_t))) == NULL) return false;
+
+	for (i = 0; i < count; i++)
+	{
+		struct tffsEntry *	anchor = &live[i];
+
+		if (!anchor->anchored) continue;
+
+		if (anchor->oldOffset > cursor)
+		{
+			size_t		gap = anchor->oldOffset - cursor;
+			size_t		filled = fillGap(live, count, gap, selected, &selectedCount);
+
+			for (j = 0; j < selectedCount; j++)
+			{
+				struct tffsEntry *	entry = &live[selected[j]];
+
+				if (cursor + TFFS_ENTRY_SIZE(entry->length) > outputSize) break;
+				cursor += placeEntry(output, cursor, entry->id, entry->length, entry->data);
+				entry->placed = true;
+			}
+			gap -= filled;
+
+			// removed entries keep the current content of the flash as their data
+			while (gap > 0 && gap <= fillerBudget)
+			{
+				size_t	length = (gap - TFFS_HEADER_SIZE > TFFS_MAX_LENGTH - 3 ? TFFS_MAX_LENGTH - 3 : gap - TFFS_HEADER_SIZE);
+
+				memcpy(output + cursor, image->data + cursor, TFFS_ENTRY_SIZE(length));
+				placeEntry(output, cursor, TFFS_ID_REMOVED, (uint16_t) length, NULL);
+				cursor += TFFS_ENTRY_SIZE(length);
+				gap -= TFFS_ENTRY_SIZE(length);
+				fillerBudget -= TFFS_ENTRY_SIZE(length);
+				result->fillers++;
+				result->fillerBytes += TFFS_ENTRY_SIZE(length);
+			}
+		}
+
+		if (cursor + TFFS_ENTRY_SIZE(anchor->length) > outputSize) break;
+		if (cursor == anchor->oldOffset) result->anchored++;
+		else result->moved++;
+		cursor += placeEntry(output, cursor, anchor->id, anchor->length, anchor->data);
+		anchor->placed = true;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (live[i].placed) continue;
+		if (cursor + TFFS_ENTRY_SIZE(live[i].length) > outputSize) break;
+		cursor += placeEntry(output, cursor, live[i].id, live[i].length, live[i].data);
+		live[i].placed = true;
+	}
+
+	free(selected);
+
+	for (i = 0; i < count; i++)
+	{
+		if (!live[i].placed)
+		{
+			fprintf(stderr, "The new content doesn't fit into an image with %zu bytes.\n", outputSize);
+			return false;
+		}
+	}
+
+	// the end marker needs its ID at least, the rest of the area is erased anyway
+	if (cursor + 2 > outputSize)
+	{
+		fprintf(stderr, "The new content doesn't fit into an image with %zu bytes.\n", outputSize);
+		return false;
+	}
+	putUint16(output + cursor, TFFS_ID_END);
+
+	return true;
+}
+
+void reportImage(const struct tffsImage *image, const struct tffsEntry *live, size_t count, const uint8_t *output, size_t outputSize, size_t eraseSize, const struct layoutResult *result)
+{
+	size_t				blocks = (outputSize + eraseSize - 1) / eraseSize;
+	size_t				unchanged = 0;
+	size_t				programmed = 0;
+	size_t				erased = 0;
+	size_t				used = 0;
+	char *				map;
+	size_t				block;
+	size_t				i;
+
+	for (i = 0; i < count; i++) used += TFFS_ENTRY_SIZE(live[i].length);
+
+	if ((map = malloc(blocks + 1)) == NULL) return;
+
+	// a NOR flash may clear bits without an erase cycle
+	for (block = 0; block < blocks; block++)
+	{
+		size_t			start = block * eraseSize;
+		size_t			end = (start + eraseSize > outputSize ? outputSize : start + eraseSize);
+		bool			changed = false;
+		bool			erase = false;
+
+		for (i = start; i < end && !erase; i++)
+		{
+			uint8_t		old = (i < image->size ? image->data[i] : 0xFF);
+
+			if (old == output[i]) continue;
+			changed = true;
+			if (output[i] & ~old) erase = true;
+		}
+
+		if (erase) erased++;
+		else if (changed) programmed++;
+		else unchanged++;
+		map[block] = (erase ? 'E' : (changed ? 'P' : '.'));
+	}
+	map[blocks] = 0;
+
+	fprintf(stderr, "entries: %zu in the current image, %zu in the new one\n", image->count, count);
+	fprintf(stderr, "used bytes: %zu in the current image (%zu bytes removed or superseded), %zu in the new one\n", image->used, image->garbage, used + result->fillerBytes);
+	fprintf(stderr, "layout: %zu entries kept at their offset, %zu moved, %zu filler(s) with %zu bytes\n", result->anchored, result->moved, result->fillers, result->fillerBytes);
+	fprintf(stderr, "erase blocks (%zu bytes): %zu total, %zu unchanged, %zu to program, %zu to erase\n", eraseSize, blocks, unchanged, programmed, erased);
+	fprintf(stderr, "block map: %s\n", map);
+
+	free(map);
+}
+
+int main(int argc, char * argv[])
+{
+	const char *		imageFile = NULL;
+	struct tffsImage	image;
+	struct tffsChange	changes[MAX_CHANGES];
+	size_t				changeCount = 0;
+	uint8_t *			merged[MAX_CHANGES];
+	size_t				mergedCount = 0;
+	struct tffsEntry *	live = NULL;
+	size_t				liveCount = 0;
+	struct layoutResult	result;
+	uint8_t *			output;
+	size_t				outputSize = 0;
+	size_t				eraseSize = DEFAULT_ERASE_SIZE;
+	size_t				fillerBudget = 0;
+	unsigned long		segmentOffset = 0;
+	bool				report = false;
+	bool				noOutput = false;
+	int					returnCode = 0;
+	size_t				i;
+	int					arg;
+
+	memset(&image, 0, sizeof(image));
+
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc)
+		{
+			uint16_t	id;
+			char *		fileName = strchr(argv[++arg], '=');
+			size_t		size;
+
+			if (fileName == NULL || !parseId(argv[arg], &id))
+			{
+				fprintf(stderr, "Invalid specification '%s', expected <id>=<file>.\n", argv[arg]);
+				exit(1);
+			}
+			if (mergedCount >= MAX_CHANGES || (merged[mergedCount] = readFile(fileName + 1, &size)) == NULL) exit(1);
+			if (!addChange(changes, &changeCount, id, merged[mergedCount++], size)) exit(1);
+		}
+		else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc)
+		{
+			uint16_t	id;
+
+			if (!parseId(argv[++arg], &id) || !addChange(changes, &changeCount, id, NULL, 0))
+			{
+				fprintf(stderr, "Invalid ID '%s'.\n", argv[arg]);
+				exit(1);
+			}
+		}
+		else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc)
+		{
+			struct tffsEntry *	entries;
+			size_t		count;
+			size_t		size;
+
+			if (mergedCount >= MAX_CHANGES || (merged[mergedCount] = readFile(argv[++arg], &size)) == NULL) exit(1);
+			if (!parseEntries(merged[mergedCount], size, &entries, &count, NULL, argv[arg])) exit(1);
+			for (i = 0; i < count; i++)
+			{
+				if (entries[i].id == TFFS_ID_REMOVED) continue;
+				if (!addChange(changes, &changeCount, entries[i].id, entries[i].data, entries[i].length)) exit(1);
+			}
+			free(entries);
+			mergedCount++;
+		}
+		else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) segmentOffset = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) eraseSize = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "-g") == 0 && arg + 1 < argc) fillerBudget = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) outputSize = strtoul(argv[++arg], NULL, 0);
+		else if (strcmp(argv[arg], "-r") == 0) report = true;
+		else if (strcmp(argv[arg], "-n") == 0) noOutput = true;
+		else if (imageFile == NULL && (argv[arg][0] != '-' || argv[arg][1] == 0)) imageFile = argv[arg];
+		else
+		{
+			usage();
+			exit(1);
+		}
+	}
+
+	if (imageFile == NULL || eraseSize == 0 || eraseSize % 4)
+	{
+		usage();
+		exit(1);
+	}
+
+	if (!noOutput && isatty(1))
+	{
+		fprintf(stderr, "The output stream is a terminal device, please redirect output to a file.\n");
+		exit(1);
+	}
+
+	if ((image.data = readFile(imageFile, &image.size)) == NULL) exit(1);
+	if (!parseEntries(image.data, image.size, &image.entries, &image.count, &image.used, imageFile)) exit(1);
+
+	if (image.count == 0 || image.entries[0].id != TFFS_ID_SEGMENT || image.entries[0].length != 4)
+	{
+		fprintf(stderr, "The file '%s' doesn't start with a segment number, it's not a TFFS image (in NOR format).\n", imageFile);
+		exit(1);
+	}
+
+	// the segment number is changed in place, it's an entry of the same size
+	if (segmentOffset > 0)
+	{
+		static uint8_t	segment[4];
+		uint32_t		number = ((uint32_t) image.entries[0].data[0] << 24) | ((uint32_t) image.entries[0].data[1] << 16) | ((uint32_t) image.entries[0].data[2] << 8) | image.entries[0].data[3];
+
+		number -= segmentOffset;
+		segment[0] = (number >> 24) & 0xFF;
+		segment[1] = (number >> 16) & 0xFF;
+		segment[2] = (number >> 8) & 0xFF;
+		segment[3] = number & 0xFF;
+		if (!addChange(changes, &changeCount, TFFS_ID_SEGMENT, segment, sizeof(segment))) exit(1);
+	}
+
+	if (outputSize == 0) outputSize = image.size;
+
+	if (!collectLiveEntries(&image, changes, changeCount, &live, &liveCount) ||
+		(output = malloc(outputSize)) == NULL) exit(1);
+
+	if (!layoutImage(&image, live, liveCount, output, outputSize, fillerBudget, &result)) returnCode = 1;
+	else
+	{
+		if (report) reportImage(&image, live, liveCount, output, outputSize, eraseSize, &result);
+
+		if (!noOutput)
+		{
+			size_t		done = 0;
+			ssize_t		written;
+
+			while (done < outputSize)
+			{
+				if ((written = write(1, output + done, outputSize - done)) == -1)
+				{
+					if (errno == EINTR) continue;
+					fprintf(stderr, "Error %d writing output data.\n", errno);
+					returnCode = 1;
+					break;
+				}
+				done += written;
+			}
+		}
+	}
+
+	free(output);
+	free(live);
+	free(image.entries);
+	free(image.data);
+	for (i = 0; i < mergedCount; i++) free(merged[i]);
+
+	exit(returnCode);
+}
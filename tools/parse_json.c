@@ -0,0 +1,946 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/***********************************************************************
+ *                                                                     *
+ * Copyright (C) 2016 P.Haemmerlein (http://www.yourfritz.de)          *
+ *                                                                     *
+ * This program is free software; you can redistribute it and/or       *
+ * modify it under the terms of the GNU General Public License         *
+ * as published by the Free Software Foundation; either version 2      *
+ * of the License, or (at your option) any later version.              *
+ *                                                                     *
+ * This program is distributed in the hope that it will be useful,     *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of      *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the       *
+ * GNU General Public License for more details.                        *
+ *                                                                     *
+ * You should have received a copy of the GNU General Public License   *
+ * along with this program, please look for the file COPYING.          *
+ *                                                                     *
+ ***********************************************************************/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+/*
+ * native implementation of the "parseJSON" script - the input is read in
+ * a single pass and every value is written as soon as it was parsed, so
+ * the memory usage is limited by the sizes below and not by the size of
+ * the JSON data
+ */
+#define INPUT_BUFFER_SIZE	(64 * 1024)
+#define MAX_STRING_SIZE		(1024 * 1024)
+#define MAX_KEYS_SIZE		4096
+#define MAX_DEPTH			64
+
+/* exit codes, the same as the script uses them */
+#define RC_ERROR			1
+#define RC_NO_FILE			4
+#define RC_PARAMETER		8
+#define RC_USAGE			32
+
+enum outputMode
+{
+	MODE_LIST,			/* scalar values (and arrays) as bash assignments */
+	MODE_ONE_VALUE,		/* -o */
+	MODE_COUNT,			/* -c */
+	MODE_ARRAY,			/* -a (and -i) */
+	MODE_STREAM,		/* -0 */
+};
+
+struct jsonInput
+{
+	int					fd;
+	const char *		name;
+	uint8_t				buffer[INPUT_BUFFER_SIZE];
+	size_t				size;
+	size_t				position;
+	size_t				offset;		/* of the buffer start in the input */
+	bool				eof;
+};
+
+struct jsonString
+{
+	char *				data;
+	size_t				size;
+	size_t				allocated;
+};
+
+/* one entry for each open object or array, the key is stored in 'keys' */
+struct jsonLevel
+{
+	bool				isArray;
+	size_t				index;
+	size_t				keyOffset;
+};
+
+struct parserContext
+{
+	struct jsonInput *	input;
+	struct jsonString	value;
+	struct jsonLevel	levels[MAX_DEPTH];
+	char				keys[MAX_KEYS_SIZE];
+	size_t				keysSize;
+	/* options */
+	enum outputMode		mode;
+	const char *		name;		/* -o, -a and -c */
+	const char *		dictionary;
+	char **				names;
+	int					namesCount;
+	bool *				namesFound;
+	long				index;
+	bool				scalarOnly;
+	bool				quiet;
+	bool				batch;
+	/* state of the current document */
+	bool				found;
+	bool				arrayActive;
+	bool				elementOpen;
+	int					rc;
+};
+
+static void usage()
+{
+	fprintf(stderr, "parse_json - parse JSON output from queries to AVM's FRITZ!OS web server\n\n");
+	fprintf(stderr, "(C) 2016 P. Hämmerlein (http://www.yourfritz.de)\n\n");
+	fprintf(stderr, "Licensed under GPLv2, see LICENSE file from source repository.\n\n");
+	fprintf(stderr, "Usage:\n\n");
+	fprintf(stderr, "parse_json [ option [...] ] JSONFILE [ NAME [...] ]\n");
+	fprintf(stderr, "parse_json -b [ option [...] ] JSONFILE [...]\n\n");
+	fprintf(stderr, "The following options are available:\n");
+	fprintf(stderr, "-h, --help\n    + display that help\n");
+	fprintf(stderr, "-d, --debug\n    + display some debug messages\n");
+	fprintf(stderr, "-q, --quiet\n    + do not display error messages\n");
+	fprintf(stderr, "-s, --scalar\n    + ignore JSON arrays\n");
+	fprintf(stderr, "-o, --one-value NAME\n    + return only the single scalar value for entry NAME, implies -s option\n");
+	fprintf(stderr, "-c, --count NAME\n    + count only the number of entries of array NAME\n");
+	fprintf(stderr, "-a, --array NAME\n    + parse only the array with the specified NAME\n");
+	fprintf(stderr, "-i, --index N\n    + parse only the Nth single entry of an array and handle it like a scalar list\n");
+	fprintf(stderr, "-D, --dictionary NAME\n    + create a dictionary (associative array) with the specified NAME instead of a simple list of\n");
+	fprintf(stderr, "      key/value assignment, implies -s\n");
+	fprintf(stderr, "-0, --null\n    + write each scalar value at any level as a pair of NUL-terminated strings: its path (like a\n");
+	fprintf(stderr, "      JSON pointer, e.g. '/vpn/0/name') and the value\n");
+	fprintf(stderr, "-b, --batch\n    + each JSONFILE ('-' for STDIN) may contain any number of JSON documents, the output of each\n");
+	fprintf(stderr, "      document is followed by an empty line (a single NUL byte with -0), -o and -c write one line\n");
+	fprintf(stderr, "      for each document\n");
+	fprintf(stderr, "\nThe output is written in the order of the JSON data.\n");
+}
+
+static bool fillInput(struct jsonInput *input)
+{
+	ssize_t				got;
+
+	if (input->eof) return false;
+
+	input->offset += input->size;
+	input->size = 0;
+	input->position = 0;
+
+	while ((got = read(input->fd, input->buffer, sizeof(input->buffer))) == -1 && errno == EINTR);
+
+	if (got <= 0)
+	{
+		if (got == -1) fprintf(stderr, "Error %d reading file '%s'.\n", errno, input->name);
+		input->eof = true;
+		return false;
+	}
+	input->size = got;
+
+	return true;
+}
+
+static int peekChar(struct jsonInput *input)
+{
+	if (input->position == input->size && !fillInput(input)) return EOF;
+	return input->buffer[input->position];
+}
+
+static int nextChar(struct jsonInput *input)
+{
+	if (input->position == input->size && !fillInput(input)) return EOF;
+	return input->buffer[input->position++];
+}
+
+static int skipWhitespace(struct jsonInput *input)
+{
+	int					c;
+
+	while ((c = peekChar(input)) == ' ' || c == '\t' || c == '\n' || c == '\r') input->position++;
+
+	return c;
+}
+
+static bool parseError(struct parserContext *ctx, const char *message)
+{
+	if (!ctx->quiet) fprintf(stderr, "Invalid JSON data in '%s' at offset %zu: %s\n", ctx->input->name, ctx->input->offset + ctx->input->position, message);
+	ctx->rc |= RC_ERROR;
+	return false;
+}
+
+static bool appendChar(struct parserContext *ctx, struct jsonString *string, char c)
+{
+	if (string->size + 1 >= string->allocated)
+	{
+		size_t			size = (string->allocated ? string->allocated * 2 : 256);
+		char *			grown;
+
+		if (size > MAX_STRING_SIZE) return parseError(ctx, "string value too large");
+		if ((grown = realloc(string->data, size)) == NULL) return parseError(ctx, "out of memory");
+		string->data = grown;
+		string->allocated = size;
+	}
+	string->data[string->size++] = c;
+	string->data[string->size] = 0;
+
+	return true;
+}
+
+static bool appendUtf8(struct parserContext *ctx, struct jsonString *string, uint32_t code)
+{
+	if (code < 0x80) return appendChar(ctx, string, code);
+	if (code < 0x800) return appendChar(ctx, string, 0xC0 | (code >> 6)) && appendChar(ctx, string, 0x80 | (code & 0x3F));
+	if (code < 0x10000) return appendChar(ctx, string, 0xE0 | (code >> 12)) && appendChar(ctx, string, 0x80 | ((code >> 6) & 0x3F)) &&
+		appendChar(ctx, string, 0x80 | (code & 0x3F));
+	return appendChar(ctx, string, 0xF0 | (code >> 18)) && appendChar(ctx, string, 0x80 | ((code >> 12) & 0x3F)) &&
+		appendChar(ctx, string, 0x80 | ((code >> 6) & 0x3F)) && appendChar(ctx, string, 0x80 | (code & 0x3F));
+}
+
+static bool parseHex4(struct parserContext *ctx, uint32_t *code)
+{
+	int					i;
+
+	*code = 0;
+	for (i = 0; i < 4; i++)
+	{
+		int				c = nextChar(ctx->input);
+
+		*code <<= 4;
+		if (c >= '0' && c <= '9') *code |= c - '0';
+		else if (c >= 'a' && c <= 'f') *code |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') *code |= c - 'A' + 10;
+		else return parseError(ctx, "invalid unicode escape sequence");
+	}
+
+	return true;
+}
+
+/* the opening quote was read already, NUL characters are rejected - they can't be stored in a shell variable */
+static bool parseString(struct parserContext *ctx, struct jsonString *string)
+{
+	int					c;
+
+	string->size = 0;
+	if (!appendChar(ctx, string, 0)) return false;
+	string->size = 0;
+
+	while ((c = nextChar(ctx->input)) != '"')
+	{
+		if (c == EOF) return parseError(ctx, "unterminated string");
+		if (c == 0) return parseError(ctx, "NUL character in string");
+
+		if (c == '\\')
+		{
+			uint32_t	code;
+
+			switch (c = nextChar(ctx->input))
+			{
+				case '"':
+				case '\\':
+				case '/':
+					break;
+
+				case 'b':
+					c = '\b';
+					break;
+
+				case 'f':
+					c = '\f';
+					break;
+
+				case 'n':
+					c = '\n';
+					break;
+
+				case 'r':
+					c = '\r';
+					break;
+
+				case 't':
+					c = '\t';
+					break;
+
+				case 'u':
+					if (!parseHex4(ctx, &code)) return false;
+					if (code >= 0xD800 && code < 0xDC00)
+					{
+						uint32_t	low;
+
+						if (nextChar(ctx->input) != '\\' || nextChar(ctx->input) != 'u' || !parseHex4(ctx, &low) || low < 0xDC00 || low > 0xDFFF)
+							return parseError(ctx, "invalid surrogate pair");
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					}
+					else if (code >= 0xDC00 && code <= 0xDFFF) return parseError(ctx, "invalid surrogate pair");
+					if (code == 0) return parseError(ctx, "NUL character in string");
+					if (!appendUtf8(ctx, string, code)) return false;
+					continue;
+
+				default:
+					return parseError(ctx, "invalid escape sequence");
+			}
+		}
+
+		if (!appendChar(ctx, string, c)) return false;
+	}
+
+	return true;
+}
+
+static bool isNumber(const char *value)
+{
+	const char *		ptr = value;
+
+	if (*ptr == '-') ptr++;
+	if (*ptr == '0') ptr++;
+	else if (*ptr >= '1' && *ptr <= '9')
+	{
+		while (*ptr >= '0' && *ptr <= '9') ptr++;
+	}
+	else return false;
+
+	if (*ptr == '.')
+	{
+		if (*(++ptr) < '0' || *ptr > '9') return false;
+		while (*ptr >= '0' && *ptr <= '9') ptr++;
+	}
+
+	if (*ptr == 'e' || *ptr == 'E')
+	{
+		if (*(++ptr) == '+' || *ptr == '-') ptr++;
+		if (*ptr < '0' || *ptr > '9') return false;
+		while (*ptr >= '0' && *ptr <= '9') ptr++;
+	}
+
+	return (*ptr == 0);
+}
+
+/* numbers and the literals are stored with their text, null as an empty value */
+static bool parseLiteral(struct parserContext *ctx)
+{
+	int					c;
+
+	ctx->value.size = 0;
+	if (!appendChar(ctx, &ctx->value, 0)) return false;
+	ctx->value.size = 0;
+
+	while ((c = peekChar(ctx->input)) != EOF && (strchr("+-.0123456789", c) != NULL || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+	{
+		if (ctx->value.size > 64) return parseError(ctx, "invalid value");
+		if (!appendChar(ctx, &ctx->value, c)) return false;
+		ctx->input->position++;
+	}
+
+	if (strcmp(ctx->value.data, "null") == 0)
+	{
+		ctx->value.size = 0;
+		ctx->value.data[0] = 0;
+	}
+	else if (strcmp(ctx->value.data, "true") != 0 && strcmp(ctx->value.data, "false") != 0 && !isNumber(ctx->value.data))
+		return parseError(ctx, "invalid value");
+
+	return true;
+}
+
+/* bash output */
+
+static bool isIdentifier(const char *name)
+{
+	const char *		ptr = name;
+
+	if (!((*ptr >= 'a' && *ptr <= 'z') || (*ptr >= 'A' && *ptr <= 'Z') || *ptr == '_')) return false;
+	while (*(++ptr))
+	{
+		if (!((*ptr >= 'a' && *ptr <= 'z') || (*ptr >= 'A' && *ptr <= 'Z') || (*ptr >= '0' && *ptr <= '9') || *ptr == '_')) return false;
+	}
+
+	return true;
+}
+
+/* values with special characters use $'...' quoting, each assignment is a single line */
+static void writeBashString(const char *data, size_t size)
+{
+	bool				plain = true;
+	size_t				i;
+
+	for (i = 0; i < size && plain; i++)
+	{
+		uint8_t			c = data[i];
+
+		if (c < 0x20 || c == 0x7F || c == '$' || c == '"' || c == '`' || c == '\\') plain = false;
+	}
+
+	if (plain)
+	{
+		putchar('"');
+		fwrite(data, 1, size, stdout);
+		putchar('"');
+		return;
+	}
+
+	fputs("$'", stdout);
+	for (i = 0; i < size; i++)
+	{
+		uint8_t			c = data[i];
+
+		if (c == '\\' || c == '\'') printf("\\%c", c);
+		else if (c < 0x20 || c == 0x7F) printf("\\x%02x", c);
+		else putchar(c);
+	}
+	putchar('\'');
+}
+
+static void writeDictionaryEntry(const char *key, const struct jsonString *value)
+{
+	const char *		ptr;
+
+	for (ptr = key; *ptr && *ptr != '\'' && (uint8_t) *ptr >= 0x20 && *ptr != 0x7F; ptr++);
+
+	if (*ptr)
+	{
+		fputs(" [", stdout);
+		writeBashString(key, strlen(key));
+		putchar(']');
+	}
+	else printf(" ['%s']", key);
+	putchar('=');
+	writeBashString(value->data, value->size);
+}
+
+static void writeAssignment(struct parserContext *ctx, const char *name, const struct jsonString *value)
+{
+	if (!isIdentifier(name))
+	{
+		if (!ctx->quiet) fprintf(stderr, "Name '%s' isn't usable for a shell variable, value ignored !\n", name);
+		return;
+	}
+	printf("%s=", name);
+	writeBashString(value->data, value->size);
+	putchar('\n');
+}
+
+/* the path is written like a JSON pointer, '~' and '/' in keys are escaped as '~0' and '~1' */
+static void writeStreamValue(struct parserContext *ctx, int depth)
+{
+	int					level;
+
+	for (level = 0; level < depth; level++)
+	{
+		putchar('/');
+		if (ctx->levels[level].isArray) printf("%zu", ctx->levels[level].index);
+		else
+		{
+			const char *	ptr;
+
+			for (ptr = ctx->keys + ctx->levels[level].keyOffset; *ptr; ptr++)
+			{
+				if (*ptr == '~') fputs("~0", stdout);
+				else if (*ptr == '/') fputs("~1", stdout);
+				else putchar(*ptr);
+			}
+		}
+	}
+	putchar(0);
+	fwrite(ctx->value.data, 1, ctx->value.size, stdout);
+	putchar(0);
+}
+
+static bool isRequestedName(struct parserContext *ctx, const char *key)
+{
+	int					i;
+
+	if (ctx->namesCount == 0) return true;
+
+	for (i = 0; i < ctx->namesCount; i++)
+	{
+		if (strcmp(ctx->names[i], key) == 0)
+		{
+			ctx->namesFound[i] = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* top-level members are at depth 1, array entries at depth 2 and their members at depth 3 */
+static const char * levelKey(struct parserContext *ctx, int level)
+{
+	return ctx->keys + ctx->levels[level].keyOffset;
+}
+
+static bool isTopLevelMember(struct parserContext *ctx, int depth)
+{
+	return (depth == 1 && !ctx->levels[0].isArray);
+}
+
+static void onScalar(struct parserContext *ctx, int depth)
+{
+	const char *		key;
+
+	if (ctx->mode == MODE_STREAM)
+	{
+		writeStreamValue(ctx, depth);
+		return;
+	}
+
+	if (isTopLevelMember(ctx, depth))
+	{
+		key = levelKey(ctx, 0);
+
+		if (ctx->mode == MODE_ONE_VALUE && strcmp(key, ctx->name) == 0)
+		{
+			fwrite(ctx->value.data, 1, ctx->value.size, stdout);
+			putchar('\n');
+			ctx->found = true;
+		}
+		else if (ctx->mode == MODE_LIST && isRequestedName(ctx, key))
+		{
+			if (ctx->dictionary) writeDictionaryEntry(key, &ctx->value);
+			else writeAssignment(ctx, key, &ctx->value);
+		}
+	}
+	else if (depth == 3 && ctx->elementOpen && !ctx->levels[2].isArray)
+	{
+		key = levelKey(ctx, 2);
+
+		if (ctx->index < 0) writeDictionaryEntry(key, &ctx->value);
+		else writeAssignment(ctx, key, &ctx->value);
+	}
+}
+
+static void onContainerStart(struct parserContext *ctx, int depth, bool isArray)
+{
+	const char *		key;
+
+	if (ctx->mode == MODE_STREAM) return;
+
+	if (isTopLevelMember(ctx, depth))
+	{
+		key = levelKey(ctx, 0);
+
+		if (ctx->mode == MODE_ONE_VALUE || (ctx->mode == MODE_LIST && (ctx->scalarOnly || !isArray)))
+		{
+			if ((ctx->mode == MODE_ONE_VALUE && strcmp(key, ctx->name) == 0) || (ctx->mode == MODE_LIST && ctx->namesCount > 0 && isRequestedName(ctx, key)))
+			{
+				/* the script reports such a name as missing (its code 2 for this case is never returned) */
+				if (!ctx->quiet) fprintf(stderr, "'%s' found, but it's an %s !\n", key, (isArray ? "array" : "object"));
+				ctx->rc |= RC_ERROR;
+				ctx->found = true;
+			}
+			return;
+		}
+
+		if (!isArray) return;
+
+		if (ctx->mode == MODE_LIST) ctx->arrayActive = isRequestedName(ctx, key);
+		else ctx->arrayActive = (strcmp(key, ctx->name) == 0);
+
+		if (ctx->arrayActive)
+		{
+			ctx->found = true;
+			if (ctx->mode != MODE_COUNT && ctx->index < 0 && !isIdentifier(key))
+			{
+				if (!ctx->quiet) fprintf(stderr, "Name '%s' isn't usable for a shell variable, array ignored !\n", key);
+				ctx->arrayActive = false;
+			}
+		}
+	}
+	else if (depth == 2 && ctx->arrayActive && !isArray && ctx->mode != MODE_COUNT)
+	{
+		size_t			index = ctx->levels[1].index;
+
+		if (ctx->index < 0)
+		{
+			printf("declare -A %s_%zu=(", levelKey(ctx, 0), index);
+			ctx->elementOpen = true;
+		}
+		else if ((size_t) ctx->index == index) ctx->elementOpen = true;
+	}
+}
+
+static void onContainerEnd(struct parserContext *ctx, int depth)
+{
+	if (ctx->mode == MODE_STREAM) return;
+
+	if (depth == 2 && ctx->elementOpen)
+	{
+		if (ctx->index < 0) fputs(" )\n", stdout);
+		ctx->elementOpen = false;
+	}
+	else if (depth == 1 && ctx->arrayActive)
+	{
+		size_t			count = ctx->levels[1].index;
+
+		if (ctx->mode == MODE_COUNT) printf("%zu\n", count);
+		else if (ctx->index < 0) printf("declare -i %s_count=%zu\n", levelKey(ctx, 0), count);
+		else if ((size_t) ctx->index >= count)
+		{
+			if (!ctx->quiet) fprintf(stderr, "Array index '%ld' is out of bounds !\n", ctx->index);
+			ctx->rc |= RC_ERROR;
+		}
+		ctx->arrayActive = false;
+	}
+}
+
+/* parser */
+
+static bool parseValue(struct parserContext *ctx, int depth);
+
+static bool parseContainer(struct parserContext *ctx, int depth, bool isArray)
+{
+	struct jsonLevel *	level;
+	char				closing = (isArray ? ']' : '}');
+	int					c;
+
+	if (depth >= MAX_DEPTH) return parseError(ctx, "nesting too deep");
+
+	level = &ctx->levels[depth];
+	level->isArray = isArray;
+	level->index = 0;
+	level->keyOffset = ctx->keysSize;
+	onContainerStart(ctx, depth, isArray);
+
+	ctx->input->position++;
+	if (skipWhitespace(ctx->input) == closing) ctx->input->position++;
+	else
+	{
+		while (true)
+		{
+			if (!isArray)
+			{
+				if (nextChar(ctx->input) != '"') return parseError(ctx, "key expected");
+				if (!parseString(ctx, &ctx->value)) return false;
+				if (level->keyOffset + ctx->value.size + 1 > MAX_KEYS_SIZE) return parseError(ctx, "keys too long");
+				memcpy(ctx->keys + level->keyOffset, ctx->value.data, ctx->value.size + 1);
+				ctx->keysSize = level->keyOffset + ctx->value.size + 1;
+				if (skipWhitespace(ctx->input) != ':') return parseError(ctx, "':' expected");
+				ctx->input->position++;
+			}
+
+			if (!parseValue(ctx, depth + 1)) return false;
+			ctx->keysSize = level->keyOffset;
+			level->index++;
+
+			if ((c = skipWhitespace(ctx->input)) == closing)
+			{
+				ctx->input->position++;
+				break;
+			}
+			if (c != ',') return parseError(ctx, (isArray ? "',' or ']' expected" : "',' or '}' expected"));
+			ctx->input->position++;
+			skipWhitespace(ctx->input);
+		}
+	}
+
+	onContainerEnd(ctx, depth);
+
+	return true;
+}
+
+/* the value at depth 0 is the document, 'levels[depth - 1]' holds the key or index of a value */
+static bool parseValue(struct parserContext *ctx, int depth)
+{
+	int					c = skipWhitespace(ctx->input);
+
+	if (c == '{') return parseContainer(ctx, depth, false);
+	if (c == '[') return parseContainer(ctx, depth, true);
+
+	if (c == '"')
+	{
+		ctx->input->position++;
+		if (!parseString(ctx, &ctx->value)) return false;
+	}
+	else if (c == EOF) return parseError(ctx, "unexpected end of data");
+	else if (!parseLiteral(ctx)) return false;
+
+	onScalar(ctx, depth);
+
+	return true;
+}
+
+static bool usesDictionary(struct parserContext *ctx)
+{
+	return (ctx->dictionary != NULL && ctx->mode == MODE_LIST);
+}
+
+static bool parseDocument(struct parserContext *ctx)
+{
+	bool				result;
+	int					i;
+
+	ctx->found = false;
+	ctx->arrayActive = false;
+	ctx->elementOpen = false;
+	ctx->keysSize = 0;
+	for (i = 0; i < ctx->namesCount; i++) ctx->namesFound[i] = false;
+
+	if (usesDictionary(ctx)) printf("declare -A %s=(", ctx->dictionary);
+
+	result = parseValue(ctx, 0);
+
+	/* the output remains usable for 'eval', even if the data was truncated */
+	if (ctx->elementOpen && ctx->index < 0) fputs(" )\n", stdout);
+	if (usesDictionary(ctx)) fputs(" )\n", stdout);
+
+	if (ctx->mode == MODE_LIST)
+	{
+		for (i = 0; i < ctx->namesCount; i++)
+		{
+			if (ctx->namesFound[i]) continue;
+			if (!ctx->quiet) fprintf(stderr, "Value with name '%s' not found !\n", ctx->names[i]);
+			ctx->rc |= RC_ERROR;
+		}
+	}
+	else if (ctx->mode != MODE_STREAM && !ctx->found)
+	{
+		if (!ctx->quiet) fprintf(stderr, (ctx->mode == MODE_ONE_VALUE ? "Value with name '%s' not found !\n" : "Array with name '%s' not found !\n"), ctx->name);
+		ctx->rc |= RC_ERROR;
+		if (ctx->batch && (ctx->mode == MODE_ONE_VALUE || ctx->mode == MODE_COUNT)) putchar('\n');
+	}
+
+	if (ctx->batch)
+	{
+		if (ctx->mode == MODE_STREAM) putchar(0);
+		else if (ctx->mode == MODE_LIST || ctx->mode == MODE_ARRAY) putchar('\n');
+	}
+
+	return result;
+}
+
+static int parseFile(struct parserContext *ctx, const char *fileName)
+{
+	struct jsonInput *	input = calloc(1, sizeof(struct jsonInput));
+	size_t				documents = 0;
+
+	if (input == NULL) return RC_ERROR;
+
+	input->name = fileName;
+	if (strcmp(fileName, "-") != 0 && (input->fd = open(fileName, O_RDONLY)) == -1)
+	{
+		if (!ctx->quiet) fprintf(stderr, "File '%s' not found or access is denied !\n", fileName);
+		free(input);
+		return RC_NO_FILE;
+	}
+	ctx->input = input;
+
+	while (skipWhitespace(input) != EOF || (documents == 0 && !ctx->batch))
+	{
+		if (documents > 0 && !ctx->batch)
+		{
+			parseError(ctx, "unexpected data after the end of the document");
+			break;
+		}
+		documents++;
+		if (!parseDocument(ctx)) break;
+	}
+
+	if (input->fd != 0) close(input->fd);
+	free(input);
+	ctx->input = NULL;
+
+	return 0;
+}
+
+int main(int argc, char * argv[])
+{
+	static struct option	options[] =
+	{
+		{ "help", no_argument, NULL, 'h' },
+		{ "debug", no_argument, NULL, 'd' },
+		{ "scalar", no_argument, NULL, 's' },
+		{ "one-value", required_argument, NULL, 'o' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "dictionary", required_argument, NULL, 'D' },
+		{ "count", required_argument, NULL, 'c' },
+		{ "array", required_argument, NULL, 'a' },
+		{ "index", required_argument, NULL, 'i' },
+		{ "null", no_argument, NULL, '0' },
+		{ "batch", no_argument, NULL, 'b' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct parserContext	ctx;
+	const char *		indexValue = NULL;
+	const char *		oneValue = NULL;
+	const char *		countName = NULL;
+	const char *		arrayName = NULL;
+	bool				debug = false;
+	bool				stream = false;
+	int					rc = 0;
+	int					opt;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.index = -1;
+
+	while ((opt = getopt_long(argc, argv, "hdso:qD:c:a:i:0b", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'h':
+				usage();
+				exit(RC_USAGE);
+
+			case 'd':
+				debug = true;
+				break;
+
+			case 's':
+				ctx.scalarOnly = true;
+				break;
+
+			case 'o':
+				oneValue = optarg;
+				ctx.scalarOnly = true;
+				break;
+
+			case 'q':
+				ctx.quiet = true;
+				break;
+
+			case 'D':
+				ctx.dictionary = optarg;
+				ctx.scalarOnly = true;
+				break;
+
+			case 'c':
+				countName = optarg;
+				break;
+
+			case 'a':
+				arrayName = optarg;
+				break;
+
+			case 'i':
+				indexValue = optarg;
+				break;
+
+			case '0':
+				stream = true;
+				break;
+
+			case 'b':
+				ctx.batch = true;
+				break;
+
+			default:
+				usage();
+				exit(RC_USAGE);
+		}
+	}
+
+	if (optind >= argc)
+	{
+		if (!ctx.quiet) fprintf(stderr, "Missing JSONFILE parameter !\n");
+		exit(RC_PARAMETER);
+	}
+
+	if (!ctx.batch)
+	{
+		ctx.names = &argv[optind + 1];
+		ctx.namesCount = argc - optind - 1;
+	}
+
+	if (oneValue != NULL && ctx.namesCount > 0)
+	{
+		if (!ctx.quiet) fprintf(stderr, "Ambiguous value name(s) while using -o option !\n");
+		exit(RC_PARAMETER);
+	}
+
+	if (arrayName != NULL && (ctx.scalarOnly || countName != NULL))
+	{
+		if (!ctx.quiet) fprintf(stderr, "Options -s, -o and -c are incompatible with -a option !\n");
+		exit(RC_PARAMETER);
+	}
+
+	if (countName != NULL && (ctx.scalarOnly || ctx.dictionary != NULL))
+	{
+		if (!ctx.quiet) fprintf(stderr, "Options -s, -o, -D and -a are incompatible with -c option !\n");
+		exit(RC_PARAMETER);
+	}
+
+	if (indexValue != NULL)
+	{
+		char *			end;
+
+		if (arrayName == NULL)
+		{
+			if (!ctx.quiet) fprintf(stderr, "Option -i is only valid in combination with -a option !\n");
+			exit(RC_PARAMETER);
+		}
+		ctx.index = strtol(indexValue, &end, 10);
+		if (*indexValue < '0' || *indexValue > '9' || *end != 0 || ctx.index < 0)
+		{
+			if (!ctx.quiet) fprintf(stderr, "Array index value after -i option needs to be a positive number !\n");
+			exit(RC_PARAMETER);
+		}
+	}
+
+	if (stream && (ctx.scalarOnly || ctx.dictionary != NULL || arrayName != NULL || countName != NULL || ctx.namesCount > 0))
+	{
+		if (!ctx.quiet) fprintf(stderr, "Option -0 is incompatible with any other selection !\n");
+		exit(RC_PARAMETER);
+	}
+
+	if (stream) ctx.mode = MODE_STREAM;
+	else if (oneValue != NULL)
+	{
+		ctx.mode = MODE_ONE_VALUE;
+		ctx.name = oneValue;
+	}
+	else if (countName != NULL)
+	{
+		ctx.mode = MODE_COUNT;
+		ctx.name = countName;
+	}
+	else if (arrayName != NULL)
+	{
+		ctx.mode = MODE_ARRAY;
+		ctx.name = arrayName;
+	}
+	else ctx.mode = MODE_LIST;
+
+	if (ctx.namesCount > 0 && (ctx.namesFound = calloc(ctx.namesCount, sizeof(bool))) == NULL) exit(RC_ERROR);
+
+	if (debug)
+	{
+		fprintf(stderr, "Debug display: command line parameters and options\n");
+		fprintf(stderr, "JSON-file(s)=%s%s\n", argv[optind], (ctx.batch && optind + 1 < argc ? " ..." : ""));
+		fprintf(stderr, "mode=%s\n", (const char *[]) { "list", "one-value", "count", "array", "stream" }[ctx.mode]);
+		if (ctx.name) fprintf(stderr, "name=%s\n", ctx.name);
+		if (ctx.index >= 0) fprintf(stderr, "array-index=%ld\n", ctx.index);
+		if (ctx.dictionary) fprintf(stderr, "dictionary-name=%s\n", ctx.dictionary);
+		fprintf(stderr, "scalar=%s\n", (ctx.scalarOnly ? "true" : "false"));
+		fprintf(stderr, "batch=%s\n", (ctx.batch ? "true" : "false"));
+		fprintf(stderr, "Debug display: end of parameters and options\n");
+		fprintf(stderr, "============================================\n");
+	}
+
+	if (ctx.batch)
+	{
+		for (; optind < argc; optind++)
+		{
+			rc |= parseFile(&ctx, argv[optind]);
+		}
+	}
+	else rc = parseFile(&ctx, argv[optind]);
+
+	fflush(stdout);
+	free(ctx.value.data);
+	free(ctx.namesFound);
+
+	exit(rc | ctx.rc);
+}
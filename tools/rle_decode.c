@@ -23,6 +23,59 @@
 #include <errno.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <string.h>
+
+#ifdef CONTENT_STORE
+/*
+ * build with '-DCONTENT_STORE ../avm_kernel_config/content_store_helpers.c'
+ * to get the '-c <store>' option, the decoded image is put into the
+ * content-addressed store then and only its reference is written to STDOUT
+ */
+#include "../avm_kernel_config/content_store_helpers.h"
+
+static char *		storePath = NULL;
+static uint8_t *	outputBuffer = NULL;
+static size_t		outputSize = 0;
+static size_t		outputAllocated = 0;
+#endif
+
+#ifdef RUN_STATISTICS
+/*
+ * build with '-DRUN_STATISTICS ../avm_kernel_config/statistics_helpers.c'
+ * to get the '--stats' option, see there
+ */
+#include "../avm_kernel_config/statistics_helpers.h"
+
+/* number of decoded runs: zero bytes, repeated bytes, spaces, literal bytes */
+static unsigned long runs[4];
+#define COUNT_RUN(type)		runs[type]++
+#else
+#define COUNT_RUN(type)
+#endif
+
+static void outputByte(int c)
+{
+#ifdef CONTENT_STORE
+	if (storePath != NULL)
+	{
+		if (outputSize == outputAllocated)
+		{
+			uint8_t *	grown = realloc(outputBuffer, outputAllocated + 1024 * 1024);
+
+			if (grown == NULL)
+			{
+				fprintf(stderr, "Unable to allocate memory for decoded data.\n\n");
+				exit(1);
+			}
+			outputBuffer = grown;
+			outputAllocated += 1024 * 1024;
+		}
+		outputBuffer[outputSize++] = c;
+		return;
+	}
+#endif
+	putchar(c);
+}
 
 int main(int argc, char * argv[])
 {
@@ -30,6 +83,14 @@ int main(int argc, char * argv[])
 	int ioffset = 0;
 	int ooffset = 0;
 	
+#ifdef RUN_STATISTICS
+	initStatistics("rle_decode", &argc, argv);
+	statisticsStartPhase("decode");
+#endif
+#ifdef CONTENT_STORE
+	if (argc > 2 && strcmp(argv[1], "-c") == 0) storePath = argv[2];
+#endif
+
 	while ((c = getchar()) != EOF)
 	{
 		ioffset++;
@@ -43,10 +104,11 @@ int main(int argc, char * argv[])
 			}
 			ioffset++;
 			if (c == 0) break; // end of compressed content before end of file
+			COUNT_RUN(0);
 //			fprintf(stderr, "input=0x%08x output=0x%08x repeating %d zero bytes\n", ioffset, ooffset, c);
 			while (c > 0)
 			{
-				putchar(0);
+				outputByte(0);
 				ooffset++;
 				c--;
 			}
@@ -54,6 +116,7 @@ int main(int argc, char * argv[])
 		else if (c == 128)
 		{
 			int cnt;
+			COUNT_RUN(1);
 			if ((cnt = getchar()) == EOF)
 			{
 				fprintf(stderr, "Unexpected end of file while reading repetition length (0x%x -> %02x).\n\n", ioffset, cl);
@@ -69,7 +132,7 @@ int main(int argc, char * argv[])
 //			fprintf(stderr, "input=0x%08x output=0x%08x repeating %d bytes of %02x\n", ioffset, ooffset, cnt, c);
 			while (cnt > 0)
 			{
-				putchar(c);
+				outputByte(c);
 				ooffset++;
 				cnt--;
 			}
@@ -79,6 +142,7 @@ int main(int argc, char * argv[])
 			int len = 2;
 			int shift = 0;
 			int cnt = 0;
+			COUNT_RUN(1);
 			while (len > 0)
 			{
 				int b;
@@ -102,7 +166,7 @@ int main(int argc, char * argv[])
 //			fprintf(stderr, "input=0x%08x output=0x%08x repeating %d bytes of %02x\n", ioffset, ooffset, cnt, c);
 			while (cnt > 0)
 			{
-				putchar(c);
+				outputByte(c);
 				ooffset++;
 				cnt--;
 			}
@@ -110,6 +174,7 @@ int main(int argc, char * argv[])
 		else if (c == 130)
 		{
 			int cnt;
+			COUNT_RUN(2);
 			if ((cnt = getchar()) == EOF)
 			{
 				fprintf(stderr, "Unexpected end of file while reading repetition length (0x%x -> %02x).\n\n", ioffset, cl);
@@ -120,7 +185,7 @@ int main(int argc, char * argv[])
 //			fprintf(stderr, "input=0x%08x output=0x%08x repeating %d bytes of %02x\n", ioffset, ooffset, cnt, c);
 			while (cnt > 0)
 			{
-				putchar(c);
+				outputByte(c);
 				ooffset++;
 				cnt--;
 			}
@@ -128,6 +193,7 @@ int main(int argc, char * argv[])
 		else if (c > 130)
 		{
 			int cnt = c - 128;
+			COUNT_RUN(1);
 			if ((c = getchar()) == EOF)
 			{
 				fprintf(stderr, "Unexpected end of file while reading byte value to repeat (0x%x -> %02x).\n\n", ioffset, cl);
@@ -137,7 +203,7 @@ int main(int argc, char * argv[])
 //			fprintf(stderr, "input=0x%08x output=0x%08x repeating %d bytes of %02x\n", ioffset, ooffset, cnt, c);
 			while (cnt > 0)
 			{
-				putchar(c);
+				outputByte(c);
 				ooffset++;
 				cnt--;
 			}
@@ -146,6 +212,7 @@ int main(int argc, char * argv[])
 		{
 //			fprintf(stderr, "input=0x%08x output=0x%08x copying %d bytes: ", ioffset, ooffset, c);
 			int ilog = ioffset;
+			COUNT_RUN(3);
 			while (c > 0)
 			{
 				int chr;
@@ -157,12 +224,34 @@ int main(int argc, char * argv[])
 				}
 				ioffset++;
 //				fprintf(stderr, "%02x", chr);	
-				putchar(chr);
+				outputByte(chr);
 				ooffset++;
 				c--;
 			}
 //			fprintf(stderr, "\n");
 		}
 	}
+#ifdef CONTENT_STORE
+	if (storePath != NULL)
+	{
+		struct contentStore	store;
+		char				reference[CONTENT_STORE_REFERENCE_SIZE];
+
+		if (!openContentStore(&store, storePath) || !putContentStoreObject(&store, outputBuffer, outputSize, reference))
+		{
+			fprintf(stderr, "Unable to put decoded data into store '%s'.\n\n", storePath);
+			exit(1);
+		}
+		fprintf(stdout, "%s\n", reference);
+	}
+#endif
+#ifdef RUN_STATISTICS
+	statisticsAdd("inputBytes", ioffset);
+	statisticsAdd("outputBytes", ooffset);
+	statisticsAdd("zeroRuns", runs[0]);
+	statisticsAdd("byteRuns", runs[1]);
+	statisticsAdd("spaceRuns", runs[2]);
+	statisticsAdd("literalRuns", runs[3]);
+#endif
 	exit(0);
 }